@@ -0,0 +1,156 @@
+/**
+ * Copyright (C) 2024 Charles Ancheta
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ * \file deep.cc
+ *
+ * Parsing and type checking programs nested a million deep: a chain of
+ * operators, parentheses, unary operators, blocks, ifs and loops, each
+ * `--depth` levels deep. Prints how long tree-sitter and building and
+ * checking the AST took, how deep the AST came out and how far the peak RSS
+ * had grown by then; anything that recursed once per level would have run
+ * out of stack instead.
+ */
+#include "DewParser.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <string_view>
+#include <sys/resource.h>
+
+using namespace dew;
+
+namespace {
+/** `main` around `body`, which nests `depth` levels deep. */
+struct Shape {
+  const char *name;
+  std::string (*body)(uint32_t depth);
+};
+
+std::string repeat(std::string_view text, uint32_t count) {
+  std::string out;
+  out.reserve(text.size() * count);
+  for (uint32_t i{0}; i < count; ++i) {
+    out += text;
+  }
+  return out;
+}
+
+const Shape SHAPES[]{
+    {"operators",
+     [](uint32_t depth) {
+       return "  x = 1" + repeat(" + 1", depth) + "\n";
+     }},
+    {"parentheses",
+     [](uint32_t depth) {
+       return "  x = " + repeat("(", depth) + "1" + repeat(")", depth) + "\n";
+     }},
+    {"unary",
+     [](uint32_t depth) { return "  x = " + repeat("- ", depth) + "1\n"; }},
+    {"blocks",
+     [](uint32_t depth) {
+       return repeat("{\n", depth) + "x++\n" + repeat("}\n", depth);
+     }},
+    {"ifs",
+     [](uint32_t depth) {
+       return repeat("if x < 1 {\n", depth) + "x++\n" + repeat("}\n", depth);
+     }},
+    {"loops",
+     [](uint32_t depth) {
+       return repeat("for x = 0; x < 1; x++ {\n", depth) + "x++\n" +
+              repeat("}\n", depth);
+     }},
+};
+
+/** How deep the first nested expression or statement of `fn` goes. */
+uint32_t depthOf(const ast::Tree &tree, const ast::Function &fn) {
+  Span<const ast::Stmt> statements{
+      tree.list(tree.block(fn.block).statements)};
+  ast::Stmt nested{statements.size() > 1 ? statements[1] : ast::Stmt{}};
+  uint32_t depth{0};
+  if (nested && nested.kind() == ast::StmtKind::Assignment) {
+    for (ast::Expr e{tree.list(tree.assignment(nested).right)[0]}; e;
+         ++depth) {
+      if (e.kind() == ast::ExprKind::Binary) {
+        e = tree.binary(e).left;
+      } else if (e.kind() == ast::ExprKind::Unary) {
+        e = tree.unary(e).operand;
+      } else {
+        return depth;
+      }
+    }
+    return depth;
+  }
+  auto first{[&](ast::Stmt block) {
+    Span<const ast::Stmt> list{tree.list(tree.block(block).statements)};
+    return list.size() > 0 ? list[0] : ast::Stmt{};
+  }};
+  for (ast::Stmt s{nested}; s; ++depth) {
+    switch (s.kind()) {
+    case ast::StmtKind::Block:
+      s = first(s);
+      break;
+    case ast::StmtKind::If:
+      s = first(tree.ifStmt(s).consequence);
+      break;
+    case ast::StmtKind::For:
+      s = first(tree.forStmt(s).body);
+      break;
+    default:
+      return depth;
+    }
+  }
+  return depth;
+}
+
+double peakMb() {
+  rusage usage{};
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_maxrss / 1024.0;
+}
+} // namespace
+
+int main(int argc, char **argv) {
+  uint32_t depth{1000000};
+  if (argc == 3 && std::string_view{argv[1]} == "--depth") {
+    depth = static_cast<uint32_t>(std::atoi(argv[2]));
+  } else if (argc != 1) {
+    std::fprintf(stderr, "USAGE: %s [--depth N]\n", argv[0]);
+    return 1;
+  }
+
+  std::printf("%-14s %8s %14s %10s %10s %12s\n", "", "MB", "tree-sitter ms",
+              "AST ms", "depth", "peak RSS MB");
+  for (const Shape &shape : SHAPES) {
+    std::string text{"fun main() {\n  i32 x\n" + shape.body(depth) + "}\n"};
+    double mb{text.size() / 1e6};
+    auto start{std::chrono::steady_clock::now()};
+    DewParser parser{std::move(text)};
+    auto parsed{std::chrono::steady_clock::now()};
+    parser.parseSource();
+    std::chrono::duration<double, std::milli> tree{parsed - start};
+    std::chrono::duration<double, std::milli> ast{
+        std::chrono::steady_clock::now() - parsed};
+    if (parser.getFunctions().empty()) {
+      std::fprintf(stderr, "%s: nothing parsed\n", shape.name);
+      return 1;
+    }
+    std::printf("%-14s %8.1f %14.1f %10.1f %10u %12.1f\n", shape.name, mb,
+                tree.count(), ast.count(),
+                depthOf(parser.astTree(), parser.getFunctions()[0]), peakMb());
+  }
+}
@@ -0,0 +1,175 @@
+/**
+ * Copyright (C) 2024 Charles Ancheta
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ * \file embed.cc
+ *
+ * Calls through the embedding API from many threads at once: one module,
+ * compiled once, and a DewCaller per thread calling a small function over
+ * and over with different arguments. Prints the calls per second at each
+ * thread count, which should grow with the threads up to the cores there
+ * are, since calls share nothing but the module.
+ */
+#include "DewModule.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+using namespace dew;
+
+namespace {
+constexpr std::string_view PROGRAM{R"(fun mix(u32 h, u32 x) u32 {
+  return (h ^ x) * 16777619
+}
+
+fun score(i32 user, i32 item) i32 {
+  u32 h
+  i32 i
+  h = 2166136261
+  for i = 0; i < 8; i++ {
+    h = mix(h, user + i * item)
+  }
+  return h % 1000
+}
+)"};
+
+struct Config {
+  uint32_t threads;
+  uint32_t calls{200000};
+  bool jit{false};
+};
+
+/** Items each thread's calls go through, over and over. */
+constexpr int64_t ITEMS{64};
+
+/**
+ * Seconds for `threads` threads to each make `config.calls` calls, all
+ * starting together. Thread `t` scores items for user `t`, and fails if
+ * any score differs from `expected[t]`.
+ */
+double run(const DewModule &module, const Config &config, uint32_t threads,
+           const std::vector<std::vector<int64_t>> &expected) {
+  const DewModule::Function &score{*module.find("score")};
+  std::atomic<uint32_t> ready{0};
+  std::atomic<bool> go{false};
+  std::atomic<bool> wrong{false};
+  std::vector<std::thread> workers;
+  for (uint32_t t{0}; t < threads; ++t) {
+    workers.emplace_back([&, t] {
+      DewCaller caller{module};
+      if (config.jit) {
+        caller.enableJit();
+      }
+      ++ready;
+      while (!go.load(std::memory_order_acquire)) {
+        std::this_thread::yield();
+      }
+      int64_t args[2]{t, 0};
+      int64_t result;
+      for (uint32_t i{0}; i < config.calls; ++i) {
+        args[1] = i % ITEMS;
+        if (!caller.call(score, args, &result) ||
+            result != expected[t][args[1]]) {
+          wrong = true;
+          return;
+        }
+      }
+    });
+  }
+  while (ready.load() < threads) {
+    std::this_thread::yield();
+  }
+  auto start{std::chrono::steady_clock::now()};
+  go.store(true, std::memory_order_release);
+  for (std::thread &worker : workers) {
+    worker.join();
+  }
+  std::chrono::duration<double> took{std::chrono::steady_clock::now() -
+                                     start};
+  if (wrong) {
+    std::fprintf(stderr, "a call on %u threads went wrong\n", threads);
+    std::exit(1);
+  }
+  return took.count();
+}
+
+int usage(const char *argv0) {
+  std::fprintf(stderr, "USAGE: %s [--threads N] [--calls N] [--jit]\n",
+               argv0);
+  return 1;
+}
+} // namespace
+
+int main(int argc, char **argv) {
+  Config config;
+  config.threads = std::max(std::thread::hardware_concurrency(), 1u);
+  for (int i{1}; i < argc; ++i) {
+    std::string_view arg{argv[i]};
+    if (arg == "--threads" && i + 1 < argc) {
+      config.threads = static_cast<uint32_t>(std::atoi(argv[++i]));
+    } else if (arg == "--calls" && i + 1 < argc) {
+      config.calls = static_cast<uint32_t>(std::atoi(argv[++i]));
+    } else if (arg == "--jit") {
+      config.jit = true;
+    } else {
+      return usage(argv[0]);
+    }
+  }
+  if (config.threads == 0 || config.calls == 0) {
+    return usage(argv[0]);
+  }
+
+  auto module{DewModule::compile(std::string{PROGRAM})};
+  if (!module) {
+    std::fprintf(stderr, "the benchmark program didn't compile\n");
+    return 1;
+  }
+  std::vector<std::vector<int64_t>> expected(config.threads);
+  {
+    DewCaller caller{*module};
+    const DewModule::Function &score{*module->find("score")};
+    for (uint32_t user{0}; user < config.threads; ++user) {
+      for (int64_t item{0}; item < ITEMS; ++item) {
+        expected[user].push_back(*caller.call(score, {user, item}));
+      }
+    }
+  }
+
+  std::printf("%u calls per thread%s, %u cores\n", config.calls,
+              config.jit ? " with --jit" : "",
+              std::thread::hardware_concurrency());
+  std::printf("%-8s %14s %18s %9s\n", "threads", "calls/s",
+              "calls/s/thread", "scaling");
+  double single{0};
+  for (uint32_t threads{1}; threads <= config.threads;
+       threads = threads < config.threads
+                     ? std::min(threads * 2, config.threads)
+                     : threads + 1) {
+    double seconds{run(*module, config, threads, expected)};
+    double rate{threads * static_cast<double>(config.calls) / seconds};
+    if (threads == 1) {
+      single = rate;
+    }
+    std::printf("%-8u %14.0f %18.0f %8.2fx\n", threads, rate, rate / threads,
+                rate / single);
+  }
+}
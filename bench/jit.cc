@@ -0,0 +1,182 @@
+/**
+ * Copyright (C) 2024 Charles Ancheta
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ * \file jit.cc
+ *
+ * The JIT against the interpreter alone, over a few workloads called over
+ * and over: recursion, a tight loop, and a loop calling a small function.
+ * Each call is timed, so the warm-up curve shows what the first calls pay
+ * to count, compile and switch tiers, and the last tenth gives the steady
+ * state throughput.
+ */
+#include "DewCompiler.h"
+#include "DewParser.h"
+#include "DewVM.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <string_view>
+#include <vector>
+
+using namespace dew;
+
+namespace {
+constexpr std::string_view PROGRAM{R"(fun fib(i32 n) i32 {
+  if n <= 1 {
+    return n
+  }
+  return fib(n - 1) + fib(n - 2)
+}
+
+fun mix(i32 n) i32 {
+  i32 h, i
+  h = 17
+  for i = 0; i < n; i++ {
+    h = (h * 31 + i) ^ (h >> 7)
+  }
+  return h
+}
+
+fun next(i32 x) i32 {
+  if x % 2 == 0 {
+    return x / 2
+  }
+  return 3 * x + 1
+}
+
+fun collatz(i32 n) i32 {
+  i32 total, i, x, steps
+  total = 0
+  for i = 1; i < n; i++ {
+    x = i
+    for steps = 0; x != 1; steps++ {
+      x = next(x)
+    }
+    total = total + steps
+  }
+  return total
+}
+)"};
+
+struct Workload {
+  const char *function;
+  int64_t arg;
+};
+
+constexpr Workload WORKLOADS[]{{"fib", 20}, {"mix", 100000}, {"collatz", 500}};
+
+/** Microseconds each of `calls` calls took, and what the last returned. */
+struct Run {
+  std::vector<double> us;
+  int64_t result;
+  std::size_t compiled;
+  std::size_t codeSize;
+};
+
+bool run(const bc::Program &program, const Workload &w, uint32_t calls,
+         uint32_t threshold, Run &out) {
+  DewVM vm{program};
+  if (threshold != 0) {
+    vm.enableJit(threshold);
+  }
+  uint32_t function{*program.find(w.function)};
+  for (uint32_t i{0}; i < calls; ++i) {
+    auto start{std::chrono::steady_clock::now()};
+    if (!vm.call(function, &w.arg, &out.result)) {
+      std::fprintf(stderr, "%s: %s\n", w.function, vm.error().c_str());
+      return false;
+    }
+    std::chrono::duration<double, std::micro> took{
+        std::chrono::steady_clock::now() - start};
+    out.us.push_back(took.count());
+  }
+  out.compiled = vm.jit() ? vm.jit()->compiledCount() : 0;
+  out.codeSize = vm.jit() ? vm.jit()->codeSize() : 0;
+  return true;
+}
+
+/** Calls per second over the last tenth of `us`, by its median. */
+double steadyRate(std::vector<double> us) {
+  std::vector<double> tail(us.end() - std::max<std::size_t>(us.size() / 10, 1),
+                           us.end());
+  std::nth_element(tail.begin(), tail.begin() + tail.size() / 2, tail.end());
+  return 1e6 / tail[tail.size() / 2];
+}
+
+int usage(const char *argv0) {
+  std::fprintf(stderr, "USAGE: %s [--calls N] [--threshold N]\n", argv0);
+  return 1;
+}
+} // namespace
+
+int main(int argc, char **argv) {
+  uint32_t calls{1000};
+  uint32_t threshold{DewVM::JIT_THRESHOLD};
+  for (int i{1}; i < argc; ++i) {
+    std::string_view arg{argv[i]};
+    if (arg == "--calls" && i + 1 < argc) {
+      calls = static_cast<uint32_t>(std::atoi(argv[++i]));
+    } else if (arg == "--threshold" && i + 1 < argc) {
+      threshold = static_cast<uint32_t>(std::atoi(argv[++i]));
+    } else {
+      return usage(argv[0]);
+    }
+  }
+  if (calls == 0 || threshold == 0) {
+    return usage(argv[0]);
+  }
+
+  DewParser parser{std::string{PROGRAM}};
+  parser.parseSource();
+  auto program{DewCompiler{parser.astTree()}.compile(parser.getFunctions())};
+  if (!program) {
+    std::fprintf(stderr, "the benchmark program didn't compile\n");
+    return 1;
+  }
+
+  std::printf("%u calls each, compiling after %u calls or back edges\n",
+              calls, threshold);
+  for (const Workload &w : WORKLOADS) {
+    Run interpreted{};
+    Run tiered{};
+    if (!run(*program, w, calls, 0, interpreted) ||
+        !run(*program, w, calls, threshold, tiered)) {
+      return 1;
+    }
+    if (interpreted.result != tiered.result) {
+      std::fprintf(stderr, "%s: the tiers disagree, %lld and %lld\n",
+                   w.function, static_cast<long long>(interpreted.result),
+                   static_cast<long long>(tiered.result));
+      return 1;
+    }
+
+    std::printf("\n%s(%lld): %zu functions compiled, %zu bytes of code\n",
+                w.function, static_cast<long long>(w.arg), tiered.compiled,
+                tiered.codeSize);
+    std::printf("%-12s %16s %16s\n", "call", "interpreted us", "tiered us");
+    for (uint32_t i{1}; i <= calls; i *= 2) {
+      std::printf("%-12u %16.1f %16.1f\n", i, interpreted.us[i - 1],
+                  tiered.us[i - 1]);
+    }
+    double base{steadyRate(interpreted.us)};
+    double fast{steadyRate(tiered.us)};
+    std::printf("%-12s %16.0f %16.0f   %.1fx\n", "calls/s", base, fast,
+                fast / base);
+  }
+}
@@ -0,0 +1,129 @@
+/**
+ * Copyright (C) 2024 Charles Ancheta
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ * \file literals.cc
+ *
+ * Integer literal parsing, as parseInt does it now against the way it used
+ * to: stripping the prefix and separators into a stringstream, then calling
+ * std::stoll on a copy of its string.
+ */
+#include "util.h"
+#include <chrono>
+#include <cstdio>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+using namespace dew;
+
+namespace {
+constexpr int ROUNDS{200};
+
+uint64_t oldParseInt(std::string_view literal) {
+  int base{10};
+  std::stringstream ss;
+  for (const char c : literal) {
+    switch (c) {
+    case 'x':
+    case 'X':
+      base = 16;
+      break;
+    case 'o':
+    case 'O':
+      base = 8;
+      break;
+    case 'b':
+    case 'B':
+      base = 2;
+      break;
+    case '_':
+      break;
+    default:
+      ss << c;
+    }
+  }
+  return std::stoll(ss.str(), 0, base);
+}
+
+template <typename F>
+double nsPerLiteral(const std::vector<std::string> &literals, F parse) {
+  auto start{std::chrono::steady_clock::now()};
+  uint64_t sum{0};
+  for (int r{0}; r < ROUNDS; ++r) {
+    for (const std::string &literal : literals) {
+      sum += parse(literal);
+    }
+  }
+  std::chrono::duration<double, std::nano> took{
+      std::chrono::steady_clock::now() - start};
+  // Keeps the loops from being optimized away.
+  if (sum == 1) {
+    std::puts("");
+  }
+  return took.count() / (ROUNDS * literals.size());
+}
+} // namespace
+
+int main() {
+  // The old parser reads `b` as a base prefix even among hex digits, and
+  // can't go above INT64_MAX, so these stay clear of both.
+  struct Set {
+    const char *name;
+    std::vector<std::string> literals;
+  } sets[]{
+      {"short decimal", {}},
+      {"long decimal", {}},
+      {"hex", {}},
+      {"binary", {}},
+  };
+  for (uint32_t i{0}; i < 10000; ++i) {
+    sets[0].literals.push_back(std::to_string(i % 1000));
+    sets[1].literals.push_back(std::to_string(1000000007ull * (i + 1)));
+    std::string hex{"0x"};
+    for (uint32_t n{i * 7919}, d{0}; d < 8; ++d, n /= 15) {
+      hex += "0123456789ACDEF"[n % 15];
+      if (d == 3) {
+        hex += '_';
+      }
+    }
+    sets[2].literals.push_back(hex);
+    std::string bin{"0b"};
+    for (int bit{15}; bit >= 0; --bit) {
+      bin += (i >> bit & 1) ? '1' : '0';
+      if (bit % 4 == 0 && bit != 0) {
+        bin += '_';
+      }
+    }
+    sets[3].literals.push_back(bin);
+  }
+
+  std::printf("%-14s %12s %12s\n", "literals", "old ns", "new ns");
+  for (const Set &set : sets) {
+    for (const std::string &literal : set.literals) {
+      if (oldParseInt(literal) != *parseInt(literal)) {
+        std::printf("mismatch on %s\n", literal.c_str());
+        return 1;
+      }
+    }
+    double before{nsPerLiteral(set.literals, oldParseInt)};
+    double after{nsPerLiteral(set.literals, [](std::string_view literal) {
+      return *parseInt(literal);
+    })};
+    std::printf("%-14s %12.2f %12.2f\n", set.name, before, after);
+  }
+}
@@ -0,0 +1,206 @@
+/**
+ * Copyright (C) 2024 Charles Ancheta
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ * \file loops.cc
+ *
+ * The loop passes on generated loop-heavy functions: counted loops over
+ * sums with invariant terms and multiples of the counter, loops with a
+ * short fixed trip count nested inside them, and longer fixed ones. Each
+ * function is compiled with `-O` with and without the loop passes, then
+ * run in the interpreter and as machine code. Prints the bytecode size and
+ * how long the runs took both ways.
+ */
+#include "DewParser.h"
+#include "DewVM.h"
+#include "IRBuilder.h"
+#include "evaluate.h"
+#include "irlower.h"
+#include "passes.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+
+using namespace dew;
+
+namespace {
+struct Config {
+  uint32_t functions{50};
+  /** The counter the outer loops run up to. */
+  int64_t iterations{20000};
+  uint32_t repetitions{5};
+};
+
+/** Functions of `n` and `k`, each a couple of loops picked at random. */
+std::string generate(const Config &config) {
+  std::minstd_rand random{42};
+  auto c{[&] { return std::to_string(random() % 50 + 2); }};
+  std::string out;
+  for (uint32_t f{0}; f < config.functions; ++f) {
+    out += "fun f" + std::to_string(f) + "(i32 n, i32 k) i32 {\n"
+           "  i32 s, i, j\n"
+           "  s = k\n";
+    for (int loop{0}; loop < 2; ++loop) {
+      switch (random() % 3) {
+      case 0:
+        out += "  for i = 0; i < n; i++ {\n"
+               "    s = s + i * " + c() + " + k * " + c() + " - (k ^ " +
+               c() + ")\n"
+               "  }\n";
+        break;
+      case 1:
+        out += "  for i = 0; i < n; i++ {\n"
+               "    for j = 0; j < " + std::to_string(random() % 4 + 2) +
+               "; j++ {\n"
+               "      s = s ^ (j * " + c() + " + i)\n"
+               "    }\n"
+               "  }\n";
+        break;
+      default:
+        out += "  for i = 0; i < n; i++ {\n"
+               "    for j = 0; j < " + std::to_string(8 * (random() % 4 + 2)) +
+               "; j++ {\n"
+               "      s = s + (j * k) % " + c() + "\n"
+               "    }\n"
+               "  }\n";
+        break;
+      }
+    }
+    out += "  return s\n}\n";
+  }
+  return out;
+}
+
+struct Variant {
+  const char *name;
+  std::optional<bc::Program> program;
+  std::size_t instructions;
+  double interpretedMs;
+  double jitMs;
+  std::vector<int64_t> results;
+};
+
+/** `-O`, with the loop passes unless `loops` is false. */
+std::optional<bc::Program> compile(const DewParser &parser, bool loops) {
+  auto module{IRBuilder{parser.astTree()}.build(parser.getFunctions())};
+  if (!module) {
+    return std::nullopt;
+  }
+  ir::PassManager passes{ir::PassManager::standard()};
+  if (!loops) {
+    passes = ir::PassManager{};
+    passes.add("fold-constants", ir::foldConstants);
+    passes.add("propagate-copies", ir::propagateCopies);
+    passes.add("simplify-cfg", ir::simplifyCFG);
+    passes.add("eliminate-dead-code", ir::eliminateDeadCode);
+    passes.add("evaluate-calls", ir::evaluateCalls);
+  }
+  passes.run(*module);
+  return ir::lower(*module);
+}
+
+/** Milliseconds to call every function once per repetition. */
+double run(const Config &config, Variant &v, bool jit) {
+  DewVM vm{*v.program};
+  if (jit) {
+    vm.enableJit(1);
+  }
+  v.results.clear();
+  auto start{std::chrono::steady_clock::now()};
+  for (uint32_t r{0}; r < config.repetitions; ++r) {
+    for (uint32_t f{0}; f < config.functions; ++f) {
+      int64_t args[]{config.iterations, f + 1};
+      int64_t result{0};
+      if (!vm.call(f, args, &result)) {
+        std::fprintf(stderr, "f%u: %s\n", f, vm.error().c_str());
+        std::exit(1);
+      }
+      v.results.push_back(result);
+    }
+  }
+  std::chrono::duration<double, std::milli> took{
+      std::chrono::steady_clock::now() - start};
+  return took.count();
+}
+
+int usage(const char *argv0) {
+  std::fprintf(stderr,
+               "USAGE: %s [--functions N] [--iterations N] "
+               "[--repetitions N]\n",
+               argv0);
+  return 1;
+}
+} // namespace
+
+int main(int argc, char **argv) {
+  Config config;
+  for (int i{1}; i < argc; ++i) {
+    std::string_view arg{argv[i]};
+    if (i + 1 == argc) {
+      return usage(argv[0]);
+    } else if (arg == "--functions") {
+      config.functions = static_cast<uint32_t>(std::atoi(argv[++i]));
+    } else if (arg == "--iterations") {
+      config.iterations = std::atoll(argv[++i]);
+    } else if (arg == "--repetitions") {
+      config.repetitions = static_cast<uint32_t>(std::atoi(argv[++i]));
+    } else {
+      return usage(argv[0]);
+    }
+  }
+  if (config.functions == 0 || config.repetitions == 0) {
+    return usage(argv[0]);
+  }
+
+  DewParser parser{generate(config)};
+  parser.parseSource();
+  Variant variants[]{{"-O without loops", {}, 0, 0, 0, {}},
+                     {"-O", {}, 0, 0, 0, {}}};
+  for (Variant &v : variants) {
+    v.program = compile(parser, &v == &variants[1]);
+    if (!v.program) {
+      std::fprintf(stderr, "the generated program didn't compile\n");
+      return 1;
+    }
+    for (const bc::Function &fn : v.program->functions) {
+      v.instructions += fn.code.size();
+    }
+    v.interpretedMs = run(config, v, false);
+    std::vector<int64_t> interpreted{v.results};
+    v.jitMs = run(config, v, true);
+    if (v.results != interpreted || v.results != variants[0].results) {
+      std::fprintf(stderr, "%s: the results differ\n", v.name);
+      return 1;
+    }
+  }
+
+  std::printf("%u functions, %lld iterations, %u repetitions\n",
+              config.functions, static_cast<long long>(config.iterations),
+              config.repetitions);
+  std::printf("%-18s %14s %16s %10s\n", "", "instructions", "interpreted ms",
+              "jit ms");
+  for (const Variant &v : variants) {
+    std::printf("%-18s %14zu %16.1f %10.1f\n", v.name, v.instructions,
+                v.interpretedMs, v.jitMs);
+  }
+  std::printf("%-18s %14s %15.2fx %9.2fx\n", "speedup", "",
+              variants[0].interpretedMs / variants[1].interpretedMs,
+              variants[0].jitMs / variants[1].jitMs);
+}
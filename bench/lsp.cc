@@ -0,0 +1,245 @@
+/**
+ * Copyright (C) 2024 Charles Ancheta
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ * \file lsp.cc
+ *
+ * The language server's latency while someone types: a 20000-line file is
+ * opened, then a scripted series of edits is replayed against it one
+ * didChange at a time, each answered with diagnostics. The edits type a
+ * statement and delete it again a key at a time, break and fix a name,
+ * change a signature that callers depend on, and type a new function at
+ * the end. Prints the latency of each kind of edit and of go-to-definition.
+ */
+#include "lsp.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+using namespace dew;
+
+namespace {
+constexpr std::string_view URI{"file:///bench.dew"};
+/** The latency edits should stay under, in milliseconds. */
+constexpr double TARGET_MS{10};
+
+/** Functions like the ones in examples/, 13 lines each. */
+std::string generate(uint32_t lines) {
+  std::string source;
+  for (uint32_t i{0}; i < lines / 13; ++i) {
+    std::string n{std::to_string(i)};
+    source += "fun f" + n + "(i32 n, i32 k) i32 {\n"
+              "  i32 a, b, i\n"
+              "  a = 0x00_" + n + "\n"
+              "  b = (k + " + n + ") * 2 - -n\n"
+              "  for i = 0; i < n; i++ {\n"
+              "    if a >= b && i != 3 {\n"
+              "      a, b = b, a + b % 7\n"
+              "    } else {\n"
+              "      b--\n"
+              "    }\n"
+              "  }\n"
+              "  return f" + std::to_string(i / 2) + "(a, b << 1)\n"
+              "}\n";
+  }
+  return source;
+}
+
+/** An edit of the script: `remove` bytes at `at` replaced by `text`. */
+struct Edit {
+  const char *kind;
+  std::size_t at;
+  std::size_t remove;
+  std::string text;
+};
+
+/** Keeps a copy of the document, to turn offsets into LSP positions. */
+class Replay {
+public:
+  Replay(std::string text) : text{std::move(text)}, server{sink}, version{0} {
+    std::ostringstream open;
+    open << "{\"jsonrpc\":\"2.0\",\"method\":\"textDocument/didOpen\","
+            "\"params\":{\"textDocument\":{\"uri\":\""
+         << URI << "\",\"languageId\":\"dew\",\"version\":0,\"text\":";
+    json::quote(open, this->text);
+    open << "}}}";
+    server.handle(open.str());
+  }
+
+  /** Applies `edit` through the server, returning how long it took. */
+  double apply(const Edit &edit) {
+    std::ostringstream change;
+    change << "{\"jsonrpc\":\"2.0\",\"method\":\"textDocument/didChange\","
+              "\"params\":{\"textDocument\":{\"uri\":\""
+           << URI << "\",\"version\":" << ++version
+           << "},\"contentChanges\":[{\"range\":{\"start\":"
+           << position(edit.at) << ",\"end\":"
+           << position(edit.at + edit.remove) << "},\"text\":";
+    json::quote(change, edit.text);
+    change << "}]}}";
+    text.replace(edit.at, edit.remove, edit.text);
+    return time(change.str());
+  }
+
+  /** Asks for the definition of what's at `at`. */
+  double definition(std::size_t at) {
+    std::ostringstream request;
+    request << "{\"jsonrpc\":\"2.0\",\"id\":" << ++version
+            << ",\"method\":\"textDocument/definition\",\"params\":{"
+               "\"textDocument\":{\"uri\":\""
+            << URI << "\"},\"position\":" << position(at) << "}}";
+    return time(request.str());
+  }
+
+  const std::string &source() const { return text; }
+  /** Whether the last reply had any diagnostics in it. */
+  bool diagnosed() const {
+    return last.find("\"diagnostics\":[]") == std::string::npos;
+  }
+
+private:
+  std::string position(std::size_t offset) const {
+    std::size_t line{0};
+    std::size_t lineStart{0};
+    for (std::size_t i{0}; i < offset; ++i) {
+      if (text[i] == '\n') {
+        ++line;
+        lineStart = i + 1;
+      }
+    }
+    return "{\"line\":" + std::to_string(line) +
+           ",\"character\":" + std::to_string(offset - lineStart) + "}";
+  }
+
+  double time(const std::string &message) {
+    sink.str("");
+    auto start{std::chrono::steady_clock::now()};
+    server.handle(message);
+    std::chrono::duration<double, std::milli> took{
+        std::chrono::steady_clock::now() - start};
+    last = sink.str();
+    return took.count();
+  }
+
+  std::string text;
+  std::ostringstream sink;
+  LanguageServer server;
+  std::string last;
+  int version;
+};
+
+std::vector<Edit> script(const std::string &text, uint32_t lines) {
+  std::vector<Edit> edits;
+  // In the middle of the file, where the most follows an edit.
+  uint32_t middle{lines / 13 / 2};
+  std::string fn{"fun f" + std::to_string(middle) + "("};
+  std::size_t header{text.find(fn)};
+  std::size_t body{text.find("  return", header)};
+
+  std::string statement{"  a = a * 3 + b\n"};
+  for (std::size_t i{0}; i < statement.size(); ++i) {
+    edits.push_back(Edit{"type", body + i, 0, statement.substr(i, 1)});
+  }
+  for (std::size_t i{statement.size()}; i-- > 0;) {
+    edits.push_back(Edit{"delete", body + i, 1, ""});
+  }
+
+  std::size_t use{text.find("(a, b << 1)", body) + 1};
+  edits.push_back(Edit{"break a name", use, 1, "zz"});
+  edits.push_back(Edit{"fix a name", use, 2, "a"});
+
+  std::size_t param{text.find("i32 k", header)};
+  edits.push_back(Edit{"change a signature", param, 3, "u16"});
+  edits.push_back(Edit{"change a signature", param, 3, "i32"});
+
+  std::string added{"fun g() i32 {\n  return f1(1, 2)\n}\n"};
+  for (std::size_t i{0}; i < added.size(); ++i) {
+    edits.push_back(Edit{"type a function", text.size() + i, 0,
+                         added.substr(i, 1)});
+  }
+  return edits;
+}
+
+struct Latency {
+  const char *kind;
+  std::vector<double> ms;
+};
+
+void print(Latency &l) {
+  std::sort(l.ms.begin(), l.ms.end());
+  auto over{std::count_if(l.ms.begin(), l.ms.end(),
+                          [](double ms) { return ms > TARGET_MS; })};
+  std::printf("%-20s %6zu %10.3f %10.3f %10.3f %8ld\n", l.kind, l.ms.size(),
+              l.ms[l.ms.size() / 2], l.ms[l.ms.size() * 99 / 100],
+              l.ms.back(), static_cast<long>(over));
+}
+} // namespace
+
+int main(int argc, char **argv) {
+  uint32_t lines{20000};
+  if (argc == 3 && std::string_view{argv[1]} == "--lines") {
+    lines = static_cast<uint32_t>(std::atoi(argv[2]));
+  } else if (argc != 1) {
+    lines = 0;
+  }
+  // Two functions at least, so that one can call the other.
+  if (lines < 26) {
+    std::fprintf(stderr, "USAGE: %s [--lines N], N >= 26\n", argv[0]);
+    return 1;
+  }
+
+  std::string text{generate(lines)};
+  auto start{std::chrono::steady_clock::now()};
+  Replay replay{text};
+  std::chrono::duration<double, std::milli> opened{
+      std::chrono::steady_clock::now() - start};
+
+  std::vector<Latency> latencies;
+  for (const Edit &edit : script(text, lines)) {
+    if (latencies.empty() ||
+        std::string_view{latencies.back().kind} != edit.kind) {
+      latencies.push_back(Latency{edit.kind, {}});
+    }
+    latencies.back().ms.push_back(replay.apply(edit));
+  }
+  if (replay.source() != text + "fun g() i32 {\n  return f1(1, 2)\n}\n" ||
+      replay.diagnosed()) {
+    std::fprintf(stderr, "the replay didn't end where it should have\n");
+    return 1;
+  }
+
+  // Every name in the function in the middle.
+  Latency definitions{"go to definition", {}};
+  std::size_t from{text.find("fun f" + std::to_string(lines / 26) + "(")};
+  std::size_t to{text.find("\n}\n", from)};
+  for (std::size_t at{from}; at < to; ++at) {
+    definitions.ms.push_back(replay.definition(at));
+  }
+
+  std::printf("%u lines, %.2f MB, opened in %.1f ms\n", lines,
+              text.size() / 1e6, opened.count());
+  std::printf("%-20s %6s %10s %10s %10s %8s\n", "", "count", "median ms",
+              "p99 ms", "max ms", "> 10 ms");
+  for (Latency &l : latencies) {
+    print(l);
+  }
+  print(definitions);
+}
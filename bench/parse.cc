@@ -0,0 +1,205 @@
+/**
+ * Copyright (C) 2024 Charles Ancheta
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ * \file parse.cc
+ *
+ * Parsing a large file to an AST, and the node dispatch in it: walking the
+ * tree the way the parser used to, comparing the types of nodes against
+ * strings and looking fields up by name, against walking it by symbol and
+ * field id through the Grammar.
+ */
+#include "DewParser.h"
+#include "grammar.h"
+#include "source.h"
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <tree_sitter/api.h>
+
+using namespace dew;
+
+namespace {
+constexpr int ROUNDS{5};
+
+/** Functions like the ones in examples/, `count` of them. */
+std::string generate(uint32_t count) {
+  std::string source;
+  for (uint32_t i{0}; i < count; ++i) {
+    std::string n{std::to_string(i)};
+    source += "fun f" + n + "(i32 n, i32 k) i32 {\n"
+              "  i32 a, b, i\n"
+              "  a = 0x00_" + n + "\n"
+              "  b = (k + " + n + ") * 2 - -n\n"
+              "  for i = 0; i < n; i++ {\n"
+              "    if a >= b && i != 3 {\n"
+              "      a, b = b, a + b % 7\n"
+              "    } else {\n"
+              "      b--\n"
+              "    }\n"
+              "  }\n"
+              "  return f" + std::to_string(i / 2) + "(a, b << 1)\n"
+              "}\n";
+  }
+  return source;
+}
+
+/** What the parser used to do at every node before descending. */
+uint32_t visitByName(TSNode node) {
+  std::string_view type{ts_node_type(node)};
+  uint32_t found{0};
+  auto field{[&](const char *name) {
+    found += !ts_node_is_null(
+        ts_node_child_by_field_name(node, name, std::strlen(name)));
+  }};
+  if (type == "parenthesized_expression") {
+  } else if (type == "binary_expression") {
+    field("left"), field("right"), field("operator");
+  } else if (type == "unary_expression") {
+    field("operand"), field("operator");
+  } else if (type == "identifier") {
+  } else if (type == "call_expression") {
+    field("function"), field("arguments");
+  } else if (type == "int_literal") {
+  } else if (type == "if_statement") {
+    field("condition"), field("consequence"), field("alternative");
+  } else if (type == "for_statement") {
+    field("init"), field("cond"), field("update"), field("body");
+  } else if (type == "return_statement") {
+  } else if (type == "expression_statement") {
+  } else if (type == "assignment_statement") {
+    field("left"), field("right");
+  } else if (type == "function_declaration") {
+    field("name"), field("parameters"), field("result"), field("body");
+  }
+  for (TSNode c{ts_node_named_child(node, 0)}; !ts_node_is_null(c);
+       c = ts_node_next_named_sibling(c)) {
+    found += visitByName(c);
+  }
+  return found;
+}
+
+/** The same through the Grammar. */
+uint32_t visitById(const Grammar &g, TSNode node) {
+  uint32_t found{0};
+  auto field{[&](Field f) { found += !ts_node_is_null(g.field(node, f)); }};
+  switch (g.kind(node)) {
+  case NodeKind::BinaryExpression:
+    field(Field::Left), field(Field::Right), field(Field::Operator);
+    break;
+  case NodeKind::UnaryExpression:
+    field(Field::Operand), field(Field::Operator);
+    break;
+  case NodeKind::CallExpression:
+    field(Field::Function), field(Field::Arguments);
+    break;
+  case NodeKind::IfStatement:
+    field(Field::Condition), field(Field::Consequence),
+        field(Field::Alternative);
+    break;
+  case NodeKind::ForStatement:
+    field(Field::Init), field(Field::Cond), field(Field::Update),
+        field(Field::Body);
+    break;
+  case NodeKind::AssignmentStatement:
+    field(Field::Left), field(Field::Right);
+    break;
+  case NodeKind::FunctionDeclaration:
+    field(Field::Name), field(Field::Parameters), field(Field::Result),
+        field(Field::Body);
+    break;
+  default:
+    break;
+  }
+  for (TSNode c{ts_node_named_child(node, 0)}; !ts_node_is_null(c);
+       c = ts_node_next_named_sibling(c)) {
+    found += visitById(g, c);
+  }
+  return found;
+}
+
+template <typename F> double bestMs(F f) {
+  double best{0};
+  for (int r{0}; r < ROUNDS; ++r) {
+    auto start{std::chrono::steady_clock::now()};
+    f();
+    std::chrono::duration<double, std::milli> took{
+        std::chrono::steady_clock::now() - start};
+    if (r == 0 || took.count() < best) {
+      best = took.count();
+    }
+  }
+  return best;
+}
+} // namespace
+
+int main(int argc, char **argv) {
+  std::string text;
+  if (argc > 1) {
+    std::optional<Source> source{Source::load(argv[1])};
+    if (!source) {
+      return 1;
+    }
+    text = source->text();
+  } else {
+    text = generate(20000);
+  }
+  double mb{text.size() / 1e6};
+  const Grammar &grammar{Grammar::get()};
+
+  // Every parser gets a copy of the text, which takes a small part of the
+  // time next to the rest.
+  double tree{bestMs([&] { DewParser parser{text}; })};
+  DewParser parser{text};
+  uint32_t byName{0};
+  uint32_t byId{0};
+  double names{bestMs([&] { byName = visitByName(parser.root()); })};
+  double ids{bestMs([&] { byId = visitById(grammar, parser.root()); })};
+  if (byName != byId) {
+    std::printf("walks disagree: %u fields by name, %u by id\n", byName, byId);
+    return 1;
+  }
+  double ast{bestMs([&] {
+    DewParser p{text};
+    p.parseSource();
+  })};
+  // Just the AST, which tree-sitter's time and its noise would hide.
+  double alone{0};
+  for (int r{0}; r < ROUNDS; ++r) {
+    DewParser p{text};
+    auto start{std::chrono::steady_clock::now()};
+    p.parseSource();
+    std::chrono::duration<double, std::milli> took{
+        std::chrono::steady_clock::now() - start};
+    if (r == 0 || took.count() < alone) {
+      alone = took.count();
+    }
+  }
+
+  std::printf("%.1f MB, %u fields\n", mb, byId);
+  std::printf("%-24s %10s %10s\n", "", "ms", "MB/s");
+  std::printf("%-24s %10.2f %10.1f\n", "tree-sitter", tree, mb / tree * 1e3);
+  std::printf("%-24s %10.2f %10.1f\n", "walk by name", names,
+              mb / names * 1e3);
+  std::printf("%-24s %10.2f %10.1f\n", "walk by id", ids, mb / ids * 1e3);
+  std::printf("%-24s %10.2f %10.1f\n", "tree-sitter and AST", ast,
+              mb / ast * 1e3);
+  std::printf("%-24s %10.2f %10.1f\n", "AST alone", alone,
+              mb / alone * 1e3);
+}
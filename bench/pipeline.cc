@@ -0,0 +1,311 @@
+/**
+ * Copyright (C) 2024 Charles Ancheta
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ * \file pipeline.cc
+ *
+ * Every stage of the compiler over a generated program, from loading the
+ * file to lowering the optimized IR, timed separately over a number of
+ * repetitions. Prints a table, or JSON with `--json` for keeping track of
+ * the numbers over time.
+ */
+#include "DewCompiler.h"
+#include "DewParser.h"
+#include "IRBuilder.h"
+#include "irlower.h"
+#include "passes.h"
+#include "source.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <optional>
+#include <random>
+#include <string>
+#include <string_view>
+#include <unistd.h>
+#include <vector>
+
+using namespace dew;
+namespace fs = std::filesystem;
+
+namespace {
+struct Config {
+  uint32_t functions{2000};
+  /** How deep ifs and loops nest in each function. */
+  uint32_t depth{3};
+  /** The share of operands that are literals rather than variables. */
+  double literals{0.5};
+  uint32_t repetitions{10};
+  bool json{false};
+};
+
+/**
+ * Functions that call each other, with ifs and loops nested `depth` deep
+ * and literals in every base.
+ */
+class Generator {
+public:
+  Generator(const Config &config) : config{config}, random{42} {}
+
+  std::string program() {
+    for (uint32_t i{0}; i < config.functions; ++i) {
+      function(i);
+    }
+    return std::move(out);
+  }
+
+private:
+  void function(uint32_t i) {
+    out += "fun f" + std::to_string(i) + "(i32 a, i32 b) i32 {\n";
+    out += "  i32 x, y";
+    for (uint32_t d{1}; d < config.depth; d += 2) {
+      out += ", i" + std::to_string(d);
+    }
+    out += "\n  x = " + expr() + "\n  y = " + expr() + "\n";
+    nest(0, 1);
+    if (i == 0) {
+      out += "  return x + y\n";
+    } else {
+      out += "  return f" + std::to_string(i / 2) + "(x, " + expr() + ")\n";
+    }
+    out += "}\n";
+  }
+
+  /** An if at even depths and a loop at odd ones, down to config.depth. */
+  void nest(uint32_t d, uint32_t indent) {
+    std::string pad(2 * indent, ' ');
+    if (d == config.depth) {
+      out += pad + "x = " + expr() + "\n";
+      out += pad + "y = " + expr() + "\n";
+      return;
+    }
+    if (d % 2 == 0) {
+      out += pad + "if " + operand() + " < " + expr() + " {\n";
+      nest(d + 1, indent + 1);
+      out += pad + "} else {\n" + pad + "  y--\n" + pad + "}\n";
+    } else {
+      std::string i{"i" + std::to_string(d)};
+      out += pad + "for " + i + " = 0; " + i + " < " + operand() + "; " + i +
+             "++ {\n";
+      nest(d + 1, indent + 1);
+      out += pad + "}\n";
+    }
+  }
+
+  std::string expr() {
+    static constexpr std::string_view ops[]{" + ", " - ", " * ", " & ",
+                                            " ^ ", " | "};
+    std::string e{operand()};
+    for (int i{0}; i < 3; ++i) {
+      e += ops[random() % std::size(ops)];
+      e += operand();
+    }
+    return e;
+  }
+
+  std::string operand() {
+    static constexpr std::string_view vars[]{"a", "b", "x", "y"};
+    if (std::uniform_real_distribution<double>{}(random) >= config.literals) {
+      return std::string{vars[random() % std::size(vars)]};
+    }
+    uint32_t n{static_cast<uint32_t>(random() % 100000)};
+    char text[48];
+    switch (random() % 4) {
+    case 0:
+      std::snprintf(text, sizeof(text), "%u", n);
+      break;
+    case 1:
+      std::snprintf(text, sizeof(text), "0x%04X_%02X", n >> 8, n & 0xFF);
+      break;
+    case 2:
+      std::snprintf(text, sizeof(text), "0o%o", n);
+      break;
+    default: {
+      std::string bits{"0b"};
+      for (int b{16}; b >= 0; --b) {
+        bits += n >> b & 1 ? '1' : '0';
+      }
+      return bits;
+    }
+    }
+    return text;
+  }
+
+  const Config &config;
+  std::minstd_rand random;
+  std::string out;
+};
+
+struct Stage {
+  const char *name;
+  std::vector<double> ms;
+};
+
+class Stopwatch {
+public:
+  Stopwatch(std::vector<Stage> &stages) : stages{stages}, index{0} {}
+
+  /** Times `f` as the next stage. */
+  template <typename F> auto operator()(F f) {
+    auto start{std::chrono::steady_clock::now()};
+    auto result{f()};
+    std::chrono::duration<double, std::milli> took{
+        std::chrono::steady_clock::now() - start};
+    stages[index++].ms.push_back(took.count());
+    return result;
+  }
+
+private:
+  std::vector<Stage> &stages;
+  std::size_t index;
+};
+
+/** Nearest-rank percentile of sorted `ms`. */
+double percentile(const std::vector<double> &ms, double p) {
+  auto rank{static_cast<std::size_t>(std::ceil(p * ms.size()))};
+  return ms[std::max<std::size_t>(rank, 1) - 1];
+}
+
+bool run(const char *path, std::vector<Stage> &stages) {
+  Stopwatch time{stages};
+  auto source{time([&] { return Source::load(path); })};
+  if (!source) {
+    return false;
+  }
+  std::optional<DewParser> parser;
+  time([&] {
+    parser.emplace(std::move(*source));
+    return true;
+  });
+  auto topLevel{time([&] { return parser->defineTopLevel(parser->root()); })};
+  time([&] {
+    parser->defineFunctions(parser->root(), topLevel);
+    return true;
+  });
+  time([&] {
+    parser->checkTypes();
+    return true;
+  });
+  auto program{time([&] {
+    return DewCompiler{parser->astTree()}.compile(parser->getFunctions());
+  })};
+  auto module{time([&] {
+    return IRBuilder{parser->astTree()}.build(parser->getFunctions());
+  })};
+  if (!program || !module) {
+    return false;
+  }
+  time([&] {
+    ir::PassManager::standard().run(*module);
+    return true;
+  });
+  return time([&] { return ir::lower(*module); }).has_value();
+}
+
+int usage(const char *argv0) {
+  std::fprintf(stderr,
+               "USAGE: %s [--functions N] [--depth N] [--literals 0..1] "
+               "[--repetitions N] [--json]\n",
+               argv0);
+  return 1;
+}
+} // namespace
+
+int main(int argc, char **argv) {
+  Config config;
+  for (int i{1}; i < argc; ++i) {
+    std::string_view arg{argv[i]};
+    bool hasValue{i + 1 < argc};
+    if (arg == "--json") {
+      config.json = true;
+    } else if (arg == "--functions" && hasValue) {
+      config.functions = static_cast<uint32_t>(std::atoi(argv[++i]));
+    } else if (arg == "--depth" && hasValue) {
+      config.depth = static_cast<uint32_t>(std::atoi(argv[++i]));
+    } else if (arg == "--literals" && hasValue) {
+      config.literals = std::atof(argv[++i]);
+    } else if (arg == "--repetitions" && hasValue) {
+      config.repetitions = static_cast<uint32_t>(std::atoi(argv[++i]));
+    } else {
+      return usage(argv[0]);
+    }
+  }
+  if (config.functions == 0 || config.repetitions == 0) {
+    return usage(argv[0]);
+  }
+
+  // Loading is one of the stages, so the program goes through a file.
+  std::string text{Generator{config}.program()};
+  fs::path path{fs::temp_directory_path() /
+                ("dew-bench-" + std::to_string(::getpid()) + ".dew")};
+  std::ofstream{path} << text;
+
+  std::vector<Stage> stages{{"load", {}},
+                            {"tree-sitter", {}},
+                            {"defineTopLevel", {}},
+                            {"defineFunctions", {}},
+                            {"typecheck", {}},
+                            {"bytecode", {}},
+                            {"ir", {}},
+                            {"passes", {}},
+                            {"lower", {}}};
+  bool ok{true};
+  for (uint32_t r{0}; ok && r < config.repetitions; ++r) {
+    ok = run(path.c_str(), stages);
+  }
+  std::error_code ec;
+  fs::remove(path, ec);
+  if (!ok) {
+    std::fprintf(stderr, "the generated program didn't compile\n");
+    return 1;
+  }
+
+  double mb{text.size() / 1e6};
+  if (config.json) {
+    std::printf("{\n  \"functions\": %u,\n  \"depth\": %u,\n"
+                "  \"literals\": %g,\n  \"repetitions\": %u,\n"
+                "  \"bytes\": %zu,\n  \"stages\": [\n",
+                config.functions, config.depth, config.literals,
+                config.repetitions, text.size());
+  } else {
+    std::printf("%u functions, depth %u, %.0f%% literals: %.2f MB\n",
+                config.functions, config.depth, config.literals * 100, mb);
+    std::printf("%-18s %10s %10s %10s %10s\n", "", "min ms", "median ms",
+                "p99 ms", "MB/s");
+  }
+  for (std::size_t i{0}; i < stages.size(); ++i) {
+    std::vector<double> &ms{stages[i].ms};
+    std::sort(ms.begin(), ms.end());
+    double median{percentile(ms, 0.5)};
+    if (config.json) {
+      std::printf("    {\"name\": \"%s\", \"min_ms\": %.4f, "
+                  "\"median_ms\": %.4f, \"p99_ms\": %.4f}%s\n",
+                  stages[i].name, ms.front(), median, percentile(ms, 0.99),
+                  i + 1 < stages.size() ? "," : "");
+    } else {
+      std::printf("%-18s %10.3f %10.3f %10.3f %10.1f\n", stages[i].name,
+                  ms.front(), median, percentile(ms, 0.99),
+                  mb / median * 1e3);
+    }
+  }
+  if (config.json) {
+    std::printf("  ]\n}\n");
+  }
+}
@@ -0,0 +1,181 @@
+/**
+ * Copyright (C) 2024 Charles Ancheta
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ * \file profile.cc
+ *
+ * What the profiler costs a running program: a few workloads run over and
+ * over, alternately with and without the profiler sampling them, in the VM
+ * alone and with the JIT. Prints the median time of each way and how much
+ * slower profiling made it.
+ */
+#include "DewCompiler.h"
+#include "DewParser.h"
+#include "DewVM.h"
+#include "profiler.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <string_view>
+#include <vector>
+
+using namespace dew;
+
+namespace {
+constexpr std::string_view PROGRAM{R"(fun fib(i32 n) i32 {
+  if n <= 1 {
+    return n
+  }
+  return fib(n - 1) + fib(n - 2)
+}
+
+fun mix(i32 n) i32 {
+  i32 h, i
+  h = 17
+  for i = 0; i < n; i++ {
+    h = (h * 31 + i) ^ (h >> 7)
+  }
+  return h
+}
+
+fun next(i32 x) i32 {
+  if x % 2 == 0 {
+    return x / 2
+  }
+  return 3 * x + 1
+}
+
+fun collatz(i32 n) i32 {
+  i32 total, i, x, steps
+  total = 0
+  for i = 1; i < n; i++ {
+    x = i
+    for steps = 0; x != 1; steps++ {
+      x = next(x)
+    }
+    total = total + steps
+  }
+  return total
+}
+)"};
+
+struct Workload {
+  const char *function;
+  int64_t arg;
+};
+
+constexpr Workload WORKLOADS[]{
+    {"fib", 30}, {"mix", 10000000}, {"collatz", 50000}};
+
+/** Milliseconds to call `w` once, sampled by `profiler` if given. */
+double run(const bc::Program &program, const Workload &w, bool jit,
+           Profiler *profiler, int64_t &result) {
+  DewVM vm{program};
+  if (jit) {
+    vm.enableJit();
+  }
+  if (profiler) {
+    vm.profileWith(profiler);
+    if (!profiler->start()) {
+      std::exit(1);
+    }
+  }
+  auto start{std::chrono::steady_clock::now()};
+  bool ok{vm.call(*program.find(w.function), &w.arg, &result)};
+  std::chrono::duration<double, std::milli> took{
+      std::chrono::steady_clock::now() - start};
+  if (profiler) {
+    profiler->stop();
+  }
+  if (!ok) {
+    std::fprintf(stderr, "%s: %s\n", w.function, vm.error().c_str());
+    std::exit(1);
+  }
+  return took.count();
+}
+
+double median(std::vector<double> ms) {
+  std::nth_element(ms.begin(), ms.begin() + ms.size() / 2, ms.end());
+  return ms[ms.size() / 2];
+}
+
+int usage(const char *argv0) {
+  std::fprintf(stderr, "USAGE: %s [--rate HZ] [--repetitions N]\n", argv0);
+  return 1;
+}
+} // namespace
+
+int main(int argc, char **argv) {
+  uint32_t rate{Profiler::DEFAULT_RATE};
+  uint32_t repetitions{7};
+  for (int i{1}; i < argc; ++i) {
+    std::string_view arg{argv[i]};
+    if (arg == "--rate" && i + 1 < argc) {
+      rate = static_cast<uint32_t>(std::atoi(argv[++i]));
+    } else if (arg == "--repetitions" && i + 1 < argc) {
+      repetitions = static_cast<uint32_t>(std::atoi(argv[++i]));
+    } else {
+      return usage(argv[0]);
+    }
+  }
+  if (rate == 0 || repetitions == 0) {
+    return usage(argv[0]);
+  }
+
+  DewParser parser{std::string{PROGRAM}};
+  parser.parseSource();
+  auto program{DewCompiler{parser.astTree()}.compile(parser.getFunctions())};
+  if (!program) {
+    std::fprintf(stderr, "the benchmark program didn't compile\n");
+    return 1;
+  }
+
+  std::printf("%u runs each, sampling %u times a second\n", repetitions,
+              rate);
+  std::printf("%-14s %-6s %12s %12s %10s %9s\n", "workload", "tier",
+              "plain ms", "profiled ms", "overhead", "samples");
+  for (const Workload &w : WORKLOADS) {
+    for (bool jit : {false, true}) {
+      std::vector<double> plain;
+      std::vector<double> profiled;
+      std::size_t samples{0};
+      // Taking turns keeps anything else the machine is doing from
+      // landing on one side only.
+      for (uint32_t i{0}; i < repetitions; ++i) {
+        int64_t expected;
+        int64_t result;
+        plain.push_back(run(*program, w, jit, nullptr, expected));
+        Profiler profiler{*program, {}, rate};
+        profiled.push_back(run(*program, w, jit, &profiler, result));
+        samples += profiler.sampled();
+        if (result != expected) {
+          std::fprintf(stderr, "%s: profiling changed the result\n",
+                       w.function);
+          return 1;
+        }
+      }
+      double base{median(plain)};
+      double slow{median(profiled)};
+      std::string name{std::string{w.function} + "(" +
+                       std::to_string(w.arg) + ")"};
+      std::printf("%-14s %-6s %12.1f %12.1f %9.1f%% %9zu\n", name.c_str(),
+                  jit ? "jit" : "vm", base, slow, 100 * (slow / base - 1),
+                  samples / repetitions);
+    }
+  }
+}
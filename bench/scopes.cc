@@ -0,0 +1,106 @@
+/**
+ * Copyright (C) 2024 Charles Ancheta
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ * \file scopes.cc
+ *
+ * Name lookups at several nesting depths, through a chain of per-scope hash
+ * maps (the way scopes used to be kept) and through an Interner and a
+ * ScopeTable. Every scope defines a few names, and the lookups are spread
+ * evenly over all of them.
+ */
+#include "symbols.h"
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+using namespace dew;
+
+namespace {
+constexpr int NAMES_PER_SCOPE{4};
+constexpr int LOOKUPS{1 << 22};
+
+/** One scope in a chain, each with a map of its own. */
+struct Chain {
+  const Chain *parent;
+  std::unordered_map<std::string_view, int> names;
+
+  const int *resolve(std::string_view name) const {
+    for (const Chain *c{this}; c; c = c->parent) {
+      auto it{c->names.find(name)};
+      if (it != c->names.end()) {
+        return &it->second;
+      }
+    }
+    return nullptr;
+  }
+};
+
+template <typename F> double nsPerLookup(F lookup) {
+  auto start{std::chrono::steady_clock::now()};
+  long sum{0};
+  for (int i{0}; i < LOOKUPS; ++i) {
+    sum += lookup(i);
+  }
+  std::chrono::duration<double, std::nano> took{
+      std::chrono::steady_clock::now() - start};
+  // Keeps the loop from being optimized away.
+  if (sum == -1) {
+    std::puts("");
+  }
+  return took.count() / LOOKUPS;
+}
+} // namespace
+
+int main() {
+  std::printf("%6s %12s %12s\n", "depth", "chain ns", "table ns");
+  for (const int depth : {1, 8, 64}) {
+    std::vector<std::string> names;
+    for (int d{0}; d < depth; ++d) {
+      for (int k{0}; k < NAMES_PER_SCOPE; ++k) {
+        names.push_back("v" + std::to_string(d) + "_" + std::to_string(k));
+      }
+    }
+
+    std::vector<Chain> chain(depth);
+    Interner interner;
+    ScopeTable<int> table;
+    std::vector<Symbol> symbols;
+    for (int d{0}; d < depth; ++d) {
+      chain[d].parent = d == 0 ? nullptr : &chain[d - 1];
+      for (int k{0}; k < NAMES_PER_SCOPE; ++k) {
+        std::size_t n{static_cast<std::size_t>(d * NAMES_PER_SCOPE + k)};
+        chain[d].names.emplace(names[n], static_cast<int>(n));
+        symbols.push_back(interner.intern(names[n]));
+        table.define(symbols.back(), static_cast<int>(n));
+      }
+    }
+
+    // A stride coprime with the name count visits the scopes out of order.
+    std::size_t count{names.size()};
+    const Chain &inner{chain.back()};
+    double chained{nsPerLookup([&](int i) {
+      return *inner.resolve(names[(i * 7919u) % count]);
+    })};
+    double flat{nsPerLookup([&](int i) {
+      return *table.resolve(symbols[(i * 7919u) % count]);
+    })};
+    std::printf("%6d %12.2f %12.2f\n", depth, chained, flat);
+  }
+}
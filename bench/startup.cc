@@ -0,0 +1,200 @@
+/**
+ * Copyright (C) 2024 Charles Ancheta
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ * \file startup.cc
+ *
+ * Time to the first call of a large generated program, from its source
+ * and from its `.dewb` file. From source that's reading, parsing, type
+ * checking and compiling every function; from `.dewb` it's mapping the
+ * file, reading the index and loading the bodies of the functions the
+ * call reaches, which here are a handful out of thousands.
+ */
+#include "DewCompiler.h"
+#include "DewParser.h"
+#include "DewVM.h"
+#include "image.h"
+#include "source.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <string>
+#include <string_view>
+#include <unistd.h>
+#include <vector>
+
+using namespace dew;
+namespace fs = std::filesystem;
+
+namespace {
+struct Config {
+  uint32_t functions{20000};
+  uint32_t repetitions{5};
+};
+
+/**
+ * Functions with a loop and some arithmetic each, every one calling the
+ * one at half its index, so a call to the last reaches about log2 of them.
+ */
+std::string generate(const Config &config) {
+  std::minstd_rand random{42};
+  auto c{[&] { return std::to_string(random() % 100 + 1); }};
+  std::string out;
+  for (uint32_t i{0}; i < config.functions; ++i) {
+    out += "fun f" + std::to_string(i) + "(i32 a, i32 b) i32 {\n"
+           "  i32 x, k\n"
+           "  x = a * " + c() + " + b\n"
+           "  for k = 0; k < " + c() + "; k++ {\n"
+           "    if x > " + c() + " {\n"
+           "      x = x - b ^ " + c() + "\n"
+           "    } else {\n"
+           "      x = x + k * " + c() + "\n"
+           "    }\n"
+           "  }\n";
+    out += i == 0 ? "  return x\n"
+                  : "  return f" + std::to_string(i / 2) + "(x, b + 1)\n";
+    out += "}\n";
+  }
+  return out;
+}
+
+/** What a first call returned, and the functions it had to load. */
+struct First {
+  int64_t result;
+  std::size_t loaded;
+};
+
+/** Runs the last function once, straight from the source at `path`. */
+First fromSource(const fs::path &path) {
+  auto source{Source::load(path.c_str())};
+  DewParser parser{std::move(*source)};
+  parser.parseSource();
+  auto program{DewCompiler{parser.astTree()}.compile(parser.getFunctions())};
+  if (!program) {
+    std::exit(1);
+  }
+  DewVM vm{*program};
+  int64_t args[]{1, 2};
+  First first{0, program->functions.size()};
+  if (!vm.call(static_cast<uint32_t>(program->functions.size() - 1), args,
+               &first.result)) {
+    std::exit(1);
+  }
+  return first;
+}
+
+/** Runs the last function once, out of the `.dewb` file at `path`. */
+First fromImage(const fs::path &path) {
+  auto file{Source::load(path.c_str())};
+  auto image{ProgramImage::open(std::move(*file), path.c_str())};
+  if (!image) {
+    std::exit(1);
+  }
+  DewVM vm{image->program()};
+  int64_t args[]{1, 2};
+  First first{0, 0};
+  if (!vm.call(static_cast<uint32_t>(image->program().functions.size() - 1),
+               args, &first.result)) {
+    std::exit(1);
+  }
+  first.loaded = image->materializedCount();
+  return first;
+}
+
+/** The median milliseconds `f` took, and what it returned the last time. */
+template <typename F>
+double time(const Config &config, F f, First &first) {
+  std::vector<double> ms;
+  for (uint32_t i{0}; i < config.repetitions; ++i) {
+    auto start{std::chrono::steady_clock::now()};
+    first = f();
+    std::chrono::duration<double, std::milli> took{
+        std::chrono::steady_clock::now() - start};
+    ms.push_back(took.count());
+  }
+  std::nth_element(ms.begin(), ms.begin() + ms.size() / 2, ms.end());
+  return ms[ms.size() / 2];
+}
+
+int usage(const char *argv0) {
+  std::fprintf(stderr, "USAGE: %s [--functions N] [--repetitions N]\n",
+               argv0);
+  return 1;
+}
+} // namespace
+
+int main(int argc, char **argv) {
+  Config config;
+  for (int i{1}; i < argc; ++i) {
+    std::string_view arg{argv[i]};
+    if (arg == "--functions" && i + 1 < argc) {
+      config.functions = static_cast<uint32_t>(std::atoi(argv[++i]));
+    } else if (arg == "--repetitions" && i + 1 < argc) {
+      config.repetitions = static_cast<uint32_t>(std::atoi(argv[++i]));
+    } else {
+      return usage(argv[0]);
+    }
+  }
+  if (config.functions == 0 || config.repetitions == 0) {
+    return usage(argv[0]);
+  }
+
+  std::string stem{"dew-startup-" + std::to_string(getpid())};
+  fs::path sourcePath{fs::temp_directory_path() / (stem + ".dew")};
+  fs::path imagePath{fs::temp_directory_path() / (stem + ".dewb")};
+  {
+    std::string text{generate(config)};
+    std::ofstream{sourcePath} << text;
+    DewParser parser{std::move(text)};
+    parser.parseSource();
+    auto program{DewCompiler{parser.astTree()}.compile(parser.getFunctions())};
+    std::ofstream image{imagePath, std::ios::binary};
+    if (!program || !ProgramImage::write(image, *program) || !image.flush()) {
+      std::fprintf(stderr, "the benchmark program couldn't be written\n");
+      return 1;
+    }
+  }
+
+  First source;
+  First image;
+  double sourceMs{time(config, [&] { return fromSource(sourcePath); }, source)};
+  double imageMs{time(config, [&] { return fromImage(imagePath); }, image)};
+  if (source.result != image.result) {
+    std::fprintf(stderr, "the first calls disagree, %lld and %lld\n",
+                 static_cast<long long>(source.result),
+                 static_cast<long long>(image.result));
+    return 1;
+  }
+
+  std::printf("%u functions, first call to f%u, median of %u\n",
+              config.functions, config.functions - 1, config.repetitions);
+  std::printf("%-8s %12s %18s %12s\n", "from", "file KB", "functions loaded",
+              "first call ms");
+  std::printf("%-8s %12.0f %18zu %12.2f\n", ".dew",
+              static_cast<double>(fs::file_size(sourcePath)) / 1024,
+              source.loaded, sourceMs);
+  std::printf("%-8s %12.0f %18zu %12.2f\n", ".dewb",
+              static_cast<double>(fs::file_size(imagePath)) / 1024,
+              image.loaded, imageMs);
+  std::printf("%-8s %12s %18s %11.1fx\n", "speedup", "", "",
+              sourceMs / imageMs);
+  fs::remove(sourcePath);
+  fs::remove(imagePath);
+}
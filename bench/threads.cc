@@ -0,0 +1,135 @@
+/**
+ * Copyright (C) 2024 Charles Ancheta
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ * \file threads.cc
+ *
+ * How `-j N` scales: a generated file parsed and compiled to bytecode on
+ * pools of 1, 2, 4 and 8 threads. Prints the best wall-clock time of each,
+ * its speedup over one thread and how many cores the machine has, since
+ * threads past that can only add overhead.
+ */
+#include "DewCompiler.h"
+#include "DewParser.h"
+#include "ThreadPool.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <thread>
+
+using namespace dew;
+
+namespace {
+constexpr unsigned THREADS[]{1, 2, 4, 8};
+
+/** Functions with loops and calls, `count` of them. */
+std::string generate(uint32_t count) {
+  std::string source;
+  for (uint32_t i{0}; i < count; ++i) {
+    std::string n{std::to_string(i)};
+    source += "fun f" + n + "(i32 n, i32 k) i32 {\n"
+              "  i32 a, b, i\n"
+              "  a = " + n + "\n"
+              "  b = (k + " + n + ") * 2 - -n\n"
+              "  for i = 0; i < n; i++ {\n"
+              "    if a >= b && i != 3 {\n"
+              "      a, b = b, a + b % 7\n"
+              "    } else {\n"
+              "      b--\n"
+              "    }\n"
+              "  }\n"
+              "  return f" + std::to_string(i / 2) + "(a, b << 1)\n"
+              "}\n";
+  }
+  return source;
+}
+
+/** The bytecode of every function, to check threads don't change it. */
+std::string listing(const bc::Program &program) {
+  std::ostringstream out;
+  for (const bc::Function &fn : program.functions) {
+    bc::dump(out, fn);
+  }
+  return out.str();
+}
+
+int usage(const char *argv0) {
+  std::fprintf(stderr, "USAGE: %s [--functions N] [--rounds N]\n", argv0);
+  return 1;
+}
+} // namespace
+
+int main(int argc, char **argv) {
+  uint32_t functions{20000};
+  uint32_t rounds{5};
+  for (int i{1}; i < argc; ++i) {
+    std::string_view arg{argv[i]};
+    if (arg == "--functions" && i + 1 < argc) {
+      functions = static_cast<uint32_t>(std::atoi(argv[++i]));
+    } else if (arg == "--rounds" && i + 1 < argc) {
+      rounds = static_cast<uint32_t>(std::atoi(argv[++i]));
+    } else {
+      return usage(argv[0]);
+    }
+  }
+  if (functions == 0 || rounds == 0) {
+    return usage(argv[0]);
+  }
+
+  std::string text{generate(functions)};
+  std::printf("%u functions, %.1f MB, %u cores, best of %u\n", functions,
+              text.size() / 1e6, std::thread::hardware_concurrency(), rounds);
+  std::printf("%-8s %10s %10s\n", "threads", "ms", "speedup");
+  std::string serial;
+  double base{0};
+  for (unsigned threads : THREADS) {
+    ThreadPool pool{threads};
+    double best{0};
+    for (uint32_t r{0}; r < rounds; ++r) {
+      auto start{std::chrono::steady_clock::now()};
+      DewParser parser{text};
+      parser.parseSource(pool);
+      auto program{
+          DewCompiler{parser.astTree()}.compile(parser.getFunctions(), pool)};
+      std::chrono::duration<double, std::milli> took{
+          std::chrono::steady_clock::now() - start};
+      if (!program) {
+        std::fprintf(stderr, "the generated program didn't compile\n");
+        return 1;
+      }
+      if (r == 0) {
+        std::string bytecode{listing(*program)};
+        if (serial.empty()) {
+          serial = std::move(bytecode);
+        } else if (bytecode != serial) {
+          std::fprintf(stderr, "%u threads compiled different bytecode\n",
+                       threads);
+          return 1;
+        }
+      }
+      if (r == 0 || took.count() < best) {
+        best = took.count();
+      }
+    }
+    if (threads == 1) {
+      base = best;
+    }
+    std::printf("%-8u %10.1f %9.2fx\n", threads, best, base / best);
+  }
+}
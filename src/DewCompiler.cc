@@ -0,0 +1,841 @@
+/**
+ * Copyright (C) 2024 Charles Ancheta
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ * \file DewCompiler.cc
+ */
+#include "DewCompiler.h"
+#include "report.h"
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+
+using namespace dew;
+
+using bc::IntKind;
+using bc::Op;
+
+constexpr uint16_t MAX_REGS{UINT16_MAX};
+
+static bool isComparison(ast::BinaryOp op) {
+  switch (op) {
+  case ast::BinaryOp::GT:
+  case ast::BinaryOp::LT:
+  case ast::BinaryOp::GTEq:
+  case ast::BinaryOp::LTEq:
+  case ast::BinaryOp::Eq:
+  case ast::BinaryOp::Neq:
+    return true;
+  default:
+    return false;
+  }
+}
+
+static Op arithmeticOp(ast::BinaryOp op) {
+  switch (op) {
+  case ast::BinaryOp::Add:
+    return Op::Add;
+  case ast::BinaryOp::Sub:
+    return Op::Sub;
+  case ast::BinaryOp::Mul:
+    return Op::Mul;
+  case ast::BinaryOp::Div:
+    return Op::Div;
+  case ast::BinaryOp::Mod:
+    return Op::Mod;
+  case ast::BinaryOp::ShiftLeft:
+    return Op::ShiftLeft;
+  case ast::BinaryOp::ShiftRight:
+    return Op::ShiftRight;
+  case ast::BinaryOp::BitAnd:
+    return Op::BitAnd;
+  case ast::BinaryOp::BitOr:
+    return Op::BitOr;
+  case ast::BinaryOp::BitXor:
+    return Op::BitXor;
+  case ast::BinaryOp::GT:
+    return Op::GT;
+  case ast::BinaryOp::LT:
+    return Op::LT;
+  case ast::BinaryOp::GTEq:
+    return Op::GTEq;
+  case ast::BinaryOp::LTEq:
+    return Op::LTEq;
+  case ast::BinaryOp::Eq:
+    return Op::Eq;
+  case ast::BinaryOp::Neq:
+    return Op::Neq;
+  default:
+    return Op::Nop;
+  }
+}
+
+/** The compare-and-branch taken when `op` is `when`. */
+static Op branchOp(ast::BinaryOp op, bool when) {
+  switch (op) {
+  case ast::BinaryOp::GT:
+    return when ? Op::JumpIfGT : Op::JumpIfLTEq;
+  case ast::BinaryOp::LT:
+    return when ? Op::JumpIfLT : Op::JumpIfGTEq;
+  case ast::BinaryOp::GTEq:
+    return when ? Op::JumpIfGTEq : Op::JumpIfLT;
+  case ast::BinaryOp::LTEq:
+    return when ? Op::JumpIfLTEq : Op::JumpIfGT;
+  case ast::BinaryOp::Eq:
+    return when ? Op::JumpIfEq : Op::JumpIfNeq;
+  case ast::BinaryOp::Neq:
+    return when ? Op::JumpIfNeq : Op::JumpIfEq;
+  default:
+    return Op::Nop;
+  }
+}
+
+DewCompiler::DewCompiler(const ast::Tree &tree)
+    : tree{tree}, decl{nullptr}, out{nullptr}, top{0}, terminated{false},
+      failed{false}, diagnostics{nullptr} {}
+
+std::optional<bc::Program>
+DewCompiler::compile(const std::vector<ast::Function> &functions) {
+  bc::Program program;
+  program.functions.resize(functions.size());
+  declare(functions);
+  bool ok{true};
+  for (std::size_t i{0}; i < functions.size(); ++i) {
+    ok = compileFunction(functions[i], program.functions[i]) && ok;
+  }
+  if (!ok) {
+    return std::nullopt;
+  }
+  return program;
+}
+
+std::optional<bc::Program>
+DewCompiler::compile(const std::vector<ast::Function> &functions,
+                     ThreadPool &pool) {
+  if (pool.size() == 1) {
+    return compile(functions);
+  }
+  bc::Program program;
+  program.functions.resize(functions.size());
+  declare(functions);
+  std::vector<DewCompiler> workers(pool.size(), *this);
+  std::atomic<bool> ok{true};
+  pool.run(functions.size(), [&](unsigned worker, std::size_t i) {
+    if (!workers[worker].compileFunction(functions[i],
+                                         program.functions[i])) {
+      ok = false;
+    }
+  });
+  if (!ok) {
+    return std::nullopt;
+  }
+  return program;
+}
+
+bool DewCompiler::recompile(const std::vector<ast::Function> &functions,
+                            uint32_t index, bc::Function &out) {
+  if (decls.size() != functions.size()) {
+    declare(functions);
+  }
+  out = bc::Function{};
+  return compileFunction(functions[index], out);
+}
+
+void DewCompiler::declare(const std::vector<ast::Function> &functions) {
+  functionIndex.clear();
+  decls.clear();
+  for (uint32_t i{0}; i < functions.size(); ++i) {
+    // Calls go to the first of several functions with the same name.
+    if (!functionIndex.resolve(functions[i].decl->symbol)) {
+      functionIndex.define(functions[i].decl->symbol, i);
+    }
+    decls.push_back(functions[i].decl);
+  }
+}
+
+bool DewCompiler::compileFunction(const ast::Function &fn, bc::Function &f) {
+  Report::Function timer{fn.decl->name};
+  decl = fn.decl;
+  out = &f;
+  locals.clear();
+  top = 0;
+  terminated = false;
+  failed = false;
+
+  f.name = std::string{decl->name};
+  f.numParams = static_cast<uint16_t>(decl->params.size());
+  f.numResults = static_cast<uint16_t>(decl->returnValues.size());
+  f.numRegs = 0;
+  for (const TypeId type : decl->returnValues) {
+    kindOf(type);
+  }
+  for (const auto &param : decl->params) {
+    auto kind{kindOf(param.type).value_or(IntKind::I32)};
+    f.paramKinds.push_back(kind);
+    locals.define(param.symbol, Local{param.symbol, alloc(), kind});
+  }
+
+  block(fn.block);
+
+  if (!terminated) {
+    // Falling off the end returns zeroes.
+    uint16_t base{alloc(f.numResults)};
+    for (uint16_t i{0}; i < f.numResults; ++i) {
+      emit(Op::LoadInt, IntKind::I32, base + i);
+    }
+    emit(Op::Return, IntKind::I32, base, f.numResults);
+  }
+  return !failed;
+}
+
+void DewCompiler::block(ast::Block b) {
+  if (!b) {
+    return;
+  }
+  std::size_t scope{locals.mark()};
+  uint16_t mark{top};
+  for (const ast::Stmt s : tree.list(tree.block(b).statements)) {
+    if (terminated) {
+      // Everything after a return is unreachable.
+      break;
+    }
+    stmt(s);
+  }
+  locals.leave(scope);
+  top = mark;
+}
+
+void DewCompiler::stmt(ast::Stmt s) {
+  if (!s) {
+    return;
+  }
+  uint16_t mark{top};
+  switch (s.kind()) {
+  case ast::StmtKind::Var:
+    varDeclaration(tree.var(s));
+    // The new locals stay allocated until the end of the enclosing block.
+    return;
+  case ast::StmtKind::Expression: {
+    ast::Expr e{tree.expression(s).expr};
+    if (e && e.kind() == ast::ExprKind::Call) {
+      if (!print(tree.call(e))) {
+        callResults(tree.call(e));
+      }
+    } else if (e) {
+      expr(e, naturalKind(e).value_or(IntKind::I32));
+    }
+    break;
+  }
+  case ast::StmtKind::Increment:
+  case ast::StmtKind::Decrement: {
+    bool inc{s.kind() == ast::StmtKind::Increment};
+    const Local *local{
+        lvalue(inc ? tree.increment(s).expr : tree.decrement(s).expr)};
+    if (local) {
+      emit(Op::AddInt, local->kind, local->reg, local->reg,
+           static_cast<uint16_t>(inc ? 1 : -1));
+    }
+    break;
+  }
+  case ast::StmtKind::Assignment:
+    assignment(tree.assignment(s));
+    break;
+  case ast::StmtKind::For:
+    forStmt(tree.forStmt(s));
+    break;
+  case ast::StmtKind::Return:
+    returnStmt(tree.returnStmt(s));
+    break;
+  case ast::StmtKind::Block:
+    block(s);
+    break;
+  case ast::StmtKind::If:
+    ifStmt(tree.ifStmt(s));
+    break;
+  }
+  top = mark;
+}
+
+void DewCompiler::varDeclaration(const ast::VarDeclaration &var) {
+  IntKind kind{kindOf(var.type).value_or(IntKind::I32)};
+  auto names{tree.list(var.names)};
+  auto values{tree.list(var.values)};
+  uint16_t base{alloc(static_cast<uint16_t>(names.size()))};
+  if (values.size() == 1 && names.size() > 1 &&
+      values[0].kind() == ast::ExprKind::Call) {
+    auto results{callResults(tree.call(values[0]))};
+    for (uint16_t i{0}; results && i < names.size(); ++i) {
+      emit(Op::Cast, kind, base + i, *results + i);
+    }
+  } else if (values.empty()) {
+    for (uint16_t i{0}; i < names.size(); ++i) {
+      emit(Op::LoadInt, kind, base + i);
+    }
+  } else if (values.size() == names.size()) {
+    // The new names aren't in scope yet, so the values can be computed
+    // straight into their registers.
+    for (uint16_t i{0}; i < names.size(); ++i) {
+      uint16_t mark{top};
+      exprTo(values[i], base + i, kind);
+      top = mark;
+    }
+  } else {
+    error("wrong number of values in declaration");
+  }
+  for (uint16_t i{0}; i < names.size(); ++i) {
+    Symbol symbol{tree.identifier(names[i]).symbol};
+    locals.define(symbol,
+                  Local{symbol, static_cast<uint16_t>(base + i), kind});
+  }
+}
+
+void DewCompiler::assignment(const ast::AssignmentStatement &assign) {
+  auto left{tree.list(assign.left)};
+  auto right{tree.list(assign.right)};
+  std::vector<const Local *> targets;
+  for (const ast::Expr e : left) {
+    targets.push_back(lvalue(e));
+  }
+  if (std::find(targets.begin(), targets.end(), nullptr) != targets.end()) {
+    return;
+  }
+
+  if (right.size() == 1 && left.size() > 1 &&
+      right[0].kind() == ast::ExprKind::Call) {
+    auto results{callResults(tree.call(right[0]))};
+    for (uint16_t i{0}; results && i < targets.size(); ++i) {
+      emit(Op::Cast, targets[i]->kind, targets[i]->reg, *results + i);
+    }
+    return;
+  } else if (right.size() != left.size()) {
+    error("wrong number of values in assignment");
+    return;
+  }
+
+  // Every value is computed before any target changes. A value can go
+  // straight into its target unless a later value still reads the target.
+  std::vector<std::pair<const Local *, uint16_t>> deferred;
+  for (std::size_t i{0}; i < right.size(); ++i) {
+    const Local *target{targets[i]};
+    bool readLater{false};
+    for (std::size_t j{i + 1}; j < right.size() && !readLater; ++j) {
+      readLater = reads(right[j], target->symbol);
+    }
+    if (readLater) {
+      uint16_t tmp{alloc()};
+      exprTo(right[i], tmp, target->kind);
+      deferred.emplace_back(target, tmp);
+    } else {
+      exprTo(right[i], target->reg, target->kind);
+    }
+  }
+  for (const auto &[target, tmp] : deferred) {
+    emit(Op::Move, target->kind, target->reg, tmp);
+  }
+}
+
+void DewCompiler::forStmt(const ast::ForStatement &loop) {
+  std::size_t scope{locals.mark()};
+  uint16_t mark{top};
+  stmt(loop.initial);
+
+  // The condition is tested at the bottom so each iteration only takes one
+  // branch.
+  Patches toCondition;
+  if (loop.condition) {
+    toCondition.push_back(emitJump(Op::Jump));
+  }
+  auto bodyStart{static_cast<uint32_t>(out->code.size())};
+  block(loop.body);
+  terminated = false;
+  stmt(loop.update);
+  patch(toCondition);
+  if (loop.condition) {
+    Patches toBody;
+    branch(loop.condition, true, toBody);
+    for (const std::size_t at : toBody) {
+      out->code[at].setImm(bodyStart);
+    }
+  } else {
+    out->code[emitJump(Op::Jump)].setImm(bodyStart);
+  }
+
+  locals.leave(scope);
+  top = mark;
+}
+
+void DewCompiler::ifStmt(const ast::IfStatement &node) {
+  Patches toElse;
+  branch(node.condition, false, toElse);
+  block(node.consequence);
+  bool thenTerminated{terminated};
+  terminated = false;
+  if (!node.alternative) {
+    patch(toElse);
+    return;
+  }
+  Patches toEnd;
+  if (!thenTerminated) {
+    toEnd.push_back(emitJump(Op::Jump));
+  }
+  patch(toElse);
+  stmt(node.alternative);
+  patch(toEnd);
+  terminated = thenTerminated && terminated;
+}
+
+void DewCompiler::returnStmt(const ast::ReturnStatement &ret) {
+  auto values{tree.list(ret.values)};
+  terminated = true;
+  if (values.size() != decl->returnValues.size()) {
+    error("wrong number of return values");
+    return;
+  }
+  if (values.size() == 1 && tailCall(values[0])) {
+    return;
+  }
+  if (values.size() == 1) {
+    IntKind kind{kindOf(decl->returnValues[0]).value_or(IntKind::I32)};
+    emit(Op::Return, kind, expr(values[0], kind), 1);
+    return;
+  }
+  uint16_t base{alloc(static_cast<uint16_t>(values.size()))};
+  for (uint16_t i{0}; i < values.size(); ++i) {
+    uint16_t mark{top};
+    exprTo(values[i], base + i,
+           kindOf(decl->returnValues[i]).value_or(IntKind::I32));
+    top = mark;
+  }
+  emit(Op::Return, IntKind::I32, base, static_cast<uint16_t>(values.size()));
+}
+
+uint16_t DewCompiler::expr(ast::Expr e, IntKind kind) {
+  if (e && e.kind() == ast::ExprKind::Identifier) {
+    const Local *local{resolve(tree.identifier(e).symbol)};
+    if (local && local->kind == kind) {
+      return local->reg;
+    }
+  }
+  uint16_t dst{alloc()};
+  exprTo(e, dst, kind);
+  return dst;
+}
+
+void DewCompiler::exprTo(ast::Expr e, uint16_t dst, IntKind kind) {
+  if (!e) {
+    error("invalid expression");
+    return;
+  }
+  switch (e.kind()) {
+  case ast::ExprKind::Binary: {
+    ast::BinaryOp op{tree.binary(e).op};
+    if (op == ast::BinaryOp::And || op == ast::BinaryOp::Or) {
+      logicalTo(e, dst, kind);
+    } else {
+      binaryTo(tree.binary(e), dst, kind);
+    }
+    break;
+  }
+  case ast::ExprKind::Unary:
+    unaryTo(tree.unary(e), dst, kind);
+    break;
+  case ast::ExprKind::Identifier: {
+    const ast::Identifier &id{tree.identifier(e)};
+    const Local *local{resolve(id.symbol)};
+    if (!local) {
+      error("undefined variable `" + std::string{id.name} + "`", id.name);
+    } else if (local->kind != kind) {
+      emit(Op::Cast, kind, dst, local->reg);
+    } else if (local->reg != dst) {
+      emit(Op::Move, kind, dst, local->reg);
+    }
+    break;
+  }
+  case ast::ExprKind::Integer: {
+    uint64_t num{tree.integer(e).num};
+    if (!bc::fits(kind, num)) {
+      error("integer literal " + std::to_string(num) + " doesn't fit in " +
+            bc::kindName(kind));
+    }
+    loadInt(dst, kind, num);
+    break;
+  }
+  case ast::ExprKind::Call:
+    callTo(tree.call(e), dst, kind);
+    break;
+  }
+}
+
+void DewCompiler::binaryTo(const ast::BinaryExpression &bin, uint16_t dst,
+                           IntKind kind) {
+  uint16_t mark{top};
+  if (isComparison(bin.op)) {
+    // Comparisons yield 0 or 1, which fits any kind.
+    IntKind operands{
+        naturalKind(bin.left).value_or(naturalKind(bin.right).value_or(kind))};
+    uint16_t l{expr(bin.left, operands)};
+    uint16_t r{expr(bin.right, operands)};
+    emit(arithmeticOp(bin.op), operands, dst, l, r);
+    top = mark;
+    return;
+  }
+
+  IntKind operands{naturalKind(bin.left).value_or(
+      naturalKind(bin.right).value_or(kind))};
+  bool addSub{bin.op == ast::BinaryOp::Add || bin.op == ast::BinaryOp::Sub};
+  if (addSub && bin.right.kind() == ast::ExprKind::Integer &&
+      bc::fits(operands, tree.integer(bin.right).num)) {
+    auto num{static_cast<int64_t>(tree.integer(bin.right).num)};
+    if (bin.op == ast::BinaryOp::Sub) {
+      num = -num;
+    }
+    if (num >= INT16_MIN && num <= INT16_MAX) {
+      uint16_t l{expr(bin.left, operands)};
+      emit(Op::AddInt, operands, dst, l, static_cast<uint16_t>(num));
+      if (operands != kind) {
+        emit(Op::Cast, kind, dst, dst);
+      }
+      top = mark;
+      return;
+    }
+  }
+  uint16_t l{expr(bin.left, operands)};
+  uint16_t r{expr(bin.right, operands)};
+  emit(arithmeticOp(bin.op), operands, dst, l, r);
+  if (operands != kind) {
+    emit(Op::Cast, kind, dst, dst);
+  }
+  top = mark;
+}
+
+void DewCompiler::logicalTo(ast::Expr e, uint16_t dst, IntKind kind) {
+  // dst only changes once the outcome is known, so it may be an operand.
+  Patches toFalse;
+  branch(e, false, toFalse);
+  emit(Op::LoadInt, kind, dst, 1);
+  Patches toEnd{emitJump(Op::Jump)};
+  patch(toFalse);
+  emit(Op::LoadInt, kind, dst, 0);
+  patch(toEnd);
+}
+
+void DewCompiler::unaryTo(const ast::UnaryExpression &un, uint16_t dst,
+                          IntKind kind) {
+  uint16_t mark{top};
+  switch (un.op) {
+  case ast::UnaryOp::Pos:
+    exprTo(un.operand, dst, kind);
+    break;
+  case ast::UnaryOp::Neg:
+    emit(Op::Neg, kind, dst, expr(un.operand, kind));
+    break;
+  case ast::UnaryOp::BitNot:
+    emit(Op::BitNot, kind, dst, expr(un.operand, kind));
+    break;
+  case ast::UnaryOp::Not: {
+    IntKind operand{naturalKind(un.operand).value_or(kind)};
+    emit(Op::Not, kind, dst, expr(un.operand, operand));
+    break;
+  }
+  case ast::UnaryOp::Deref:
+  case ast::UnaryOp::Ref:
+    error("pointers are not supported");
+    break;
+  }
+  top = mark;
+}
+
+void DewCompiler::callTo(const ast::CallExpression &call, uint16_t dst,
+                         IntKind kind) {
+  if (print(call)) {
+    emit(Op::LoadInt, kind, dst);
+    return;
+  }
+  uint16_t mark{top};
+  auto results{callResults(call, dst)};
+  auto index{function(call.function)};
+  if (!results) {
+    top = mark;
+    return;
+  }
+  const FunctionDeclaration *callee{decls[*index]};
+  std::optional<IntKind> result{
+      callee->returnValues.empty() ? std::nullopt
+                                   : bc::intKind(callee->returnValues[0])};
+  if (result != kind) {
+    emit(Op::Cast, kind, dst, *results);
+  } else if (*results != dst) {
+    emit(Op::Move, kind, dst, *results);
+  }
+  top = mark;
+}
+
+bool DewCompiler::tailCall(ast::Expr e) {
+  if (!e || e.kind() != ast::ExprKind::Call) {
+    return false;
+  }
+  const ast::CallExpression &call{tree.call(e)};
+  auto args{tree.list(call.arguments)};
+  auto index{function(call.function)};
+  if (!index) {
+    return false;
+  }
+  const FunctionDeclaration *callee{decls[*index]};
+  // Anything else is left for callResults to compile or report.
+  if (args.size() != callee->params.size() ||
+      !std::equal(callee->returnValues.begin(), callee->returnValues.end(),
+                  decl->returnValues.begin(), decl->returnValues.end())) {
+    return false;
+  }
+  uint16_t mark{top};
+  uint16_t base{alloc(static_cast<uint16_t>(args.size()))};
+  for (uint16_t i{0}; i < args.size(); ++i) {
+    uint16_t argMark{top};
+    exprTo(args[i], base + i,
+           kindOf(callee->params[i].type).value_or(IntKind::I32));
+    top = argMark;
+  }
+  if (callee == decl) {
+    // Self recursion becomes a loop: the parameters are the first
+    // registers, and every argument is computed before any is replaced.
+    for (uint16_t i{0}; i < args.size(); ++i) {
+      emit(Op::Move, out->paramKinds[i], i, base + i);
+    }
+    out->code[emitJump(Op::Jump)].setImm(0);
+  } else {
+    emit(Op::TailCall, IntKind::I32, 0, static_cast<uint16_t>(*index), base);
+  }
+  top = mark;
+  return true;
+}
+
+bool DewCompiler::print(const ast::CallExpression &call) {
+  if (function(call.function) ||
+      call.function.kind() != ast::ExprKind::Identifier ||
+      tree.identifier(call.function).name != "print") {
+    return false;
+  }
+  uint16_t mark{top};
+  for (const ast::Expr arg : tree.list(call.arguments)) {
+    emit(Op::Print, IntKind::I32,
+         expr(arg, naturalKind(arg).value_or(IntKind::I32)));
+  }
+  top = mark;
+  return true;
+}
+
+std::optional<uint16_t>
+DewCompiler::callResults(const ast::CallExpression &call,
+                         std::optional<uint16_t> at) {
+  auto args{tree.list(call.arguments)};
+  auto index{function(call.function)};
+  if (!index) {
+    error("call to undefined function", nameOf(call.function));
+    return std::nullopt;
+  }
+
+  const FunctionDeclaration *callee{decls[*index]};
+  if (args.size() != callee->params.size()) {
+    error("wrong number of arguments to `" + std::string{callee->name} + "`",
+          nameOf(call.function));
+    return std::nullopt;
+  }
+  // Arguments are gathered in consecutive registers and the results come
+  // back in the same window.
+  auto window{static_cast<uint16_t>(
+      std::max(args.size(), std::max<std::size_t>(
+                                callee->returnValues.size(), 1)))};
+  // If the destination is the newest register and only holds a temporary,
+  // the window can start there and save a move.
+  bool reuse{at && *at + 1 == top &&
+             std::none_of(locals.all().begin(), locals.all().end(),
+                          [&](const auto &l) { return l.value.reg == *at; })};
+  uint16_t base{reuse ? *at : alloc(1)};
+  alloc(window - 1);
+  for (uint16_t i{0}; i < args.size(); ++i) {
+    uint16_t mark{top};
+    exprTo(args[i], base + i,
+           kindOf(callee->params[i].type).value_or(IntKind::I32));
+    top = mark;
+  }
+  emit(Op::Call, IntKind::I32, base, static_cast<uint16_t>(*index), base);
+  return base;
+}
+
+void DewCompiler::branch(ast::Expr cond, bool when, Patches &patches) {
+  uint16_t mark{top};
+  if (cond && cond.kind() == ast::ExprKind::Binary) {
+    const ast::BinaryExpression &bin{tree.binary(cond)};
+    if (isComparison(bin.op)) {
+      IntKind operands{naturalKind(bin.left).value_or(
+          naturalKind(bin.right).value_or(IntKind::I32))};
+      uint16_t l{expr(bin.left, operands)};
+      uint16_t r{expr(bin.right, operands)};
+      emit(branchOp(bin.op, when), operands, l, r);
+      patches.push_back(emitJump(Op::Nop));
+      top = mark;
+      return;
+    }
+    bool isAnd{bin.op == ast::BinaryOp::And};
+    if (isAnd || bin.op == ast::BinaryOp::Or) {
+      // Branch on `a && b` being false (or `a || b` being true) as soon as
+      // the left side decides it; otherwise the right side decides.
+      if (isAnd != when) {
+        branch(bin.left, when, patches);
+        branch(bin.right, when, patches);
+      } else {
+        Patches skip;
+        branch(bin.left, !when, skip);
+        branch(bin.right, when, patches);
+        patch(skip);
+      }
+      return;
+    }
+  } else if (cond && cond.kind() == ast::ExprKind::Unary &&
+             tree.unary(cond).op == ast::UnaryOp::Not) {
+    branch(tree.unary(cond).operand, !when, patches);
+    return;
+  }
+  uint16_t r{expr(cond, naturalKind(cond).value_or(IntKind::I32))};
+  patches.push_back(emitJump(when ? Op::JumpIfNotZero : Op::JumpIfZero, r));
+  top = mark;
+}
+
+std::optional<IntKind> DewCompiler::naturalKind(ast::Expr e) const {
+  return bc::intKind(tree.type(e));
+}
+
+bool DewCompiler::reads(ast::Expr e, Symbol symbol) const {
+  if (!e) {
+    return false;
+  }
+  switch (e.kind()) {
+  case ast::ExprKind::Binary:
+    return reads(tree.binary(e).left, symbol) ||
+           reads(tree.binary(e).right, symbol);
+  case ast::ExprKind::Unary:
+    return reads(tree.unary(e).operand, symbol);
+  case ast::ExprKind::Identifier:
+    return tree.identifier(e).symbol == symbol;
+  case ast::ExprKind::Integer:
+    return false;
+  case ast::ExprKind::Call:
+    for (const ast::Expr arg : tree.list(tree.call(e).arguments)) {
+      if (reads(arg, symbol)) {
+        return true;
+      }
+    }
+    return false;
+  }
+  return false;
+}
+
+const DewCompiler::Local *DewCompiler::resolve(Symbol symbol) const {
+  return locals.resolve(symbol);
+}
+
+const DewCompiler::Local *DewCompiler::lvalue(ast::Expr e) {
+  if (!e || e.kind() != ast::ExprKind::Identifier) {
+    error("can only assign to variables");
+    return nullptr;
+  }
+  const ast::Identifier &id{tree.identifier(e)};
+  const Local *local{resolve(id.symbol)};
+  if (!local) {
+    error("undefined variable `" + std::string{id.name} + "`", id.name);
+  }
+  return local;
+}
+
+std::optional<uint32_t> DewCompiler::function(ast::Expr callee) const {
+  if (!callee || callee.kind() != ast::ExprKind::Identifier) {
+    return std::nullopt;
+  }
+  const uint32_t *index{functionIndex.resolve(tree.identifier(callee).symbol)};
+  if (!index) {
+    return std::nullopt;
+  }
+  return *index;
+}
+
+std::optional<IntKind> DewCompiler::kindOf(TypeId type) {
+  auto kind{bc::intKind(type)};
+  if (!kind) {
+    error("unknown type");
+  }
+  return kind;
+}
+
+uint16_t DewCompiler::alloc(uint16_t count) {
+  if (top > MAX_REGS - count) {
+    error("function needs too many registers");
+    return 0;
+  }
+  uint16_t reg{top};
+  top += count;
+  out->numRegs = std::max(out->numRegs, top);
+  return reg;
+}
+
+void DewCompiler::loadInt(uint16_t dst, IntKind kind, uint64_t num) {
+  int64_t value{bc::wrap(kind, static_cast<int64_t>(num))};
+  if (value >= INT32_MIN && value <= INT32_MAX) {
+    out->code[emit(Op::LoadInt, kind, dst)].setImm(
+        static_cast<uint32_t>(value));
+  } else {
+    auto index{static_cast<uint32_t>(out->constants.size())};
+    out->constants.push_back(value);
+    out->code[emit(Op::LoadConst, kind, dst)].setImm(index);
+  }
+}
+
+std::size_t DewCompiler::emit(Op op, IntKind kind, uint16_t a, uint16_t b,
+                              uint16_t c) {
+  out->code.push_back(bc::Instr{op, kind, a, b, c});
+  return out->code.size() - 1;
+}
+
+std::size_t DewCompiler::emitJump(Op op, uint16_t a) {
+  return emit(op, IntKind::I32, a);
+}
+
+void DewCompiler::patch(const Patches &patches) {
+  auto target{static_cast<uint32_t>(out->code.size())};
+  for (const std::size_t at : patches) {
+    out->code[at].setImm(target);
+  }
+}
+
+void DewCompiler::collectErrors(std::vector<Diagnostic> *sink) {
+  diagnostics = sink;
+}
+
+void DewCompiler::error(std::string_view message, std::string_view at) {
+  failed = true;
+  if (diagnostics) {
+    diagnostics->push_back(
+        Diagnostic{at.empty() ? decl->name : at, std::string{message}});
+    return;
+  }
+  std::cerr << decl->name << ": " << message << "\n";
+}
+
+std::string_view DewCompiler::nameOf(ast::Expr e) const {
+  if (!e || e.kind() != ast::ExprKind::Identifier) {
+    return {};
+  }
+  return tree.identifier(e).name;
+}
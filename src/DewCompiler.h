@@ -0,0 +1,144 @@
+/**
+ * Copyright (C) 2024 Charles Ancheta
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ * \file DewCompiler.h
+ */
+#ifndef DEW_COMPILER_H_
+#define DEW_COMPILER_H_
+
+#include "ThreadPool.h"
+#include "ast.h"
+#include "bytecode.h"
+#include "symbols.h"
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace dew {
+/** An error in a function, for callers that show errors themselves. */
+struct Diagnostic {
+  /** The text the error is about, out of the text the AST was built from. */
+  std::string_view at;
+  std::string message;
+};
+
+/**
+ * Lowers the functions of a compilation unit to register bytecode.
+ *
+ * Registers are handed out like a stack: parameters first, then locals in
+ * declaration order, with expression temporaries above them being released
+ * at the end of every statement.
+ */
+class DewCompiler {
+public:
+  DewCompiler(const ast::Tree &tree);
+  /** Errors are reported on std::cerr. */
+  std::optional<bc::Program>
+  compile(const std::vector<ast::Function> &functions);
+  /** Compiles on `pool`, with a copy of this compiler for each worker. */
+  std::optional<bc::Program>
+  compile(const std::vector<ast::Function> &functions, ThreadPool &pool);
+  /**
+   * Compiles `functions[index]` alone into `out`, for callers that keep the
+   * rest of a program from before and know the declarations are unchanged.
+   */
+  bool recompile(const std::vector<ast::Function> &functions, uint32_t index,
+                 bc::Function &out);
+  /**
+   * Collects errors into `sink` rather than reporting them on std::cerr, or
+   * goes back to std::cerr if it's null. Not for compiling on a pool.
+   */
+  void collectErrors(std::vector<Diagnostic> *sink);
+
+private:
+  struct Local {
+    Symbol symbol;
+    uint16_t reg;
+    bc::IntKind kind;
+  };
+  using Patches = std::vector<std::size_t>;
+
+  void declare(const std::vector<ast::Function> &functions);
+  bool compileFunction(const ast::Function &fn, bc::Function &out);
+
+  void stmt(ast::Stmt s);
+  void block(ast::Block b);
+  void varDeclaration(const ast::VarDeclaration &var);
+  void assignment(const ast::AssignmentStatement &assign);
+  void forStmt(const ast::ForStatement &loop);
+  void ifStmt(const ast::IfStatement &node);
+  void returnStmt(const ast::ReturnStatement &ret);
+
+  uint16_t expr(ast::Expr e, bc::IntKind kind);
+  void exprTo(ast::Expr e, uint16_t dst, bc::IntKind kind);
+  void binaryTo(const ast::BinaryExpression &bin, uint16_t dst,
+                bc::IntKind kind);
+  void logicalTo(ast::Expr e, uint16_t dst, bc::IntKind kind);
+  void unaryTo(const ast::UnaryExpression &un, uint16_t dst, bc::IntKind kind);
+  void callTo(const ast::CallExpression &call, uint16_t dst, bc::IntKind kind);
+  /**
+   * Calls `call` leaving its results in a window of registers, starting at
+   * `at` if that's free to grow.
+   */
+  std::optional<uint16_t>
+  callResults(const ast::CallExpression &call,
+              std::optional<uint16_t> at = std::nullopt);
+  /**
+   * Compiles `return e` as a tail call if `e` calls a function with the same
+   * results as this one: a jump back to the start if it's this function,
+   * a TailCall otherwise. Returns false, having emitted nothing, if not.
+   */
+  bool tailCall(ast::Expr e);
+  /** Handles the `print` builtin, returning false for any other call. */
+  bool print(const ast::CallExpression &call);
+  void branch(ast::Expr cond, bool when, Patches &patches);
+  /** The kind the TypeChecker found `e` has of its own, if any. */
+  std::optional<bc::IntKind> naturalKind(ast::Expr e) const;
+  bool reads(ast::Expr e, Symbol symbol) const;
+
+  const Local *resolve(Symbol symbol) const;
+  const Local *lvalue(ast::Expr e);
+  std::optional<uint32_t> function(ast::Expr callee) const;
+  std::optional<bc::IntKind> kindOf(TypeId type);
+
+  uint16_t alloc(uint16_t count = 1);
+  void loadInt(uint16_t dst, bc::IntKind kind, uint64_t num);
+  std::size_t emit(bc::Op op, bc::IntKind kind, uint16_t a, uint16_t b = 0,
+                   uint16_t c = 0);
+  std::size_t emitJump(bc::Op op, uint16_t a = 0);
+  void patch(const Patches &patches);
+  /** Reports `message` about `at`, or about the function if it's empty. */
+  void error(std::string_view message, std::string_view at = {});
+  /** The name `e` is, if it's an identifier. */
+  std::string_view nameOf(ast::Expr e) const;
+
+  const ast::Tree &tree;
+  ScopeTable<uint32_t> functionIndex;
+  std::vector<const FunctionDeclaration *> decls;
+
+  // State for the function being compiled.
+  const FunctionDeclaration *decl;
+  bc::Function *out;
+  ScopeTable<Local> locals;
+  uint16_t top;
+  bool terminated;
+  bool failed;
+  std::vector<Diagnostic> *diagnostics;
+};
+} // namespace dew
+#endif // !DEW_COMPILER_H_
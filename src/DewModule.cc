@@ -0,0 +1,100 @@
+/**
+ * Copyright (C) 2024 Charles Ancheta
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ * \file DewModule.cc
+ */
+#include "DewModule.h"
+#include "DewCompiler.h"
+#include "DewParser.h"
+#include "IRBuilder.h"
+#include "irlower.h"
+#include "passes.h"
+
+using namespace dew;
+
+DewModule::DewModule(bc::Program program, std::vector<Function> signatures)
+    : bytecode{std::make_unique<const bc::Program>(std::move(program))},
+      signatures{std::move(signatures)} {}
+
+std::optional<DewModule> DewModule::compile(std::string source,
+                                            bool optimize) {
+  DewParser p{std::move(source)};
+  p.parseSource();
+  const std::vector<ast::Function> &functions{p.getFunctions()};
+  std::optional<bc::Program> program;
+  if (!optimize) {
+    program = DewCompiler{p.astTree()}.compile(functions);
+  } else if (auto module{IRBuilder{p.astTree()}.build(functions)}) {
+    ir::PassManager::standard().run(*module);
+    program = ir::lower(*module);
+  }
+  if (!program) {
+    return std::nullopt;
+  }
+
+  // The declarations go with the parser; keep what calls need of them.
+  std::vector<Function> signatures;
+  for (uint32_t i{0}; i < functions.size(); ++i) {
+    const FunctionDeclaration &decl{*functions[i].decl};
+    Function &fn{signatures.emplace_back()};
+    fn.index = i;
+    fn.name = decl.name;
+    for (const ast::Parameter &param : decl.params) {
+      fn.params.push_back(param.type);
+    }
+    fn.results.assign(decl.returnValues.begin(), decl.returnValues.end());
+  }
+  return DewModule{std::move(*program), std::move(signatures)};
+}
+
+const DewModule::Function *DewModule::find(std::string_view name) const {
+  auto index{bytecode->find(name)};
+  return index ? &signatures[*index] : nullptr;
+}
+
+DewCaller::DewCaller(const DewModule &module)
+    : vm{module.program()} {}
+
+void DewCaller::enableJit(uint32_t threshold) { vm.enableJit(threshold); }
+
+bool DewCaller::call(const DewModule::Function &fn, const int64_t *args,
+                     int64_t *results) {
+  refused.clear();
+  return vm.call(fn.index, args, results);
+}
+
+std::optional<int64_t> DewCaller::call(const DewModule::Function &fn,
+                                       std::initializer_list<int64_t> args) {
+  if (fn.results.size() > 1) {
+    refused = fn.name + " returns more than one value";
+    return std::nullopt;
+  }
+  if (args.size() != fn.params.size()) {
+    refused = fn.name + ": expected " + std::to_string(fn.params.size()) +
+              " arguments, got " + std::to_string(args.size());
+    return std::nullopt;
+  }
+  int64_t result{0};
+  if (!call(fn, args.begin(), &result)) {
+    return std::nullopt;
+  }
+  return result;
+}
+
+const std::string &DewCaller::error() const {
+  return refused.empty() ? vm.error() : refused;
+}
@@ -0,0 +1,115 @@
+/**
+ * Copyright (C) 2024 Charles Ancheta
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ * \file DewModule.h
+ */
+#ifndef DEW_MODULE_H_
+#define DEW_MODULE_H_
+
+#include "DewVM.h"
+#include "bytecode.h"
+#include "type.h"
+#include <cstdint>
+#include <initializer_list>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace dew {
+/**
+ * A program compiled once, for embedding Dew in a C++ host. A module never
+ * changes after it's compiled, so any number of threads can look up its
+ * functions and call them at the same time, each through a DewCaller of
+ * its own.
+ *
+ * ```
+ * auto module{DewModule::compile(source)};
+ * const DewModule::Function *add{module->find("add")};
+ * DewCaller caller{*module};
+ * std::optional<int64_t> sum{caller.call(*add, {1, 2})};
+ * ```
+ */
+class DewModule {
+public:
+  /** A function of the module and its signature, as declared. */
+  struct Function {
+    uint32_t index;
+    std::string name;
+    std::vector<TypeId> params;
+    std::vector<TypeId> results;
+  };
+
+  /**
+   * Compiles `source`, through the IR passes if `optimize`. Errors are
+   * reported on std::cerr.
+   */
+  static std::optional<DewModule> compile(std::string source,
+                                          bool optimize = false);
+
+  /** The function called `name`, if any; it lives as long as the module. */
+  const Function *find(std::string_view name) const;
+  const std::vector<Function> &functions() const { return signatures; }
+  const bc::Program &program() const { return *bytecode; }
+
+private:
+  DewModule(bc::Program program, std::vector<Function> signatures);
+
+  /** On the heap, so callers' references survive the module moving. */
+  std::unique_ptr<const bc::Program> bytecode;
+  std::vector<Function> signatures;
+};
+
+/**
+ * What calls into a module run on from one thread: a VM's registers and
+ * frames, and its JIT if enabled. Calls through it take no locks and don't
+ * allocate, so a host keeps one per thread, for as long as the thread
+ * makes calls. The module has to outlive it.
+ */
+class DewCaller {
+public:
+  DewCaller(const DewModule &module);
+  /**
+   * Compiles this caller's hot functions to machine code. Each caller
+   * compiles its own.
+   */
+  void enableJit(uint32_t threshold = DewVM::JIT_THRESHOLD);
+
+  /**
+   * Calls `fn` with one argument per parameter, storing one value per
+   * result in `results`. Arguments are wrapped to their parameters' types.
+   * Returns false and sets error() if the program traps.
+   */
+  bool call(const DewModule::Function &fn, const int64_t *args,
+            int64_t *results);
+  /**
+   * Calls `fn`, which returns one value or none, checking the number of
+   * arguments. Returns its result, zero if it has none, or nothing if the
+   * call couldn't be made or trapped, with error() saying why.
+   */
+  std::optional<int64_t> call(const DewModule::Function &fn,
+                              std::initializer_list<int64_t> args);
+  const std::string &error() const;
+
+private:
+  DewVM vm;
+  /** Why the last call couldn't be made, if it got no further than here. */
+  std::string refused;
+};
+} // namespace dew
+#endif // !DEW_MODULE_H_
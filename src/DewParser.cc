@@ -18,11 +18,19 @@
  * \file DewParser.cc
  */
 #include "DewParser.h"
-#include "DewContext.h"
 #include "ast.h"
+#include "grammar.h"
+#include "report.h"
+#include "symbols.h"
+#include "typecheck.h"
 #include "util.h"
+#include <algorithm>
+#include <cstdlib>
 #include <iostream>
+#include <iterator>
 #include <memory>
+#include <new>
+#include <optional>
 #include <ostream>
 #include <string_view>
 #include <tree_sitter/api.h>
@@ -34,214 +42,859 @@ using Expr = ast::Expr;
 using Stmt = ast::Stmt;
 using Block = ast::Block;
 
-void dbg(TSNode node) { std::cout << SExpression{node}.get() << std::endl; }
+static const Grammar &grammar{Grammar::get()};
 
-TSParser *newTSParser() {
+void dbg(TSNode node) { std::cerr << SExpression{node}.get() << std::endl; }
+
+TSParser *dew::newTSParser() {
   TSParser *parser{ts_parser_new()};
   ts_parser_set_language(parser, tree_sitter_dew());
   return parser;
 }
 
+/** The row and column of byte `offset` in `source`. */
+static TSPoint pointAt(std::string_view source, uint32_t offset) {
+  auto begin{source.begin()};
+  auto row{std::count(begin, begin + offset, '\n')};
+  auto lineStart{source.rfind('\n', offset == 0 ? 0 : offset - 1)};
+  uint32_t column{lineStart == std::string_view::npos || offset == 0
+                      ? offset
+                      : static_cast<uint32_t>(offset - lineStart - 1)};
+  return TSPoint{static_cast<uint32_t>(row), column};
+}
+
 DewParser::DewParser(std::string source)
-    : source(source), parser(newTSParser()),
-      tree(ts_parser_parse_string(parser, nullptr, source.c_str(),
-                                  source.length())) {}
+    : DewParser{Source{std::move(source)}} {}
+
+DewParser::DewParser(Source source) : DewParser{std::move(source), nullptr} {}
+
+DewParser::DewParser(Source source, TSParser *parser)
+    : source{std::move(source)}, parser{parser ? parser : newTSParser()},
+      ownsParser{!parser}, tree{nullptr}, textStart{0}, parsedBytes{0} {
+  Report::Phase phase{"tree-sitter"};
+  tree = ts_parser_parse_string(this->parser, nullptr,
+                                this->source.text().data(),
+                                this->source.size());
+}
+
+DewParser::DewParser(Source source, TSParser *parser, Streaming)
+    : source{std::move(source)}, parser{parser ? parser : newTSParser()},
+      ownsParser{!parser}, tree{nullptr}, textStart{0}, parsedBytes{0} {}
+
+DewParser::DewParser(TSTree *tree)
+    : source{std::string{}}, parser{nullptr}, ownsParser{false},
+      tree{ts_tree_copy(tree)}, textStart{0}, parsedBytes{0} {}
 
 TSNode DewParser::root() const { return ts_tree_root_node(tree); }
 
 ast::Parameter DewParser::parseParameter(TSNode node) {
-  TSNode type{getField(node, "type")};
-  std::string_view typeName{ts_node_type(type)};
-  std::string_view name{nodeStr(getField(node, "name"))};
-  if (typeName != "builtin_type") {
-    // TODO: Do check here??
-  }
-  return ast::Parameter{nodeStr(type), name};
+  TypeId type{parseType(grammar.field(node, Field::Type))};
+  std::string_view name{nodeStr(grammar.field(node, Field::Name))};
+  return ast::Parameter{type, name, symbols.intern(name)};
 }
 
 ParamList DewParser::parseParamList(TSNode node) {
-  ParamList p;
-  TSNode params{getField(node, "params")};
+  TSNode params{grammar.field(node, Field::Params)};
   if (ts_node_is_null(params)) {
-    return p;
+    return ParamList{};
+  }
+  // Count first so the list can go straight into the arena. A cursor created
+  // on `params` can't move past it, so walk the siblings through the nodes.
+  std::size_t count{0};
+  for (TSNode n{params}; !ts_node_is_null(n);
+       n = ts_node_next_named_sibling(n)) {
+    ++count;
   }
-  DewCursor cur{params};
-  TSTreeCursor *c{&cur.get()->cur};
-  do {
-    p.emplace_back(parseParameter(ts_tree_cursor_current_node(c)));
-  } while (ts_tree_cursor_goto_next_sibling(c));
 
-  return p;
+  auto p{static_cast<ast::Parameter *>(arena.allocate(
+      sizeof(ast::Parameter) * count, alignof(ast::Parameter)))};
+  std::size_t i{0};
+  for (TSNode n{params}; !ts_node_is_null(n);
+       n = ts_node_next_named_sibling(n)) {
+    new (p + i++) ast::Parameter{parseParameter(n)};
+  }
+
+  return ParamList{p, count};
 }
 
 ast::Expr DewParser::parseExpr(TSNode node) {
-  if (ts_node_is_null(node)) {
-    return Expr(nullptr);
-  }
-  std::string_view type{ts_node_type(node)};
-  if (type == "parenthesized_expression") {
-    return parseExpr(ts_node_named_child(node, 0));
-  } else if (type == "binary_expression") {
-    Expr left{parseExpr(getField(node, "left"))};
-    Expr right{parseExpr(getField(node, "right"))};
-    ast::BinaryOp binOp{getBinaryOp(nodeStr(getField(node, "operator")))};
-    // TODO: Throw on invalid expression?
-    if (!left || !right) {
-      return Expr(nullptr);
-    }
-    if (left->type != right->type) {
-      // TODO: handle error?
-    }
-    // TODO: CHeck if the operation is valid
-    // check if the operator is valid, but then again we only have integers?
-    return std::make_unique<ast::BinaryExpression>(std::move(left), binOp,
-                                                   std::move(right));
-  } else if (type == "identifier") {
-    // TODO: check for conflicts here
-    return std::make_unique<ast::Identifier>(nodeStr(node));
-  } else if (type == "call_expression") {
-    return std::make_unique<ast::CallExpression>(
-        parseExpr(getField(node, "function")),
-        parseExprList(getField(node, "arguments")));
-  } else if (type == "int_literal") {
-    return std::make_unique<ast::IntegerLiteral>(parseInt(nodeStr(node)));
-  } else {
-    // TODO: do the rest of the expression types
-    std::cerr << "Invalid type: " << type << "\n";
-  }
-  return Expr(nullptr);
-}
-
-std::vector<Expr> DewParser::parseExprList(TSNode node) {
-  std::vector<Expr> values;
+  // Operands are parsed before the expression they're in, leaving their
+  // values on exprStack for it to take.
+  std::size_t bottom{exprWork.size()};
+  auto push{[&](TSNode n) {
+    NodeKind kind{ts_node_is_null(n) ? NodeKind::Other : grammar.kind(n)};
+    exprWork.push_back(Work{n, kind, 0, 0, {}, Expr{}});
+  }};
+  auto take{[&] {
+    Expr e{exprStack.back()};
+    exprStack.pop_back();
+    return e;
+  }};
+  auto done{[&](Expr e) {
+    exprWork.pop_back();
+    exprStack.push_back(e);
+  }};
+
+  push(node);
+  while (exprWork.size() > bottom) {
+    Work &w{exprWork.back()};
+    TSNode n{w.node};
+    if (ts_node_is_null(n)) {
+      done(Expr{});
+      continue;
+    }
+    switch (w.kind) {
+    case NodeKind::ParenthesizedExpression:
+      exprWork.pop_back();
+      push(ts_node_named_child(n, 0));
+      break;
+    case NodeKind::BinaryExpression: {
+      if (w.stage++ == 0) {
+        // The left operand goes on top, so that it's parsed first.
+        push(grammar.field(n, Field::Right));
+        push(grammar.field(n, Field::Left));
+        break;
+      }
+      Expr right{take()};
+      Expr left{take()};
+      TSNode op{grammar.field(n, Field::Operator)};
+      auto binOp{grammar.binaryOp(op)};
+      if (!binOp) {
+        std::cerr << "Invalid operator: " << nodeStr(op) << "\n";
+        done(Expr{});
+        break;
+      }
+      // TODO: Throw on invalid expression?
+      if (!left || !right) {
+        done(Expr{});
+        break;
+      }
+      // TODO: CHeck if the operation is valid
+      // check if the operator is valid, but then again we only have integers?
+      done(nodes.add(ast::BinaryExpression{left, right, *binOp}));
+      break;
+    }
+    case NodeKind::UnaryExpression: {
+      if (w.stage++ == 0) {
+        push(grammar.field(n, Field::Operand));
+        break;
+      }
+      Expr operand{take()};
+      TSNode op{grammar.field(n, Field::Operator)};
+      auto unOp{grammar.unaryOp(op)};
+      if (!unOp) {
+        std::cerr << "Invalid operator: " << nodeStr(op) << "\n";
+        done(Expr{});
+        break;
+      }
+      done(operand ? nodes.add(ast::UnaryExpression{operand, *unOp}) : Expr{});
+      break;
+    }
+    case NodeKind::Identifier: {
+      // TODO: check for conflicts here
+      std::string_view name{nodeStr(n)};
+      done(nodes.add(ast::Identifier{name, symbols.intern(name)}));
+      break;
+    }
+    case NodeKind::CallExpression: {
+      if (w.stage++ == 0) {
+        // The function, then the arguments in order, from the top down.
+        w.mark = exprStack.size();
+        std::size_t first{exprWork.size()};
+        TSNode arguments{grammar.field(n, Field::Arguments)};
+        TSNode a{arguments};
+        if (!ts_node_is_null(a)) {
+          a = ts_node_named_child(arguments, 0);
+        }
+        for (; !ts_node_is_null(a); a = ts_node_next_named_sibling(a)) {
+          push(a);
+        }
+        std::reverse(exprWork.begin() + first, exprWork.end());
+        push(grammar.field(n, Field::Function));
+        break;
+      }
+      std::size_t mark{w.mark};
+      Expr function{exprStack[mark]};
+      auto arguments{nodes.addList(exprStack.data() + mark + 1,
+                                   exprStack.size() - mark - 1)};
+      exprStack.resize(mark);
+      done(nodes.add(ast::CallExpression{function, arguments}));
+      break;
+    }
+    case NodeKind::IntLiteral: {
+      auto num{parseInt(nodeStr(n))};
+      if (!num) {
+        std::cerr << "Invalid integer literal: " << nodeStr(n) << "\n";
+        done(Expr{});
+        break;
+      }
+      done(nodes.add(ast::IntegerLiteral{*num}));
+      break;
+    }
+    default:
+      // TODO: do the rest of the expression types
+      std::cerr << "Invalid type: " << ts_node_type(n) << "\n";
+      done(Expr{});
+      break;
+    }
+  }
+  return take();
+}
+
+ast::List<Expr> DewParser::parseExprList(TSNode node) {
+  std::size_t mark{exprStack.size()};
   if (!ts_node_is_null(node)) {
     TSNode s{ts_node_named_child(node, 0)};
     while (!ts_node_is_null(s)) {
-      values.emplace_back(parseExpr(s));
+      // Nested lists are pushed and popped above this one before we get here.
+      Expr e{parseExpr(s)};
+      exprStack.push_back(e);
       s = ts_node_next_named_sibling(s);
     }
   }
 
+  auto values{nodes.addList(exprStack.data() + mark, exprStack.size() - mark)};
+  exprStack.resize(mark);
   return values;
 }
 
 Stmt DewParser::parseStmt(TSNode node) {
-  if (ts_node_is_null(node)) {
-    return Stmt(nullptr);
-  }
-  std::string_view type{ts_node_type(node)};
-  if (type == "if_statement") {
-    TSNode condition{getField(node, "condition")};
-    TSNode consequence{getField(node, "consequence")};
-    TSNode alternative{getField(node, "alternative")};
-    return std::make_unique<ast::IfStatement>(
-        parseExpr(condition), parseBlock(consequence), parseBlock(alternative));
-  } else if (type == "for_statement") {
-    TSNode init{getField(node, "init")};
-    TSNode cond{getField(node, "cond")};
-    TSNode update{getField(node, "update")};
-    return std::make_unique<ast::ForStatement>(parseStmt(init), parseExpr(cond),
-                                               parseStmt(update));
-  } else if (type == "return_statement") {
-    return std::make_unique<ast::ReturnStatement>(
-        parseExprList(ts_node_named_child(node, 0)));
-  } else if (type == "expression_statement") {
-    return std::make_unique<ast::ExpressionStatement>(
-        parseExpr(ts_node_named_child(node, 0)));
-  } else if (type == "assignment_statement") {
-    return std::make_unique<ast::AssignmentStatement>(
-        parseExprList(getField(node, "left")),
-        parseExprList(getField(node, "right")));
-  } else if (type == "var_declaration") {
-    // Assignment statement??
-    return Stmt(nullptr);
-  } else {
+  return parseStmt(node, ts_node_is_null(node) ? NodeKind::Other
+                                               : grammar.kind(node));
+}
+
+Stmt DewParser::parseStmt(TSNode node, NodeKind kind) {
+  // Statements nested in a block, an if or a for are parsed before it,
+  // leaving their values on stmtStack for it to take.
+  std::size_t bottom{stmtWork.size()};
+  auto push{[&](TSNode n, NodeKind k) {
+    stmtWork.push_back(Work{n, k, 0, stmtStack.size(), {}, Expr{}});
+  }};
+  auto kindOf{[](TSNode n) {
+    return ts_node_is_null(n) ? NodeKind::Other : grammar.kind(n);
+  }};
+  auto take{[&] {
+    Stmt s{stmtStack.back()};
+    stmtStack.pop_back();
+    return s;
+  }};
+  auto done{[&](Stmt s) {
+    stmtWork.pop_back();
+    stmtStack.push_back(s);
+  }};
+
+  push(node, kind);
+  while (stmtWork.size() > bottom) {
+    Work &w{stmtWork.back()};
+    TSNode n{w.node};
+    if (ts_node_is_null(n)) {
+      done(Stmt{});
+      continue;
+    }
+    switch (w.kind) {
+    case NodeKind::Block: {
+      if (w.stage == 0) {
+        w.stage = 1;
+        w.next = ts_node_named_child(n, 0);
+      }
+      if (!ts_node_is_null(w.next)) {
+        TSNode s{w.next};
+        w.next = ts_node_next_named_sibling(s);
+        push(s, grammar.kind(s));
+        break;
+      }
+      std::size_t mark{w.mark};
+      auto list{
+          nodes.addList(stmtStack.data() + mark, stmtStack.size() - mark)};
+      stmtStack.resize(mark);
+      done(nodes.add(ast::BlockStatement{list}));
+      break;
+    }
+    case NodeKind::IfStatement:
+      switch (w.stage++) {
+      case 0:
+        w.condition = parseExpr(grammar.field(n, Field::Condition));
+        push(grammar.field(n, Field::Consequence), NodeKind::Block);
+        break;
+      case 1: {
+        TSNode alternative{grammar.field(n, Field::Alternative)};
+        // Without an `else` there's no node to ask the kind of.
+        bool elseIf{kindOf(alternative) == NodeKind::IfStatement};
+        push(alternative, elseIf ? NodeKind::IfStatement : NodeKind::Block);
+        break;
+      }
+      default: {
+        Expr cond{w.condition};
+        Stmt alt{take()};
+        Stmt cons{take()};
+        done(nodes.add(ast::IfStatement{cond, cons, alt}));
+        break;
+      }
+      }
+      break;
+    case NodeKind::ForStatement:
+      switch (w.stage++) {
+      case 0: {
+        TSNode init{grammar.field(n, Field::Init)};
+        push(init, kindOf(init));
+        break;
+      }
+      case 1: {
+        w.condition = parseExpr(grammar.field(n, Field::Cond));
+        TSNode update{grammar.field(n, Field::Update)};
+        push(update, kindOf(update));
+        break;
+      }
+      case 2:
+        push(grammar.field(n, Field::Body), NodeKind::Block);
+        break;
+      default: {
+        Expr condition{w.condition};
+        Stmt body{take()};
+        Stmt next{take()};
+        Stmt initial{take()};
+        done(nodes.add(ast::ForStatement{initial, condition, next, body}));
+        break;
+      }
+      }
+      break;
+    default:
+      done(parseSimpleStmt(n));
+      break;
+    }
+  }
+  return take();
+}
+
+Stmt DewParser::parseSimpleStmt(TSNode node) {
+  switch (grammar.kind(node)) {
+  case NodeKind::ReturnStatement:
+    return nodes.add(
+        ast::ReturnStatement{parseExprList(ts_node_named_child(node, 0))});
+  case NodeKind::ExpressionStatement:
+    return nodes.add(
+        ast::ExpressionStatement{parseExpr(ts_node_named_child(node, 0))});
+  case NodeKind::AssignmentStatement: {
+    auto left{parseExprList(grammar.field(node, Field::Left))};
+    auto right{parseExprList(grammar.field(node, Field::Right))};
+    return nodes.add(ast::AssignmentStatement{left, right});
+  }
+  case NodeKind::IncStatement:
+    return nodes.add(
+        ast::IncrementStatement{parseExpr(ts_node_named_child(node, 0))});
+  case NodeKind::DecStatement:
+    return nodes.add(
+        ast::DecrementStatement{parseExpr(ts_node_named_child(node, 0))});
+  case NodeKind::VarDeclaration:
+    return parseVarDeclaration(node);
+  default:
     // TODO: do the rest of the statement types
-    std::cerr << "Invalid type: " << type << "\n";
+    std::cerr << "Invalid type: " << ts_node_type(node) << "\n";
     dbg(node);
-    return Stmt(nullptr);
+    return Stmt{};
+  }
+}
+
+Stmt DewParser::parseVarDeclaration(TSNode node) {
+  // `i32 a, b, i` or `i8 a = 100`: names come before the `=`, values after.
+  TypeId type{TypeId::Invalid};
+  std::size_t nameMark{exprStack.size()};
+  std::size_t valueMark{0};
+  bool values{false};
+  uint32_t count{ts_node_child_count(node)};
+  for (uint32_t i{0}; i < count; ++i) {
+    TSNode child{ts_node_child(node, i)};
+    NodeKind kind{grammar.kind(child)};
+    if (!ts_node_is_named(child)) {
+      if (kind == NodeKind::Assign && !values) {
+        values = true;
+        valueMark = exprStack.size();
+      }
+    } else if (!values && kind == NodeKind::Identifier) {
+      std::string_view name{nodeStr(child)};
+      Expr id{nodes.add(ast::Identifier{name, symbols.intern(name)})};
+      exprStack.push_back(id);
+    } else if (!values) {
+      type = parseType(child);
+    } else if (kind == NodeKind::ExpressionList) {
+      ast::List<Expr> list{parseExprList(child)};
+      for (const Expr e : nodes.list(list)) {
+        exprStack.push_back(e);
+      }
+    } else {
+      Expr e{parseExpr(child)};
+      exprStack.push_back(e);
+    }
   }
+  if (!values) {
+    valueMark = exprStack.size();
+  }
+  auto names{nodes.addList(exprStack.data() + nameMark, valueMark - nameMark)};
+  auto inits{nodes.addList(exprStack.data() + valueMark,
+                           exprStack.size() - valueMark)};
+  exprStack.resize(nameMark);
+  return nodes.add(ast::VarDeclaration{type, names, inits});
 }
 
 Block DewParser::parseBlock(TSNode node) {
-  if (ts_node_is_null(node)) {
-    return Block(nullptr);
+  return parseStmt(node, NodeKind::Block);
+}
+
+TypeId DewParser::parseType(TSNode node) {
+  TypeId type{typeNamed(nodeStr(node))};
+  if (type == TypeId::Invalid) {
+    std::cerr << "Unknown type: " << nodeStr(node) << "\n";
+  }
+  return type;
+}
+
+Span<TypeId> DewParser::parseResult(TSNode node) {
+  TSNode result{grammar.field(node, Field::Result)};
+  if (ts_node_is_null(result)) {
+    return Span<TypeId>{};
+  }
+  uint32_t count{ts_node_named_child_count(result)};
+  if (count == 0) {
+    TypeId type{parseType(result)};
+    return arena.copy(&type, 1);
   }
-  std::vector<Stmt> list;
-  TSNode s{ts_node_named_child(node, 0)};
-  while (!ts_node_is_null(s)) {
-    list.emplace_back(parseStmt(s));
-    s = ts_node_next_named_sibling(s);
+  auto types{static_cast<TypeId *>(
+      arena.allocate(sizeof(TypeId) * count, alignof(TypeId)))};
+  for (uint32_t i{0}; i < count; ++i) {
+    types[i] = parseType(ts_node_named_child(result, i));
   }
-  return std::make_unique<ast::BlockStatement>(std::move(list));
+  return Span<TypeId>{types, count};
 }
 
-FunctionDeclaration DewParser::parseFunctionDeclaration(TSNode node) {
-  return FunctionDeclaration{nodeStr(getField(node, "name")),
-                             std::vector<DataType>(), // TODO: Parse return type
-                             parseParamList(getField(node, "parameters"))};
+FunctionDeclaration *DewParser::parseFunctionDeclaration(TSNode node) {
+  std::string_view name{nodeStr(grammar.field(node, Field::Name))};
+  return arena.make<FunctionDeclaration>(
+      name, symbols.intern(name), parseResult(node),
+      parseParamList(grammar.field(node, Field::Parameters)));
 }
 
 ast::Function DewParser::parseFunction(TSNode node, FunctionDeclaration *decl) {
-  return ast::Function{decl, parseBlock(getField(node, "body"))};
+  return ast::Function{decl, parseBlock(grammar.field(node, Field::Body))};
 }
 
-DewContext DewParser::defineTopLevel(TSNode node) {
-  DewContext ctx{nullptr};
+ScopeTable<Definition *> DewParser::defineTopLevel(TSNode node) {
+  ScopeTable<Definition *> ctx;
   DewCursor cur{node};
   TSTreeCursor *c{&cur.get()->cur};
   ts_tree_cursor_goto_first_child(c);
   do {
     TSNode node{ts_tree_cursor_current_node(c)};
-    std::string_view type{ts_node_type(node)};
-    if (type == "function_declaration") {
-      auto decl = new FunctionDeclaration{parseFunctionDeclaration(node)};
-      ctx.define(decl->name, decl);
+    if (grammar.kind(node) == NodeKind::FunctionDeclaration) {
+      enter(node);
+      extents.push_back(Extent{ts_node_start_byte(node),
+                               ts_node_end_byte(node), text});
+      auto decl{parseFunctionDeclaration(node)};
+      // The first of several functions with the same name is the one seen.
+      if (!ctx.resolve(decl->symbol)) {
+        ctx.define(decl->symbol, decl);
+      }
     } else {
-      std::cerr << "Invalid type: " << type << "\n";
-      return ctx;
+      // Skipped here and in defineFunctions alike, so the rest still parse.
+      std::cerr << "Invalid type: " << ts_node_type(node) << "\n";
     }
   } while (ts_tree_cursor_goto_next_sibling(c));
 
   return ctx;
 }
 
-void DewParser::defineFunctions(TSNode node, DewContext &topLevel) {
-  std::vector<ast::Function> functions;
+void DewParser::defineFunctions(TSNode node,
+                                const ScopeTable<Definition *> &topLevel) {
   DewCursor cur{node};
   TSTreeCursor *c{&cur.get()->cur};
   ts_tree_cursor_goto_first_child(c);
   do {
     TSNode node{ts_tree_cursor_current_node(c)};
-    std::string_view type{ts_node_type(node)};
-    if (type == "function_declaration") {
-      auto name{nodeStr(getField(node, "name"))};
-      auto decl{(FunctionDeclaration *)(topLevel.resolve(name).value())};
+    if (grammar.kind(node) == NodeKind::FunctionDeclaration) {
+      text = extents[functions.size()].text;
+      textStart = extents[functions.size()].start;
+      auto name{nodeStr(grammar.field(node, Field::Name))};
+      auto decl{
+          (FunctionDeclaration *)(*topLevel.resolve(*symbols.find(name)))};
+      Report::Function timer{decl->name};
       functions.emplace_back(parseFunction(node, decl));
-    } else {
-      std::cerr << "Invalid type: " << type << "\n";
-      return;
     }
   } while (ts_tree_cursor_goto_next_sibling(c));
+}
 
-  // TODO: Do something with the functions. Maybe compile them?
-  for (const auto &f : functions) {
-    std::cout << f.decl->name << "\n";
+void DewParser::parseSource() {
+  TSNode rootNode{root()};
+  ScopeTable<Definition *> ctx;
+  {
+    Report::Phase phase{"declarations"};
+    ctx = defineTopLevel(rootNode);
   }
+  {
+    Report::Phase phase{"bodies"};
+    defineFunctions(rootNode, ctx);
+  }
+  checkTypes();
 }
-void DewParser::parseSource() {
+
+void DewParser::checkTypes() {
+  Report::Phase phase{"types"};
+  TypeChecker checker{nodes, functions};
+  calls.assign(functions.size(), {});
+  for (std::size_t i{0}; i < functions.size(); ++i) {
+    Report::Function timer{functions[i].decl->name};
+    checker.check(functions[i], &calls[i]);
+  }
+}
+
+/**
+ * Where each top-level item of `source` starts and ends, found without
+ * parsing: the grammar has braces only around blocks, so an item runs from
+ * its first character to the brace that closes its body.
+ */
+static std::vector<std::pair<uint32_t, uint32_t>>
+topLevelItems(std::string_view source) {
+  std::vector<std::pair<uint32_t, uint32_t>> items;
+  std::size_t start{std::string_view::npos};
+  uint32_t depth{0};
+  for (std::size_t i{0}; i < source.size(); ++i) {
+    char c{source[i]};
+    if (c == '/' && i + 1 < source.size() && source[i + 1] == '/') {
+      i = std::min(source.find('\n', i), source.size());
+      continue;
+    }
+    if (start == std::string_view::npos && c != ' ' && c != '\t' &&
+        c != '\n' && c != '\r') {
+      start = i;
+    }
+    if (c == '{') {
+      ++depth;
+    } else if (c == '}' && depth > 0 && --depth == 0) {
+      items.emplace_back(start, i + 1);
+      start = std::string_view::npos;
+    }
+  }
+  if (start != std::string_view::npos) {
+    items.emplace_back(start, source.size());
+  }
+  return items;
+}
+
+void DewParser::stream(const std::function<void(uint32_t)> &visit) {
+  std::string_view all{source.text()};
+  {
+    // Bodies can call functions declared after them, so the declarations
+    // all go in first. Each is parsed from its header with an empty body.
+    Report::Phase phase{"declarations"};
+    std::string header;
+    for (const auto &[start, end] : topLevelItems(all)) {
+      std::string_view item{all.substr(start, end - start)};
+      header.assign(item.substr(0, item.find('{')));
+      header += "{}";
+      TSTree *t{ts_parser_parse_string(parser, nullptr, header.data(),
+                                       header.size())};
+      TSNode node{ts_node_named_child(ts_tree_root_node(t), 0)};
+      if (grammar.kind(node) == NodeKind::FunctionDeclaration) {
+        // The header is the item up to its body, so offsets into one are
+        // offsets into the other.
+        text = item;
+        textStart = 0;
+        extents.push_back(Extent{start, end, item});
+        functions.emplace_back(parseFunctionDeclaration(node), Block{});
+      } else {
+        std::cerr << "Invalid type: " << ts_node_type(node) << "\n";
+      }
+      ts_tree_delete(t);
+    }
+  }
+
+  Report::Phase phase{"bodies"};
+  TypeChecker checker{nodes, functions};
+  // Mapped pages are let go in batches rather than a call per function.
+  constexpr std::size_t RELEASE_BYTES{16 << 20};
+  std::size_t released{0};
+  for (uint32_t i{0}; i < functions.size(); ++i) {
+    {
+      Report::Function timer{functions[i].decl->name};
+      text = extents[i].text;
+      textStart = 0;
+      TSTree *t{ts_parser_parse_string(parser, nullptr, text.data(),
+                                       text.size())};
+      TSNode node{ts_node_named_child(ts_tree_root_node(t), 0)};
+      if (grammar.kind(node) == NodeKind::FunctionDeclaration) {
+        functions[i].block = parseBlock(grammar.field(node, Field::Body));
+        checker.check(functions[i]);
+      } else {
+        std::cerr << "Invalid type: " << ts_node_type(node) << "\n";
+      }
+      ts_tree_delete(t);
+    }
+    visit(i);
+    functions[i].block = Block{};
+    nodes.clear();
+    if (extents[i].end - released >= RELEASE_BYTES) {
+      released = extents[i].end;
+      source.release(released);
+    }
+  }
+}
+
+void DewParser::parseSource(ThreadPool &pool) {
+  if (pool.size() == 1) {
+    parseSource();
+    return;
+  }
   TSNode rootNode{root()};
-  DewContext ctx{defineTopLevel(rootNode)};
-  defineFunctions(rootNode, ctx);
+  ScopeTable<Definition *> ctx;
+  {
+    Report::Phase phase{"declarations"};
+    ctx = defineTopLevel(rootNode);
+  }
+  std::optional<Report::Phase> phase{std::in_place, "bodies"};
+
+  // Trees can't be shared between threads, so each worker walks a copy of
+  // its own, and builds its functions into an AST of its own too.
+  std::vector<std::unique_ptr<DewParser>> workers;
+  std::vector<std::vector<TSNode>> workerNodes(pool.size());
+  for (unsigned i{0}; i < pool.size(); ++i) {
+    workers.emplace_back(new DewParser{tree});
+  }
+  std::vector<std::optional<ast::Function>> parsed(extents.size());
+  std::vector<unsigned> owner(extents.size());
+  pool.run(extents.size(), [&](unsigned worker, std::size_t i) {
+    DewParser &w{*workers[worker]};
+    std::vector<TSNode> &fns{workerNodes[worker]};
+    if (fns.empty()) {
+      DewCursor cur{w.root()};
+      TSTreeCursor *c{&cur.get()->cur};
+      ts_tree_cursor_goto_first_child(c);
+      do {
+        TSNode n{ts_tree_cursor_current_node(c)};
+        if (grammar.kind(n) == NodeKind::FunctionDeclaration) {
+          fns.push_back(n);
+        }
+      } while (ts_tree_cursor_goto_next_sibling(c));
+    }
+    w.text = extents[i].text;
+    w.textStart = extents[i].start;
+    auto name{w.nodeStr(grammar.field(fns[i], Field::Name))};
+    auto decl{(FunctionDeclaration *)(*ctx.resolve(*symbols.find(name)))};
+    Report::Function timer{decl->name};
+    parsed[i].emplace(w.parseFunction(fns[i], decl));
+    owner[i] = worker;
+  });
+
+  // Each worker interned the names in its functions on its own.
+  std::vector<ast::Relocation> moves;
+  for (const auto &w : workers) {
+    std::vector<Symbol> to(w->symbols.size());
+    for (Symbol s{0}; s < to.size(); ++s) {
+      to[s] = symbols.intern(w->symbols.name(s));
+    }
+    w->nodes.renameSymbols(to);
+    moves.push_back(nodes.append(w->nodes));
+  }
+  for (std::size_t i{0}; i < parsed.size(); ++i) {
+    functions.emplace_back(parsed[i]->decl, moves[owner[i]](parsed[i]->block));
+  }
+  phase.emplace("types");
+  // Types only go in once every function is declared and in one tree.
+  std::vector<TypeChecker> checkers(pool.size(), TypeChecker{nodes, functions});
+  calls.assign(functions.size(), {});
+  pool.run(functions.size(), [&](unsigned worker, std::size_t i) {
+    Report::Function timer{functions[i].decl->name};
+    checkers[worker].check(functions[i], &calls[i]);
+  });
+}
+
+const ast::Tree &DewParser::astTree() const { return nodes; }
+
+const std::vector<ast::Function> &DewParser::getFunctions() const {
+  return functions;
+}
+
+std::string_view DewParser::getSource() const { return source.text(); }
+
+void DewParser::enter(TSNode node) {
+  uint32_t start{ts_node_start_byte(node)};
+  uint32_t end{ts_node_end_byte(node)};
+  textStart = start;
+  if (source.mapped()) {
+    text = source.text().substr(start, end - start);
+    return;
+  }
+  Span<char> copy{arena.copy(source.text().data() + start, end - start)};
+  text = std::string_view{copy.begin(), copy.size()};
+  parsedBytes += copy.size();
+}
+
+void DewParser::rebuild() {
+  functions.clear();
+  extents.clear();
+  nodes.clear();
+  arena.reset();
+  parsedBytes = 0;
+  parseSource();
+}
+
+std::vector<uint32_t> DewParser::edit(uint32_t start, uint32_t end,
+                                      std::string_view replacement) {
+  auto newEnd{static_cast<uint32_t>(start + replacement.size())};
+  TSInputEdit change{start,
+                     end,
+                     newEnd,
+                     pointAt(source.text(), start),
+                     pointAt(source.text(), end),
+                     {}};
+  source.replace(start, end, replacement);
+  change.new_end_point = pointAt(source.text(), newEnd);
+  ts_tree_edit(tree, &change);
+  TSTree *old{tree};
+  tree = ts_parser_parse_string(parser, old, source.text().data(),
+                                source.size());
+  uint32_t rangeCount{0};
+  TSRange *changed{ts_tree_get_changed_ranges(old, tree, &rangeCount)};
+  ts_tree_delete(old);
+
+  std::vector<ast::Function> oldFunctions;
+  std::vector<Extent> oldExtents;
+  std::vector<std::vector<Symbol>> oldCalls;
+  std::swap(oldFunctions, functions);
+  std::swap(oldExtents, extents);
+  std::swap(oldCalls, calls);
+  std::vector<bool> kept(oldFunctions.size());
+  // Where an old function is now, if the edit only moved it.
+  auto moved{[&](const Extent &e) -> std::optional<Extent> {
+    if (e.end <= start) {
+      return e;
+    } else if (e.start >= end) {
+      return Extent{e.start + newEnd - end, e.end + newEnd - end, e.text};
+    }
+    return std::nullopt;
+  }};
+
+  std::vector<uint32_t> rebuilt;
+  std::size_t j{0};
+  TSNode rootNode{root()};
+  for (TSNode node{ts_node_named_child(rootNode, 0)}; !ts_node_is_null(node);
+       node = ts_node_next_named_sibling(node)) {
+    if (grammar.kind(node) != NodeKind::FunctionDeclaration) {
+      std::cerr << "Invalid type: " << ts_node_type(node) << "\n";
+      continue;
+    }
+    uint32_t s{ts_node_start_byte(node)};
+    uint32_t e{ts_node_end_byte(node)};
+    for (; j < oldExtents.size(); ++j) {
+      auto at{moved(oldExtents[j])};
+      if (at && at->start >= s) {
+        break;
+      }
+    }
+    auto at{j < oldExtents.size() ? moved(oldExtents[j]) : std::nullopt};
+    bool same{at && at->start == s && at->end == e};
+    for (uint32_t i{0}; same && i < rangeCount; ++i) {
+      same = changed[i].end_byte <= s || changed[i].start_byte >= e;
+    }
+    if (same) {
+      functions.push_back(oldFunctions[j]);
+      extents.push_back(*at);
+      calls.push_back(std::move(oldCalls[j]));
+      kept[j] = true;
+      continue;
+    }
+    rebuilt.push_back(static_cast<uint32_t>(functions.size()));
+    enter(node);
+    extents.push_back(Extent{s, e, text});
+    calls.emplace_back();
+    functions.push_back(parseFunction(node, parseFunctionDeclaration(node)));
+  }
+  std::free(changed);
+
+  // Replaced functions stay in the arena until enough of them pile up.
+  if (parsedBytes > 2 * source.size()) {
+    rebuild();
+    rebuilt.resize(functions.size());
+    for (uint32_t i{0}; i < rebuilt.size(); ++i) {
+      rebuilt[i] = i;
+    }
+    return rebuilt;
+  }
+
+  // Calls resolve to the first function of their name. Where that's now
+  // another declaration, or none, with a different signature, the types of
+  // calls to it from the functions that were kept may have changed too.
+  auto first{[](const std::vector<ast::Function> &fns,
+                Symbol name) -> const FunctionDeclaration * {
+    auto found{std::find_if(
+        fns.begin(), fns.end(),
+        [&](const ast::Function &f) { return f.decl->symbol == name; })};
+    return found == fns.end() ? nullptr : found->decl;
+  }};
+  std::vector<Symbol> changedNames;
+  auto compare{[&](Symbol name) {
+    const FunctionDeclaration *was{first(oldFunctions, name)};
+    const FunctionDeclaration *now{first(functions, name)};
+    if (was != now && (!was || !now || !sameSignature(*was, *now))) {
+      changedNames.push_back(name);
+    }
+  }};
+  for (const uint32_t i : rebuilt) {
+    compare(functions[i].decl->symbol);
+  }
+  for (std::size_t i{0}; i < oldFunctions.size(); ++i) {
+    if (!kept[i]) {
+      compare(oldFunctions[i].decl->symbol);
+    }
+  }
+  std::vector<bool> check(functions.size());
+  for (const uint32_t i : rebuilt) {
+    check[i] = true;
+  }
+  for (std::size_t i{0}; !changedNames.empty() && i < functions.size(); ++i) {
+    const std::vector<Symbol> &names{calls[i]};
+    if (std::find_first_of(names.begin(), names.end(), changedNames.begin(),
+                           changedNames.end()) != names.end()) {
+      check[i] = true;
+    }
+  }
+  Report::Phase phase{"types"};
+  TypeChecker checker{nodes, functions};
+  for (std::size_t i{0}; i < functions.size(); ++i) {
+    if (check[i]) {
+      Report::Function timer{functions[i].decl->name};
+      calls[i].clear();
+      checker.check(functions[i], &calls[i]);
+    }
+  }
+  return rebuilt;
+}
+
+std::optional<uint32_t> DewParser::functionAt(uint32_t offset) const {
+  auto after{std::upper_bound(
+      extents.begin(), extents.end(), offset,
+      [](uint32_t offset, const Extent &e) { return offset < e.start; })};
+  if (after == extents.begin() || offset > std::prev(after)->end) {
+    return std::nullopt;
+  }
+  return static_cast<uint32_t>(after - extents.begin() - 1);
+}
+
+uint32_t DewParser::offsetOf(uint32_t index, std::string_view text) const {
+  const Extent &e{extents[index]};
+  return e.start + static_cast<uint32_t>(text.data() - e.text.data());
 }
 
 std::string_view DewParser::nodeStr(TSNode node) const {
+  // Half-typed code can leave out the nodes asked for.
+  if (ts_node_is_null(node)) {
+    return {};
+  }
   uint32_t start{ts_node_start_byte(node)};
   uint32_t end{ts_node_end_byte(node)};
-  return std::string_view(source).substr(start, end - start);
+  return text.substr(start - textStart, end - start);
 }
 
 DewParser::~DewParser() {
   ts_tree_delete(tree);
-  ts_parser_delete(parser);
+  if (ownsParser) {
+    ts_parser_delete(parser);
+  }
 }
@@ -20,36 +20,159 @@
 #ifndef DEW_PARSER_H_
 #define DEW_PARSER_H_
 
-#include "DewContext.h"
+#include "ThreadPool.h"
+#include "arena.h"
 #include "ast.h"
+#include "grammar.h"
+#include "source.h"
+#include "symbols.h"
+#include <functional>
+#include <optional>
 #include <string>
 #include <tree_sitter/api.h>
+#include <vector>
 
 namespace dew {
+/** A TSParser for Dew, for callers that keep one across DewParsers. */
+TSParser *newTSParser();
+
 class DewParser {
 public:
   DewParser(std::string source);
+  /** Parses straight out of `source`, without copying a mapped file. */
+  DewParser(Source source);
+  /**
+   * Parses with `parser`, which stays the caller's to delete, or with a
+   * parser of its own if it's null.
+   */
+  DewParser(Source source, TSParser *parser);
+  /** Picks the constructor that leaves the parsing to stream(). */
+  struct Streaming {};
+  DewParser(Source source, TSParser *parser, Streaming);
   TSNode root() const;
   std::string_view nodeStr(TSNode node) const;
   void parseSource();
-  DewContext defineTopLevel(TSNode node);
-  void defineFunctions(TSNode node, DewContext &topLevel);
+  /**
+   * Like parseSource, but with the function bodies spread over `pool`. The
+   * declarations are all defined first and only read after that.
+   */
+  void parseSource(ThreadPool &pool);
+  ScopeTable<Definition *> defineTopLevel(TSNode node);
+  void defineFunctions(TSNode node, const ScopeTable<Definition *> &topLevel);
+  /** Annotates the AST with types, once every function is defined. */
+  void checkTypes();
+  /**
+   * Parses and type checks one function at a time, calling `visit` with its
+   * index and dropping its tree and AST before the next, so memory follows
+   * the largest function rather than the whole file. Every declaration is
+   * read first, from the text before each body. While `visit(i)` runs,
+   * getFunctions() has every declaration but only the body of function `i`.
+   * Only for parsers constructed for Streaming.
+   */
+  void stream(const std::function<void(uint32_t)> &visit);
 
-  FunctionDeclaration parseFunctionDeclaration(TSNode node);
+  FunctionDeclaration *parseFunctionDeclaration(TSNode node);
+  /** Reports names that aren't types, which become TypeId::Invalid. */
+  TypeId parseType(TSNode node);
+  Span<TypeId> parseResult(TSNode node);
   ast::Function parseFunction(TSNode node, FunctionDeclaration *decl);
   ast::Parameter parseParameter(TSNode node);
   ast::Block parseBlock(TSNode node);
   ast::Stmt parseStmt(TSNode node);
+  /** parseStmt, taking `node` to be of `kind`. */
+  ast::Stmt parseStmt(TSNode node, NodeKind kind);
+  /** A statement that holds expressions but no other statements. */
+  ast::Stmt parseSimpleStmt(TSNode node);
+  ast::Stmt parseVarDeclaration(TSNode node);
   ast::Expr parseExpr(TSNode node);
-  std::vector<ast::Expr> parseExprList(TSNode node);
+  ast::List<ast::Expr> parseExprList(TSNode node);
   ParamList parseParamList(TSNode node);
+  const ast::Tree &astTree() const;
+  const std::vector<ast::Function> &getFunctions() const;
+  std::string_view getSource() const;
+  /**
+   * Replaces the bytes in [start, end) of the source with `text`, reparses
+   * incrementally and rebuilds the AST of only the functions the edit
+   * touched; the rest keep theirs. Returns the indices of the functions
+   * that were rebuilt, in order.
+   */
+  std::vector<uint32_t> edit(uint32_t start, uint32_t end,
+                             std::string_view text);
+  /** The function whose text holds byte `offset` of the source, if any. */
+  std::optional<uint32_t> functionAt(uint32_t offset) const;
+  /**
+   * Where `text`, a name or other view into the AST of `functions[index]`,
+   * starts in the source.
+   */
+  uint32_t offsetOf(uint32_t index, std::string_view text) const;
   ~DewParser();
 
 private:
-  std::string source;
+  /** Where a top-level function is in the source, and its copy of it. */
+  struct Extent {
+    uint32_t start;
+    uint32_t end;
+    std::string_view text;
+  };
+
+  /** A parser for one worker of parseSource, over a copy of `tree`. */
+  DewParser(TSTree *tree);
+
+  /**
+   * Points the AST at the text of `node`. Text that can be edited is copied
+   * into the arena first, so that it outlives the edits; a mapped file is
+   * used as is.
+   */
+  void enter(TSNode node);
+  /** Parses everything again into a fresh arena. */
+  void rebuild();
+
+  Source source;
   TSParser *parser;
+  bool ownsParser;
   TSTree *tree;
-  DewContext *context;
+  /** Names of everything in the AST; kept across edits and rebuilds. */
+  Interner symbols;
+  /** The text nodeStr reads from, and where it starts in the source. */
+  std::string_view text;
+  uint32_t textStart;
+  std::vector<Extent> extents;
+  /**
+   * The names each function calls, so that an edit to a declaration checks
+   * the types of only the functions calling it again.
+   */
+  std::vector<std::vector<Symbol>> calls;
+  /** Source bytes parsed into the arena, including since-replaced ones. */
+  std::size_t parsedBytes;
+  // Everything below is owned by the compilation unit and released in one go
+  // when the parser is destroyed.
+  Arena arena;
+  ast::Tree nodes;
+  std::vector<ast::Function> functions;
+  // Children of the lists being built, stacked so that nested lists can be
+  // collected without a temporary vector per list.
+  std::vector<ast::Expr> exprStack;
+  std::vector<ast::Stmt> stmtStack;
+
+  /**
+   * A node partway through being parsed. Sources nest as deep as they like
+   * and the C++ stack doesn't, so expressions and statements are parsed off
+   * stacks of these rather than by recursing.
+   */
+  struct Work {
+    TSNode node;
+    NodeKind kind;
+    /** How many of its children have been seen to. */
+    uint8_t stage;
+    /** Where its children's values start on exprStack or stmtStack. */
+    std::size_t mark;
+    /** The next statement of a block. */
+    TSNode next;
+    /** The condition of an if or a for, once parsed. */
+    ast::Expr condition;
+  };
+  std::vector<Work> exprWork;
+  std::vector<Work> stmtWork;
 };
 } // namespace dew
 #endif // !DEW_PARSER_H_
@@ -0,0 +1,257 @@
+/**
+ * Copyright (C) 2024 Charles Ancheta
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ * \file DewSession.cc
+ */
+#include "DewSession.h"
+#include "DewCompiler.h"
+#include <algorithm>
+#include <tree_sitter/api.h>
+
+using namespace dew;
+
+DewSession::DewSession(std::string source)
+    : parser{std::move(source)}, lastCompiled{0} {
+  parser.parseSource();
+}
+
+void DewSession::edit(uint32_t start, uint32_t end, std::string_view text) {
+  std::vector<uint32_t> rebuilt{parser.edit(start, end, text)};
+  if (rebuilt.size() == parser.getFunctions().size()) {
+    // Everything is new, possibly at the addresses of what it replaced.
+    compiled.clear();
+  }
+}
+
+const bc::Program *DewSession::update() {
+  const std::vector<ast::Function> &functions{parser.getFunctions()};
+  bool all{compiled.size() != functions.size()};
+  for (std::size_t i{0}; !all && i < functions.size(); ++i) {
+    all = compiled[i] != functions[i].decl &&
+          !sameSignature(*compiled[i], *functions[i].decl);
+  }
+  if (all) {
+    program.functions.assign(functions.size(), bc::Function{});
+    compiled.assign(functions.size(), nullptr);
+    errors.assign(functions.size(), {});
+  }
+
+  DewCompiler compiler{parser.astTree()};
+  lastCompiled = 0;
+  for (uint32_t i{0}; i < functions.size(); ++i) {
+    if (compiled[i] == functions[i].decl) {
+      continue;
+    }
+    errors[i].clear();
+    compiler.collectErrors(&errors[i]);
+    compiler.recompile(functions, i, program.functions[i]);
+    compiled[i] = functions[i].decl;
+    ++lastCompiled;
+  }
+  bool ok{std::all_of(errors.begin(), errors.end(),
+                      [](const auto &e) { return e.empty(); })};
+  return ok ? &program : nullptr;
+}
+
+std::vector<DewSession::Problem> DewSession::problems() const {
+  std::vector<Problem> found;
+  // Only the nodes with errors under them are worth going into.
+  std::vector<TSNode> work{parser.root()};
+  while (!work.empty()) {
+    TSNode node{work.back()};
+    work.pop_back();
+    if (!ts_node_has_error(node)) {
+      continue;
+    }
+    Range range{ts_node_start_byte(node), ts_node_end_byte(node)};
+    if (ts_node_is_missing(node)) {
+      found.push_back(
+          Problem{range, "missing `" + std::string{ts_node_type(node)} + "`"});
+    } else if (ts_node_is_error(node)) {
+      found.push_back(Problem{range, "syntax error"});
+    } else {
+      for (uint32_t i{ts_node_child_count(node)}; i-- > 0;) {
+        work.push_back(ts_node_child(node, i));
+      }
+    }
+  }
+
+  // Errors are kept until their function is compiled again, which it is
+  // whenever its text changes, so they still point into its AST.
+  for (uint32_t i{0}; i < errors.size(); ++i) {
+    for (const Diagnostic &d : errors[i]) {
+      uint32_t start{parser.offsetOf(i, d.at)};
+      found.push_back(Problem{
+          Range{start, start + static_cast<uint32_t>(d.at.size())},
+          d.message});
+    }
+  }
+  std::stable_sort(found.begin(), found.end(),
+                   [](const Problem &a, const Problem &b) {
+                     return a.range.start < b.range.start;
+                   });
+  return found;
+}
+
+std::optional<DewSession::Range> DewSession::definition(uint32_t offset) const {
+  auto index{parser.functionAt(offset)};
+  if (!index) {
+    return std::nullopt;
+  }
+  const ast::Tree &tree{parser.astTree()};
+  const std::vector<ast::Function> &functions{parser.getFunctions()};
+  const FunctionDeclaration &decl{*functions[*index].decl};
+  auto range{[&](uint32_t i, std::string_view name) {
+    uint32_t start{parser.offsetOf(i, name)};
+    return Range{start, start + static_cast<uint32_t>(name.size())};
+  }};
+  auto under{[&](std::string_view name) {
+    Range r{range(*index, name)};
+    return r.start <= offset && offset <= r.end;
+  }};
+  // Calls go to the first function with the name, as they compile.
+  auto function{[&](Symbol symbol) -> std::optional<Range> {
+    for (uint32_t i{0}; i < functions.size(); ++i) {
+      if (functions[i].decl->symbol == symbol) {
+        return range(i, functions[i].decl->name);
+      }
+    }
+    return std::nullopt;
+  }};
+
+  if (under(decl.name)) {
+    return range(*index, decl.name);
+  }
+  ScopeTable<std::string_view> locals;
+  for (const ast::Parameter &param : decl.params) {
+    if (under(param.name)) {
+      return range(*index, param.name);
+    }
+    locals.define(param.symbol, param.name);
+  }
+
+  // The body in source order, with names coming into scope as they're
+  // declared. Steps are pushed in reverse, so the first comes off first.
+  enum class Step : uint8_t { Stmt, Expr, Declare, Leave };
+  struct Work {
+    Step step;
+    ast::Stmt stmt;
+    ast::Expr expr;
+    std::size_t mark;
+  };
+  std::vector<Work> work{Work{Step::Stmt, functions[*index].block, {}, 0}};
+  auto stmt{[&](ast::Stmt s) { work.push_back(Work{Step::Stmt, s, {}, 0}); }};
+  auto expr{[&](ast::Expr e) { work.push_back(Work{Step::Expr, {}, e, 0}); }};
+  auto exprs{[&](ast::List<ast::Expr> list, Step step) {
+    Span<const ast::Expr> items{tree.list(list)};
+    for (std::size_t i{items.size()}; i-- > 0;) {
+      work.push_back(Work{step, {}, items[i], 0});
+    }
+  }};
+  while (!work.empty()) {
+    Work w{work.back()};
+    work.pop_back();
+    if (w.step == Step::Leave) {
+      locals.leave(w.mark);
+    } else if (w.step == Step::Declare) {
+      const ast::Identifier &id{tree.identifier(w.expr)};
+      if (under(id.name)) {
+        return range(*index, id.name);
+      }
+      locals.define(id.symbol, id.name);
+    } else if (w.step == Step::Expr && w.expr) {
+      ast::Expr e{w.expr};
+      switch (e.kind()) {
+      case ast::ExprKind::Binary:
+        expr(tree.binary(e).right);
+        expr(tree.binary(e).left);
+        break;
+      case ast::ExprKind::Unary:
+        expr(tree.unary(e).operand);
+        break;
+      case ast::ExprKind::Call:
+        exprs(tree.call(e).arguments, Step::Expr);
+        expr(tree.call(e).function);
+        break;
+      case ast::ExprKind::Identifier: {
+        const ast::Identifier &id{tree.identifier(e)};
+        if (!under(id.name)) {
+          break;
+        }
+        if (const std::string_view *local{locals.resolve(id.symbol)}) {
+          return range(*index, *local);
+        }
+        return function(id.symbol);
+      }
+      case ast::ExprKind::Integer:
+        break;
+      }
+    } else if (w.step == Step::Stmt && w.stmt) {
+      ast::Stmt s{w.stmt};
+      switch (s.kind()) {
+      case ast::StmtKind::Var:
+        // The values can't see the names they initialize.
+        exprs(tree.var(s).names, Step::Declare);
+        exprs(tree.var(s).values, Step::Expr);
+        break;
+      case ast::StmtKind::Expression:
+        expr(tree.expression(s).expr);
+        break;
+      case ast::StmtKind::Increment:
+        expr(tree.increment(s).expr);
+        break;
+      case ast::StmtKind::Decrement:
+        expr(tree.decrement(s).expr);
+        break;
+      case ast::StmtKind::Assignment:
+        exprs(tree.assignment(s).right, Step::Expr);
+        exprs(tree.assignment(s).left, Step::Expr);
+        break;
+      case ast::StmtKind::For: {
+        const ast::ForStatement &loop{tree.forStmt(s)};
+        work.push_back(Work{Step::Leave, {}, {}, locals.mark()});
+        stmt(loop.body);
+        stmt(loop.update);
+        expr(loop.condition);
+        stmt(loop.initial);
+        break;
+      }
+      case ast::StmtKind::Return:
+        exprs(tree.returnStmt(s).values, Step::Expr);
+        break;
+      case ast::StmtKind::Block: {
+        work.push_back(Work{Step::Leave, {}, {}, locals.mark()});
+        Span<const ast::Stmt> statements{tree.list(tree.block(s).statements)};
+        for (std::size_t i{statements.size()}; i-- > 0;) {
+          stmt(statements[i]);
+        }
+        break;
+      }
+      case ast::StmtKind::If:
+        stmt(tree.ifStmt(s).alternative);
+        stmt(tree.ifStmt(s).consequence);
+        expr(tree.ifStmt(s).condition);
+        break;
+      }
+    }
+  }
+  return std::nullopt;
+}
+
+std::string_view DewSession::source() const { return parser.getSource(); }
+
+std::size_t DewSession::compiledCount() const { return lastCompiled; }
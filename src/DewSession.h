@@ -0,0 +1,82 @@
+/**
+ * Copyright (C) 2024 Charles Ancheta
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ * \file DewSession.h
+ */
+#ifndef DEW_SESSION_H_
+#define DEW_SESSION_H_
+
+#include "DewCompiler.h"
+#include "DewParser.h"
+#include "bytecode.h"
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace dew {
+/**
+ * A long-lived compilation of one source file for editors and watchers.
+ * Edits are reparsed incrementally, and only the functions whose text
+ * changed get a new AST and new bytecode, unless a signature changed and
+ * callers have to be compiled again too.
+ */
+class DewSession {
+public:
+  /** Bytes [start, end) of the source. */
+  struct Range {
+    uint32_t start;
+    uint32_t end;
+  };
+  struct Problem {
+    Range range;
+    std::string message;
+  };
+
+  DewSession(std::string source);
+  /** Replaces the bytes in [start, end) of the source with `text`. */
+  void edit(uint32_t start, uint32_t end, std::string_view text);
+  /**
+   * Brings the program up to date with the edits so far. Returns nullptr
+   * while some function doesn't compile; see problems() for why.
+   */
+  const bc::Program *update();
+  /**
+   * The syntax errors in the source and the errors of every function as of
+   * the last update, in order.
+   */
+  std::vector<Problem> problems() const;
+  /**
+   * Where the name at byte `offset` is declared: a local, a parameter or a
+   * function. The cursor may also be just past the name.
+   */
+  std::optional<Range> definition(uint32_t offset) const;
+  std::string_view source() const;
+  /** How many functions the last update compiled. */
+  std::size_t compiledCount() const;
+
+private:
+  DewParser parser;
+  bc::Program program;
+  /** The declaration each function of `program` was compiled from. */
+  std::vector<const FunctionDeclaration *> compiled;
+  /** The errors of each function, when it was last compiled. */
+  std::vector<std::vector<Diagnostic>> errors;
+  std::size_t lastCompiled;
+};
+} // namespace dew
+#endif // !DEW_SESSION_H_
@@ -0,0 +1,445 @@
+/**
+ * Copyright (C) 2024 Charles Ancheta
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ * \file DewVM.cc
+ */
+#include "DewVM.h"
+#include <algorithm>
+#include <climits>
+#include <iostream>
+
+using namespace dew;
+
+using bc::Instr;
+using bc::Op;
+
+// GCC and Clang can jump straight through a table of label addresses, which
+// gives every handler its own indirect branch. Anything else gets a switch.
+#if defined(__GNUC__)
+#define DEW_COMPUTED_GOTO
+#endif
+
+DewVM::DewVM(const bc::Program &program, std::size_t stackSize,
+             std::size_t maxDepth)
+    : program{program}, stack(stackSize), frames(maxDepth),
+      countdowns(program.functions.size(), INT32_MAX), profiler{nullptr},
+      top{nullptr}, topFrame{nullptr} {}
+
+const std::string &DewVM::error() const { return err; }
+
+void DewVM::enableJit(uint32_t threshold) {
+  compiler = std::make_unique<Jit>(program, interpret, this);
+  std::fill(countdowns.begin(), countdowns.end(),
+            static_cast<int32_t>(std::clamp<uint32_t>(threshold, 1,
+                                                      INT32_MAX)));
+}
+
+bool DewVM::call(uint32_t function, const int64_t *args, int64_t *results) {
+  const bc::Function *fn{&program.functions[function]};
+  if (!load(function)) {
+    return false;
+  }
+  if (fn->numRegs > stack.size()) {
+    err = "stack overflow";
+    return false;
+  }
+  int64_t *regs{stack.data()};
+  for (uint16_t i{0}; i < fn->numParams; ++i) {
+    regs[i] = bc::wrap(fn->paramKinds[i], args[i]);
+  }
+  uint32_t depth{profiler ? profiler->calling() : 0};
+  if (profiler) {
+    profiler->enter(function);
+  }
+  bool ok{--countdowns[function] <= 0 && tierUp(function)
+              ? callNative(function, regs, results, regs + fn->numRegs,
+                           frames.data())
+              : execute(fn, regs, frames.data(), results)};
+  if (profiler) {
+    profiler->unwind(depth);
+  }
+  return ok;
+}
+
+bool DewVM::load(uint32_t function) {
+  const bc::Function &fn{program.functions[function]};
+  if (!fn.code.empty() ||
+      (program.materialize && program.materialize(function))) {
+    return true;
+  }
+  err = "the code of " + fn.name + " is corrupt";
+  return false;
+}
+
+bool DewVM::tierUp(uint32_t function) {
+  if (compiler && compiler->compile(function)) {
+    countdowns[function] = 0;
+    return true;
+  }
+  countdowns[function] = INT32_MAX;
+  return false;
+}
+
+bool DewVM::callNative(uint32_t function, int64_t *args, int64_t *results,
+                       int64_t *top, Frame *topFrame,
+                       std::optional<uint32_t> resumeAt) {
+  int64_t *outerTop{this->top};
+  Frame *outerFrame{this->topFrame};
+  this->top = top;
+  this->topFrame = topFrame;
+  bool ok{resumeAt ? compiler->resume(function, *resumeAt, args, results)
+                   : compiler->call(function, args, results)};
+  this->top = outerTop;
+  this->topFrame = outerFrame;
+  if (!ok) {
+    err = compiler->error();
+  }
+  return ok;
+}
+
+bool DewVM::interpret(void *vm, uint32_t function, const int64_t *args,
+                      int64_t *results, std::string &error) {
+  auto *self{static_cast<DewVM *>(vm)};
+  const bc::Function *fn{&self->program.functions[function]};
+  int64_t *regs{self->top};
+  if (!self->load(function)) {
+    error = self->err;
+    return false;
+  }
+  if (regs + fn->numRegs > self->stack.data() + self->stack.size()) {
+    error = "stack overflow in " + fn->name;
+    return false;
+  }
+  std::copy_n(args, fn->numParams, regs);
+  Profiler *profiler{self->profiler};
+  uint32_t depth{profiler ? profiler->calling() : 0};
+  if (profiler) {
+    profiler->enter(function);
+  }
+  // Calls from machine code count too; once compiled, later ones skip the
+  // interpreter altogether.
+  bool ok{--self->countdowns[function] <= 0 && self->tierUp(function)
+              ? self->callNative(function, regs, results,
+                                 regs + fn->numRegs, self->topFrame)
+              : self->execute(fn, regs, self->topFrame, results)};
+  if (profiler) {
+    profiler->unwind(depth);
+  }
+  if (!ok) {
+    error = self->err;
+    return false;
+  }
+  return true;
+}
+
+#ifdef DEW_COMPUTED_GOTO
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+#define DEW_OP(name) op_##name:
+#define DEW_DISPATCH() goto *labels[static_cast<uint8_t>(pc->op)]
+#else
+#define DEW_OP(name) case Op::name:
+#define DEW_DISPATCH() goto dispatch
+#endif
+#define DEW_NEXT()                                                             \
+  ++pc;                                                                        \
+  DEW_DISPATCH()
+#define DEW_BINARY(name, expr)                                                 \
+  DEW_OP(name) {                                                               \
+    int64_t b{r[pc->b]};                                                       \
+    int64_t c{r[pc->c]};                                                       \
+    r[pc->a] = bc::wrap(pc->kind, expr);                                       \
+    DEW_NEXT();                                                                \
+  }
+#define DEW_COMPARE(name, op)                                                  \
+  DEW_OP(name) {                                                               \
+    r[pc->a] = r[pc->b] op r[pc->c];                                           \
+    DEW_NEXT();                                                                \
+  }
+// A jump back from `from` is a loop going round again, which counts towards
+// compiling the function like a call does, but only until it's compiled.
+// The loop that made it hot finishes in machine code, from the top of the
+// next iteration.
+#define DEW_BACK_EDGE(from)                                                    \
+  if (pc <= from) {                                                            \
+    auto function{static_cast<uint32_t>(fn - functions)};                      \
+    if (countdowns[function] > 0 && --countdowns[function] == 0 &&             \
+        tierUp(function)) {                                                    \
+      if (callNative(function, r, &result, r + fn->numRegs, fp,                \
+                     static_cast<uint32_t>(pc - code))) {                      \
+        goto returnNative;                                                     \
+      } else if (!err.empty()) {                                               \
+        return false;                                                          \
+      }                                                                        \
+    }                                                                          \
+  }
+#define DEW_BRANCH(name, op)                                                   \
+  DEW_OP(name) {                                                               \
+    const Instr *from{pc};                                                     \
+    pc = r[pc->a] op r[pc->b] ? code + pc[1].imm() : pc + 2;                   \
+    DEW_BACK_EDGE(from)                                                        \
+    DEW_DISPATCH();                                                            \
+  }
+
+bool DewVM::execute(const bc::Function *fn, int64_t *regs, Frame *base,
+                    int64_t *results) {
+#ifdef DEW_COMPUTED_GOTO
+  static const void *labels[]{
+#define DEW_OP_LABEL(name) &&op_##name,
+      DEW_OPCODES(DEW_OP_LABEL)
+#undef DEW_OP_LABEL
+  };
+#endif
+  const bc::Function *functions{program.functions.data()};
+  int32_t *const countdowns{this->countdowns.data()};
+  Profiler *const profiler{this->profiler};
+  const int64_t *stackEnd{stack.data() + stack.size()};
+  Frame *const firstFrame{base};
+  Frame *const lastFrame{frames.data() + frames.size()};
+  Frame *fp{firstFrame};
+  const Instr *code{fn->code.data()};
+  const Instr *pc{code};
+  int64_t *r{regs};
+  int64_t result;
+
+#ifdef DEW_COMPUTED_GOTO
+  DEW_DISPATCH();
+#else
+dispatch:
+  switch (pc->op) {
+#endif
+  DEW_OP(Nop) { DEW_NEXT(); }
+  DEW_OP(Move) {
+    r[pc->a] = r[pc->b];
+    DEW_NEXT();
+  }
+  DEW_OP(LoadInt) {
+    r[pc->a] = static_cast<int32_t>(pc->imm());
+    DEW_NEXT();
+  }
+  DEW_OP(LoadConst) {
+    r[pc->a] = fn->constants[pc->imm()];
+    DEW_NEXT();
+  }
+  DEW_BINARY(Add, b + c)
+  DEW_OP(AddInt) {
+    r[pc->a] = bc::wrap(pc->kind, r[pc->b] + static_cast<int16_t>(pc->c));
+    DEW_NEXT();
+  }
+  DEW_BINARY(Sub, b - c)
+  // 32-bit unsigned operands can overflow a signed 64-bit product.
+  DEW_BINARY(Mul, static_cast<int64_t>(static_cast<uint64_t>(b) *
+                                       static_cast<uint64_t>(c)))
+  DEW_OP(Div) {
+    if (r[pc->c] == 0) {
+      err = "division by zero in " + fn->name;
+      return false;
+    }
+    r[pc->a] = bc::wrap(pc->kind, r[pc->b] / r[pc->c]);
+    DEW_NEXT();
+  }
+  DEW_OP(Mod) {
+    if (r[pc->c] == 0) {
+      err = "division by zero in " + fn->name;
+      return false;
+    }
+    r[pc->a] = bc::wrap(pc->kind, r[pc->b] % r[pc->c]);
+    DEW_NEXT();
+  }
+  // Shift counts are taken modulo 64, like the hardware does.
+  DEW_BINARY(ShiftLeft, static_cast<int64_t>(static_cast<uint64_t>(b)
+                                             << (c & 63)))
+  DEW_BINARY(ShiftRight, b >> (c & 63))
+  DEW_BINARY(BitAnd, b & c)
+  DEW_BINARY(BitOr, b | c)
+  DEW_BINARY(BitXor, b ^ c)
+  DEW_OP(Neg) {
+    r[pc->a] = bc::wrap(pc->kind, -r[pc->b]);
+    DEW_NEXT();
+  }
+  DEW_OP(BitNot) {
+    r[pc->a] = bc::wrap(pc->kind, ~r[pc->b]);
+    DEW_NEXT();
+  }
+  DEW_OP(Not) {
+    r[pc->a] = r[pc->b] == 0;
+    DEW_NEXT();
+  }
+  DEW_OP(Cast) {
+    r[pc->a] = bc::wrap(pc->kind, r[pc->b]);
+    DEW_NEXT();
+  }
+  DEW_COMPARE(LT, <)
+  DEW_COMPARE(LTEq, <=)
+  DEW_COMPARE(GT, >)
+  DEW_COMPARE(GTEq, >=)
+  DEW_COMPARE(Eq, ==)
+  DEW_COMPARE(Neq, !=)
+  DEW_OP(Jump) {
+    const Instr *from{pc};
+    pc = code + pc->imm();
+    DEW_BACK_EDGE(from)
+    DEW_DISPATCH();
+  }
+  DEW_OP(JumpIfZero) {
+    const Instr *from{pc};
+    pc = r[pc->a] == 0 ? code + pc->imm() : pc + 1;
+    DEW_BACK_EDGE(from)
+    DEW_DISPATCH();
+  }
+  DEW_OP(JumpIfNotZero) {
+    const Instr *from{pc};
+    pc = r[pc->a] != 0 ? code + pc->imm() : pc + 1;
+    DEW_BACK_EDGE(from)
+    DEW_DISPATCH();
+  }
+  DEW_BRANCH(JumpIfLT, <)
+  DEW_BRANCH(JumpIfLTEq, <=)
+  DEW_BRANCH(JumpIfGT, >)
+  DEW_BRANCH(JumpIfGTEq, >=)
+  DEW_BRANCH(JumpIfEq, ==)
+  DEW_BRANCH(JumpIfNeq, !=)
+  DEW_OP(Call) {
+    const bc::Function *callee{functions + pc->b};
+    // Programs loaded lazily get each body on its first call.
+    if (callee->code.empty() && !load(pc->b)) {
+      return false;
+    }
+    int64_t *next{r + fn->numRegs};
+    if (--countdowns[pc->b] <= 0 && tierUp(pc->b)) {
+      if (profiler) {
+        profiler->enter(pc->b);
+      }
+      if (!callNative(pc->b, r + pc->c, &result, next, fp)) {
+        return false;
+      }
+      if (profiler) {
+        profiler->leave();
+      }
+      if (callee->numResults == 1) {
+        r[pc->a] = result;
+      }
+      DEW_NEXT();
+    }
+    if (fp == lastFrame || next + callee->numRegs > stackEnd) {
+      err = "stack overflow in " + callee->name;
+      return false;
+    }
+    const int64_t *args{r + pc->c};
+    for (uint16_t i{0}; i < callee->numParams; ++i) {
+      next[i] = args[i];
+    }
+    *fp++ = Frame{fn, pc + 1, r, pc->a};
+    if (profiler) {
+      profiler->enter(pc->b);
+    }
+    fn = callee;
+    r = next;
+    code = pc = callee->code.data();
+    DEW_DISPATCH();
+  }
+  DEW_OP(TailCall) {
+    // The callee takes over this window and returns straight to our caller,
+    // so no frame is pushed and recursion through here runs in constant
+    // stack.
+    const bc::Function *callee{functions + pc->b};
+    if (callee->code.empty() && !load(pc->b)) {
+      return false;
+    }
+    if (profiler) {
+      profiler->replace(pc->b);
+    }
+    if (--countdowns[pc->b] <= 0 && tierUp(pc->b)) {
+      if (!callNative(pc->b, r + pc->c, &result, r + fn->numRegs, fp)) {
+        return false;
+      }
+      fn = callee;
+      goto returnNative;
+    }
+    if (r + callee->numRegs > stackEnd) {
+      err = "stack overflow in " + callee->name;
+      return false;
+    }
+    // Arguments sit at or above their destinations, so copying upwards
+    // never reads a register it has already overwritten.
+    const int64_t *args{r + pc->c};
+    for (uint16_t i{0}; i < callee->numParams; ++i) {
+      r[i] = args[i];
+    }
+    fn = callee;
+    code = pc = callee->code.data();
+    DEW_DISPATCH();
+  }
+  DEW_OP(Return) {
+    const int64_t *values{r + pc->a};
+    uint16_t count{pc->b};
+    if (fp == firstFrame) {
+      for (uint16_t i{0}; i < count; ++i) {
+        results[i] = values[i];
+      }
+      return true;
+    }
+    if (profiler) {
+      profiler->leave();
+    }
+    const Frame &caller{*--fp};
+    // The callee's window sits above the caller's, so this can't overlap.
+    int64_t *dst{caller.regs + caller.dst};
+    for (uint16_t i{0}; i < count; ++i) {
+      dst[i] = values[i];
+    }
+    fn = caller.fn;
+    r = caller.regs;
+    code = fn->code.data();
+    pc = caller.pc;
+    DEW_DISPATCH();
+  }
+  DEW_OP(Print) {
+    std::cout << r[pc->a] << "\n";
+    DEW_NEXT();
+  }
+  // Machine code ran the rest of `fn`; return what it did like Return.
+returnNative:
+  if (fp == firstFrame) {
+    if (fn->numResults == 1) {
+      results[0] = result;
+    }
+    return true;
+  }
+  if (profiler) {
+    profiler->leave();
+  }
+  {
+    const Frame &caller{*--fp};
+    if (fn->numResults == 1) {
+      caller.regs[caller.dst] = result;
+    }
+    fn = caller.fn;
+    r = caller.regs;
+    code = fn->code.data();
+    pc = caller.pc;
+    DEW_DISPATCH();
+  }
+#ifndef DEW_COMPUTED_GOTO
+  }
+  return false;
+#endif
+}
+
+#ifdef DEW_COMPUTED_GOTO
+#pragma GCC diagnostic pop
+#endif
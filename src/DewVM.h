@@ -0,0 +1,110 @@
+/**
+ * Copyright (C) 2024 Charles Ancheta
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ * \file DewVM.h
+ */
+#ifndef DEW_VM_H_
+#define DEW_VM_H_
+
+#include "bytecode.h"
+#include "jit.h"
+#include "profiler.h"
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace dew {
+/**
+ * Register machine for bc::Program. Every call gets a window of registers
+ * right after its caller's, all carved out of one preallocated stack, so
+ * calls don't allocate.
+ *
+ * With the JIT enabled, the VM is the first tier: it counts every
+ * function's calls and loop back edges, and once a function has had
+ * enough, compiles it to machine code and calls that from then on. A call
+ * whose loop made the function hot carries on in machine code from the
+ * loop's next iteration; other calls already running finish in the VM.
+ */
+class DewVM {
+public:
+  /** Calls and back edges before a function is compiled, by default. */
+  static constexpr uint32_t JIT_THRESHOLD{1000};
+
+  DewVM(const bc::Program &program, std::size_t stackSize = 1 << 20,
+        std::size_t maxDepth = 1 << 16);
+  /**
+   * Runs `function` with `args`, storing its results in `results`. Returns
+   * false and sets error() when the program traps.
+   */
+  bool call(uint32_t function, const int64_t *args, int64_t *results);
+  const std::string &error() const;
+  /** Compiles functions once called or looped `threshold` times. */
+  void enableJit(uint32_t threshold = JIT_THRESHOLD);
+  /** The second tier, if enabled. */
+  const Jit *jit() const { return compiler.get(); }
+  /** Tells `profiler` about every call from here on, or stops with null. */
+  void profileWith(Profiler *profiler) { this->profiler = profiler; }
+
+private:
+  struct Frame {
+    const bc::Function *fn;
+    const bc::Instr *pc;
+    int64_t *regs;
+    uint16_t dst;
+  };
+
+  /** Runs `fn` in the window at `regs`, pushing frames from `base` on. */
+  bool execute(const bc::Function *fn, int64_t *regs, Frame *base,
+               int64_t *results);
+  /**
+   * Makes sure `function` has its code, filling it in if the program loads
+   * bodies lazily. Sets err if it's corrupt.
+   */
+  bool load(uint32_t function);
+  /**
+   * Whether `function` runs as machine code now, compiling it if there's a
+   * JIT; functions that can't be compiled are never counted again.
+   */
+  bool tierUp(uint32_t function);
+  /**
+   * Calls compiled `function`, or with `resumeAt`, finishes the call whose
+   * registers are `args` from there. The VM's stack is in use up to `top`.
+   * Returns false with error() empty if the call couldn't be resumed.
+   */
+  bool callNative(uint32_t function, int64_t *args, int64_t *results,
+                  int64_t *top, Frame *topFrame,
+                  std::optional<uint32_t> resumeAt = std::nullopt);
+  /** Runs `function` for machine code, above where callNative left off. */
+  static bool interpret(void *vm, uint32_t function, const int64_t *args,
+                        int64_t *results, std::string &error);
+
+  const bc::Program &program;
+  std::vector<int64_t> stack;
+  std::vector<Frame> frames;
+  std::string err;
+  /** Calls and back edges left before each function is compiled. */
+  std::vector<int32_t> countdowns;
+  std::unique_ptr<Jit> compiler;
+  Profiler *profiler;
+  /** The first free register and frame while machine code runs. */
+  int64_t *top;
+  Frame *topFrame;
+};
+} // namespace dew
+#endif // !DEW_VM_H_
@@ -0,0 +1,774 @@
+/**
+ * Copyright (C) 2024 Charles Ancheta
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ * \file IRBuilder.cc
+ */
+#include "IRBuilder.h"
+#include "report.h"
+#include <algorithm>
+#include <iostream>
+
+using namespace dew;
+
+using bc::IntKind;
+using ir::BlockId;
+using ir::Opcode;
+using ir::Value;
+
+static bool isComparison(ast::BinaryOp op) {
+  switch (op) {
+  case ast::BinaryOp::GT:
+  case ast::BinaryOp::LT:
+  case ast::BinaryOp::GTEq:
+  case ast::BinaryOp::LTEq:
+  case ast::BinaryOp::Eq:
+  case ast::BinaryOp::Neq:
+    return true;
+  default:
+    return false;
+  }
+}
+
+static Opcode opcode(ast::BinaryOp op) {
+  switch (op) {
+  case ast::BinaryOp::Add:
+    return Opcode::Add;
+  case ast::BinaryOp::Sub:
+    return Opcode::Sub;
+  case ast::BinaryOp::Mul:
+    return Opcode::Mul;
+  case ast::BinaryOp::Div:
+    return Opcode::Div;
+  case ast::BinaryOp::Mod:
+    return Opcode::Mod;
+  case ast::BinaryOp::ShiftLeft:
+    return Opcode::ShiftLeft;
+  case ast::BinaryOp::ShiftRight:
+    return Opcode::ShiftRight;
+  case ast::BinaryOp::BitAnd:
+    return Opcode::BitAnd;
+  case ast::BinaryOp::BitOr:
+    return Opcode::BitOr;
+  case ast::BinaryOp::BitXor:
+    return Opcode::BitXor;
+  case ast::BinaryOp::GT:
+    return Opcode::GT;
+  case ast::BinaryOp::LT:
+    return Opcode::LT;
+  case ast::BinaryOp::GTEq:
+    return Opcode::GTEq;
+  case ast::BinaryOp::LTEq:
+    return Opcode::LTEq;
+  case ast::BinaryOp::Eq:
+    return Opcode::Eq;
+  case ast::BinaryOp::Neq:
+    return Opcode::Neq;
+  default:
+    return Opcode::Nop;
+  }
+}
+
+/** Renumbers the blocks of `fn` so that `order` becomes the layout. */
+static void renumber(ir::Function &fn, const std::vector<BlockId> &order) {
+  std::vector<BlockId> newId(fn.blocks.size());
+  for (BlockId i{0}; i < order.size(); ++i) {
+    newId[order[i]] = i;
+  }
+  std::vector<ir::Block> blocks;
+  for (const BlockId old : order) {
+    ir::Block &b{fn.blocks[old]};
+    for (BlockId &p : b.preds) {
+      p = newId[p];
+    }
+    for (BlockId &s : b.succs) {
+      s = newId[s];
+    }
+    for (const Value v : b.insts) {
+      fn[v].block = newId[old];
+    }
+    blocks.push_back(std::move(b));
+  }
+  fn.blocks = std::move(blocks);
+}
+
+IRBuilder::IRBuilder(const ast::Tree &tree)
+    : tree{tree}, decl{nullptr}, out{nullptr}, current{0}, failed{false} {}
+
+std::optional<ir::Module>
+IRBuilder::build(const std::vector<ast::Function> &functions) {
+  ir::Module module;
+  module.functions.resize(functions.size());
+  declare(functions);
+  bool ok{true};
+  for (std::size_t i{0}; i < functions.size(); ++i) {
+    ok = buildFunction(functions[i], module.functions[i]) && ok;
+  }
+  if (!ok) {
+    return std::nullopt;
+  }
+  return module;
+}
+
+bool IRBuilder::build(const std::vector<ast::Function> &functions,
+                      uint32_t index, ir::Function &out) {
+  if (decls.size() != functions.size()) {
+    declare(functions);
+  }
+  out = ir::Function{};
+  return buildFunction(functions[index], out);
+}
+
+void IRBuilder::declare(const std::vector<ast::Function> &functions) {
+  functionIndex.clear();
+  decls.clear();
+  for (uint32_t i{0}; i < functions.size(); ++i) {
+    // Calls go to the first of several functions with the same name.
+    if (!functionIndex.resolve(functions[i].decl->symbol)) {
+      functionIndex.define(functions[i].decl->symbol, i);
+    }
+    decls.push_back(functions[i].decl);
+  }
+}
+
+bool IRBuilder::buildFunction(const ast::Function &fn, ir::Function &f) {
+  Report::Function timer{fn.decl->name};
+  decl = fn.decl;
+  out = &f;
+  locals.clear();
+  varKinds.clear();
+  defs.clear();
+  sealed.clear();
+  incomplete.clear();
+  entered.clear();
+  failed = false;
+
+  f.name = std::string{decl->name};
+  for (const TypeId type : decl->returnValues) {
+    f.results.push_back(kindOf(type).value_or(IntKind::I32));
+  }
+  enter(newBlock());
+  seal(current);
+  for (const auto &param : decl->params) {
+    auto kind{kindOf(param.type).value_or(IntKind::I32)};
+    auto var{static_cast<uint32_t>(varKinds.size())};
+    varKinds.push_back(kind);
+    locals.define(param.symbol, Local{var, kind});
+    auto index{static_cast<int64_t>(f.params.size())};
+    f.params.push_back(kind);
+    write(var, current, emit(Opcode::Param, kind, {}, index));
+  }
+  // Self tail recursion becomes a loop over everything but the parameters.
+  loop.reset();
+  if (returnsSelfCall(fn.block)) {
+    loop = newBlock();
+    jump(*loop);
+    enter(*loop);
+  }
+
+  block(fn.block);
+
+  if (!out->terminator(current)) {
+    // Falling off the end returns zeroes.
+    std::vector<Value> zeroes;
+    for (const IntKind kind : f.results) {
+      zeroes.push_back(constant(kind, 0));
+    }
+    emit(Opcode::Return, IntKind::I32, std::move(zeroes));
+  }
+  if (loop) {
+    seal(*loop);
+  }
+  renumber(f, entered);
+  return !failed;
+}
+
+void IRBuilder::block(ast::Block b) {
+  if (!b) {
+    return;
+  }
+  std::size_t scope{locals.mark()};
+  for (const ast::Stmt s : tree.list(tree.block(b).statements)) {
+    stmt(s);
+  }
+  locals.leave(scope);
+}
+
+void IRBuilder::stmt(ast::Stmt s) {
+  if (!s) {
+    return;
+  }
+  switch (s.kind()) {
+  case ast::StmtKind::Var:
+    varDeclaration(tree.var(s));
+    break;
+  case ast::StmtKind::Expression: {
+    ast::Expr e{tree.expression(s).expr};
+    if (e && e.kind() == ast::ExprKind::Call) {
+      if (!print(tree.call(e))) {
+        callResults(tree.call(e));
+      }
+    } else if (e) {
+      expr(e, naturalKind(e).value_or(IntKind::I32));
+    }
+    break;
+  }
+  case ast::StmtKind::Increment:
+  case ast::StmtKind::Decrement: {
+    bool inc{s.kind() == ast::StmtKind::Increment};
+    const Local *local{
+        lvalue(inc ? tree.increment(s).expr : tree.decrement(s).expr)};
+    if (local) {
+      Value old{read(local->var, current)};
+      Value one{constant(local->kind, 1)};
+      write(local->var, current,
+            emit(inc ? Opcode::Add : Opcode::Sub, local->kind, {old, one}));
+    }
+    break;
+  }
+  case ast::StmtKind::Assignment:
+    assignment(tree.assignment(s));
+    break;
+  case ast::StmtKind::For:
+    forStmt(tree.forStmt(s));
+    break;
+  case ast::StmtKind::Return:
+    returnStmt(tree.returnStmt(s));
+    break;
+  case ast::StmtKind::Block:
+    block(s);
+    break;
+  case ast::StmtKind::If:
+    ifStmt(tree.ifStmt(s));
+    break;
+  }
+}
+
+void IRBuilder::varDeclaration(const ast::VarDeclaration &var) {
+  IntKind kind{kindOf(var.type).value_or(IntKind::I32)};
+  auto names{tree.list(var.names)};
+  auto values{tree.list(var.values)};
+  std::vector<Value> initial;
+  if (values.size() == 1 && names.size() > 1 &&
+      values[0].kind() == ast::ExprKind::Call) {
+    auto results{callResults(tree.call(values[0]))};
+    if (results && results->size() < names.size()) {
+      error("wrong number of values in declaration");
+      results.reset();
+    }
+    for (std::size_t i{0}; results && i < names.size(); ++i) {
+      initial.push_back(cast((*results)[i], kind));
+    }
+  } else if (values.empty()) {
+    for (std::size_t i{0}; i < names.size(); ++i) {
+      initial.push_back(constant(kind, 0));
+    }
+  } else if (values.size() == names.size()) {
+    for (const ast::Expr value : values) {
+      initial.push_back(expr(value, kind));
+    }
+  } else {
+    error("wrong number of values in declaration");
+  }
+  for (std::size_t i{0}; i < names.size(); ++i) {
+    auto v{static_cast<uint32_t>(varKinds.size())};
+    varKinds.push_back(kind);
+    locals.define(tree.identifier(names[i]).symbol, Local{v, kind});
+    write(v, current, i < initial.size() ? initial[i] : constant(kind, 0));
+  }
+}
+
+void IRBuilder::assignment(const ast::AssignmentStatement &assign) {
+  auto left{tree.list(assign.left)};
+  auto right{tree.list(assign.right)};
+  std::vector<const Local *> targets;
+  for (const ast::Expr e : left) {
+    targets.push_back(lvalue(e));
+  }
+  if (std::find(targets.begin(), targets.end(), nullptr) != targets.end()) {
+    return;
+  }
+
+  // Every value is computed before any target changes.
+  std::vector<Value> values;
+  if (right.size() == 1 && left.size() > 1 &&
+      right[0].kind() == ast::ExprKind::Call) {
+    auto results{callResults(tree.call(right[0]))};
+    if (results && results->size() < targets.size()) {
+      error("wrong number of values in assignment");
+      return;
+    } else if (!results) {
+      return;
+    }
+    for (std::size_t i{0}; i < targets.size(); ++i) {
+      values.push_back(cast((*results)[i], targets[i]->kind));
+    }
+  } else if (right.size() != left.size()) {
+    error("wrong number of values in assignment");
+    return;
+  } else {
+    for (std::size_t i{0}; i < right.size(); ++i) {
+      values.push_back(expr(right[i], targets[i]->kind));
+    }
+  }
+  for (std::size_t i{0}; i < targets.size(); ++i) {
+    write(targets[i]->var, current, values[i]);
+  }
+}
+
+void IRBuilder::forStmt(const ast::ForStatement &loop) {
+  std::size_t scope{locals.mark()};
+  stmt(loop.initial);
+
+  // The body is generated before the condition so that the layout tests it
+  // at the bottom, and each iteration only takes one branch.
+  BlockId body{newBlock()};
+  if (!loop.condition) {
+    jump(body);
+    enter(body);
+    block(loop.body);
+    stmt(loop.update);
+    jump(body);
+    seal(body);
+    enter(newBlock());
+    seal(current);
+    locals.leave(scope);
+    return;
+  }
+  BlockId condition{newBlock()};
+  BlockId exit{newBlock()};
+  jump(condition);
+  enter(body);
+  block(loop.body);
+  stmt(loop.update);
+  jump(condition);
+  seal(condition);
+  enter(condition);
+  branch(loop.condition, body, exit);
+  seal(body);
+  seal(exit);
+  enter(exit);
+  locals.leave(scope);
+}
+
+void IRBuilder::ifStmt(const ast::IfStatement &node) {
+  BlockId consequence{newBlock()};
+  std::optional<BlockId> alternative;
+  if (node.alternative) {
+    alternative = newBlock();
+  }
+  BlockId end{newBlock()};
+  branch(node.condition, consequence, alternative.value_or(end));
+  seal(consequence);
+  enter(consequence);
+  block(node.consequence);
+  jump(end);
+  if (alternative) {
+    seal(*alternative);
+    enter(*alternative);
+    stmt(node.alternative);
+    jump(end);
+  }
+  seal(end);
+  enter(end);
+}
+
+void IRBuilder::returnStmt(const ast::ReturnStatement &ret) {
+  auto values{tree.list(ret.values)};
+  if (values.size() != decl->returnValues.size()) {
+    error("wrong number of return values");
+  } else if (values.size() == 1 && loop && selfCall(values[0])) {
+    auto args{tree.list(tree.call(values[0]).arguments)};
+    std::vector<Value> next;
+    for (std::size_t i{0}; i < args.size(); ++i) {
+      next.push_back(expr(args[i], out->params[i]));
+    }
+    // The parameters were the first variables defined.
+    for (uint32_t i{0}; i < next.size(); ++i) {
+      write(i, current, next[i]);
+    }
+    jump(*loop);
+  } else {
+    std::vector<Value> results;
+    for (std::size_t i{0}; i < values.size(); ++i) {
+      results.push_back(expr(values[i], out->results[i]));
+    }
+    emit(Opcode::Return, IntKind::I32, std::move(results));
+  }
+  // Anything after a return goes into a block nothing jumps to, which
+  // simplifyCFG then drops.
+  enter(newBlock());
+  seal(current);
+}
+
+Value IRBuilder::expr(ast::Expr e, IntKind kind) {
+  if (!e) {
+    error("invalid expression");
+    return constant(kind, 0);
+  }
+  switch (e.kind()) {
+  case ast::ExprKind::Binary: {
+    ast::BinaryOp op{tree.binary(e).op};
+    if (op == ast::BinaryOp::And || op == ast::BinaryOp::Or) {
+      return logical(e, kind);
+    }
+    return binary(tree.binary(e), kind);
+  }
+  case ast::ExprKind::Unary:
+    return unary(tree.unary(e), kind);
+  case ast::ExprKind::Identifier: {
+    const ast::Identifier &id{tree.identifier(e)};
+    const Local *local{resolve(id.symbol)};
+    if (!local) {
+      error("undefined variable `" + std::string{id.name} + "`");
+      return constant(kind, 0);
+    }
+    return cast(read(local->var, current), kind);
+  }
+  case ast::ExprKind::Integer: {
+    uint64_t num{tree.integer(e).num};
+    if (!bc::fits(kind, num)) {
+      error("integer literal " + std::to_string(num) + " doesn't fit in " +
+            bc::kindName(kind));
+    }
+    return constant(kind, num);
+  }
+  case ast::ExprKind::Call:
+    return call(tree.call(e), kind);
+  }
+  return constant(kind, 0);
+}
+
+Value IRBuilder::binary(const ast::BinaryExpression &bin, IntKind kind) {
+  IntKind operands{
+      naturalKind(bin.left).value_or(naturalKind(bin.right).value_or(kind))};
+  Value l{expr(bin.left, operands)};
+  Value r{expr(bin.right, operands)};
+  if (isComparison(bin.op)) {
+    // Comparisons yield 0 or 1, which fits any kind.
+    return emit(opcode(bin.op), kind, {l, r});
+  }
+  return cast(emit(opcode(bin.op), operands, {l, r}), kind);
+}
+
+Value IRBuilder::logical(ast::Expr e, IntKind kind) {
+  BlockId ifTrue{newBlock()};
+  BlockId ifFalse{newBlock()};
+  BlockId end{newBlock()};
+  branch(e, ifTrue, ifFalse);
+  seal(ifTrue);
+  seal(ifFalse);
+  enter(ifTrue);
+  Value one{constant(kind, 1)};
+  jump(end);
+  enter(ifFalse);
+  Value zero{constant(kind, 0)};
+  jump(end);
+  seal(end);
+  enter(end);
+  Value phi{out->addPhi(end, kind)};
+  (*out)[phi].operands = {one, zero};
+  return phi;
+}
+
+Value IRBuilder::unary(const ast::UnaryExpression &un, IntKind kind) {
+  switch (un.op) {
+  case ast::UnaryOp::Pos:
+    return expr(un.operand, kind);
+  case ast::UnaryOp::Neg:
+    return emit(Opcode::Neg, kind, {expr(un.operand, kind)});
+  case ast::UnaryOp::BitNot:
+    return emit(Opcode::BitNot, kind, {expr(un.operand, kind)});
+  case ast::UnaryOp::Not: {
+    IntKind operand{naturalKind(un.operand).value_or(kind)};
+    return emit(Opcode::Not, kind, {expr(un.operand, operand)});
+  }
+  case ast::UnaryOp::Deref:
+  case ast::UnaryOp::Ref:
+    error("pointers are not supported");
+    break;
+  }
+  return constant(kind, 0);
+}
+
+Value IRBuilder::call(const ast::CallExpression &node, IntKind kind) {
+  if (print(node)) {
+    return constant(kind, 0);
+  }
+  auto results{callResults(node)};
+  if (!results || results->empty()) {
+    return constant(kind, 0);
+  }
+  return cast(results->front(), kind);
+}
+
+bool IRBuilder::print(const ast::CallExpression &node) {
+  if (function(node.function) ||
+      node.function.kind() != ast::ExprKind::Identifier ||
+      tree.identifier(node.function).name != "print") {
+    return false;
+  }
+  for (const ast::Expr arg : tree.list(node.arguments)) {
+    emit(Opcode::Print, IntKind::I32,
+         {expr(arg, naturalKind(arg).value_or(IntKind::I32))});
+  }
+  return true;
+}
+
+std::optional<std::vector<Value>>
+IRBuilder::callResults(const ast::CallExpression &node) {
+  auto args{tree.list(node.arguments)};
+  auto index{function(node.function)};
+  if (!index) {
+    error("call to undefined function");
+    return std::nullopt;
+  }
+
+  const FunctionDeclaration *callee{decls[*index]};
+  if (args.size() != callee->params.size()) {
+    error("wrong number of arguments to `" + std::string{callee->name} + "`");
+    return std::nullopt;
+  }
+  std::vector<Value> values;
+  for (std::size_t i{0}; i < args.size(); ++i) {
+    values.push_back(
+        expr(args[i], kindOf(callee->params[i].type).value_or(IntKind::I32)));
+  }
+  std::vector<IntKind> kinds;
+  for (const TypeId type : callee->returnValues) {
+    kinds.push_back(bc::intKind(type).value_or(IntKind::I32));
+  }
+  Value c{emit(Opcode::Call, kinds.empty() ? IntKind::I32 : kinds[0],
+               std::move(values), *index)};
+  std::vector<Value> results;
+  for (std::size_t i{0}; i < kinds.size(); ++i) {
+    results.push_back(i == 0 ? c
+                             : emit(Opcode::Result, kinds[i], {c},
+                                    static_cast<int64_t>(i)));
+  }
+  return results;
+}
+
+bool IRBuilder::selfCall(ast::Expr e) const {
+  if (!e || e.kind() != ast::ExprKind::Call) {
+    return false;
+  }
+  const ast::CallExpression &call{tree.call(e)};
+  auto index{function(call.function)};
+  return index && decls[*index] == decl &&
+         tree.list(call.arguments).size() == decl->params.size();
+}
+
+bool IRBuilder::returnsSelfCall(ast::Stmt s) const {
+  if (!s) {
+    return false;
+  }
+  switch (s.kind()) {
+  case ast::StmtKind::Return: {
+    auto values{tree.list(tree.returnStmt(s).values)};
+    return values.size() == 1 && decl->returnValues.size() == 1 &&
+           selfCall(values[0]);
+  }
+  case ast::StmtKind::Block:
+    for (const ast::Stmt child : tree.list(tree.block(s).statements)) {
+      if (returnsSelfCall(child)) {
+        return true;
+      }
+    }
+    return false;
+  case ast::StmtKind::For:
+    return returnsSelfCall(tree.forStmt(s).body);
+  case ast::StmtKind::If:
+    return returnsSelfCall(tree.ifStmt(s).consequence) ||
+           returnsSelfCall(tree.ifStmt(s).alternative);
+  default:
+    return false;
+  }
+}
+
+void IRBuilder::branch(ast::Expr cond, BlockId ifTrue, BlockId ifFalse) {
+  if (cond && cond.kind() == ast::ExprKind::Binary) {
+    const ast::BinaryExpression &bin{tree.binary(cond)};
+    if (isComparison(bin.op)) {
+      IntKind operands{naturalKind(bin.left).value_or(
+          naturalKind(bin.right).value_or(IntKind::I32))};
+      Value l{expr(bin.left, operands)};
+      Value r{expr(bin.right, operands)};
+      branchOn(emit(opcode(bin.op), IntKind::I32, {l, r}), ifTrue, ifFalse);
+      return;
+    }
+    bool isAnd{bin.op == ast::BinaryOp::And};
+    if (isAnd || bin.op == ast::BinaryOp::Or) {
+      // The right side only runs when the left side doesn't decide it.
+      BlockId right{newBlock()};
+      if (isAnd) {
+        branch(bin.left, right, ifFalse);
+      } else {
+        branch(bin.left, ifTrue, right);
+      }
+      seal(right);
+      enter(right);
+      branch(bin.right, ifTrue, ifFalse);
+      return;
+    }
+  } else if (cond && cond.kind() == ast::ExprKind::Unary &&
+             tree.unary(cond).op == ast::UnaryOp::Not) {
+    branch(tree.unary(cond).operand, ifFalse, ifTrue);
+    return;
+  }
+  branchOn(expr(cond, naturalKind(cond).value_or(IntKind::I32)), ifTrue,
+           ifFalse);
+}
+
+std::optional<IntKind> IRBuilder::naturalKind(ast::Expr e) const {
+  return bc::intKind(tree.type(e));
+}
+
+const IRBuilder::Local *IRBuilder::resolve(Symbol symbol) const {
+  return locals.resolve(symbol);
+}
+
+const IRBuilder::Local *IRBuilder::lvalue(ast::Expr e) {
+  if (!e || e.kind() != ast::ExprKind::Identifier) {
+    error("can only assign to variables");
+    return nullptr;
+  }
+  const ast::Identifier &id{tree.identifier(e)};
+  const Local *local{resolve(id.symbol)};
+  if (!local) {
+    error("undefined variable `" + std::string{id.name} + "`");
+  }
+  return local;
+}
+
+std::optional<uint32_t> IRBuilder::function(ast::Expr callee) const {
+  if (!callee || callee.kind() != ast::ExprKind::Identifier) {
+    return std::nullopt;
+  }
+  const uint32_t *index{functionIndex.resolve(tree.identifier(callee).symbol)};
+  if (!index) {
+    return std::nullopt;
+  }
+  return *index;
+}
+
+std::optional<IntKind> IRBuilder::kindOf(TypeId type) {
+  auto kind{bc::intKind(type)};
+  if (!kind) {
+    error("unknown type");
+  }
+  return kind;
+}
+
+BlockId IRBuilder::newBlock() {
+  defs.emplace_back();
+  sealed.push_back(false);
+  incomplete.emplace_back();
+  return out->addBlock();
+}
+
+void IRBuilder::seal(BlockId b) {
+  for (const auto &[var, phi] : incomplete[b]) {
+    addPhiOperands(var, phi);
+  }
+  incomplete[b].clear();
+  sealed[b] = true;
+}
+
+void IRBuilder::write(uint32_t var, BlockId b, Value v) { defs[b][var] = v; }
+
+Value IRBuilder::read(uint32_t var, BlockId b) {
+  auto def{defs[b].find(var)};
+  if (def != defs[b].end()) {
+    return def->second;
+  }
+  Value v;
+  const std::vector<BlockId> &preds{out->blocks[b].preds};
+  if (!sealed[b]) {
+    v = out->addPhi(b, varKinds[var]);
+    incomplete[b].emplace_back(var, v);
+  } else if (preds.size() == 1) {
+    v = read(var, preds[0]);
+  } else if (preds.empty()) {
+    // Only unreachable blocks get here; any value will do.
+    v = out->addPhi(b, varKinds[var]);
+    (*out)[v].op = Opcode::Const;
+  } else {
+    // Record the phi before looking through the predecessors so that
+    // loops find it instead of recursing forever.
+    v = out->addPhi(b, varKinds[var]);
+    write(var, b, v);
+    addPhiOperands(var, v);
+  }
+  write(var, b, v);
+  return v;
+}
+
+void IRBuilder::addPhiOperands(uint32_t var, Value phi) {
+  BlockId b{(*out)[phi].block};
+  for (std::size_t i{0}; i < out->blocks[b].preds.size(); ++i) {
+    Value operand{read(var, out->blocks[b].preds[i])};
+    (*out)[phi].operands.push_back(operand);
+  }
+}
+
+Value IRBuilder::emit(Opcode op, IntKind type, std::vector<Value> operands,
+                      int64_t imm) {
+  return out->append(current, op, type, std::move(operands), imm);
+}
+
+Value IRBuilder::constant(IntKind type, uint64_t num) {
+  return emit(Opcode::Const, type, {},
+              bc::wrap(type, static_cast<int64_t>(num)));
+}
+
+Value IRBuilder::cast(Value v, IntKind type) {
+  if ((*out)[v].type == type) {
+    return v;
+  }
+  return emit(Opcode::Cast, type, {v});
+}
+
+void IRBuilder::jump(BlockId to) {
+  emit(Opcode::Jump, IntKind::I32);
+  out->addEdge(current, to);
+}
+
+void IRBuilder::branchOn(Value cond, BlockId ifTrue, BlockId ifFalse) {
+  emit(Opcode::Branch, IntKind::I32, {cond});
+  out->addEdge(current, ifTrue);
+  out->addEdge(current, ifFalse);
+}
+
+void IRBuilder::enter(BlockId b) {
+  current = b;
+  entered.push_back(b);
+}
+
+bool IRBuilder::reachable() const {
+  return current == 0 || !sealed[current] ||
+         !out->blocks[current].preds.empty();
+}
+
+void IRBuilder::error(std::string_view message) {
+  // Code after a return is never compiled by DewCompiler either, so it
+  // doesn't get to fail the build.
+  if (!reachable()) {
+    return;
+  }
+  std::cerr << decl->name << ": " << message << "\n";
+  failed = true;
+}
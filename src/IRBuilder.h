@@ -0,0 +1,141 @@
+/**
+ * Copyright (C) 2024 Charles Ancheta
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ * \file IRBuilder.h
+ */
+#ifndef DEW_IR_BUILDER_H_
+#define DEW_IR_BUILDER_H_
+
+#include "ast.h"
+#include "ir.h"
+#include "symbols.h"
+#include <optional>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace dew {
+/**
+ * Builds SSA form straight from the AST, following Braun et al., "Simple
+ * and Efficient Construction of Static Single Assignment Form": variables
+ * are looked up through the predecessors of the current block, with phis
+ * placed only where definitions meet. Typing follows DewCompiler exactly, so
+ * both paths give programs the same meaning.
+ *
+ * Phis that turn out to be trivial are left for propagateCopies to clean up.
+ */
+class IRBuilder {
+public:
+  IRBuilder(const ast::Tree &tree);
+  /** Errors are reported on std::cerr. */
+  std::optional<ir::Module> build(const std::vector<ast::Function> &functions);
+  /**
+   * Builds `functions[index]` alone into `out`, for callers that hand over
+   * the functions one at a time with the declarations all in place.
+   */
+  bool build(const std::vector<ast::Function> &functions, uint32_t index,
+             ir::Function &out);
+
+private:
+  struct Local {
+    uint32_t var;
+    bc::IntKind kind;
+  };
+
+  void declare(const std::vector<ast::Function> &functions);
+  bool buildFunction(const ast::Function &fn, ir::Function &out);
+
+  void stmt(ast::Stmt s);
+  void block(ast::Block b);
+  void varDeclaration(const ast::VarDeclaration &var);
+  void assignment(const ast::AssignmentStatement &assign);
+  void forStmt(const ast::ForStatement &loop);
+  void ifStmt(const ast::IfStatement &node);
+  void returnStmt(const ast::ReturnStatement &ret);
+
+  ir::Value expr(ast::Expr e, bc::IntKind kind);
+  ir::Value binary(const ast::BinaryExpression &bin, bc::IntKind kind);
+  ir::Value logical(ast::Expr e, bc::IntKind kind);
+  ir::Value unary(const ast::UnaryExpression &un, bc::IntKind kind);
+  ir::Value call(const ast::CallExpression &call, bc::IntKind kind);
+  /** Emits `call`, returning one value per result of the callee. */
+  std::optional<std::vector<ir::Value>>
+  callResults(const ast::CallExpression &call);
+  /** Handles the `print` builtin, returning false for any other call. */
+  bool print(const ast::CallExpression &call);
+  /** Whether `e` calls the function being built with the right arity. */
+  bool selfCall(ast::Expr e) const;
+  /** Whether `s` has a `return` of a selfCall anywhere in it. */
+  bool returnsSelfCall(ast::Stmt s) const;
+  /** Ends the current block, going to `ifTrue` or `ifFalse` on `cond`. */
+  void branch(ast::Expr cond, ir::BlockId ifTrue, ir::BlockId ifFalse);
+  /** The kind the TypeChecker found `e` has of its own, if any. */
+  std::optional<bc::IntKind> naturalKind(ast::Expr e) const;
+
+  const Local *resolve(Symbol symbol) const;
+  const Local *lvalue(ast::Expr e);
+  std::optional<uint32_t> function(ast::Expr callee) const;
+  std::optional<bc::IntKind> kindOf(TypeId type);
+
+  // SSA construction.
+  ir::BlockId newBlock();
+  /** Marks that `b` has all its predecessors. */
+  void seal(ir::BlockId b);
+  void write(uint32_t var, ir::BlockId b, ir::Value v);
+  ir::Value read(uint32_t var, ir::BlockId b);
+  void addPhiOperands(uint32_t var, ir::Value phi);
+
+  ir::Value emit(ir::Opcode op, bc::IntKind type,
+                 std::vector<ir::Value> operands = {}, int64_t imm = 0);
+  ir::Value constant(bc::IntKind type, uint64_t num);
+  ir::Value cast(ir::Value v, bc::IntKind type);
+  void jump(ir::BlockId to);
+  void branchOn(ir::Value cond, ir::BlockId ifTrue, ir::BlockId ifFalse);
+  /** Continues in `b`, which becomes the block new code goes into. */
+  void enter(ir::BlockId b);
+  bool reachable() const;
+  void error(std::string_view message);
+
+  const ast::Tree &tree;
+  ScopeTable<uint32_t> functionIndex;
+  std::vector<const FunctionDeclaration *> decls;
+
+  // State for the function being built.
+  const FunctionDeclaration *decl;
+  ir::Function *out;
+  ir::BlockId current;
+  /**
+   * Where returns of a self call jump back to, after passing the arguments
+   * in the parameters' variables. Sealed once the whole body is built.
+   */
+  std::optional<ir::BlockId> loop;
+  ScopeTable<Local> locals;
+  std::vector<bc::IntKind> varKinds;
+  /** The value of each variable at the end of each block, once known. */
+  std::vector<std::unordered_map<uint32_t, ir::Value>> defs;
+  std::vector<bool> sealed;
+  /**
+   * Blocks in the order code first went into them, which is source order
+   * and becomes the layout.
+   */
+  std::vector<ir::BlockId> entered;
+  /** Phis waiting for their block to be sealed, with their variables. */
+  std::vector<std::vector<std::pair<uint32_t, ir::Value>>> incomplete;
+  bool failed;
+};
+} // namespace dew
+#endif // !DEW_IR_BUILDER_H_
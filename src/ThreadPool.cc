@@ -0,0 +1,109 @@
+/**
+ * Copyright (C) 2024 Charles Ancheta
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ * \file ThreadPool.cc
+ */
+#include "ThreadPool.h"
+
+using namespace dew;
+
+ThreadPool::ThreadPool(unsigned threads)
+    : shares(threads == 0 ? 1 : threads), task{nullptr}, batch{0}, busy{0},
+      stopping{false} {
+  for (unsigned i{1}; i < shares.size(); ++i) {
+    this->threads.emplace_back([this, i] { loop(i); });
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> guard{lock};
+    stopping = true;
+  }
+  wake.notify_all();
+  for (std::thread &t : threads) {
+    t.join();
+  }
+}
+
+unsigned ThreadPool::size() const {
+  return static_cast<unsigned>(shares.size());
+}
+
+void ThreadPool::run(std::size_t count, const Task &t) {
+  std::size_t n{shares.size()};
+  for (std::size_t i{0}; i < n; ++i) {
+    std::lock_guard<std::mutex> guard{shares[i].lock};
+    shares[i].begin = count * i / n;
+    shares[i].end = count * (i + 1) / n;
+  }
+  {
+    std::lock_guard<std::mutex> guard{lock};
+    task = &t;
+    ++batch;
+    busy = static_cast<unsigned>(threads.size());
+  }
+  wake.notify_all();
+  work(0);
+  std::unique_lock<std::mutex> guard{lock};
+  done.wait(guard, [&] { return busy == 0; });
+  task = nullptr;
+}
+
+void ThreadPool::loop(unsigned worker) {
+  std::size_t seen{0};
+  for (;;) {
+    {
+      std::unique_lock<std::mutex> guard{lock};
+      wake.wait(guard, [&] { return stopping || batch != seen; });
+      if (stopping) {
+        return;
+      }
+      seen = batch;
+    }
+    work(worker);
+    std::lock_guard<std::mutex> guard{lock};
+    if (--busy == 0) {
+      done.notify_one();
+    }
+  }
+}
+
+void ThreadPool::work(unsigned worker) {
+  std::size_t index;
+  while (take(shares[worker], true, index)) {
+    (*task)(worker, index);
+  }
+  // Steal one task at a time from whoever has some left.
+  for (std::size_t i{1}; i < shares.size();) {
+    Share &victim{shares[(worker + i) % shares.size()]};
+    if (take(victim, false, index)) {
+      (*task)(worker, index);
+    } else {
+      ++i;
+    }
+  }
+}
+
+bool ThreadPool::take(Share &share, bool front, std::size_t &index) {
+  std::lock_guard<std::mutex> guard{share.lock};
+  if (share.begin == share.end) {
+    return false;
+  }
+  index = front ? share.begin++ : --share.end;
+  return true;
+}
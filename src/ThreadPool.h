@@ -0,0 +1,75 @@
+/**
+ * Copyright (C) 2024 Charles Ancheta
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ * \file ThreadPool.h
+ */
+#ifndef DEW_THREAD_POOL_H_
+#define DEW_THREAD_POOL_H_
+
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace dew {
+/**
+ * Worker threads for running batches of independent, indexed tasks. Each
+ * worker starts on its own contiguous share of a batch and, once that runs
+ * out, steals from the far end of the others' shares, so uneven tasks still
+ * keep every thread busy. The calling thread works as worker 0.
+ */
+class ThreadPool {
+public:
+  using Task = std::function<void(unsigned worker, std::size_t index)>;
+
+  /** A pool of `threads` workers in all, counting the caller. */
+  ThreadPool(unsigned threads);
+  ~ThreadPool();
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+  unsigned size() const;
+  /** Runs `task` for every index in [0, count), returning once all ran. */
+  void run(std::size_t count, const Task &task);
+
+private:
+  /** The indices a worker has left, taken from both ends. */
+  struct Share {
+    std::mutex lock;
+    std::size_t begin;
+    std::size_t end;
+  };
+
+  void loop(unsigned worker);
+  void work(unsigned worker);
+  bool take(Share &share, bool front, std::size_t &index);
+
+  std::vector<std::thread> threads;
+  std::vector<Share> shares;
+  std::mutex lock;
+  std::condition_variable wake;
+  std::condition_variable done;
+  const Task *task;
+  /** Bumped for every batch, so that workers can tell a new one apart. */
+  std::size_t batch;
+  unsigned busy;
+  bool stopping;
+};
+} // namespace dew
+#endif // !DEW_THREAD_POOL_H_
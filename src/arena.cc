@@ -0,0 +1,88 @@
+/**
+ * Copyright (C) 2024 Charles Ancheta
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ * \file arena.cc
+ */
+#include "arena.h"
+#include <cstdint>
+#include <new>
+
+using namespace dew;
+
+constexpr std::size_t MIN_CHUNK_SIZE{64 * 1024};
+constexpr std::size_t MAX_CHUNK_SIZE{4 * 1024 * 1024};
+
+Arena::Arena()
+    : head{nullptr}, cur{nullptr}, end{nullptr}, finalizers{nullptr},
+      reservedBytes{0} {}
+
+Arena::~Arena() { reset(); }
+
+void Arena::reset() {
+  for (Finalizer *f{finalizers}; f != nullptr; f = f->next) {
+    f->destroy(f->object);
+  }
+  finalizers = nullptr;
+  while (head != nullptr) {
+    Chunk *prev{head->prev};
+    ::operator delete(head);
+    head = prev;
+  }
+  cur = end = nullptr;
+  reservedBytes = 0;
+}
+
+void Arena::grow(std::size_t minSize) {
+  // Double the chunk size as the arena fills up so that big inputs only touch
+  // the heap a handful of times.
+  std::size_t size{head == nullptr ? MIN_CHUNK_SIZE : head->size * 2};
+  if (size > MAX_CHUNK_SIZE) {
+    size = MAX_CHUNK_SIZE;
+  }
+  minSize += sizeof(Chunk) + alignof(std::max_align_t);
+  if (size < minSize) {
+    size = minSize;
+  }
+  auto chunk{static_cast<Chunk *>(::operator new(size))};
+  chunk->prev = head;
+  chunk->size = size;
+  head = chunk;
+  cur = reinterpret_cast<char *>(chunk + 1);
+  end = reinterpret_cast<char *>(chunk) + size;
+  reservedBytes += size;
+}
+
+void *Arena::allocate(std::size_t size, std::size_t align) {
+  auto aligned{[&]() {
+    auto p{reinterpret_cast<std::uintptr_t>(cur)};
+    return reinterpret_cast<char *>((p + align - 1) & ~(align - 1));
+  }};
+  char *p{cur == nullptr ? nullptr : aligned()};
+  if (p == nullptr || p + size > end) {
+    grow(size + align);
+    p = aligned();
+  }
+  cur = p + size;
+  return p;
+}
+
+void Arena::addFinalizer(void (*destroy)(void *), void *object) {
+  auto f{static_cast<Finalizer *>(
+      allocate(sizeof(Finalizer), alignof(Finalizer)))};
+  *f = Finalizer{destroy, object, finalizers};
+  finalizers = f;
+}
@@ -0,0 +1,107 @@
+/**
+ * Copyright (C) 2024 Charles Ancheta
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ * \file arena.h
+ */
+#ifndef DEW_ARENA_H_
+#define DEW_ARENA_H_
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace dew {
+/**
+ * Non-owning view of a contiguous array, usually one handed out by an Arena.
+ */
+template <typename T> class Span {
+public:
+  Span() : ptr{nullptr}, count{0} {}
+  Span(T *ptr, std::size_t count) : ptr{ptr}, count{count} {}
+  T *begin() const { return ptr; }
+  T *end() const { return ptr + count; }
+  T &operator[](std::size_t i) const { return ptr[i]; }
+  std::size_t size() const { return count; }
+  bool empty() const { return count == 0; }
+
+private:
+  T *ptr;
+  std::size_t count;
+};
+
+/**
+ * Bump allocator. Memory is handed out from large chunks and is only given
+ * back all at once, when the arena is reset or destroyed. Objects that need
+ * their destructor run are remembered and destroyed in reverse order.
+ */
+class Arena {
+public:
+  Arena();
+  ~Arena();
+  Arena(const Arena &) = delete;
+  Arena &operator=(const Arena &) = delete;
+
+  void *allocate(std::size_t size, std::size_t align);
+  void reset();
+  /** Total bytes reserved from the system, including unused chunk tails. */
+  std::size_t reserved() const { return reservedBytes; }
+
+  template <typename T, typename... Args> T *make(Args &&...args) {
+    T *obj{new (allocate(sizeof(T), alignof(T)))
+               T{std::forward<Args>(args)...}};
+    if constexpr (!std::is_trivially_destructible_v<T>) {
+      addFinalizer([](void *p) { static_cast<T *>(p)->~T(); }, obj);
+    }
+    return obj;
+  }
+
+  /** Copies `count` trivially destructible values into the arena. */
+  template <typename T> Span<T> copy(const T *first, std::size_t count) {
+    static_assert(std::is_trivially_destructible_v<T>);
+    if (count == 0) {
+      return Span<T>{};
+    }
+    T *data{static_cast<T *>(allocate(sizeof(T) * count, alignof(T)))};
+    for (std::size_t i{0}; i < count; ++i) {
+      new (data + i) T{first[i]};
+    }
+    return Span<T>{data, count};
+  }
+
+private:
+  struct Chunk {
+    Chunk *prev;
+    std::size_t size;
+  };
+  struct Finalizer {
+    void (*destroy)(void *);
+    void *object;
+    Finalizer *next;
+  };
+
+  void addFinalizer(void (*destroy)(void *), void *object);
+  void grow(std::size_t minSize);
+
+  Chunk *head;
+  char *cur;
+  char *end;
+  Finalizer *finalizers;
+  std::size_t reservedBytes;
+};
+} // namespace dew
+#endif // !DEW_ARENA_H_
@@ -0,0 +1,195 @@
+/**
+ * Copyright (C) 2024 Charles Ancheta
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ * \file ast.cc
+ */
+#include "ast.h"
+#include <algorithm>
+
+using namespace dew;
+
+void ast::Tree::clear() {
+  binaries.clear();
+  unaries.clear();
+  identifiers.clear();
+  integers.clear();
+  calls.clear();
+  vars.clear();
+  expressionStmts.clear();
+  increments.clear();
+  decrements.clear();
+  assignments.clear();
+  fors.clear();
+  returns.clear();
+  blocks.clear();
+  ifs.clear();
+  exprLists.clear();
+  stmtLists.clear();
+}
+
+/** Appends `from` to `to`, fixing up each copy. */
+template <typename T, typename Fix>
+static void appendAll(std::vector<T> &to, const std::vector<T> &from,
+                      Fix fix) {
+  to.reserve(to.size() + from.size());
+  for (const T &node : from) {
+    to.push_back(node);
+    fix(to.back());
+  }
+}
+
+ast::Relocation ast::Tree::append(const Tree &other) {
+  // Every offset has to be known before any node is fixed up.
+  Relocation r;
+  r.exprs[static_cast<int>(ExprKind::Binary)] = binaries.size();
+  r.exprs[static_cast<int>(ExprKind::Unary)] = unaries.size();
+  r.exprs[static_cast<int>(ExprKind::Identifier)] = identifiers.size();
+  r.exprs[static_cast<int>(ExprKind::Integer)] = integers.size();
+  r.exprs[static_cast<int>(ExprKind::Call)] = calls.size();
+  r.stmts[static_cast<int>(StmtKind::Var)] = vars.size();
+  r.stmts[static_cast<int>(StmtKind::Expression)] = expressionStmts.size();
+  r.stmts[static_cast<int>(StmtKind::Increment)] = increments.size();
+  r.stmts[static_cast<int>(StmtKind::Decrement)] = decrements.size();
+  r.stmts[static_cast<int>(StmtKind::Assignment)] = assignments.size();
+  r.stmts[static_cast<int>(StmtKind::For)] = fors.size();
+  r.stmts[static_cast<int>(StmtKind::Return)] = returns.size();
+  r.stmts[static_cast<int>(StmtKind::Block)] = blocks.size();
+  r.stmts[static_cast<int>(StmtKind::If)] = ifs.size();
+  r.exprList = exprLists.size();
+  r.stmtList = stmtLists.size();
+
+  appendAll(binaries, other.binaries, [&](BinaryExpression &n) {
+    n.left = r(n.left);
+    n.right = r(n.right);
+  });
+  appendAll(unaries, other.unaries,
+            [&](UnaryExpression &n) { n.operand = r(n.operand); });
+  appendAll(identifiers, other.identifiers, [](Identifier &) {});
+  appendAll(integers, other.integers, [](IntegerLiteral &) {});
+  appendAll(calls, other.calls, [&](CallExpression &n) {
+    n.function = r(n.function);
+    n.arguments = r(n.arguments);
+  });
+  appendAll(vars, other.vars, [&](VarDeclaration &n) {
+    n.names = r(n.names);
+    n.values = r(n.values);
+  });
+  appendAll(expressionStmts, other.expressionStmts,
+            [&](ExpressionStatement &n) { n.expr = r(n.expr); });
+  appendAll(increments, other.increments,
+            [&](IncrementStatement &n) { n.expr = r(n.expr); });
+  appendAll(decrements, other.decrements,
+            [&](DecrementStatement &n) { n.expr = r(n.expr); });
+  appendAll(assignments, other.assignments, [&](AssignmentStatement &n) {
+    n.left = r(n.left);
+    n.right = r(n.right);
+  });
+  appendAll(fors, other.fors, [&](ForStatement &n) {
+    n.initial = r(n.initial);
+    n.condition = r(n.condition);
+    n.update = r(n.update);
+    n.body = r(n.body);
+  });
+  appendAll(returns, other.returns,
+            [&](ReturnStatement &n) { n.values = r(n.values); });
+  appendAll(blocks, other.blocks,
+            [&](BlockStatement &n) { n.statements = r(n.statements); });
+  appendAll(ifs, other.ifs, [&](IfStatement &n) {
+    n.condition = r(n.condition);
+    n.consequence = r(n.consequence);
+    n.alternative = r(n.alternative);
+  });
+  appendAll(exprLists, other.exprLists, [&](Expr &e) { e = r(e); });
+  appendAll(stmtLists, other.stmtLists, [&](Stmt &s) { s = r(s); });
+  return r;
+}
+
+void ast::Tree::renameSymbols(const std::vector<Symbol> &to) {
+  for (Identifier &id : identifiers) {
+    id.symbol = to[id.symbol];
+  }
+}
+
+TypeId ast::Tree::type(Expr e) const {
+  if (!e) {
+    return TypeId::Untyped;
+  }
+  switch (e.kind()) {
+  case ExprKind::Binary:
+    return binary(e).type;
+  case ExprKind::Unary:
+    return unary(e).type;
+  case ExprKind::Identifier:
+    return identifier(e).type;
+  case ExprKind::Integer:
+    return integer(e).type;
+  case ExprKind::Call:
+    return call(e).type;
+  }
+  return TypeId::Untyped;
+}
+
+void ast::Tree::setType(Expr e, TypeId type) {
+  switch (e.kind()) {
+  case ExprKind::Binary:
+    binary(e).type = type;
+    break;
+  case ExprKind::Unary:
+    unary(e).type = type;
+    break;
+  case ExprKind::Identifier:
+    identifier(e).type = type;
+    break;
+  case ExprKind::Integer:
+    integer(e).type = type;
+    break;
+  case ExprKind::Call:
+    call(e).type = type;
+    break;
+  }
+}
+
+std::size_t ast::Tree::nodeCount() const {
+  return binaries.size() + unaries.size() + identifiers.size() +
+         integers.size() + calls.size() + vars.size() + expressionStmts.size() +
+         increments.size() + decrements.size() + assignments.size() +
+         fors.size() + returns.size() + blocks.size() + ifs.size();
+}
+
+template <typename T> static std::size_t bytes(const std::vector<T> &v) {
+  return v.capacity() * sizeof(T);
+}
+
+std::size_t ast::Tree::capacityBytes() const {
+  return bytes(binaries) + bytes(unaries) + bytes(identifiers) +
+         bytes(integers) + bytes(calls) + bytes(vars) + bytes(expressionStmts) +
+         bytes(increments) + bytes(decrements) + bytes(assignments) +
+         bytes(fors) + bytes(returns) + bytes(blocks) + bytes(ifs) +
+         bytes(exprLists) + bytes(stmtLists);
+}
+
+bool dew::sameSignature(const FunctionDeclaration &a,
+                        const FunctionDeclaration &b) {
+  auto sameParams{[](const ast::Parameter &x, const ast::Parameter &y) {
+    return x.type == y.type;
+  }};
+  return a.name == b.name &&
+         std::equal(a.returnValues.begin(), a.returnValues.end(),
+                    b.returnValues.begin(), b.returnValues.end()) &&
+         std::equal(a.params.begin(), a.params.end(), b.params.begin(),
+                    b.params.end(), sameParams);
+}
@@ -20,8 +20,10 @@
 #ifndef DEW_AST_H_
 #define DEW_AST_H_
 
+#include "arena.h"
+#include "symbols.h"
 #include "type.h"
-#include <memory>
+#include <cstdint>
 #include <string_view>
 #include <vector>
 
@@ -39,7 +41,7 @@ public:
 };
 
 namespace ast {
-enum class BinaryOp {
+enum class BinaryOp : uint8_t {
   Add,
   Sub,
   BitOr,
@@ -60,144 +62,352 @@ enum class BinaryOp {
   Or,
 };
 
-enum class UnaryOp { Pos, Neg, Not, BitNot, Deref, Ref };
-class Expression {
+enum class UnaryOp : uint8_t { Pos, Neg, Not, BitNot, Deref, Ref };
+
+enum class ExprKind : uint8_t { Binary, Unary, Identifier, Integer, Call };
+
+enum class StmtKind : uint8_t {
+  Var,
+  Expression,
+  Increment,
+  Decrement,
+  Assignment,
+  For,
+  Return,
+  Block,
+  If,
+};
+
+/**
+ * 32-bit handle to a node stored in a Tree. The top bits hold the node kind
+ * and the rest index into the Tree's array for that kind. A default
+ * constructed Ref is null.
+ */
+template <typename Kind> class Ref {
 public:
-  DataType type;
-  virtual ~Expression() = default;
+  static constexpr uint32_t INDEX_BITS{28};
+  static constexpr uint32_t MAX_INDEX{(uint32_t{1} << INDEX_BITS) - 1};
+
+  constexpr Ref() : bits{UINT32_MAX} {}
+  constexpr Ref(Kind kind, uint32_t index)
+      : bits{static_cast<uint32_t>(kind) << INDEX_BITS | index} {}
+  constexpr Kind kind() const { return static_cast<Kind>(bits >> INDEX_BITS); }
+  constexpr uint32_t index() const { return bits & MAX_INDEX; }
+  constexpr explicit operator bool() const { return bits != UINT32_MAX; }
+  constexpr bool operator==(Ref other) const { return bits == other.bits; }
+  constexpr bool operator!=(Ref other) const { return bits != other.bits; }
+
+private:
+  uint32_t bits;
 };
 
-using Expr = std::unique_ptr<ast::Expression>;
+using Expr = Ref<ExprKind>;
+using Stmt = Ref<StmtKind>;
+/** A Stmt that always refers to a BlockStatement. */
+using Block = Stmt;
 
-class BinaryExpression : public Expression {
-public:
-  BinaryExpression(Expr left, BinaryOp op, Expr right)
-      : left(std::move(left)), right(std::move(right)), op(op) {}
+/** Range of a list of children stored contiguously in a Tree. */
+template <typename T> struct List {
+  uint32_t begin;
+  uint32_t size;
+};
+
+// The type of every expression is filled in by the TypeChecker.
+struct BinaryExpression {
   Expr left;
   Expr right;
   BinaryOp op;
+  TypeId type{TypeId::Untyped};
 };
 
-class Identifier : public Expression {
-public:
-  Identifier(std::string_view name) : name(name) {}
+struct UnaryExpression {
+  Expr operand;
+  UnaryOp op;
+  TypeId type{TypeId::Untyped};
+};
+
+struct Identifier {
   std::string_view name;
+  Symbol symbol;
+  TypeId type{TypeId::Untyped};
 };
 
-class IntegerLiteral : public Expression {
-public:
-  IntegerLiteral(uint64_t num) : num(num) {}
+struct IntegerLiteral {
   uint64_t num;
+  TypeId type{TypeId::Untyped};
 };
 
-class CallExpression : public Expression {
-public:
-  CallExpression(Expr function, std::vector<Expr> arguments)
-      : function(std::move(function)), arguments(std::move(arguments)) {}
+struct CallExpression {
   Expr function;
-  std::vector<Expr> arguments;
+  List<Expr> arguments;
+  TypeId type{TypeId::Untyped};
 };
 
-class Statement {
-public:
-  virtual ~Statement() = default;
+/** `i32 a, b = 1, 2`. Every name is an Identifier. */
+struct VarDeclaration {
+  TypeId type;
+  List<Expr> names;
+  List<Expr> values;
 };
 
-using Stmt = std::unique_ptr<ast::Statement>;
-
-class VarDeclaration : public Statement {
-public:
-  VarDeclaration(std::string_view name, DataType type)
-      : name(name), type(type) {}
-  std::string_view name;
-  DataType type;
-};
-
-class ExpressionStatement : public Statement {
-public:
-  ExpressionStatement(Expr expr) : expr(std::move(expr)) {}
+struct ExpressionStatement {
   Expr expr;
 };
-class IncrementStatement : public Statement {
-public:
-  IncrementStatement(Expr expr) : expr(std::move(expr)) {}
+
+struct IncrementStatement {
   Expr expr;
 };
-class DecrementStatement : public Statement {
-public:
-  DecrementStatement(Expr expr) : expr(std::move(expr)) {}
+
+struct DecrementStatement {
   Expr expr;
 };
 
-class AssignmentStatement : public Statement {
-public:
-  AssignmentStatement(std::vector<Expr> left, std::vector<Expr> right)
-      : left(std::move(left)), right(std::move(right)) {}
-  std::vector<Expr> left;
-  std::vector<Expr> right;
+struct AssignmentStatement {
+  List<Expr> left;
+  List<Expr> right;
 };
 
-class ForStatement : public Statement {
-public:
-  ForStatement(Stmt initial, Expr condition, Stmt update)
-      : initial(std::move(initial)), condition(std::move(condition)),
-        update(std::move(update)) {}
+struct ForStatement {
   Stmt initial;
   Expr condition;
   Stmt update;
+  Block body;
 };
 
-class ReturnStatement : public Statement {
-public:
-  ReturnStatement(std::vector<Expr> values) : values(std::move(values)) {}
-  std::vector<Expr> values;
+struct ReturnStatement {
+  List<Expr> values;
 };
 
-class BlockStatement : Statement {
-public:
-  BlockStatement(std::vector<Stmt> statements)
-      : statements(std::move(statements)) {}
-  std::vector<Stmt> statements;
+struct BlockStatement {
+  List<Stmt> statements;
 };
 
-using Block = std::unique_ptr<ast::BlockStatement>;
+struct IfStatement {
+  Expr condition;
+  Block consequence;
+  /** Either a Block or, for `else if`, another IfStatement. */
+  Stmt alternative;
+};
 
-class IfStatement : public Statement {
+/**
+ * How the nodes of one Tree were renumbered when appended to another. Maps
+ * refs and lists into the old tree to their place in the new one.
+ */
+class Relocation {
 public:
-  IfStatement(Expr condition, Block consequence, Block alternative)
-      : condition(std::move(condition)), consequence(std::move(consequence)),
-        alternative(std::move(alternative)) {}
+  Expr operator()(Expr e) const {
+    return e ? Expr{e.kind(), e.index() + exprs[static_cast<int>(e.kind())]}
+             : e;
+  }
+  Stmt operator()(Stmt s) const {
+    return s ? Stmt{s.kind(), s.index() + stmts[static_cast<int>(s.kind())]}
+             : s;
+  }
+  List<Expr> operator()(List<Expr> l) const {
+    return List<Expr>{l.begin + exprList, l.size};
+  }
+  List<Stmt> operator()(List<Stmt> l) const {
+    return List<Stmt>{l.begin + stmtList, l.size};
+  }
 
-  Expr condition;
-  Block consequence;
-  Block alternative;
+private:
+  friend class Tree;
+  uint32_t exprs[5];
+  uint32_t stmts[9];
+  uint32_t exprList;
+  uint32_t stmtList;
 };
 
-class Parameter {
+/**
+ * Storage for the nodes of one compilation unit. Nodes of each kind live in
+ * their own contiguous array and refer to each other by index, so building
+ * and walking the tree never chases individually allocated objects. All
+ * nodes go away together with the Tree.
+ */
+class Tree {
 public:
-  Parameter(DataType type, std::string_view name) : type(type), name(name) {}
-  DataType type;
+  Expr add(const BinaryExpression &node) {
+    return push(binaries, ExprKind::Binary, node);
+  }
+  Expr add(const UnaryExpression &node) {
+    return push(unaries, ExprKind::Unary, node);
+  }
+  Expr add(const Identifier &node) {
+    return push(identifiers, ExprKind::Identifier, node);
+  }
+  Expr add(const IntegerLiteral &node) {
+    return push(integers, ExprKind::Integer, node);
+  }
+  Expr add(const CallExpression &node) {
+    return push(calls, ExprKind::Call, node);
+  }
+  Stmt add(const VarDeclaration &node) {
+    return push(vars, StmtKind::Var, node);
+  }
+  Stmt add(const ExpressionStatement &node) {
+    return push(expressionStmts, StmtKind::Expression, node);
+  }
+  Stmt add(const IncrementStatement &node) {
+    return push(increments, StmtKind::Increment, node);
+  }
+  Stmt add(const DecrementStatement &node) {
+    return push(decrements, StmtKind::Decrement, node);
+  }
+  Stmt add(const AssignmentStatement &node) {
+    return push(assignments, StmtKind::Assignment, node);
+  }
+  Stmt add(const ForStatement &node) {
+    return push(fors, StmtKind::For, node);
+  }
+  Stmt add(const ReturnStatement &node) {
+    return push(returns, StmtKind::Return, node);
+  }
+  Stmt add(const BlockStatement &node) {
+    return push(blocks, StmtKind::Block, node);
+  }
+  Stmt add(const IfStatement &node) { return push(ifs, StmtKind::If, node); }
+
+  List<Expr> addList(const Expr *first, std::size_t count) {
+    return pushList(exprLists, first, count);
+  }
+  List<Stmt> addList(const Stmt *first, std::size_t count) {
+    return pushList(stmtLists, first, count);
+  }
+
+  BinaryExpression &binary(Expr e) { return binaries[e.index()]; }
+  UnaryExpression &unary(Expr e) { return unaries[e.index()]; }
+  Identifier &identifier(Expr e) { return identifiers[e.index()]; }
+  IntegerLiteral &integer(Expr e) { return integers[e.index()]; }
+  CallExpression &call(Expr e) { return calls[e.index()]; }
+  VarDeclaration &var(Stmt s) { return vars[s.index()]; }
+  ExpressionStatement &expression(Stmt s) {
+    return expressionStmts[s.index()];
+  }
+  IncrementStatement &increment(Stmt s) { return increments[s.index()]; }
+  DecrementStatement &decrement(Stmt s) { return decrements[s.index()]; }
+  AssignmentStatement &assignment(Stmt s) { return assignments[s.index()]; }
+  ForStatement &forStmt(Stmt s) { return fors[s.index()]; }
+  ReturnStatement &returnStmt(Stmt s) { return returns[s.index()]; }
+  BlockStatement &block(Stmt s) { return blocks[s.index()]; }
+  IfStatement &ifStmt(Stmt s) { return ifs[s.index()]; }
+
+  const BinaryExpression &binary(Expr e) const { return binaries[e.index()]; }
+  const UnaryExpression &unary(Expr e) const { return unaries[e.index()]; }
+  const Identifier &identifier(Expr e) const { return identifiers[e.index()]; }
+  const IntegerLiteral &integer(Expr e) const { return integers[e.index()]; }
+  const CallExpression &call(Expr e) const { return calls[e.index()]; }
+  const VarDeclaration &var(Stmt s) const { return vars[s.index()]; }
+  const ExpressionStatement &expression(Stmt s) const {
+    return expressionStmts[s.index()];
+  }
+  const IncrementStatement &increment(Stmt s) const {
+    return increments[s.index()];
+  }
+  const DecrementStatement &decrement(Stmt s) const {
+    return decrements[s.index()];
+  }
+  const AssignmentStatement &assignment(Stmt s) const {
+    return assignments[s.index()];
+  }
+  const ForStatement &forStmt(Stmt s) const { return fors[s.index()]; }
+  const ReturnStatement &returnStmt(Stmt s) const {
+    return returns[s.index()];
+  }
+  const BlockStatement &block(Stmt s) const { return blocks[s.index()]; }
+  const IfStatement &ifStmt(Stmt s) const { return ifs[s.index()]; }
+
+  /** The type annotated on `e`, or Untyped if `e` is null. */
+  TypeId type(Expr e) const;
+  void setType(Expr e, TypeId type);
+
+  /**
+   * The returned view is invalidated by the next addList call, so don't add
+   * lists while iterating one.
+   */
+  Span<const Expr> list(List<Expr> l) const {
+    return Span<const Expr>{exprLists.data() + l.begin, l.size};
+  }
+  Span<const Stmt> list(List<Stmt> l) const {
+    return Span<const Stmt>{stmtLists.data() + l.begin, l.size};
+  }
+
+  void clear();
+  /**
+   * Copies every node of `other` to the end of this tree, for trees built
+   * separately, say on different threads. Refs held outside `other` have to
+   * go through the returned Relocation.
+   */
+  Relocation append(const Tree &other);
+  /**
+   * Replaces the symbol of every identifier with `to[symbol]`, for moving a
+   * tree over to another interner.
+   */
+  void renameSymbols(const std::vector<Symbol> &to);
+  /** Number of nodes of every kind currently stored. */
+  std::size_t nodeCount() const;
+  /** Bytes reserved by the node and list arrays. */
+  std::size_t capacityBytes() const;
+
+private:
+  template <typename Node, typename Kind>
+  static Ref<Kind> push(std::vector<Node> &nodes, Kind kind,
+                        const Node &node) {
+    nodes.push_back(node);
+    return Ref<Kind>{kind, static_cast<uint32_t>(nodes.size() - 1)};
+  }
+  template <typename T>
+  static List<T> pushList(std::vector<T> &lists, const T *first,
+                          std::size_t count) {
+    auto begin{static_cast<uint32_t>(lists.size())};
+    lists.insert(lists.end(), first, first + count);
+    return List<T>{begin, static_cast<uint32_t>(count)};
+  }
+
+  std::vector<BinaryExpression> binaries;
+  std::vector<UnaryExpression> unaries;
+  std::vector<Identifier> identifiers;
+  std::vector<IntegerLiteral> integers;
+  std::vector<CallExpression> calls;
+  std::vector<VarDeclaration> vars;
+  std::vector<ExpressionStatement> expressionStmts;
+  std::vector<IncrementStatement> increments;
+  std::vector<DecrementStatement> decrements;
+  std::vector<AssignmentStatement> assignments;
+  std::vector<ForStatement> fors;
+  std::vector<ReturnStatement> returns;
+  std::vector<BlockStatement> blocks;
+  std::vector<IfStatement> ifs;
+  std::vector<Expr> exprLists;
+  std::vector<Stmt> stmtLists;
+};
+
+struct Parameter {
+  TypeId type;
   std::string_view name;
+  Symbol symbol;
 };
 } // namespace ast
-using ParamList = std::vector<ast::Parameter>;
+using ParamList = Span<ast::Parameter>;
 
 class FunctionDeclaration : public Definition {
 public:
-  FunctionDeclaration(std::string_view name, std::vector<DataType> returnValues,
-                      ParamList params)
-      : Definition(DefinitionType::Function), name(name),
+  FunctionDeclaration(std::string_view name, Symbol symbol,
+                      Span<TypeId> returnValues, ParamList params)
+      : Definition(DefinitionType::Function), name(name), symbol(symbol),
         returnValues(returnValues), params(params) {}
   std::string_view name;
-  std::vector<DataType> returnValues;
+  Symbol symbol;
+  Span<TypeId> returnValues;
   ParamList params;
 };
 
+/** Whether callers compiled or type checked against `a` suit `b` as well. */
+bool sameSignature(const FunctionDeclaration &a, const FunctionDeclaration &b);
+
 namespace ast {
 class Function {
 public:
-  Function(FunctionDeclaration *decl, Block block)
-      : decl(decl), block(std::move(block)) {}
+  Function(FunctionDeclaration *decl, Block block) : decl(decl), block(block) {}
   FunctionDeclaration *decl;
   Block block;
 }; // No first-class functions here 😭
@@ -0,0 +1,257 @@
+/**
+ * Copyright (C) 2024 Charles Ancheta
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ * \file bytecode.cc
+ */
+#include "bytecode.h"
+#include <algorithm>
+
+using namespace dew;
+
+const char *bc::opName(Op op) {
+  static const char *names[]{
+#define DEW_OPCODE_NAME(name) #name,
+      DEW_OPCODES(DEW_OPCODE_NAME)
+#undef DEW_OPCODE_NAME
+  };
+  return names[static_cast<uint8_t>(op)];
+}
+
+static_assert(static_cast<uint8_t>(TypeId::U32) -
+                      static_cast<uint8_t>(TypeId::I8) ==
+                  static_cast<uint8_t>(bc::IntKind::U32),
+              "TypeId and IntKind list the integers in the same order");
+
+std::optional<bc::IntKind> bc::intKind(TypeId type) {
+  if (!isInteger(type)) {
+    return std::nullopt;
+  }
+  return static_cast<IntKind>(static_cast<uint8_t>(type) -
+                              static_cast<uint8_t>(TypeId::I8));
+}
+
+std::optional<uint32_t> bc::Program::find(std::string_view name) const {
+  for (uint32_t i{0}; i < functions.size(); ++i) {
+    if (functions[i].name == name) {
+      return i;
+    }
+  }
+  return std::nullopt;
+}
+
+const char *bc::kindName(IntKind kind) {
+  static const char *kinds[]{"i8", "i16", "i32", "u8", "u16", "u32"};
+  return kinds[static_cast<uint8_t>(kind)];
+}
+
+void bc::dump(std::ostream &out, const Function &fn) {
+  out << fn.name << ": params=" << fn.numParams
+      << " results=" << fn.numResults << " regs=" << fn.numRegs << "\n";
+  for (std::size_t pc{0}; pc < fn.code.size(); ++pc) {
+    const Instr &in{fn.code[pc]};
+    out << "  " << pc << "\t" << opName(in.op);
+    switch (in.op) {
+    case Op::Nop:
+      out << "\t-> " << in.imm();
+      break;
+    case Op::LoadInt:
+      out << "\tr" << in.a << ", " << static_cast<int32_t>(in.imm());
+      break;
+    case Op::LoadConst:
+      out << "\tr" << in.a << ", " << fn.constants[in.imm()];
+      break;
+    case Op::Jump:
+      out << "\t-> " << in.imm();
+      break;
+    case Op::JumpIfZero:
+    case Op::JumpIfNotZero:
+      out << "\tr" << in.a << " -> " << in.imm();
+      break;
+    case Op::Call:
+      out << "\tr" << in.a << ", #" << in.b << ", r" << in.c;
+      break;
+    case Op::TailCall:
+      out << "\t#" << in.b << ", r" << in.c;
+      break;
+    case Op::Return:
+      out << "\tr" << in.a << ", " << in.b;
+      break;
+    case Op::Print:
+      out << "\tr" << in.a;
+      break;
+    case Op::Move:
+    case Op::Neg:
+    case Op::BitNot:
+    case Op::Not:
+    case Op::Cast:
+      out << "." << kindName(in.kind) << "\tr" << in.a << ", r" << in.b;
+      break;
+    case Op::AddInt:
+      out << "." << kindName(in.kind) << "\tr" << in.a << ", r" << in.b
+          << ", " << static_cast<int16_t>(in.c);
+      break;
+    default:
+      if (isFusedBranch(in.op)) {
+        out << "\tr" << in.a << ", r" << in.b;
+      } else {
+        out << "." << kindName(in.kind) << "\tr" << in.a << ", r" << in.b
+            << ", r" << in.c;
+      }
+    }
+    out << "\n";
+  }
+}
+
+/** Tells programs written by write apart, and older layouts of them. */
+static constexpr char PROGRAM_MAGIC[4]{'D', 'E', 'W', 'P'};
+static constexpr uint32_t PROGRAM_VERSION{2};
+
+template <typename T> static void put(std::ostream &out, T value) {
+  out.write(reinterpret_cast<const char *>(&value), sizeof(T));
+}
+
+template <typename T>
+static void putArray(std::ostream &out, const std::vector<T> &values) {
+  put(out, static_cast<uint32_t>(values.size()));
+  out.write(reinterpret_cast<const char *>(values.data()),
+            static_cast<std::streamsize>(values.size() * sizeof(T)));
+}
+
+void bc::write(std::ostream &out, const Program &program) {
+  out.write(PROGRAM_MAGIC, sizeof(PROGRAM_MAGIC));
+  put(out, PROGRAM_VERSION);
+  put(out, static_cast<uint32_t>(program.functions.size()));
+  for (const Function &fn : program.functions) {
+    put(out, static_cast<uint32_t>(fn.name.size()));
+    out.write(fn.name.data(), static_cast<std::streamsize>(fn.name.size()));
+    put(out, fn.numParams);
+    put(out, fn.numResults);
+    put(out, fn.numRegs);
+    putArray(out, fn.paramKinds);
+    putArray(out, fn.code);
+    putArray(out, fn.constants);
+  }
+}
+
+namespace {
+/** Reads values off the front of a buffer, failing once it runs out. */
+class Reader {
+public:
+  Reader(std::string_view bytes) : bytes{bytes}, ok{true} {}
+
+  template <typename T> T get() {
+    T value{};
+    take(&value, sizeof(T));
+    return value;
+  }
+  template <typename T> void getArray(std::vector<T> &values) {
+    auto count{get<uint32_t>()};
+    if (count > bytes.size() / sizeof(T)) {
+      ok = false;
+      return;
+    }
+    values.resize(count);
+    take(values.data(), count * sizeof(T));
+  }
+  void getString(std::string &s) {
+    auto count{get<uint32_t>()};
+    if (count > bytes.size()) {
+      ok = false;
+      return;
+    }
+    s.assign(bytes.data(), count);
+    bytes.remove_prefix(count);
+  }
+  bool done() const { return ok && bytes.empty(); }
+  bool good() const { return ok; }
+
+private:
+  void take(void *to, std::size_t size) {
+    if (size > bytes.size()) {
+      ok = false;
+      return;
+    }
+    std::copy_n(bytes.data(), size, static_cast<char *>(to));
+    bytes.remove_prefix(size);
+  }
+
+  std::string_view bytes;
+  bool ok;
+};
+} // namespace
+
+bool bc::verify(const Program &program, const Function &fn) {
+  if (fn.paramKinds.size() != fn.numParams || fn.numParams > fn.numRegs ||
+      fn.code.empty() || fallsThrough(fn.code.back().op) ||
+      std::any_of(fn.paramKinds.begin(), fn.paramKinds.end(),
+                  [](IntKind kind) { return kind > IntKind::U32; })) {
+    return false;
+  }
+  bool valid{true};
+  auto inRange{[&](uint32_t reg) { valid = valid && reg < fn.numRegs; }};
+  for (std::size_t pc{0}; valid && pc < fn.code.size(); ++pc) {
+    const Instr &in{fn.code[pc]};
+    if (in.op > Op::Print || in.kind > IntKind::U32 ||
+        ((in.op == Op::Call || in.op == Op::TailCall) &&
+         in.b >= program.functions.size()) ||
+        (in.op == Op::TailCall &&
+         program.functions[in.b].numResults != fn.numResults) ||
+        (in.op == Op::Return && in.b != fn.numResults) ||
+        (in.op == Op::LoadConst && in.imm() >= fn.constants.size()) ||
+        // Whatever its second slot holds, a fused branch falls through
+        // past it, so that has to be in range too.
+        (isFusedBranch(in.op) && pc + 2 >= fn.code.size())) {
+      return false;
+    }
+    visitOperands(program, in, inRange, inRange);
+    auto target{branchTarget(fn.code, pc)};
+    valid = valid && (!target || *target < fn.code.size());
+  }
+  return valid;
+}
+
+std::optional<bc::Program> bc::read(std::string_view bytes) {
+  if (bytes.substr(0, sizeof(PROGRAM_MAGIC)) !=
+      std::string_view{PROGRAM_MAGIC, sizeof(PROGRAM_MAGIC)}) {
+    return std::nullopt;
+  }
+  Reader in{bytes.substr(sizeof(PROGRAM_MAGIC))};
+  if (in.get<uint32_t>() != PROGRAM_VERSION) {
+    return std::nullopt;
+  }
+  Program program;
+  auto count{in.get<uint32_t>()};
+  for (uint32_t i{0}; in.good() && i < count; ++i) {
+    Function &fn{program.functions.emplace_back()};
+    in.getString(fn.name);
+    fn.numParams = in.get<uint16_t>();
+    fn.numResults = in.get<uint16_t>();
+    fn.numRegs = in.get<uint16_t>();
+    in.getArray(fn.paramKinds);
+    in.getArray(fn.code);
+    in.getArray(fn.constants);
+  }
+  if (!in.done()) {
+    return std::nullopt;
+  }
+  for (const Function &fn : program.functions) {
+    if (!verify(program, fn)) {
+      return std::nullopt;
+    }
+  }
+  return program;
+}
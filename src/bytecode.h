@@ -0,0 +1,257 @@
+/**
+ * Copyright (C) 2024 Charles Ancheta
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ * \file bytecode.h
+ */
+#ifndef DEW_BYTECODE_H_
+#define DEW_BYTECODE_H_
+
+#include "type.h"
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace dew {
+namespace bc {
+/**
+ * Every opcode, in encoding order. `a`, `b` and `c` are register operands
+ * unless noted otherwise; `imm` is the 32-bit immediate made out of `b` and
+ * `c`. Arithmetic wraps the result to the instruction's integer kind.
+ */
+#define DEW_OPCODES(X)                                                         \
+  X(Nop)           /* data slot for the preceding branch */                    \
+  X(Move)          /* a = b */                                                 \
+  X(LoadInt)       /* a = int32(imm) */                                        \
+  X(LoadConst)     /* a = constants[imm] */                                    \
+  X(Add)           /* a = b + c */                                             \
+  X(AddInt)        /* a = b + int16(c) */                                      \
+  X(Sub)           /* a = b - c */                                             \
+  X(Mul)           /* a = b * c */                                             \
+  X(Div)           /* a = b / c */                                             \
+  X(Mod)           /* a = b % c */                                             \
+  X(ShiftLeft)     /* a = b << c */                                            \
+  X(ShiftRight)    /* a = b >> c */                                            \
+  X(BitAnd)        /* a = b & c */                                             \
+  X(BitOr)         /* a = b | c */                                             \
+  X(BitXor)        /* a = b ^ c */                                             \
+  X(Neg)           /* a = -b */                                                \
+  X(BitNot)        /* a = ~b */                                                \
+  X(Not)           /* a = !b */                                                \
+  X(Cast)          /* a = b, wrapped to the instruction's kind */              \
+  X(LT)            /* a = b < c */                                             \
+  X(LTEq)          /* a = b <= c */                                            \
+  X(GT)            /* a = b > c */                                             \
+  X(GTEq)          /* a = b >= c */                                            \
+  X(Eq)            /* a = b == c */                                            \
+  X(Neq)           /* a = b != c */                                            \
+  X(Jump)          /* pc = imm */                                              \
+  X(JumpIfZero)    /* if !a: pc = imm */                                       \
+  X(JumpIfNotZero) /* if a: pc = imm */                                        \
+  X(JumpIfLT)      /* if a < b: pc = imm of the next (Nop) slot */             \
+  X(JumpIfLTEq)    /* if a <= b: ditto */                                      \
+  X(JumpIfGT)      /* if a > b: ditto */                                       \
+  X(JumpIfGTEq)    /* if a >= b: ditto */                                      \
+  X(JumpIfEq)      /* if a == b: ditto */                                      \
+  X(JumpIfNeq)     /* if a != b: ditto */                                      \
+  X(Call)          /* a.. = functions[b](c..) */                               \
+  X(TailCall)      /* return functions[b](c..), reusing the frame */          \
+  X(Return)        /* return a..a+b */                                         \
+  X(Print)         /* print a */
+
+enum class Op : uint8_t {
+#define DEW_OPCODE_ENUM(name) name,
+  DEW_OPCODES(DEW_OPCODE_ENUM)
+#undef DEW_OPCODE_ENUM
+};
+
+const char *opName(Op op);
+
+/** Integer representation the VM wraps results to. */
+enum class IntKind : uint8_t { I8, I16, I32, U8, U16, U32 };
+
+/** The kind of integer `type` is, if it is one. */
+std::optional<IntKind> intKind(TypeId type);
+const char *kindName(IntKind kind);
+
+/**
+ * Registers always hold the value normalized to its kind (sign extended for
+ * signed kinds, zero extended for unsigned ones), so comparisons, division
+ * and right shifts can work on the 64-bit value directly.
+ */
+inline int64_t wrap(IntKind kind, int64_t v) {
+  // Shift the value to the top of the register and back down again, which
+  // sign or zero extends it without branching on the kind.
+  static constexpr uint8_t shifts[]{56, 48, 32, 56, 48, 32};
+  uint8_t s{shifts[static_cast<uint8_t>(kind)]};
+  auto up{static_cast<uint64_t>(v) << s};
+  auto sext{static_cast<int64_t>(up) >> s};
+  auto zext{static_cast<int64_t>(up >> s)};
+  return kind <= IntKind::I32 ? sext : zext;
+}
+
+/**
+ * Whether the bits of a literal fit in `kind`, so `0xFF` suits an i8 as well
+ * as a u8. A negative number is a negated literal, like `-128`.
+ */
+inline bool fits(IntKind kind, uint64_t literal) {
+  static constexpr uint8_t bits[]{8, 16, 32, 8, 16, 32};
+  return literal >> bits[static_cast<uint8_t>(kind)] == 0;
+}
+
+struct Instr {
+  Op op;
+  IntKind kind;
+  uint16_t a;
+  uint16_t b;
+  uint16_t c;
+
+  uint32_t imm() const { return uint32_t{b} | uint32_t{c} << 16; }
+  void setImm(uint32_t imm) {
+    b = static_cast<uint16_t>(imm);
+    c = static_cast<uint16_t>(imm >> 16);
+  }
+};
+static_assert(sizeof(Instr) == 8);
+
+/** Compare-and-branch instructions carry their target in a second slot. */
+inline bool isFusedBranch(Op op) {
+  return op >= Op::JumpIfLT && op <= Op::JumpIfNeq;
+}
+
+struct Function {
+  std::string name;
+  uint16_t numParams;
+  uint16_t numResults;
+  /** Register window size; a callee's window starts right after it. */
+  uint16_t numRegs;
+  std::vector<IntKind> paramKinds;
+  std::vector<Instr> code;
+  std::vector<int64_t> constants;
+};
+
+struct Program {
+  std::vector<Function> functions;
+  /**
+   * For programs whose bodies are loaded on first call, like a mapped
+   * ProgramImage's: fills in the code and constants of a function whose
+   * code is still empty, returning false if they're corrupt.
+   */
+  std::function<bool(uint32_t)> materialize;
+  std::optional<uint32_t> find(std::string_view name) const;
+};
+
+/**
+ * Calls `use` for every register `in` reads and then `def` for every one it
+ * writes. Calls take their signature from `program`.
+ */
+template <typename Use, typename Def>
+void visitOperands(const Program &program, const Instr &in, Use use,
+                   Def def) {
+  switch (in.op) {
+  case Op::Nop:
+  case Op::Jump:
+    break;
+  case Op::LoadInt:
+  case Op::LoadConst:
+    def(in.a);
+    break;
+  case Op::Move:
+  case Op::AddInt:
+  case Op::Neg:
+  case Op::BitNot:
+  case Op::Not:
+  case Op::Cast:
+    use(in.b);
+    def(in.a);
+    break;
+  case Op::JumpIfZero:
+  case Op::JumpIfNotZero:
+  case Op::Print:
+    use(in.a);
+    break;
+  case Op::Call: {
+    const Function &callee{program.functions[in.b]};
+    for (uint16_t i{0}; i < callee.numParams; ++i) {
+      use(in.c + i);
+    }
+    for (uint16_t i{0}; i < callee.numResults; ++i) {
+      def(in.a + i);
+    }
+    break;
+  }
+  case Op::TailCall: {
+    const Function &callee{program.functions[in.b]};
+    for (uint16_t i{0}; i < callee.numParams; ++i) {
+      use(in.c + i);
+    }
+    break;
+  }
+  case Op::Return:
+    for (uint16_t i{0}; i < in.b; ++i) {
+      use(in.a + i);
+    }
+    break;
+  default:
+    if (isFusedBranch(in.op)) {
+      use(in.a);
+      use(in.b);
+    } else {
+      use(in.b);
+      use(in.c);
+      def(in.a);
+    }
+  }
+}
+
+/** Whether control can fall through to the next instruction. */
+inline bool fallsThrough(Op op) {
+  return op != Op::Jump && op != Op::Return && op != Op::TailCall;
+}
+
+/** Jump target of the branch at `pc`, if it is one. */
+inline std::optional<uint32_t> branchTarget(const std::vector<Instr> &code,
+                                            std::size_t pc) {
+  Op op{code[pc].op};
+  if (op == Op::Jump || op == Op::JumpIfZero || op == Op::JumpIfNotZero) {
+    return code[pc].imm();
+  } else if (isFusedBranch(op)) {
+    return code[pc + 1].imm();
+  }
+  return std::nullopt;
+}
+
+void dump(std::ostream &out, const Function &fn);
+
+/**
+ * Writes `program` in a compact binary form for read to take back, in the
+ * byte order of the machine writing it.
+ */
+void write(std::ostream &out, const Program &program);
+/** Reads a program back from write's output, or nothing if it isn't one. */
+std::optional<Program> read(std::string_view bytes);
+/**
+ * Whether the VM can run `fn` of `program` without indexing out of bounds.
+ * The VM trusts its code, so anything read from outside goes through this.
+ */
+bool verify(const Program &program, const Function &fn);
+} // namespace bc
+} // namespace dew
+#endif // !DEW_BYTECODE_H_
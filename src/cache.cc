@@ -0,0 +1,208 @@
+/**
+ * Copyright (C) 2024 Charles Ancheta
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ * \file cache.cc
+ */
+#include "cache.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <system_error>
+#include <thread>
+#include <unistd.h>
+
+using namespace dew;
+namespace fs = std::filesystem;
+
+/** Bumped whenever the compiler's output changes without the binary. */
+static constexpr std::string_view CACHE_VERSION{"1"};
+
+CompileCache::CompileCache(fs::path dir)
+    : dir{std::move(dir)}, hits{0}, misses{0}, failedStores{0} {
+  std::error_code ec;
+  fs::create_directories(this->dir, ec);
+  // Any rebuild of dewc changes its size or modification time.
+  std::ostringstream id;
+  id << CACHE_VERSION;
+  fs::path self{"/proc/self/exe"};
+  auto size{fs::file_size(self, ec)};
+  if (!ec) {
+    id << ' ' << size << ' '
+       << fs::last_write_time(self, ec).time_since_epoch().count();
+  }
+  compiler = id.str();
+}
+
+namespace {
+/**
+ * SHA-256, so that two inputs can't share a key by accident or by design;
+ * the entry under a key is trusted to be that input's program.
+ */
+class Sha256 {
+public:
+  Sha256()
+      : state{0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f,
+              0x9b05688c, 0x1f83d9ab, 0x5be0cd19},
+        block{}, used{0}, length{0} {}
+
+  void update(std::string_view bytes) {
+    length += bytes.size();
+    while (!bytes.empty()) {
+      std::size_t n{std::min(sizeof(block) - used, bytes.size())};
+      std::memcpy(block + used, bytes.data(), n);
+      used += n;
+      bytes.remove_prefix(n);
+      if (used == sizeof(block)) {
+        compress();
+        used = 0;
+      }
+    }
+  }
+
+  std::string hex() {
+    uint64_t bits{length * 8};
+    update(std::string_view{"\x80", 1});
+    while (used != 56) {
+      update(std::string_view{"\0", 1});
+    }
+    for (int shift{56}; shift >= 0; shift -= 8) {
+      block[used++] = static_cast<uint8_t>(bits >> shift);
+    }
+    compress();
+    std::string out;
+    char digits[9];
+    for (const uint32_t word : state) {
+      std::snprintf(digits, sizeof(digits), "%08x", word);
+      out += digits;
+    }
+    return out;
+  }
+
+private:
+  static uint32_t rotate(uint32_t x, int n) { return x >> n | x << (32 - n); }
+
+  void compress() {
+    static constexpr uint32_t k[64]{
+        0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b,
+        0x59f111f1, 0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01,
+        0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7,
+        0xc19bf174, 0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+        0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da, 0x983e5152,
+        0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+        0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc,
+        0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+        0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819,
+        0xd6990624, 0xf40e3585, 0x106aa070, 0x19a4c116, 0x1e376c08,
+        0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f,
+        0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+        0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+    uint32_t w[64];
+    for (int i{0}; i < 16; ++i) {
+      w[i] = uint32_t{block[4 * i]} << 24 | uint32_t{block[4 * i + 1]} << 16 |
+             uint32_t{block[4 * i + 2]} << 8 | uint32_t{block[4 * i + 3]};
+    }
+    for (int i{16}; i < 64; ++i) {
+      uint32_t s0{rotate(w[i - 15], 7) ^ rotate(w[i - 15], 18) ^
+                  w[i - 15] >> 3};
+      uint32_t s1{rotate(w[i - 2], 17) ^ rotate(w[i - 2], 19) ^
+                  w[i - 2] >> 10};
+      w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+    uint32_t v[8];
+    std::copy(std::begin(state), std::end(state), v);
+    for (int i{0}; i < 64; ++i) {
+      uint32_t s1{rotate(v[4], 6) ^ rotate(v[4], 11) ^ rotate(v[4], 25)};
+      uint32_t choice{(v[4] & v[5]) ^ (~v[4] & v[6])};
+      uint32_t t1{v[7] + s1 + choice + k[i] + w[i]};
+      uint32_t s0{rotate(v[0], 2) ^ rotate(v[0], 13) ^ rotate(v[0], 22)};
+      uint32_t majority{(v[0] & v[1]) ^ (v[0] & v[2]) ^ (v[1] & v[2])};
+      std::copy_backward(v, v + 7, v + 8);
+      v[4] += t1;
+      v[0] = t1 + s0 + majority;
+    }
+    for (int i{0}; i < 8; ++i) {
+      state[i] += v[i];
+    }
+  }
+
+  uint32_t state[8];
+  uint8_t block[64];
+  std::size_t used;
+  uint64_t length;
+};
+} // namespace
+
+std::string CompileCache::key(std::string_view source,
+                              std::string_view flags) const {
+  // Each part is prefixed with its length, so no two inputs run together
+  // the same way.
+  Sha256 hash;
+  for (const std::string_view part : {std::string_view{compiler}, flags,
+                                      source}) {
+    char size[24];
+    std::snprintf(size, sizeof(size), "%zu:", part.size());
+    hash.update(size);
+    hash.update(part);
+  }
+  return hash.hex();
+}
+
+std::optional<bc::Program> CompileCache::load(const std::string &key) {
+  std::ifstream in{dir / key, std::ios::binary | std::ios::ate};
+  std::optional<bc::Program> program;
+  if (in.is_open()) {
+    std::string bytes(static_cast<std::size_t>(in.tellg()), '\0');
+    in.seekg(0);
+    if (in.read(bytes.data(), static_cast<std::streamsize>(bytes.size()))) {
+      program = bc::read(bytes);
+    }
+  }
+  ++(program ? hits : misses);
+  return program;
+}
+
+void CompileCache::store(const std::string &key, const bc::Program &program) {
+  std::ostringstream tmpName;
+  // Unique to this thread of this process, as others may be storing too.
+  tmpName << key << ".tmp." << getpid() << '.' << std::this_thread::get_id();
+  fs::path tmp{dir / tmpName.str()};
+  {
+    std::ofstream out{tmp, std::ios::binary};
+    bc::write(out, program);
+    if (!out.flush()) {
+      ++failedStores;
+      return;
+    }
+  }
+  std::error_code ec;
+  fs::rename(tmp, dir / key, ec);
+  if (ec) {
+    fs::remove(tmp, ec);
+    ++failedStores;
+  }
+}
+
+void CompileCache::report(std::ostream &out) const {
+  out << "cache: " << hits << " hit(s), " << misses << " miss(es)";
+  if (failedStores) {
+    out << ", " << failedStores << " failed to store";
+  }
+  out << "\n";
+}
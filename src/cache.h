@@ -0,0 +1,58 @@
+/**
+ * Copyright (C) 2024 Charles Ancheta
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ * \file cache.h
+ */
+#ifndef DEW_CACHE_H_
+#define DEW_CACHE_H_
+
+#include "bytecode.h"
+#include <atomic>
+#include <filesystem>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <string_view>
+
+namespace dew {
+/**
+ * Compiled programs kept on disk, one file per distinct input. An input is
+ * the source text along with everything else that decides the output: the
+ * compiler itself and the flags it ran with. Entries are written whole and
+ * renamed into place, so several dewc processes can share a directory.
+ */
+class CompileCache {
+public:
+  CompileCache(std::filesystem::path dir);
+
+  /** Names the entry for `source` compiled with `flags`. */
+  std::string key(std::string_view source, std::string_view flags) const;
+  std::optional<bc::Program> load(const std::string &key);
+  void store(const std::string &key, const bc::Program &program);
+  /** Prints how many lookups hit and missed. */
+  void report(std::ostream &out) const;
+
+private:
+  std::filesystem::path dir;
+  /** Identifies the running compiler, so that rebuilding it starts afresh. */
+  std::string compiler;
+  std::atomic<uint32_t> hits;
+  std::atomic<uint32_t> misses;
+  std::atomic<uint32_t> failedStores;
+};
+} // namespace dew
+#endif // !DEW_CACHE_H_
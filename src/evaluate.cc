@@ -0,0 +1,210 @@
+/**
+ * Copyright (C) 2024 Charles Ancheta
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ * \file evaluate.cc
+ */
+#include "evaluate.h"
+#include <algorithm>
+#include <unordered_map>
+
+using namespace dew;
+using namespace dew::ir;
+
+/** Steps one call may take, and all of them in one run of the pass. */
+constexpr uint64_t CALL_FUEL{1 << 16};
+constexpr uint64_t PASS_FUEL{1 << 22};
+/** Deepest the calls evaluate makes may nest. */
+constexpr unsigned MAX_DEPTH{256};
+
+namespace {
+class Evaluator {
+public:
+  Evaluator(const Module &module, uint64_t &fuel)
+      : module{module}, fuel{fuel}, depth{0} {}
+
+  std::optional<std::vector<int64_t>> call(uint32_t function,
+                                           const std::vector<int64_t> &args) {
+    if (depth == MAX_DEPTH) {
+      return std::nullopt;
+    }
+    ++depth;
+    auto results{run(module.functions[function], args)};
+    --depth;
+    return results;
+  }
+
+private:
+  std::optional<std::vector<int64_t>> run(const Function &fn,
+                                          const std::vector<int64_t> &args) {
+    std::vector<int64_t> values(fn.insts.size());
+    std::unordered_map<Value, std::vector<int64_t>> calls;
+    std::vector<int64_t> phis;
+    BlockId from{0};
+    BlockId b{0};
+    while (true) {
+      const std::vector<Value> &insts{fn.blocks[b].insts};
+      // Phis all read the values from the edge at once, before any of them
+      // changes, as they may read each other. Look for them through the
+      // whole block rather than trust them to come first.
+      phis.clear();
+      if (b != 0) {
+        const std::vector<BlockId> &preds{fn.blocks[b].preds};
+        auto edge{std::find(preds.begin(), preds.end(), from) - preds.begin()};
+        for (const Value v : insts) {
+          if (fn[v].op == Opcode::Phi) {
+            phis.push_back(values[fn[v].operands[edge]]);
+          }
+        }
+        auto phi{phis.begin()};
+        for (const Value v : insts) {
+          if (fn[v].op == Opcode::Phi) {
+            values[v] = *phi++;
+          }
+        }
+      }
+      for (const Value v : insts) {
+        if (fuel == 0) {
+          return std::nullopt;
+        }
+        --fuel;
+        const Inst &inst{fn[v]};
+        auto operand{[&](std::size_t n) { return values[inst.operands[n]]; }};
+        switch (inst.op) {
+        case Opcode::Nop:
+        case Opcode::Phi:
+          break;
+        case Opcode::Param:
+          values[v] = args[inst.imm];
+          break;
+        case Opcode::Const:
+          values[v] = inst.imm;
+          break;
+        case Opcode::Copy:
+          values[v] = operand(0);
+          break;
+        case Opcode::Call: {
+          std::vector<int64_t> callArgs;
+          for (const Value a : inst.operands) {
+            callArgs.push_back(values[a]);
+          }
+          auto results{call(static_cast<uint32_t>(inst.imm), callArgs)};
+          if (!results) {
+            return std::nullopt;
+          }
+          values[v] = results->empty() ? 0 : (*results)[0];
+          calls[v] = std::move(*results);
+          break;
+        }
+        case Opcode::Result:
+          values[v] = calls[inst.operands[0]][inst.imm];
+          break;
+        case Opcode::Print:
+          return std::nullopt;
+        case Opcode::Jump:
+          from = b;
+          b = fn.blocks[b].succs[0];
+          break;
+        case Opcode::Branch:
+          from = b;
+          b = fn.blocks[b].succs[operand(0) != 0 ? 0 : 1];
+          break;
+        case Opcode::Return: {
+          std::vector<int64_t> results;
+          for (const Value r : inst.operands) {
+            results.push_back(values[r]);
+          }
+          return results;
+        }
+        default: {
+          auto value{fold(inst.op, inst.type, operand(0),
+                          inst.operands.size() > 1 ? operand(1) : 0)};
+          if (!value) {
+            return std::nullopt;
+          }
+          values[v] = *value;
+        }
+        }
+      }
+      if (fn.blocks[b].insts.empty()) {
+        // Only a removed block has no terminator.
+        return std::nullopt;
+      }
+    }
+  }
+
+  const Module &module;
+  uint64_t &fuel;
+  unsigned depth;
+};
+} // namespace
+
+std::optional<std::vector<int64_t>>
+ir::evaluate(const Module &module, uint32_t function,
+             const std::vector<int64_t> &args, uint64_t &fuel) {
+  return Evaluator{module, fuel}.call(function, args);
+}
+
+bool ir::evaluateCalls(Module &module) {
+  bool changed{false};
+  uint64_t budget{PASS_FUEL};
+  for (Function &fn : module.functions) {
+    // Work out every call first: one of them may run this very function,
+    // which has to stay as it was until then.
+    std::unordered_map<Value, std::vector<int64_t>> known;
+    for (const Block &block : fn.blocks) {
+      for (const Value v : block.insts) {
+        const Inst &inst{fn[v]};
+        bool constant{std::all_of(
+            inst.operands.begin(), inst.operands.end(),
+            [&](Value o) { return fn[o].op == Opcode::Const; })};
+        if (inst.op != Opcode::Call || !constant || budget == 0) {
+          continue;
+        }
+        std::vector<int64_t> args;
+        for (const Value o : inst.operands) {
+          args.push_back(fn[o].imm);
+        }
+        uint64_t fuel{std::min(CALL_FUEL, budget)};
+        auto results{
+            evaluate(module, static_cast<uint32_t>(inst.imm), args, fuel)};
+        budget -= std::min(CALL_FUEL, budget) - fuel;
+        if (results) {
+          known[v] = std::move(*results);
+        }
+      }
+    }
+    if (known.empty()) {
+      continue;
+    }
+    for (Inst &inst : fn.insts) {
+      auto call{inst.op == Opcode::Result ? known.find(inst.operands[0])
+                                          : known.end()};
+      if (call != known.end()) {
+        inst.op = Opcode::Const;
+        inst.imm = call->second[inst.imm];
+        inst.operands.clear();
+      }
+    }
+    for (const auto &[v, results] : known) {
+      fn[v].op = Opcode::Const;
+      fn[v].imm = results.empty() ? 0 : results[0];
+      fn[v].operands.clear();
+    }
+    changed = true;
+  }
+  return changed;
+}
@@ -0,0 +1,50 @@
+/**
+ * Copyright (C) 2024 Charles Ancheta
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ * \file evaluate.h
+ */
+#ifndef DEW_EVALUATE_H_
+#define DEW_EVALUATE_H_
+
+#include "ir.h"
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+namespace dew {
+namespace ir {
+/**
+ * Runs `module.functions[function]` on `args` at compile time, returning its
+ * results. Every instruction run, in it or in the functions it calls, takes
+ * one step out of `fuel`. Nothing comes back if it prints, traps, recurses
+ * too deep or runs out of fuel first, all of which have to happen at run
+ * time instead.
+ */
+std::optional<std::vector<int64_t>> evaluate(const Module &module,
+                                             uint32_t function,
+                                             const std::vector<int64_t> &args,
+                                             uint64_t &fuel);
+
+/**
+ * Replaces calls on constant arguments with their results wherever
+ * evaluate can work them out. Each call gets a budget of its own, and the
+ * pass as a whole one larger budget, so that it can't hang the compiler.
+ */
+bool evaluateCalls(Module &module);
+} // namespace ir
+} // namespace dew
+#endif // !DEW_EVALUATE_H_
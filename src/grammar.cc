@@ -0,0 +1,126 @@
+/**
+ * Copyright (C) 2024 Charles Ancheta
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ * \file grammar.cc
+ */
+#include "grammar.h"
+#include "ast.h"
+#include "util.h"
+#include <iterator>
+#include <optional>
+#include <string_view>
+#include <tree_sitter/api.h>
+#include <utility>
+
+using namespace dew;
+
+static constexpr std::pair<std::string_view, NodeKind> NODES[]{
+    {"function_declaration", NodeKind::FunctionDeclaration},
+    {"builtin_type", NodeKind::BuiltinType},
+    {"block", NodeKind::Block},
+    {"if_statement", NodeKind::IfStatement},
+    {"for_statement", NodeKind::ForStatement},
+    {"return_statement", NodeKind::ReturnStatement},
+    {"expression_statement", NodeKind::ExpressionStatement},
+    {"assignment_statement", NodeKind::AssignmentStatement},
+    {"inc_statement", NodeKind::IncStatement},
+    {"dec_statement", NodeKind::DecStatement},
+    {"var_declaration", NodeKind::VarDeclaration},
+    {"parenthesized_expression", NodeKind::ParenthesizedExpression},
+    {"binary_expression", NodeKind::BinaryExpression},
+    {"unary_expression", NodeKind::UnaryExpression},
+    {"call_expression", NodeKind::CallExpression},
+    {"identifier", NodeKind::Identifier},
+    {"int_literal", NodeKind::IntLiteral},
+    {"expression_list", NodeKind::ExpressionList},
+};
+
+/** In the order of Field. */
+static constexpr std::string_view FIELDS[]{
+    "alternative", "arguments", "body",   "cond",       "condition",
+    "consequence", "function",  "init",   "left",       "name",
+    "operand",     "operator",  "params", "parameters", "result",
+    "right",       "type",      "update",
+};
+static_assert(std::size(FIELDS) == static_cast<uint8_t>(Field::Count));
+
+static constexpr std::pair<std::string_view, ast::BinaryOp> BINARY_OPS[]{
+    {"*", ast::BinaryOp::Mul},         {"/", ast::BinaryOp::Div},
+    {"%", ast::BinaryOp::Mod},         {"<<", ast::BinaryOp::ShiftLeft},
+    {">>", ast::BinaryOp::ShiftRight}, {"&", ast::BinaryOp::BitAnd},
+    {"+", ast::BinaryOp::Add},         {"-", ast::BinaryOp::Sub},
+    {"|", ast::BinaryOp::BitOr},       {"^", ast::BinaryOp::BitXor},
+    {">", ast::BinaryOp::GT},          {"<", ast::BinaryOp::LT},
+    {">=", ast::BinaryOp::GTEq},       {"<=", ast::BinaryOp::LTEq},
+    {"==", ast::BinaryOp::Eq},         {"!=", ast::BinaryOp::Neq},
+    {"&&", ast::BinaryOp::And},        {"||", ast::BinaryOp::Or},
+};
+
+static constexpr std::pair<std::string_view, ast::UnaryOp> UNARY_OPS[]{
+    {"+", ast::UnaryOp::Pos},   {"-", ast::UnaryOp::Neg},
+    {"!", ast::UnaryOp::Not},   {"~", ast::UnaryOp::BitNot},
+    {"*", ast::UnaryOp::Deref}, {"&", ast::UnaryOp::Ref},
+};
+
+const Grammar &dew::Grammar::get() {
+  static const Grammar grammar{tree_sitter_dew()};
+  return grammar;
+}
+
+dew::Grammar::Grammar(const TSLanguage *language)
+    : kinds(ts_language_symbol_count(language), NodeKind::Other),
+      binaryOps(kinds.size()), unaryOps(kinds.size()), fields{} {
+  // Symbol 0 is the end of the input, which is also what names missing from
+  // the grammar get; those are left as NodeKind::Other.
+  auto symbol{[&](std::string_view name, bool named) -> TSSymbol {
+    TSSymbol s{ts_language_symbol_for_name(
+        language, name.data(), static_cast<uint32_t>(name.size()), named)};
+    return s < kinds.size() ? s : 0;
+  }};
+  for (const auto &[name, kind] : NODES) {
+    if (TSSymbol s{symbol(name, true)}) {
+      kinds[s] = kind;
+    }
+  }
+  if (TSSymbol s{symbol("=", false)}) {
+    kinds[s] = NodeKind::Assign;
+  }
+  for (const auto &[name, op] : BINARY_OPS) {
+    if (TSSymbol s{symbol(name, false)}) {
+      binaryOps[s] = op;
+    }
+  }
+  for (const auto &[name, op] : UNARY_OPS) {
+    if (TSSymbol s{symbol(name, false)}) {
+      unaryOps[s] = op;
+    }
+  }
+  for (std::size_t i{0}; i < fields.size(); ++i) {
+    fields[i] = ts_language_field_id_for_name(
+        language, FIELDS[i].data(), static_cast<uint32_t>(FIELDS[i].size()));
+  }
+}
+
+std::optional<ast::BinaryOp> dew::Grammar::binaryOp(TSNode node) const {
+  TSSymbol symbol{ts_node_symbol(node)};
+  return symbol < binaryOps.size() ? binaryOps[symbol] : std::nullopt;
+}
+
+std::optional<ast::UnaryOp> dew::Grammar::unaryOp(TSNode node) const {
+  TSSymbol symbol{ts_node_symbol(node)};
+  return symbol < unaryOps.size() ? unaryOps[symbol] : std::nullopt;
+}
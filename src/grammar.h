@@ -0,0 +1,111 @@
+/**
+ * Copyright (C) 2024 Charles Ancheta
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ * \file grammar.h
+ */
+#ifndef DEW_GRAMMAR_H_
+#define DEW_GRAMMAR_H_
+
+#include "ast.h"
+#include <array>
+#include <cstdint>
+#include <optional>
+#include <tree_sitter/api.h>
+#include <vector>
+
+namespace dew {
+/** The nodes of the grammar that the parser tells apart. */
+enum class NodeKind : uint8_t {
+  Other,
+  FunctionDeclaration,
+  BuiltinType,
+  Block,
+  IfStatement,
+  ForStatement,
+  ReturnStatement,
+  ExpressionStatement,
+  AssignmentStatement,
+  IncStatement,
+  DecStatement,
+  VarDeclaration,
+  ParenthesizedExpression,
+  BinaryExpression,
+  UnaryExpression,
+  CallExpression,
+  Identifier,
+  IntLiteral,
+  ExpressionList,
+  /** The `=` token. */
+  Assign,
+};
+
+/** The fields of the grammar's nodes. */
+enum class Field : uint8_t {
+  Alternative,
+  Arguments,
+  Body,
+  Cond,
+  Condition,
+  Consequence,
+  Function,
+  Init,
+  Left,
+  Name,
+  Operand,
+  Operator,
+  Params,
+  Parameters,
+  Result,
+  Right,
+  Type,
+  Update,
+  Count,
+};
+
+/**
+ * The symbols and field ids of the Dew grammar, looked up by name once so
+ * that the parser can switch on the kinds of nodes instead of comparing
+ * strings.
+ */
+class Grammar {
+public:
+  /** The grammar of tree_sitter_dew(), resolved on first use. */
+  static const Grammar &get();
+
+  NodeKind kind(TSNode node) const {
+    TSSymbol symbol{ts_node_symbol(node)};
+    return symbol < kinds.size() ? kinds[symbol] : NodeKind::Other;
+  }
+  TSNode field(TSNode node, Field field) const {
+    return ts_node_child_by_field_id(node,
+                                     fields[static_cast<uint8_t>(field)]);
+  }
+  /** The operator `node` is a token of, if any. */
+  std::optional<ast::BinaryOp> binaryOp(TSNode node) const;
+  std::optional<ast::UnaryOp> unaryOp(TSNode node) const;
+
+private:
+  Grammar(const TSLanguage *language);
+
+  /** Indexed by symbol. */
+  std::vector<NodeKind> kinds;
+  std::vector<std::optional<ast::BinaryOp>> binaryOps;
+  std::vector<std::optional<ast::UnaryOp>> unaryOps;
+  std::array<TSFieldId, static_cast<uint8_t>(Field::Count)> fields;
+};
+} // namespace dew
+#endif // !DEW_GRAMMAR_H_
@@ -0,0 +1,208 @@
+/**
+ * Copyright (C) 2024 Charles Ancheta
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ * \file image.cc
+ */
+#include "image.h"
+#include <cstring>
+#include <iostream>
+#include <limits>
+
+using namespace dew;
+
+namespace {
+/** Tells `.dewb` files apart, and older layouts of them. */
+constexpr char IMAGE_MAGIC[4]{'D', 'E', 'W', 'B'};
+constexpr uint32_t IMAGE_VERSION{1};
+
+struct Header {
+  char magic[4];
+  uint32_t version;
+  uint32_t count;
+  uint32_t unused;
+};
+
+/** A function in the index; offsets are from the start of the file. */
+struct Entry {
+  uint32_t name;
+  uint32_t nameSize;
+  uint32_t paramKinds;
+  uint16_t numParams;
+  uint16_t numResults;
+  uint16_t numRegs;
+  uint16_t unused;
+  /** Where the code starts, eight-byte aligned; the constants follow it. */
+  uint32_t code;
+  uint32_t codeSize;
+  uint32_t constantsSize;
+};
+static_assert(sizeof(Header) == 16 && sizeof(Entry) == 32);
+
+template <typename T> void put(std::ostream &out, const T &value) {
+  out.write(reinterpret_cast<const char *>(&value), sizeof(T));
+}
+} // namespace
+
+bool ProgramImage::recognizes(std::string_view bytes) {
+  return bytes.substr(0, sizeof(IMAGE_MAGIC)) ==
+         std::string_view{IMAGE_MAGIC, sizeof(IMAGE_MAGIC)};
+}
+
+bool ProgramImage::write(std::ostream &out, const bc::Program &program) {
+  const std::vector<bc::Function> &functions{program.functions};
+  // Names and kinds go right after the index, and the bodies after them.
+  uint64_t at{sizeof(Header) + functions.size() * sizeof(Entry)};
+  std::vector<Entry> entries;
+  for (const bc::Function &fn : functions) {
+    Entry &e{entries.emplace_back()};
+    e.name = static_cast<uint32_t>(at);
+    e.nameSize = static_cast<uint32_t>(fn.name.size());
+    e.paramKinds = static_cast<uint32_t>(at + fn.name.size());
+    e.numParams = fn.numParams;
+    e.numResults = fn.numResults;
+    e.numRegs = fn.numRegs;
+    e.unused = 0;
+    at += fn.name.size() + fn.paramKinds.size();
+  }
+  uint64_t strings{at};
+  at = (at + 7) & ~uint64_t{7};
+  uint64_t padding{at - strings};
+  for (std::size_t i{0}; i < functions.size(); ++i) {
+    entries[i].code = static_cast<uint32_t>(at);
+    entries[i].codeSize = static_cast<uint32_t>(functions[i].code.size());
+    entries[i].constantsSize =
+        static_cast<uint32_t>(functions[i].constants.size());
+    at += sizeof(bc::Instr) * functions[i].code.size() +
+          sizeof(int64_t) * functions[i].constants.size();
+  }
+  if (at > std::numeric_limits<uint32_t>::max()) {
+    return false;
+  }
+
+  Header header{{}, IMAGE_VERSION, static_cast<uint32_t>(functions.size()),
+                0};
+  std::memcpy(header.magic, IMAGE_MAGIC, sizeof(IMAGE_MAGIC));
+  put(out, header);
+  for (const Entry &e : entries) {
+    put(out, e);
+  }
+  for (const bc::Function &fn : functions) {
+    out.write(fn.name.data(), static_cast<std::streamsize>(fn.name.size()));
+    out.write(reinterpret_cast<const char *>(fn.paramKinds.data()),
+              static_cast<std::streamsize>(fn.paramKinds.size()));
+  }
+  out.write("\0\0\0\0\0\0\0", static_cast<std::streamsize>(padding));
+  for (const bc::Function &fn : functions) {
+    out.write(reinterpret_cast<const char *>(fn.code.data()),
+              static_cast<std::streamsize>(sizeof(bc::Instr) *
+                                           fn.code.size()));
+    out.write(reinterpret_cast<const char *>(fn.constants.data()),
+              static_cast<std::streamsize>(sizeof(int64_t) *
+                                           fn.constants.size()));
+  }
+  return true;
+}
+
+ProgramImage::ProgramImage(Source file)
+    : file{std::move(file)}, materialized{0} {}
+
+std::unique_ptr<ProgramImage> ProgramImage::open(Source file,
+                                                 const char *path) {
+  std::unique_ptr<ProgramImage> image{new ProgramImage{std::move(file)}};
+  std::string_view bytes{image->file.text()};
+  auto corrupt{[&] {
+    std::cerr << "file `" << path << "` isn't a valid .dewb file\n";
+    return nullptr;
+  }};
+  Header header;
+  if (bytes.size() < sizeof(Header)) {
+    return corrupt();
+  }
+  std::memcpy(&header, bytes.data(), sizeof(Header));
+  if (!recognizes(bytes) || header.version != IMAGE_VERSION ||
+      header.count > (bytes.size() - sizeof(Header)) / sizeof(Entry)) {
+    return corrupt();
+  }
+
+  // Only the index is read; everything it points at is checked to be
+  // inside the file, and bodies are checked further when they're loaded.
+  bc::Program &program{image->loaded};
+  program.functions.resize(header.count);
+  image->bodies.resize(header.count);
+  for (uint32_t i{0}; i < header.count; ++i) {
+    Entry e;
+    std::memcpy(&e, bytes.data() + sizeof(Header) + i * sizeof(Entry),
+                sizeof(Entry));
+    uint64_t bodyEnd{e.code + sizeof(bc::Instr) * uint64_t{e.codeSize} +
+                     sizeof(int64_t) * uint64_t{e.constantsSize}};
+    if (uint64_t{e.name} + e.nameSize > bytes.size() ||
+        uint64_t{e.paramKinds} + e.numParams > bytes.size() ||
+        bodyEnd > bytes.size()) {
+      return corrupt();
+    }
+    bc::Function &fn{program.functions[i]};
+    fn.name = bytes.substr(e.name, e.nameSize);
+    fn.numParams = e.numParams;
+    fn.numResults = e.numResults;
+    fn.numRegs = e.numRegs;
+    // Out of range kinds are caught by bc::verify when the body loads.
+    for (uint32_t k{0}; k < e.numParams; ++k) {
+      fn.paramKinds.push_back(
+          static_cast<bc::IntKind>(bytes[e.paramKinds + k]));
+    }
+    image->bodies[i] = Body{e.code, e.codeSize, e.constantsSize};
+  }
+  program.materialize = [image{image.get()}](uint32_t function) {
+    return image->materialize(function);
+  };
+  return image;
+}
+
+bool ProgramImage::materialize(uint32_t function) {
+  bc::Function &fn{loaded.functions[function]};
+  if (!fn.code.empty()) {
+    return true;
+  }
+  const Body &body{bodies[function]};
+  if (body.codeSize == 0) {
+    return false;
+  }
+  const char *code{file.text().data() + body.code};
+  fn.code.resize(body.codeSize);
+  std::memcpy(fn.code.data(), code, sizeof(bc::Instr) * body.codeSize);
+  if (body.constantsSize != 0) {
+    fn.constants.resize(body.constantsSize);
+    std::memcpy(fn.constants.data(),
+                code + sizeof(bc::Instr) * body.codeSize,
+                sizeof(int64_t) * body.constantsSize);
+  }
+  if (!bc::verify(loaded, fn)) {
+    fn.code.clear();
+    fn.constants.clear();
+    return false;
+  }
+  ++materialized;
+  return true;
+}
+
+bool ProgramImage::materializeAll() {
+  bool ok{true};
+  for (uint32_t i{0}; i < loaded.functions.size(); ++i) {
+    ok = materialize(i) && ok;
+  }
+  return ok;
+}
@@ -0,0 +1,86 @@
+/**
+ * Copyright (C) 2024 Charles Ancheta
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ * \file image.h
+ */
+#ifndef DEW_IMAGE_H_
+#define DEW_IMAGE_H_
+
+#include "bytecode.h"
+#include "source.h"
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <string_view>
+#include <vector>
+
+namespace dew {
+/**
+ * A compiled program in the `.dewb` format, mapped into memory. The file
+ * starts with a header and an index of every function's signature, with
+ * the names and parameter kinds behind them, and then every function's
+ * code and constants, each at an offset the index gives. Opening a file
+ * reads the index alone; a function's body is checked and copied out of
+ * the mapping when it's first called, so running a large program touches
+ * only the pages of the functions it calls.
+ *
+ * Bodies are filled in by whatever runs the program, so an image is for
+ * one thread at a time.
+ */
+class ProgramImage {
+public:
+  /** Whether `bytes` start like a `.dewb` file. */
+  static bool recognizes(std::string_view bytes);
+  /**
+   * Writes `program` as a `.dewb` file, in the byte order of the machine
+   * writing it. Returns false if it's too big for the format's offsets.
+   */
+  static bool write(std::ostream &out, const bc::Program &program);
+  /**
+   * Takes over `file`, a `.dewb` file, reading its index. Errors are
+   * reported on std::cerr, naming `path`.
+   */
+  static std::unique_ptr<ProgramImage> open(Source file, const char *path);
+
+  ProgramImage(const ProgramImage &) = delete;
+  ProgramImage &operator=(const ProgramImage &) = delete;
+
+  /** The program, with only the bodies called so far filled in. */
+  const bc::Program &program() const { return loaded; }
+  /** Fills in every body, for anything that reads them all. */
+  bool materializeAll();
+  /** How many bodies have been filled in. */
+  std::size_t materializedCount() const { return materialized; }
+
+private:
+  /** Where a function's body is, in the file. */
+  struct Body {
+    uint32_t code;
+    uint32_t codeSize;
+    uint32_t constantsSize;
+  };
+
+  ProgramImage(Source file);
+  bool materialize(uint32_t function);
+
+  Source file;
+  bc::Program loaded;
+  std::vector<Body> bodies;
+  std::size_t materialized;
+};
+} // namespace dew
+#endif // !DEW_IMAGE_H_
@@ -0,0 +1,314 @@
+/**
+ * Copyright (C) 2024 Charles Ancheta
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ * \file ir.cc
+ */
+#include "ir.h"
+#include <algorithm>
+
+using namespace dew;
+using namespace dew::ir;
+
+const char *ir::opcodeName(Opcode op) {
+  static const char *names[]{
+#define DEW_IR_OPCODE_NAME(name) #name,
+      DEW_IR_OPCODES(DEW_IR_OPCODE_NAME)
+#undef DEW_IR_OPCODE_NAME
+  };
+  return names[static_cast<uint8_t>(op)];
+}
+
+BlockId Function::addBlock() {
+  blocks.push_back(Block{{}, {}, {}, false});
+  return static_cast<BlockId>(blocks.size() - 1);
+}
+
+Value Function::append(BlockId block, Opcode op, bc::IntKind type,
+                       std::vector<Value> operands, int64_t imm) {
+  auto v{static_cast<Value>(insts.size())};
+  insts.push_back(Inst{op, type, block, imm, std::move(operands)});
+  blocks[block].insts.push_back(v);
+  return v;
+}
+
+Value Function::addPhi(BlockId block, bc::IntKind type) {
+  auto v{static_cast<Value>(insts.size())};
+  insts.push_back(Inst{Opcode::Phi, type, block, 0, {}});
+  std::vector<Value> &list{blocks[block].insts};
+  auto firstNonPhi{std::find_if(list.begin(), list.end(), [&](Value i) {
+    return insts[i].op != Opcode::Phi;
+  })};
+  list.insert(firstNonPhi, v);
+  return v;
+}
+
+std::optional<Value> Function::terminator(BlockId block) const {
+  const std::vector<Value> &list{blocks[block].insts};
+  if (list.empty() || !isTerminator(insts[list.back()].op)) {
+    return std::nullopt;
+  }
+  return list.back();
+}
+
+void Function::addEdge(BlockId from, BlockId to) {
+  blocks[from].succs.push_back(to);
+  blocks[to].preds.push_back(from);
+}
+
+void Function::removeEdge(BlockId from, BlockId to) {
+  std::vector<BlockId> &succs{blocks[from].succs};
+  succs.erase(std::find(succs.begin(), succs.end(), to));
+  std::vector<BlockId> &preds{blocks[to].preds};
+  auto pred{std::find(preds.begin(), preds.end(), from)};
+  auto index{pred - preds.begin()};
+  preds.erase(pred);
+  for (const Value v : blocks[to].insts) {
+    if (insts[v].op != Opcode::Phi) {
+      break;
+    }
+    insts[v].operands.erase(insts[v].operands.begin() + index);
+  }
+}
+
+void Function::replaceUses(std::vector<Value> &forward) {
+  auto resolve{[&](Value v) {
+    Value root{v};
+    while (forward[root] != root) {
+      root = forward[root];
+    }
+    while (forward[v] != root) {
+      Value next{forward[v]};
+      forward[v] = root;
+      v = next;
+    }
+    return root;
+  }};
+  for (const Block &b : blocks) {
+    for (const Value v : b.insts) {
+      for (Value &operand : insts[v].operands) {
+        operand = resolve(operand);
+      }
+    }
+  }
+}
+
+void Function::erase(Value v) {
+  std::vector<Value> &list{blocks[insts[v].block].insts};
+  list.erase(std::find(list.begin(), list.end(), v));
+  insts[v].op = Opcode::Nop;
+  insts[v].operands.clear();
+}
+
+bool Function::removeUnreachable() {
+  std::vector<bool> reached(blocks.size());
+  std::vector<BlockId> work{0};
+  reached[0] = true;
+  while (!work.empty()) {
+    BlockId b{work.back()};
+    work.pop_back();
+    for (const BlockId s : blocks[b].succs) {
+      if (!reached[s]) {
+        reached[s] = true;
+        work.push_back(s);
+      }
+    }
+  }
+
+  bool changed{false};
+  for (BlockId b{0}; b < blocks.size(); ++b) {
+    if (reached[b] || blocks[b].removed) {
+      continue;
+    }
+    // Edges between unreachable blocks go with them, and some of those have
+    // been removed already; only reachable successors need their preds and
+    // phis fixed.
+    for (const BlockId s : std::vector<BlockId>{blocks[b].succs}) {
+      if (reached[s]) {
+        removeEdge(b, s);
+      }
+    }
+    for (const Value v : blocks[b].insts) {
+      insts[v].op = Opcode::Nop;
+      insts[v].operands.clear();
+    }
+    blocks[b].insts.clear();
+    blocks[b].preds.clear();
+    blocks[b].succs.clear();
+    blocks[b].removed = true;
+    changed = true;
+  }
+  return changed;
+}
+
+std::optional<uint32_t> Module::find(std::string_view name) const {
+  for (uint32_t i{0}; i < functions.size(); ++i) {
+    if (functions[i].name == name) {
+      return i;
+    }
+  }
+  return std::nullopt;
+}
+
+std::optional<int64_t> ir::fold(Opcode op, bc::IntKind type, int64_t a,
+                                int64_t b) {
+  // Unsigned arithmetic wraps without overflowing, and the result is
+  // truncated to the type afterwards.
+  auto ua{static_cast<uint64_t>(a)};
+  auto ub{static_cast<uint64_t>(b)};
+  int64_t value;
+  switch (op) {
+  case Opcode::Add:
+    value = static_cast<int64_t>(ua + ub);
+    break;
+  case Opcode::Sub:
+    value = static_cast<int64_t>(ua - ub);
+    break;
+  case Opcode::Mul:
+    value = static_cast<int64_t>(ua * ub);
+    break;
+  case Opcode::Div:
+  case Opcode::Mod:
+    // Operands are at most 32 bits wide, so INT64_MIN / -1 can't happen.
+    if (b == 0) {
+      return std::nullopt;
+    }
+    value = op == Opcode::Div ? a / b : a % b;
+    break;
+  case Opcode::ShiftLeft:
+    value = static_cast<int64_t>(ua << (b & 63));
+    break;
+  case Opcode::ShiftRight:
+    value = a >> (b & 63);
+    break;
+  case Opcode::BitAnd:
+    value = a & b;
+    break;
+  case Opcode::BitOr:
+    value = a | b;
+    break;
+  case Opcode::BitXor:
+    value = a ^ b;
+    break;
+  case Opcode::Neg:
+    value = static_cast<int64_t>(0 - ua);
+    break;
+  case Opcode::BitNot:
+    value = ~a;
+    break;
+  case Opcode::Cast:
+    value = a;
+    break;
+  case Opcode::Not:
+    return a == 0;
+  case Opcode::LT:
+    return a < b;
+  case Opcode::LTEq:
+    return a <= b;
+  case Opcode::GT:
+    return a > b;
+  case Opcode::GTEq:
+    return a >= b;
+  case Opcode::Eq:
+    return a == b;
+  case Opcode::Neq:
+    return a != b;
+  default:
+    return std::nullopt;
+  }
+  return bc::wrap(type, value);
+}
+
+bool ir::isTerminator(Opcode op) {
+  return op == Opcode::Jump || op == Opcode::Branch || op == Opcode::Return;
+}
+
+bool ir::hasSideEffects(const Function &fn, const Inst &inst) {
+  switch (inst.op) {
+  case Opcode::Call:
+  case Opcode::Print:
+  case Opcode::Jump:
+  case Opcode::Branch:
+  case Opcode::Return:
+    return true;
+  case Opcode::Div:
+  case Opcode::Mod: {
+    // Dividing by zero traps, so only a known divisor makes it removable.
+    const Inst &divisor{fn[inst.operands[1]]};
+    return divisor.op != Opcode::Const || divisor.imm == 0;
+  }
+  default:
+    return false;
+  }
+}
+
+void ir::dump(std::ostream &out, const Function &fn) {
+  static const char *types[]{"i8", "i16", "i32", "u8", "u16", "u32"};
+  auto type{[](bc::IntKind t) { return types[static_cast<uint8_t>(t)]; }};
+  out << "fun " << fn.name << "(";
+  for (std::size_t i{0}; i < fn.params.size(); ++i) {
+    out << (i ? ", " : "") << type(fn.params[i]);
+  }
+  out << ")";
+  for (const bc::IntKind t : fn.results) {
+    out << " " << type(t);
+  }
+  out << "\n";
+  for (BlockId b{0}; b < fn.blocks.size(); ++b) {
+    const Block &block{fn.blocks[b]};
+    if (block.removed) {
+      continue;
+    }
+    out << "b" << b << ":";
+    if (!block.preds.empty()) {
+      out << "\t; preds";
+      for (const BlockId p : block.preds) {
+        out << " b" << p;
+      }
+    }
+    out << "\n";
+    for (const Value v : block.insts) {
+      const Inst &inst{fn[v]};
+      out << "  ";
+      bool hasValue{!isTerminator(inst.op) && inst.op != Opcode::Print};
+      if (hasValue) {
+        out << "v" << v << " = ";
+      }
+      out << opcodeName(inst.op);
+      if (hasValue) {
+        out << "." << type(inst.type);
+      }
+      const char *sep{" "};
+      if (inst.op == Opcode::Param || inst.op == Opcode::Const ||
+          inst.op == Opcode::Call || inst.op == Opcode::Result) {
+        out << sep << (inst.op == Opcode::Call ? "#" : "") << inst.imm;
+        sep = ", ";
+      }
+      for (const Value operand : inst.operands) {
+        out << sep << "v" << operand;
+        sep = ", ";
+      }
+      for (std::size_t i{0};
+           (inst.op == Opcode::Jump || inst.op == Opcode::Branch) &&
+           i < block.succs.size();
+           ++i) {
+        out << sep << "b" << block.succs[i];
+        sep = ", ";
+      }
+      out << "\n";
+    }
+  }
+}
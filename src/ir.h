@@ -0,0 +1,154 @@
+/**
+ * Copyright (C) 2024 Charles Ancheta
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ * \file ir.h
+ */
+#ifndef DEW_IR_H_
+#define DEW_IR_H_
+
+#include "bytecode.h"
+#include <cstdint>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace dew {
+namespace ir {
+/**
+ * Every opcode. Arithmetic wraps to the instruction's type like the
+ * bytecode does; comparisons and Not yield 0 or 1.
+ */
+#define DEW_IR_OPCODES(X)                                                      \
+  X(Nop)        /* erased; nothing refers to it anymore */                     \
+  X(Param)      /* imm-th parameter */                                         \
+  X(Const)      /* imm, already wrapped to the type */                         \
+  X(Copy)       /* operands[0] */                                              \
+  X(Add)                                                                       \
+  X(Sub)                                                                       \
+  X(Mul)                                                                       \
+  X(Div)                                                                       \
+  X(Mod)                                                                       \
+  X(ShiftLeft)                                                                 \
+  X(ShiftRight)                                                                \
+  X(BitAnd)                                                                    \
+  X(BitOr)                                                                     \
+  X(BitXor)                                                                    \
+  X(Neg)                                                                       \
+  X(BitNot)                                                                    \
+  X(Not)                                                                       \
+  X(Cast)                                                                      \
+  X(LT)                                                                        \
+  X(LTEq)                                                                      \
+  X(GT)                                                                        \
+  X(GTEq)                                                                      \
+  X(Eq)                                                                        \
+  X(Neq)                                                                       \
+  X(Phi)        /* one operand per predecessor, in the same order */           \
+  X(Call)       /* functions[imm](operands..), yields the first result */      \
+  X(Result)     /* imm-th result of the Call operands[0] */                    \
+  X(Print)      /* print operands[0] */                                        \
+  X(Jump)       /* to succs[0] */                                              \
+  X(Branch)     /* to succs[0] if operands[0] else succs[1] */                 \
+  X(Return)     /* return operands.. */
+
+enum class Opcode : uint8_t {
+#define DEW_IR_OPCODE_ENUM(name) name,
+  DEW_IR_OPCODES(DEW_IR_OPCODE_ENUM)
+#undef DEW_IR_OPCODE_ENUM
+};
+
+const char *opcodeName(Opcode op);
+
+/** Index of an instruction, which is also the value it defines. */
+using Value = uint32_t;
+using BlockId = uint32_t;
+
+struct Inst {
+  Opcode op;
+  bc::IntKind type;
+  BlockId block;
+  int64_t imm;
+  std::vector<Value> operands;
+};
+
+struct Block {
+  /** Phis come first and the terminator last. */
+  std::vector<Value> insts;
+  std::vector<BlockId> preds;
+  std::vector<BlockId> succs;
+  /** Unreachable blocks are dropped by clearing them and setting this. */
+  bool removed;
+};
+
+/**
+ * A function in SSA form. Blocks are kept in layout order, entry first, and
+ * instructions are never moved between functions, so a Value stays valid
+ * for as long as its function does.
+ */
+struct Function {
+  std::string name;
+  std::vector<bc::IntKind> params;
+  std::vector<bc::IntKind> results;
+  std::vector<Inst> insts;
+  std::vector<Block> blocks;
+
+  Inst &operator[](Value v) { return insts[v]; }
+  const Inst &operator[](Value v) const { return insts[v]; }
+
+  BlockId addBlock();
+  /** Appends a new instruction to the end of `block`. */
+  Value append(BlockId block, Opcode op, bc::IntKind type,
+               std::vector<Value> operands = {}, int64_t imm = 0);
+  /** Adds a phi with no operands yet to the top of `block`. */
+  Value addPhi(BlockId block, bc::IntKind type);
+  /** Last instruction of `block` if it is a Jump, Branch or Return. */
+  std::optional<Value> terminator(BlockId block) const;
+  /** Adds the edge from -> to, which needs a phi operand for every phi. */
+  void addEdge(BlockId from, BlockId to);
+  /** Removes one from -> to edge along with its phi operands. */
+  void removeEdge(BlockId from, BlockId to);
+  /** Points every operand through `forward`, following chains. */
+  void replaceUses(std::vector<Value> &forward);
+  /** Erases `v` from its block; it must be unused by then. */
+  void erase(Value v);
+  /** Removes blocks the entry can't reach; true if there were any. */
+  bool removeUnreachable();
+};
+
+struct Module {
+  std::vector<Function> functions;
+  std::optional<uint32_t> find(std::string_view name) const;
+};
+
+/**
+ * The value of arithmetic, a comparison or a cast of type `type` on
+ * constants, wrapped to the type. Nothing if it traps or `op` is anything
+ * else; unary operators ignore `b`.
+ */
+std::optional<int64_t> fold(Opcode op, bc::IntKind type, int64_t a,
+                            int64_t b = 0);
+
+bool isTerminator(Opcode op);
+/** Whether `inst` has to run even if nothing uses its value. */
+bool hasSideEffects(const Function &fn, const Inst &inst);
+
+void dump(std::ostream &out, const Function &fn);
+} // namespace ir
+} // namespace dew
+#endif // !DEW_IR_H_
@@ -0,0 +1,752 @@
+/**
+ * Copyright (C) 2024 Charles Ancheta
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ * \file irlower.cc
+ */
+#include "irlower.h"
+#include "report.h"
+#include <algorithm>
+#include <iostream>
+#include <iterator>
+#include <limits>
+
+using namespace dew;
+using namespace dew::ir;
+
+using bc::Instr;
+using bc::IntKind;
+using bc::Op;
+
+namespace {
+constexpr uint32_t NONE{std::numeric_limits<uint32_t>::max()};
+
+using Bits = std::vector<uint64_t>;
+using Range = std::pair<uint32_t, uint32_t>;
+
+bool test(const Bits &bits, uint32_t i) { return bits[i / 64] >> (i % 64) & 1; }
+void set(Bits &bits, uint32_t i) { bits[i / 64] |= uint64_t{1} << (i % 64); }
+
+bool isCompare(Opcode op) { return op >= Opcode::LT && op <= Opcode::Neq; }
+
+Op bytecodeOp(Opcode op) {
+  switch (op) {
+  case Opcode::Add:
+    return Op::Add;
+  case Opcode::Sub:
+    return Op::Sub;
+  case Opcode::Mul:
+    return Op::Mul;
+  case Opcode::Div:
+    return Op::Div;
+  case Opcode::Mod:
+    return Op::Mod;
+  case Opcode::ShiftLeft:
+    return Op::ShiftLeft;
+  case Opcode::ShiftRight:
+    return Op::ShiftRight;
+  case Opcode::BitAnd:
+    return Op::BitAnd;
+  case Opcode::BitOr:
+    return Op::BitOr;
+  case Opcode::BitXor:
+    return Op::BitXor;
+  case Opcode::Neg:
+    return Op::Neg;
+  case Opcode::BitNot:
+    return Op::BitNot;
+  case Opcode::Not:
+    return Op::Not;
+  case Opcode::Cast:
+    return Op::Cast;
+  case Opcode::LT:
+    return Op::LT;
+  case Opcode::LTEq:
+    return Op::LTEq;
+  case Opcode::GT:
+    return Op::GT;
+  case Opcode::GTEq:
+    return Op::GTEq;
+  case Opcode::Eq:
+    return Op::Eq;
+  case Opcode::Neq:
+    return Op::Neq;
+  default:
+    return Op::Nop;
+  }
+}
+
+/** The compare-and-branch taken when `op` is `when`. */
+Op branchOp(Opcode op, bool when) {
+  switch (op) {
+  case Opcode::GT:
+    return when ? Op::JumpIfGT : Op::JumpIfLTEq;
+  case Opcode::LT:
+    return when ? Op::JumpIfLT : Op::JumpIfGTEq;
+  case Opcode::GTEq:
+    return when ? Op::JumpIfGTEq : Op::JumpIfLT;
+  case Opcode::LTEq:
+    return when ? Op::JumpIfLTEq : Op::JumpIfGT;
+  case Opcode::Eq:
+    return when ? Op::JumpIfEq : Op::JumpIfNeq;
+  default:
+    return when ? Op::JumpIfNeq : Op::JumpIfEq;
+  }
+}
+
+class Lowering {
+public:
+  Lowering(const Module &module, Function &fn, bc::Function &out)
+      : module{module}, fn{fn}, out{out} {}
+
+  bool lower() {
+    fn.removeUnreachable();
+    splitPhiEdges();
+    analyze();
+    liveness();
+    allocate();
+
+    out.name = fn.name;
+    out.numParams = static_cast<uint16_t>(fn.params.size());
+    out.numResults = static_cast<uint16_t>(fn.results.size());
+    out.paramKinds = fn.params;
+    temp = nextReg;
+    window = nextReg + 1;
+    std::size_t maxWindow{std::max<std::size_t>(fn.results.size(), 1)};
+    for (const BlockId b : layout) {
+      for (const Value v : fn.blocks[b].insts) {
+        if (fn[v].op == Opcode::Call) {
+          const Function &callee{module.functions[fn[v].imm]};
+          maxWindow = std::max({maxWindow, callee.params.size(),
+                                callee.results.size()});
+        }
+      }
+    }
+    if (window + maxWindow > std::numeric_limits<uint16_t>::max()) {
+      std::cerr << fn.name << ": function needs too many registers\n";
+      return false;
+    }
+    top = nextReg;
+
+    std::vector<uint32_t> blockPc(fn.blocks.size());
+    for (std::size_t i{0}; i < layout.size(); ++i) {
+      BlockId b{layout[i]};
+      blockPc[b] = static_cast<uint32_t>(out.code.size());
+      next = i + 1 < layout.size() ? layout[i + 1] : NONE;
+      for (const Value v : fn.blocks[b].insts) {
+        emit(b, v);
+      }
+    }
+    for (const auto &[pc, target] : patches) {
+      out.code[pc].setImm(blockPc[target]);
+    }
+    out.numRegs = static_cast<uint16_t>(top);
+    return true;
+  }
+
+private:
+  void splitPhiEdges() {
+    std::size_t count{fn.blocks.size()};
+    std::vector<std::vector<BlockId>> splitAfter(count);
+    for (BlockId b{0}; b < count; ++b) {
+      if (fn.blocks[b].removed || fn.blocks[b].succs.size() < 2) {
+        continue;
+      }
+      for (std::size_t i{0}; i < fn.blocks[b].succs.size(); ++i) {
+        BlockId s{fn.blocks[b].succs[i]};
+        bool phis{!fn.blocks[s].insts.empty() &&
+                  fn[fn.blocks[s].insts[0]].op == Opcode::Phi};
+        if (!phis) {
+          continue;
+        }
+        BlockId n{fn.addBlock()};
+        fn.blocks[b].succs[i] = n;
+        std::vector<BlockId> &preds{fn.blocks[s].preds};
+        *std::find(preds.begin(), preds.end(), b) = n;
+        fn.blocks[n].preds = {b};
+        fn.blocks[n].succs = {s};
+        fn.append(n, Opcode::Jump, IntKind::I32);
+        splitAfter[b].push_back(n);
+      }
+    }
+    for (BlockId b{0}; b < count; ++b) {
+      if (fn.blocks[b].removed) {
+        continue;
+      }
+      layout.push_back(b);
+      layout.insert(layout.end(), splitAfter[b].begin(), splitAfter[b].end());
+    }
+  }
+
+  /** The 16-bit immediate `v` can be turned into an AddInt with, if any. */
+  std::optional<std::pair<Value, int16_t>> addImmediate(Value v) const {
+    const Inst &inst{fn[v]};
+    if (inst.op != Opcode::Add && inst.op != Opcode::Sub) {
+      return std::nullopt;
+    }
+    for (std::size_t i{0}; i < 2; ++i) {
+      if (inst.op == Opcode::Sub && i == 0) {
+        continue;
+      }
+      const Inst &c{fn[inst.operands[i]]};
+      if (c.op != Opcode::Const) {
+        continue;
+      }
+      int64_t imm{inst.op == Opcode::Sub ? -c.imm : c.imm};
+      if (imm >= INT16_MIN && imm <= INT16_MAX) {
+        return std::pair{inst.operands[1 - i], static_cast<int16_t>(imm)};
+      }
+    }
+    return std::nullopt;
+  }
+
+  /** Calls `use` for every operand `v` needs in a register. */
+  template <typename Use> void forEachUse(Value v, Use use) const {
+    const Inst &inst{fn[v]};
+    if (inst.op == Opcode::Phi || inst.op == Opcode::Result ||
+        (isCompare(inst.op) && fused[v])) {
+      // Phis read at the end of predecessors, Results are written by their
+      // Call and fused compares are read by their branch.
+      return;
+    }
+    if (inst.op == Opcode::Branch && fused[inst.operands[0]]) {
+      for (const Value operand : fn[inst.operands[0]].operands) {
+        use(operand);
+      }
+      return;
+    }
+    if (auto add{addImmediate(v)}) {
+      use(add->first);
+      return;
+    }
+    for (const Value operand : inst.operands) {
+      use(operand);
+    }
+  }
+
+  void analyze() {
+    fused.assign(fn.insts.size(), false);
+    tail.assign(fn.insts.size(), false);
+    position.assign(fn.insts.size(), NONE);
+    resultsOf.assign(fn.insts.size(), {});
+    std::vector<uint32_t> uses(fn.insts.size());
+    for (const BlockId b : layout) {
+      for (const Value v : fn.blocks[b].insts) {
+        for (const Value operand : fn[v].operands) {
+          ++uses[operand];
+        }
+        if (fn[v].op == Opcode::Result) {
+          resultsOf[fn[v].operands[0]].push_back(v);
+        }
+      }
+    }
+    uint32_t index{0};
+    for (const BlockId b : layout) {
+      const std::vector<Value> &insts{fn.blocks[b].insts};
+      for (std::size_t i{0}; i < insts.size(); ++i) {
+        position[insts[i]] = index++;
+      }
+      // A compare only used by the branch right after it becomes part of
+      // the branch.
+      if (insts.size() >= 2 && fn[insts.back()].op == Opcode::Branch) {
+        Value cmp{insts[insts.size() - 2]};
+        fused[cmp] = fn[insts.back()].operands[0] == cmp &&
+                     isCompare(fn[cmp].op) && uses[cmp] == 1;
+      }
+      // So does a call whose results are returned just as they come back.
+      if (!insts.empty() && fn[insts.back()].op == Opcode::Return) {
+        std::size_t i{insts.size() - 1};
+        while (i > 0 && (fn[insts[i - 1]].op == Opcode::Result ||
+                         fn[insts[i - 1]].op == Opcode::Nop)) {
+          --i;
+        }
+        if (i > 0 && returnsCall(insts.back(), insts[i - 1])) {
+          tail[insts[i - 1]] = true;
+          tail[insts.back()] = true;
+        }
+      }
+    }
+    // Constants that only feed AddInts are never materialized.
+    needed.assign(fn.insts.size(), false);
+    for (const BlockId b : layout) {
+      for (const Value v : fn.blocks[b].insts) {
+        if (fn[v].op == Opcode::Phi) {
+          for (const Value operand : fn[v].operands) {
+            needed[operand] = true;
+          }
+        }
+        forEachUse(v, [&](Value operand) { needed[operand] = true; });
+      }
+    }
+  }
+
+  /** Whether `ret` returns exactly the results of `call`. */
+  bool returnsCall(Value ret, Value call) const {
+    if (fn[call].op != Opcode::Call) {
+      return false;
+    }
+    const std::vector<Value> &values{fn[ret].operands};
+    if (module.functions[fn[call].imm].results != fn.results ||
+        values.size() != fn.results.size()) {
+      return false;
+    }
+    for (std::size_t i{1}; i < values.size(); ++i) {
+      const Inst &result{fn[values[i]]};
+      if (result.op != Opcode::Result || result.operands[0] != call ||
+          result.imm != static_cast<int64_t>(i)) {
+        return false;
+      }
+    }
+    return values.empty() || values[0] == call;
+  }
+
+  bool materialized(Value v) const {
+    return (fn[v].op != Opcode::Const || needed[v]) && !fused[v];
+  }
+
+  std::optional<std::size_t> predIndex(BlockId s, BlockId p) const {
+    const std::vector<BlockId> &preds{fn.blocks[s].preds};
+    auto it{std::find(preds.begin(), preds.end(), p)};
+    if (it == preds.end()) {
+      return std::nullopt;
+    }
+    return it - preds.begin();
+  }
+
+  void liveness() {
+    std::size_t words{(fn.insts.size() + 63) / 64};
+    std::size_t n{fn.blocks.size()};
+    std::vector<Bits> uses(n, Bits(words));
+    std::vector<Bits> defs(n, Bits(words));
+    std::vector<Bits> phiDefs(n, Bits(words));
+    for (const BlockId b : layout) {
+      for (const Value v : fn.blocks[b].insts) {
+        forEachUse(v, [&](Value operand) {
+          if (!test(defs[b], operand)) {
+            set(uses[b], operand);
+          }
+        });
+        set(defs[b], v);
+        if (fn[v].op == Opcode::Phi) {
+          set(phiDefs[b], v);
+        }
+      }
+    }
+    std::vector<Bits> liveIn(n, Bits(words));
+    std::vector<Bits> liveOut(n, Bits(words));
+    for (bool changed{true}; changed;) {
+      changed = false;
+      for (auto it{layout.rbegin()}; it != layout.rend(); ++it) {
+        BlockId b{*it};
+        Bits out(words);
+        for (const BlockId s : fn.blocks[b].succs) {
+          for (std::size_t w{0}; w < words; ++w) {
+            out[w] |= liveIn[s][w] & ~phiDefs[s][w];
+          }
+          std::size_t index{*predIndex(s, b)};
+          for (const Value v : fn.blocks[s].insts) {
+            if (fn[v].op != Opcode::Phi) {
+              break;
+            }
+            set(out, fn[v].operands[index]);
+          }
+        }
+        for (std::size_t w{0}; w < words; ++w) {
+          uint64_t in{uses[b][w] | (out[w] & ~defs[b][w])};
+          changed = changed || in != liveIn[b][w] || out[w] != liveOut[b][w];
+          liveIn[b][w] = in;
+          liveOut[b][w] = out[w];
+        }
+      }
+    }
+
+    // Reads happen at 2 * position and writes at 2 * position + 1. Each
+    // block adds at most one range to a value, extending the last one when
+    // the value lives on from the block laid out before.
+    ranges.assign(fn.insts.size(), {});
+    std::vector<Range> local(fn.insts.size(), Range{NONE, 0});
+    std::vector<Value> touched;
+    auto touch{[&](Value v, uint32_t pos) {
+      if (local[v].first == NONE) {
+        touched.push_back(v);
+      }
+      local[v] = {std::min(local[v].first, pos), std::max(local[v].second, pos)};
+    }};
+    auto each{[&](const Bits &bits, auto f) {
+      for (std::size_t w{0}; w < words; ++w) {
+        // Stop at the highest bit set, without shifting by 64.
+        for (uint32_t i{0}; i < 64 && bits[w] >> i != 0; ++i) {
+          if (bits[w] >> i & 1) {
+            f(static_cast<Value>(w * 64 + i));
+          }
+        }
+      }
+    }};
+    for (const BlockId b : layout) {
+      const std::vector<Value> &insts{fn.blocks[b].insts};
+      uint32_t first{2 * position[insts.front()]};
+      uint32_t last{2 * position[insts.back()] + 1};
+      each(liveIn[b], [&](Value v) { touch(v, first); });
+      each(liveOut[b], [&](Value v) { touch(v, last); });
+      for (const Value v : insts) {
+        uint32_t pos{position[v]};
+        forEachUse(v, [&](Value operand) { touch(operand, 2 * pos); });
+        if (fn[v].op == Opcode::Result) {
+          // Written together with the Call.
+          pos = position[fn[v].operands[0]];
+        }
+        if (fn[v].op == Opcode::Phi) {
+          touch(v, first);
+        } else if (materialized(v) && fn[v].op != Opcode::Nop) {
+          touch(v, 2 * pos + 1);
+        }
+      }
+      for (const Value v : touched) {
+        std::vector<Range> &list{ranges[v]};
+        if (!list.empty() && list.back().second + 1 >= local[v].first) {
+          list.back().second = local[v].second;
+        } else {
+          list.push_back(local[v]);
+        }
+        local[v] = Range{NONE, 0};
+      }
+      touched.clear();
+    }
+  }
+
+  static bool overlap(const std::vector<Range> &a,
+                      const std::vector<Range> &b) {
+    for (std::size_t i{0}, j{0}; i < a.size() && j < b.size();) {
+      if (a[i].second < b[j].first) {
+        ++i;
+      } else if (b[j].second < a[i].first) {
+        ++j;
+      } else {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  /**
+   * Gives each value the first register free over all of its ranges, which
+   * can be one that another value only holds across a hole.
+   */
+  void allocate() {
+    reg.assign(fn.insts.size(), NONE);
+    std::vector<Value> order;
+    std::vector<std::vector<Value>> phiUsers(fn.insts.size());
+    for (Value v{0}; v < fn.insts.size(); ++v) {
+      if (!ranges[v].empty()) {
+        order.push_back(v);
+      }
+      if (fn[v].op == Opcode::Phi) {
+        for (const Value operand : fn[v].operands) {
+          phiUsers[operand].push_back(v);
+        }
+      }
+    }
+    std::sort(order.begin(), order.end(), [&](Value a, Value b) {
+      return ranges[a][0].first < ranges[b][0].first ||
+             (ranges[a][0].first == ranges[b][0].first && a < b);
+    });
+
+    // Parameters arrive in the first registers, and come first in order.
+    std::vector<std::vector<Range>> held(fn.params.size());
+    auto fits{[&](uint32_t r, Value v) { return !overlap(held[r], ranges[v]); }};
+    for (const Value v : order) {
+      uint32_t r{NONE};
+      if (fn[v].op == Opcode::Param) {
+        r = static_cast<uint32_t>(fn[v].imm);
+      }
+      // Sharing a register with a phi on either side saves a copy.
+      auto hint{[&](Value other) {
+        if (r == NONE && reg[other] != NONE && fits(reg[other], v)) {
+          r = reg[other];
+        }
+      }};
+      if (fn[v].op == Opcode::Phi) {
+        for (const Value operand : fn[v].operands) {
+          hint(operand);
+        }
+      }
+      for (const Value phi : phiUsers[v]) {
+        hint(phi);
+      }
+      // Taking the register of another phi that v's phi is copied alongside
+      // would turn those copies into a cycle.
+      std::vector<uint32_t> avoid;
+      for (const Value phi : phiUsers[v]) {
+        for (const Value other : fn.blocks[fn[phi].block].insts) {
+          if (fn[other].op != Opcode::Phi) {
+            break;
+          }
+          avoid.push_back(reg[other]);
+        }
+      }
+      for (uint32_t i{0}; r == NONE && i < held.size(); ++i) {
+        if (fits(i, v) &&
+            std::find(avoid.begin(), avoid.end(), i) == avoid.end()) {
+          r = i;
+        }
+      }
+      if (r == NONE) {
+        r = static_cast<uint32_t>(held.size());
+        held.emplace_back();
+      }
+      std::vector<Range> merged;
+      std::merge(held[r].begin(), held[r].end(), ranges[v].begin(),
+                 ranges[v].end(), std::back_inserter(merged));
+      held[r] = std::move(merged);
+      reg[v] = r;
+    }
+    nextReg = static_cast<uint32_t>(held.size());
+  }
+
+  std::size_t put(Op op, IntKind kind, uint32_t a, uint32_t b = 0,
+                  uint32_t c = 0) {
+    out.code.push_back(Instr{op, kind, static_cast<uint16_t>(a),
+                             static_cast<uint16_t>(b),
+                             static_cast<uint16_t>(c)});
+    return out.code.size() - 1;
+  }
+
+  void jumpTo(Op op, BlockId target, uint32_t a = 0) {
+    patches.emplace_back(put(op, IntKind::I32, a), target);
+  }
+
+  void move(uint32_t dst, uint32_t src) {
+    if (dst != src) {
+      put(Op::Move, IntKind::I32, dst, src);
+      top = std::max(top, dst + 1);
+    }
+  }
+
+  /** Performs every move as if simultaneously. */
+  void parallelMove(std::vector<std::pair<uint32_t, uint32_t>> moves) {
+    moves.erase(std::remove_if(moves.begin(), moves.end(),
+                               [](const auto &m) {
+                                 return m.first == m.second;
+                               }),
+                moves.end());
+    while (!moves.empty()) {
+      auto ready{std::find_if(moves.begin(), moves.end(), [&](const auto &m) {
+        return std::none_of(moves.begin(), moves.end(), [&](const auto &o) {
+          return o.second == m.first;
+        });
+      })};
+      if (ready == moves.end()) {
+        // Everything left is a cycle; park one destination in the spare
+        // register.
+        uint32_t parked{moves.front().first};
+        move(temp, parked);
+        for (auto &m : moves) {
+          if (m.second == parked) {
+            m.second = temp;
+          }
+        }
+        continue;
+      }
+      move(ready->first, ready->second);
+      moves.erase(ready);
+    }
+  }
+
+  void loadConst(uint32_t dst, IntKind kind, int64_t value) {
+    if (value >= INT32_MIN && value <= INT32_MAX) {
+      out.code[put(Op::LoadInt, kind, dst)].setImm(
+          static_cast<uint32_t>(value));
+    } else {
+      auto index{static_cast<uint32_t>(out.constants.size())};
+      out.constants.push_back(value);
+      out.code[put(Op::LoadConst, kind, dst)].setImm(index);
+    }
+  }
+
+  void emit(BlockId b, Value v) {
+    const Inst &inst{fn[v]};
+    switch (inst.op) {
+    case Opcode::Nop:
+    case Opcode::Param:
+    case Opcode::Phi:
+    case Opcode::Result:
+      break;
+    case Opcode::Const:
+      if (needed[v]) {
+        loadConst(reg[v], inst.type, inst.imm);
+      }
+      break;
+    case Opcode::Copy:
+      move(reg[v], reg[inst.operands[0]]);
+      break;
+    case Opcode::Neg:
+    case Opcode::BitNot:
+    case Opcode::Not:
+    case Opcode::Cast:
+      put(bytecodeOp(inst.op), inst.type, reg[v], reg[inst.operands[0]]);
+      break;
+    case Opcode::Call: {
+      const Function &callee{module.functions[inst.imm]};
+      // Arguments already in consecutive registers are passed in place.
+      uint32_t args{window};
+      if (!inst.operands.empty()) {
+        args = reg[inst.operands[0]];
+      }
+      for (std::size_t i{0}; i < inst.operands.size(); ++i) {
+        if (reg[inst.operands[i]] != args + i) {
+          args = window;
+        }
+      }
+      for (std::size_t i{0}; args == window && i < inst.operands.size();
+           ++i) {
+        move(window + static_cast<uint32_t>(i), reg[inst.operands[i]]);
+      }
+      if (tail[v]) {
+        put(Op::TailCall, IntKind::I32, 0, static_cast<uint32_t>(inst.imm),
+            args);
+        break;
+      }
+      if (callee.results.size() == 1) {
+        put(Op::Call, IntKind::I32, reg[v], static_cast<uint32_t>(inst.imm),
+            args);
+        break;
+      }
+      put(Op::Call, IntKind::I32, window, static_cast<uint32_t>(inst.imm),
+          args);
+      top = std::max(top, window + static_cast<uint32_t>(
+                                       callee.results.size()));
+      if (!callee.results.empty()) {
+        move(reg[v], window);
+      }
+      for (const Value result : resultsOf[v]) {
+        move(reg[result], window + static_cast<uint32_t>(fn[result].imm));
+      }
+      break;
+    }
+    case Opcode::Print:
+      put(Op::Print, IntKind::I32, reg[inst.operands[0]]);
+      break;
+    case Opcode::Jump: {
+      BlockId s{fn.blocks[b].succs[0]};
+      std::size_t index{*predIndex(s, b)};
+      std::vector<std::pair<uint32_t, uint32_t>> copies;
+      for (const Value phi : fn.blocks[s].insts) {
+        if (fn[phi].op != Opcode::Phi) {
+          break;
+        }
+        if (reg[phi] != NONE) {
+          copies.emplace_back(reg[phi], reg[fn[phi].operands[index]]);
+        }
+      }
+      parallelMove(std::move(copies));
+      if (s != next) {
+        jumpTo(Op::Jump, s);
+      }
+      break;
+    }
+    case Opcode::Branch: {
+      BlockId ifTrue{fn.blocks[b].succs[0]};
+      BlockId ifFalse{fn.blocks[b].succs[1]};
+      Value cond{inst.operands[0]};
+      // Branch to whichever side doesn't follow, falling into the other.
+      bool when{ifTrue != next};
+      BlockId target{when ? ifTrue : ifFalse};
+      if (fused[cond]) {
+        const Inst &cmp{fn[cond]};
+        put(branchOp(cmp.op, when), fn[cmp.operands[0]].type,
+            reg[cmp.operands[0]], reg[cmp.operands[1]]);
+        jumpTo(Op::Nop, target);
+      } else {
+        jumpTo(when ? Op::JumpIfNotZero : Op::JumpIfZero, target, reg[cond]);
+      }
+      if (when && ifFalse != next) {
+        jumpTo(Op::Jump, ifFalse);
+      }
+      break;
+    }
+    case Opcode::Return: {
+      if (tail[v]) {
+        // The tail call returns for us.
+        break;
+      } else if (inst.operands.empty()) {
+        put(Op::Return, IntKind::I32, 0, 0);
+        break;
+      } else if (inst.operands.size() == 1) {
+        put(Op::Return, IntKind::I32, reg[inst.operands[0]], 1);
+        break;
+      }
+      for (std::size_t i{0}; i < inst.operands.size(); ++i) {
+        move(window + static_cast<uint32_t>(i), reg[inst.operands[i]]);
+      }
+      put(Op::Return, IntKind::I32, window,
+          static_cast<uint32_t>(inst.operands.size()));
+      break;
+    }
+    default:
+      if (isCompare(inst.op)) {
+        if (!fused[v]) {
+          put(bytecodeOp(inst.op), fn[inst.operands[0]].type, reg[v],
+              reg[inst.operands[0]], reg[inst.operands[1]]);
+        }
+      } else if (auto add{addImmediate(v)}) {
+        put(Op::AddInt, inst.type, reg[v], reg[add->first],
+            static_cast<uint16_t>(add->second));
+      } else {
+        put(bytecodeOp(inst.op), inst.type, reg[v], reg[inst.operands[0]],
+            reg[inst.operands[1]]);
+      }
+    }
+  }
+
+  const Module &module;
+  Function &fn;
+  bc::Function &out;
+  std::vector<BlockId> layout;
+  std::vector<uint32_t> position;
+  std::vector<bool> fused;
+  /** Calls lowered to TailCall, and the returns they make redundant. */
+  std::vector<bool> tail;
+  std::vector<bool> needed;
+  std::vector<std::vector<Value>> resultsOf;
+  /** Where each value is live, as sorted inclusive position ranges. */
+  std::vector<std::vector<Range>> ranges;
+  std::vector<uint32_t> reg;
+  uint32_t nextReg;
+  /** A spare register for breaking cycles of phi copies. */
+  uint32_t temp;
+  /** Where arguments and results go when they aren't in place already. */
+  uint32_t window;
+  /** One past the highest register used so far. */
+  uint32_t top;
+  BlockId next;
+  std::vector<std::pair<std::size_t, BlockId>> patches;
+};
+} // namespace
+
+std::optional<bc::Program> ir::lower(Module &module) {
+  bc::Program program;
+  program.functions.resize(module.functions.size());
+  bool ok{true};
+  for (std::size_t i{0}; i < module.functions.size(); ++i) {
+    Report::Function timer{module.functions[i].name};
+    ok = Lowering{module, module.functions[i], program.functions[i]}.lower() &&
+         ok;
+  }
+  if (!ok) {
+    return std::nullopt;
+  }
+  return program;
+}
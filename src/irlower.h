@@ -15,38 +15,28 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 /**
- * \file DewContext.h
+ * \file irlower.h
  */
-#ifndef DEW_CONTEXT_H_
-#define DEW_CONTEXT_H_
+#ifndef DEW_IRLOWER_H_
+#define DEW_IRLOWER_H_
 
-#include "ast.h"
+#include "bytecode.h"
+#include "ir.h"
 #include <optional>
-#include <string_view>
-#include <unordered_map>
 
 namespace dew {
-class DewContextStack;
-
-class DewContext {
-public:
-  DewContext(DewContext *parent);
-  ~DewContext();
-  void define(const std::string_view &name, Definition *definition);
-  std::optional<Definition *> resolve(const std::string_view &name);
-  DewContext *next;
-
-private:
-  DewContext *parent;
-  DewContextStack *children;
-  std::unordered_map<std::string_view, Definition *> definitions;
-};
-
-class DewContextStack {
-public:
-  DewContextStack();
-  DewContext *head;
-  ~DewContextStack();
-};
+namespace ir {
+/**
+ * Translates `module` out of SSA form into bytecode. Values get registers
+ * by linear scan over their live intervals, with phis preferring the
+ * registers of their operands so that most of the copies they imply
+ * disappear. Edges from branches into blocks with phis are split first, so
+ * that every phi copy has a block of its own to go in; that is the only
+ * change made to `module`.
+ *
+ * Errors are reported on std::cerr.
+ */
+std::optional<bc::Program> lower(Module &module);
+} // namespace ir
 } // namespace dew
-#endif // !DEW_CONTEXT_H_
+#endif // !DEW_IRLOWER_H_
@@ -0,0 +1,260 @@
+/**
+ * Copyright (C) 2024 Charles Ancheta
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ * \file jit.cc
+ */
+#include "jit.h"
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+using namespace dew;
+
+using x86::Operand;
+using x86::Reg;
+
+namespace {
+#if defined(__x86_64__)
+constexpr bool HOST_IS_X86_64{true};
+#else
+constexpr bool HOST_IS_X86_64{false};
+#endif
+
+/** Code is mapped this much at a time. */
+constexpr std::size_t CHUNK_SIZE{1 << 16};
+/**
+ * Stack left below the deepest machine code frame for what it calls into:
+ * printing, the interpreter, and the trap handler.
+ */
+constexpr uintptr_t STACK_MARGIN{256 << 10};
+
+/** The lowest address machine code may take this thread's stack to. */
+uintptr_t stackFloor() {
+  thread_local uintptr_t floor{0};
+  if (floor != 0) {
+    return floor;
+  }
+  pthread_attr_t attr;
+  void *low;
+  std::size_t size;
+  if (pthread_getattr_np(pthread_self(), &attr) == 0) {
+    if (pthread_attr_getstack(&attr, &low, &size) == 0) {
+      floor = reinterpret_cast<uintptr_t>(low) + STACK_MARGIN;
+    }
+    pthread_attr_destroy(&attr);
+  }
+  if (floor == 0) {
+    // Assume a megabyte below here, the least any thread gets by default.
+    floor = reinterpret_cast<uintptr_t>(__builtin_frame_address(0)) -
+            (1 << 20) + STACK_MARGIN;
+  }
+  return floor;
+}
+} // namespace
+
+Jit::Jit(const bc::Program &program, Interpret interpret, void *context)
+    : program{program}, interpret{interpret}, context{context},
+      entries(program.functions.size()), native(program.functions.size()),
+      stackLimit{0}, runtime{entries.data(), &stackLimit, print, trap, this},
+      enter{nullptr}, landing{nullptr}, compiledFunctions{0}, bytes{0} {}
+
+Jit::~Jit() {
+  for (const Chunk &chunk : chunks) {
+    munmap(chunk.start, chunk.size);
+  }
+}
+
+const std::string &Jit::error() const { return err; }
+
+void *Jit::place(const std::vector<uint8_t> &code) {
+  auto page{static_cast<std::size_t>(sysconf(_SC_PAGESIZE))};
+  if (chunks.empty() || chunks.back().used + code.size() > chunks.back().size) {
+    std::size_t size{
+        std::max(CHUNK_SIZE, (code.size() + page - 1) / page * page)};
+    void *p{mmap(nullptr, size, PROT_READ | PROT_EXEC,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)};
+    if (p == MAP_FAILED) {
+      return nullptr;
+    }
+    chunks.push_back(Chunk{static_cast<uint8_t *>(p), size, 0});
+  }
+  // Pages are never writable and executable at once. Code already in them
+  // isn't running meanwhile: this thread is here, and the rest of the
+  // chunk belongs to it alone.
+  Chunk &chunk{chunks.back()};
+  uint8_t *at{chunk.start + chunk.used};
+  std::size_t from{chunk.used / page * page};
+  std::size_t length{chunk.used + code.size() - from};
+  if (mprotect(chunk.start + from, length, PROT_READ | PROT_WRITE) != 0) {
+    return nullptr;
+  }
+  std::memcpy(at, code.data(), code.size());
+  if (mprotect(chunk.start + from, length, PROT_READ | PROT_EXEC) != 0) {
+    return nullptr;
+  }
+  chunk.used += (code.size() + 15) & ~std::size_t{15};
+  bytes += code.size();
+  return at;
+}
+
+bool Jit::stub(uint32_t function) {
+  x86::CodeWriter out{runtime};
+  out.beginStub();
+  if (!enter) {
+    // int64_t enter(const int64_t *args, const void *code), with the
+    // arguments read through rbp, which the code called preserves.
+    out.push(Reg::RBP);
+    out.mov(Operand::r(Reg::RAX), Operand::r(Reg::RSI));
+    out.mov(Operand::r(Reg::RBP), Operand::r(Reg::RDI));
+    for (std::size_t i{0}; i < x86::maxParams; ++i) {
+      out.mov(Operand::r(x86::argRegs[i]),
+              Operand::mem(static_cast<int32_t>(8 * i)));
+    }
+    out.callAddress(Reg::RAX);
+    out.pop(Reg::RBP);
+    out.ret();
+    out.endFunction();
+    void *code{place(out.code())};
+    if (!code) {
+      return false;
+    }
+    enter = reinterpret_cast<int64_t (*)(const int64_t *, const void *)>(code);
+    out.beginStub();
+  }
+  // Spills the argument registers and hands them to bridge().
+  constexpr auto spill{static_cast<int32_t>(8 * x86::maxParams)};
+  out.push(Reg::RBP);
+  out.mov(Operand::r(Reg::RBP), Operand::r(Reg::RSP));
+  out.alu(x86::Alu::Sub, Operand::r(Reg::RSP), Operand::imm(spill));
+  for (std::size_t i{0}; i < x86::maxParams; ++i) {
+    out.mov(Operand::mem(static_cast<int32_t>(8 * i) - spill),
+            Operand::r(x86::argRegs[i]));
+  }
+  out.movImm64(Reg::RDI, reinterpret_cast<int64_t>(this));
+  out.mov(Operand::r(Reg::RSI), Operand::imm(static_cast<int32_t>(function)));
+  out.mov(Operand::r(Reg::RDX), Operand::r(Reg::RSP));
+  out.movImm64(Reg::RAX, reinterpret_cast<int64_t>(bridge));
+  out.callAddress(Reg::RAX);
+  out.mov(Operand::r(Reg::RSP), Operand::r(Reg::RBP));
+  out.pop(Reg::RBP);
+  out.ret();
+  out.endFunction();
+  void *code{place(out.code())};
+  entries[function] = code;
+  return code != nullptr;
+}
+
+bool Jit::link(uint32_t function) {
+  if (!HOST_IS_X86_64 || !x86::supported(program, function)) {
+    return false;
+  }
+  if (!enter && !stub(function)) {
+    return false;
+  }
+  // Callees that aren't compiled yet run in the interpreter.
+  for (const bc::Instr &in : program.functions[function].code) {
+    if ((in.op == bc::Op::Call || in.op == bc::Op::TailCall) &&
+        !entries[in.b] && !stub(in.b)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool Jit::compile(uint32_t function) {
+  if (native[function]) {
+    return true;
+  }
+  if (!link(function)) {
+    return false;
+  }
+  x86::CodeWriter out{runtime};
+  if (!x86::generate(program, function, out)) {
+    return false;
+  }
+  void *code{place(out.code())};
+  if (!code) {
+    return false;
+  }
+  entries[function] = code;
+  native[function] = true;
+  ++compiledFunctions;
+  return true;
+}
+
+bool Jit::call(uint32_t function, const int64_t *args, int64_t *results) {
+  int64_t regs[x86::maxParams]{};
+  std::copy_n(args, program.functions[function].numParams, regs);
+  return run(function, entries[function], regs, results);
+}
+
+bool Jit::resume(uint32_t function, uint32_t pc, int64_t *regs,
+                 int64_t *results) {
+  void *&code{resumptions[uint64_t{function} << 32 | pc]};
+  if (!code) {
+    x86::CodeWriter out{runtime};
+    if (!link(function) || !x86::generateEntry(program, function, pc, out) ||
+        !(code = place(out.code()))) {
+      err.clear();
+      return false;
+    }
+  }
+  int64_t args[x86::maxParams]{reinterpret_cast<int64_t>(regs)};
+  return run(function, code, args, results);
+}
+
+bool Jit::run(uint32_t function, const void *code, const int64_t *args,
+              int64_t *results) {
+  std::jmp_buf here;
+  std::jmp_buf *outer{landing};
+  if (!outer) {
+    stackLimit = stackFloor();
+  }
+  landing = &here;
+  if (setjmp(here) != 0) {
+    landing = outer;
+    return false;
+  }
+  int64_t result{enter(args, code)};
+  landing = outer;
+  if (program.functions[function].numResults == 1) {
+    results[0] = result;
+  }
+  return true;
+}
+
+void Jit::print(int64_t value) { std::cout << value << "\n"; }
+
+void Jit::trap(void *context, uint32_t function, x86::Trap trap) {
+  auto *jit{static_cast<Jit *>(context)};
+  jit->err = (trap == x86::Trap::DivisionByZero ? "division by zero in "
+                                                : "stack overflow in ") +
+             jit->program.functions[function].name;
+  // Nothing between here and call() has anything to destroy.
+  std::longjmp(*jit->landing, 1);
+}
+
+int64_t Jit::bridge(Jit *jit, uint32_t function, const int64_t *args) {
+  int64_t result{0};
+  if (!jit->interpret(jit->context, function, args, &result, jit->err)) {
+    std::longjmp(*jit->landing, 1);
+  }
+  return result;
+}
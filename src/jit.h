@@ -0,0 +1,117 @@
+/**
+ * Copyright (C) 2024 Charles Ancheta
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ * \file jit.h
+ */
+#ifndef DEW_JIT_H_
+#define DEW_JIT_H_
+
+#include "bytecode.h"
+#include "x86.h"
+#include <csetjmp>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace dew {
+/**
+ * Machine code for the functions of a program that turn out to be hot,
+ * in pages mapped executable. Compiled code calls every function through
+ * a table of entry points, so compiling a function redirects all of its
+ * callers to it at once; until then its entry is a stub that runs it in
+ * the interpreter. Only x86-64 hosts get machine code; elsewhere nothing
+ * compiles.
+ */
+class Jit {
+public:
+  /**
+   * Runs `function` in the interpreter on behalf of compiled code, returning
+   * false with `error` set if it traps.
+   */
+  using Interpret = bool (*)(void *context, uint32_t function,
+                             const int64_t *args, int64_t *results,
+                             std::string &error);
+
+  Jit(const bc::Program &program, Interpret interpret, void *context);
+  ~Jit();
+  Jit(const Jit &) = delete;
+  Jit &operator=(const Jit &) = delete;
+
+  /** Compiles `function` unless it already is; false if it can't be. */
+  bool compile(uint32_t function);
+  bool compiled(uint32_t function) const { return native[function]; }
+  /**
+   * Runs compiled `function` with `args`, storing its result, if any, in
+   * `results`. Returns false and sets error() when the program traps.
+   */
+  bool call(uint32_t function, const int64_t *args, int64_t *results);
+  /**
+   * Finishes a call to `function` the interpreter is partway through, from
+   * the branch target `pc` on, with the call's registers in `regs`. Returns
+   * like call(), or false with error() empty if it can't be compiled.
+   */
+  bool resume(uint32_t function, uint32_t pc, int64_t *regs,
+              int64_t *results);
+  const std::string &error() const;
+  std::size_t compiledCount() const { return compiledFunctions; }
+  /** Bytes of machine code generated, stubs included. */
+  std::size_t codeSize() const { return bytes; }
+
+private:
+  /** Executable pages, made writable only while code is copied in. */
+  struct Chunk {
+    uint8_t *start;
+    std::size_t size;
+    std::size_t used;
+  };
+
+  /** Copies `code` into executable memory, returning where, or null. */
+  void *place(const std::vector<uint8_t> &code);
+  /** Points `function`'s entry at a stub into the interpreter. */
+  bool stub(uint32_t function);
+  /** Makes sure what code for `function` calls exists, if it can have any. */
+  bool link(uint32_t function);
+  /** Runs `code` for `function` on the six argument registers in `args`. */
+  bool run(uint32_t function, const void *code, const int64_t *args,
+           int64_t *results);
+
+  static void print(int64_t value);
+  static void trap(void *context, uint32_t function, x86::Trap trap);
+  static int64_t bridge(Jit *jit, uint32_t function, const int64_t *args);
+
+  const bc::Program &program;
+  Interpret interpret;
+  void *context;
+  /** Where calls to each function go; null until something needs it. */
+  std::vector<void *> entries;
+  std::vector<bool> native;
+  /** Code for resuming calls, by function and pc. */
+  std::unordered_map<uint64_t, void *> resumptions;
+  std::vector<Chunk> chunks;
+  uintptr_t stackLimit;
+  x86::Runtime runtime;
+  /** Calls `code` with the six argument registers loaded from `args`. */
+  int64_t (*enter)(const int64_t *args, const void *code);
+  /** Where traps jump back to: the innermost call() still running. */
+  std::jmp_buf *landing;
+  std::string err;
+  std::size_t compiledFunctions;
+  std::size_t bytes;
+};
+} // namespace dew
+#endif // !DEW_JIT_H_
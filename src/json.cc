@@ -0,0 +1,329 @@
+/**
+ * Copyright (C) 2024 Charles Ancheta
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ * \file json.cc
+ */
+#include "json.h"
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+
+using namespace dew;
+using namespace dew::json;
+
+namespace dew {
+namespace json {
+/** Recursive descent over the text, nesting at most MAX_DEPTH deep. */
+class Reader {
+public:
+  Reader(std::string_view text) : text{text}, at{0} {}
+
+  std::optional<Value> document() {
+    Value v;
+    if (!value(v, 0)) {
+      return std::nullopt;
+    }
+    space();
+    if (at != text.size()) {
+      return std::nullopt;
+    }
+    return v;
+  }
+
+private:
+  // Nothing an editor sends nests anywhere near this deep.
+  static constexpr int MAX_DEPTH{64};
+
+  void space() {
+    while (at < text.size() && (text[at] == ' ' || text[at] == '\t' ||
+                                text[at] == '\n' || text[at] == '\r')) {
+      ++at;
+    }
+  }
+
+  bool literal(std::string_view word) {
+    if (text.substr(at, word.size()) != word) {
+      return false;
+    }
+    at += word.size();
+    return true;
+  }
+
+  bool value(Value &v, int depth) {
+    space();
+    if (at == text.size() || depth > MAX_DEPTH) {
+      return false;
+    }
+    switch (text[at]) {
+    case 'n':
+      v.kind = Value::Kind::Null;
+      return literal("null");
+    case 't':
+      v.kind = Value::Kind::Bool;
+      v.boolean = true;
+      return literal("true");
+    case 'f':
+      v.kind = Value::Kind::Bool;
+      v.boolean = false;
+      return literal("false");
+    case '"':
+      v.kind = Value::Kind::String;
+      return string(v.text);
+    case '[':
+      v.kind = Value::Kind::Array;
+      return array(v, depth);
+    case '{':
+      v.kind = Value::Kind::Object;
+      return object(v, depth);
+    default:
+      v.kind = Value::Kind::Number;
+      return numberValue(v.number);
+    }
+  }
+
+  bool numberValue(double &out) {
+    std::size_t start{at};
+    while (at < text.size() &&
+           std::string_view{"+-0123456789.eE"}.find(text[at]) !=
+               std::string_view::npos) {
+      ++at;
+    }
+    if (at == start) {
+      return false;
+    }
+    std::string digits{text.substr(start, at - start)};
+    char *end{nullptr};
+    out = std::strtod(digits.c_str(), &end);
+    return end == digits.c_str() + digits.size();
+  }
+
+  bool hex(uint32_t &out) {
+    if (text.size() - at < 4) {
+      return false;
+    }
+    out = 0;
+    for (int i{0}; i < 4; ++i) {
+      char c{text[at++]};
+      uint32_t digit;
+      if (c >= '0' && c <= '9') {
+        digit = c - '0';
+      } else if (c >= 'a' && c <= 'f') {
+        digit = c - 'a' + 10;
+      } else if (c >= 'A' && c <= 'F') {
+        digit = c - 'A' + 10;
+      } else {
+        return false;
+      }
+      out = out << 4 | digit;
+    }
+    return true;
+  }
+
+  static void utf8(std::string &out, uint32_t c) {
+    if (c < 0x80) {
+      out += static_cast<char>(c);
+    } else if (c < 0x800) {
+      out += static_cast<char>(0xC0 | c >> 6);
+      out += static_cast<char>(0x80 | (c & 0x3F));
+    } else if (c < 0x10000) {
+      out += static_cast<char>(0xE0 | c >> 12);
+      out += static_cast<char>(0x80 | (c >> 6 & 0x3F));
+      out += static_cast<char>(0x80 | (c & 0x3F));
+    } else {
+      out += static_cast<char>(0xF0 | c >> 18);
+      out += static_cast<char>(0x80 | (c >> 12 & 0x3F));
+      out += static_cast<char>(0x80 | (c >> 6 & 0x3F));
+      out += static_cast<char>(0x80 | (c & 0x3F));
+    }
+  }
+
+  bool string(std::string &out) {
+    ++at;
+    for (;;) {
+      std::size_t plain{at};
+      while (at < text.size() && text[at] != '"' && text[at] != '\\') {
+        ++at;
+      }
+      out.append(text.substr(plain, at - plain));
+      if (at == text.size()) {
+        return false;
+      }
+      if (text[at++] == '"') {
+        return true;
+      }
+      if (at == text.size()) {
+        return false;
+      }
+      char c{text[at++]};
+      switch (c) {
+      case 'b':
+        out += '\b';
+        break;
+      case 'f':
+        out += '\f';
+        break;
+      case 'n':
+        out += '\n';
+        break;
+      case 'r':
+        out += '\r';
+        break;
+      case 't':
+        out += '\t';
+        break;
+      case 'u': {
+        uint32_t code;
+        if (!hex(code)) {
+          return false;
+        }
+        // A surrogate pair is two escapes for one character.
+        uint32_t low;
+        if (code >= 0xD800 && code < 0xDC00 && literal("\\u") && hex(low) &&
+            low >= 0xDC00 && low < 0xE000) {
+          code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+        }
+        utf8(out, code);
+        break;
+      }
+      default:
+        out += c;
+      }
+    }
+  }
+
+  bool array(Value &v, int depth) {
+    ++at;
+    space();
+    if (at < text.size() && text[at] == ']') {
+      ++at;
+      return true;
+    }
+    for (;;) {
+      v.elements.emplace_back();
+      if (!value(v.elements.back(), depth + 1)) {
+        return false;
+      }
+      space();
+      if (at == text.size()) {
+        return false;
+      }
+      char c{text[at++]};
+      if (c == ']') {
+        return true;
+      } else if (c != ',') {
+        return false;
+      }
+    }
+  }
+
+  bool object(Value &v, int depth) {
+    ++at;
+    space();
+    if (at < text.size() && text[at] == '}') {
+      ++at;
+      return true;
+    }
+    for (;;) {
+      space();
+      if (at == text.size() || text[at] != '"') {
+        return false;
+      }
+      v.members.emplace_back();
+      if (!string(v.members.back().first)) {
+        return false;
+      }
+      space();
+      if (at == text.size() || text[at++] != ':') {
+        return false;
+      }
+      if (!value(v.members.back().second, depth + 1)) {
+        return false;
+      }
+      space();
+      if (at == text.size()) {
+        return false;
+      }
+      char c{text[at++]};
+      if (c == '}') {
+        return true;
+      } else if (c != ',') {
+        return false;
+      }
+    }
+  }
+
+  std::string_view text;
+  std::size_t at;
+};
+} // namespace json
+} // namespace dew
+
+const Value &Value::operator[](std::string_view key) const {
+  static const Value missing;
+  for (const auto &[name, value] : members) {
+    if (name == key) {
+      return value;
+    }
+  }
+  return missing;
+}
+
+std::optional<Value> json::parse(std::string_view text) {
+  return Reader{text}.document();
+}
+
+void json::quote(std::ostream &out, std::string_view text) {
+  out << '"';
+  for (const char c : text) {
+    switch (c) {
+    case '"':
+      out << "\\\"";
+      break;
+    case '\\':
+      out << "\\\\";
+      break;
+    case '\n':
+      out << "\\n";
+      break;
+    case '\r':
+      out << "\\r";
+      break;
+    case '\t':
+      out << "\\t";
+      break;
+    default:
+      if (static_cast<unsigned char>(c) < 0x20) {
+        char escape[8];
+        std::snprintf(escape, sizeof(escape), "\\u%04x", c);
+        out << escape;
+      } else {
+        out << c;
+      }
+    }
+  }
+  out << '"';
+}
+
+void json::number(std::ostream &out, double value) {
+  if (value == std::floor(value) && std::fabs(value) < 1e15) {
+    out << static_cast<int64_t>(value);
+  } else {
+    char text[32];
+    std::snprintf(text, sizeof(text), "%.17g", value);
+    out << text;
+  }
+}
@@ -0,0 +1,69 @@
+/**
+ * Copyright (C) 2024 Charles Ancheta
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ * \file json.h
+ */
+#ifndef DEW_JSON_H_
+#define DEW_JSON_H_
+
+#include <cstdint>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace dew {
+namespace json {
+/** A parsed JSON value, just enough of one for the language server. */
+class Value {
+public:
+  enum class Kind : uint8_t { Null, Bool, Number, String, Array, Object };
+
+  Value() : kind{Kind::Null}, boolean{false}, number{0} {}
+
+  Kind type() const { return kind; }
+  bool isNull() const { return kind == Kind::Null; }
+  bool asBool() const { return boolean; }
+  double asNumber() const { return number; }
+  /** The string, or the empty one if it's not a string. */
+  const std::string &asString() const { return text; }
+  const std::vector<Value> &items() const { return elements; }
+  /** The member called `key`, or null if there's none. */
+  const Value &operator[](std::string_view key) const;
+
+private:
+  friend class Reader;
+
+  Kind kind;
+  bool boolean;
+  double number;
+  std::string text;
+  std::vector<Value> elements;
+  std::vector<std::pair<std::string, Value>> members;
+};
+
+/** Parses `text`, which has to be a single value and nothing else. */
+std::optional<Value> parse(std::string_view text);
+/** Writes `text` as a JSON string, quotes and all. */
+void quote(std::ostream &out, std::string_view text);
+/** Writes the number `value` back the way it was read. */
+void number(std::ostream &out, double value);
+} // namespace json
+} // namespace dew
+#endif // !DEW_JSON_H_
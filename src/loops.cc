@@ -0,0 +1,617 @@
+/**
+ * Copyright (C) 2024 Charles Ancheta
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ * \file loops.cc
+ */
+#include "loops.h"
+#include <algorithm>
+#include <limits>
+#include <string>
+#include <unordered_set>
+
+using namespace dew;
+using namespace dew::ir;
+
+namespace {
+constexpr BlockId NONE{std::numeric_limits<BlockId>::max()};
+/** Instructions an unrolled loop body may grow to. */
+constexpr std::size_t UNROLL_BUDGET{64};
+/** Trip counts are worked out by stepping the counter, this far at most. */
+constexpr int64_t MAX_TRIPS{1 << 20};
+
+std::ostream *decisions{nullptr};
+/** What's been said already, since passes run more than once. */
+std::unordered_set<std::string> said;
+
+void note(const Function &fn, const Loop &loop, const std::string &what) {
+  if (!decisions) {
+    return;
+  }
+  std::string line{fn.name + ": loop at b" + std::to_string(loop.header) +
+                   ": " + what};
+  if (said.insert(line).second) {
+    *decisions << line << "\n";
+  }
+}
+
+/** Each reachable block's immediate dominator; NONE for the rest. */
+std::vector<BlockId> dominators(const Function &fn) {
+  // Reverse postorder, without recursing.
+  std::vector<BlockId> order;
+  std::vector<bool> seen(fn.blocks.size());
+  std::vector<std::pair<BlockId, std::size_t>> stack{{0, 0}};
+  seen[0] = true;
+  while (!stack.empty()) {
+    auto [b, next]{stack.back()};
+    if (next < fn.blocks[b].succs.size()) {
+      ++stack.back().second;
+      BlockId s{fn.blocks[b].succs[next]};
+      if (!seen[s]) {
+        seen[s] = true;
+        stack.emplace_back(s, 0);
+      }
+    } else {
+      order.push_back(b);
+      stack.pop_back();
+    }
+  }
+  std::reverse(order.begin(), order.end());
+  std::vector<uint32_t> rank(fn.blocks.size());
+  for (uint32_t i{0}; i < order.size(); ++i) {
+    rank[order[i]] = i;
+  }
+
+  std::vector<BlockId> idom(fn.blocks.size(), NONE);
+  idom[0] = 0;
+  auto intersect{[&](BlockId a, BlockId b) {
+    while (a != b) {
+      while (rank[a] > rank[b]) {
+        a = idom[a];
+      }
+      while (rank[b] > rank[a]) {
+        b = idom[b];
+      }
+    }
+    return a;
+  }};
+  for (bool changed{true}; changed;) {
+    changed = false;
+    for (std::size_t i{1}; i < order.size(); ++i) {
+      BlockId b{order[i]};
+      BlockId dom{NONE};
+      for (const BlockId p : fn.blocks[b].preds) {
+        if (idom[p] != NONE) {
+          dom = dom == NONE ? p : intersect(p, dom);
+        }
+      }
+      if (dom != idom[b]) {
+        idom[b] = dom;
+        changed = true;
+      }
+    }
+  }
+  return idom;
+}
+
+bool dominates(const std::vector<BlockId> &idom, BlockId a, BlockId b) {
+  for (;; b = idom[b]) {
+    if (b == a) {
+      return true;
+    } else if (b == 0 || idom[b] == NONE) {
+      return false;
+    }
+  }
+}
+
+std::vector<bool> membership(const Function &fn, const Loop &loop) {
+  std::vector<bool> in(fn.blocks.size());
+  for (const BlockId b : loop.blocks) {
+    in[b] = true;
+  }
+  return in;
+}
+
+/** Puts `v`, from elsewhere or just appended, right before `block` ends. */
+void placeBeforeEnd(Function &fn, BlockId block, Value v) {
+  std::vector<Value> &list{fn.blocks[block].insts};
+  if (list.back() == v) {
+    list.pop_back();
+  }
+  list.insert(list.end() - 1, v);
+  fn[v].block = block;
+}
+
+Value insertBeforeEnd(Function &fn, BlockId block, Opcode op,
+                      bc::IntKind type, std::vector<Value> operands,
+                      int64_t imm = 0) {
+  Value v{fn.append(block, op, type, std::move(operands), imm)};
+  placeBeforeEnd(fn, block, v);
+  return v;
+}
+
+/** Whether `inst` computes the same thing on every iteration. */
+bool invariant(const Function &fn, const Inst &inst,
+               const std::vector<bool> &in) {
+  switch (inst.op) {
+  case Opcode::Nop:
+  case Opcode::Param:
+  case Opcode::Phi:
+  case Opcode::Call:
+  case Opcode::Result:
+  case Opcode::Print:
+  case Opcode::Jump:
+  case Opcode::Branch:
+  case Opcode::Return:
+    return false;
+  default:
+    break;
+  }
+  return !hasSideEffects(fn, inst) &&
+         std::all_of(inst.operands.begin(), inst.operands.end(),
+                     [&](Value o) { return !in[fn[o].block]; });
+}
+
+/**
+ * A phi in a loop's header that starts at `init` and goes up or down by a
+ * constant `step` once per iteration, `links` times over if the loop has
+ * been unrolled that many times already.
+ */
+struct Induction {
+  Value phi;
+  Value init;
+  Opcode op;
+  int64_t step;
+  uint32_t links;
+};
+
+/**
+ * The loop's induction variables, if it is entered from its preheader and
+ * jumps back from one latch, which is all the passes below handle.
+ */
+std::vector<Induction> inductions(const Function &fn, const Loop &loop) {
+  const Block &header{fn.blocks[loop.header]};
+  if (!loop.preheader || loop.latches.size() != 1 ||
+      header.preds.size() != 2) {
+    return {};
+  }
+  std::size_t entry{header.preds[0] == *loop.preheader ? 0u : 1u};
+  std::vector<Induction> found;
+  for (const Value v : header.insts) {
+    const Inst &phi{fn[v]};
+    if (phi.op != Opcode::Phi) {
+      break;
+    }
+    Induction iv{v, phi.operands[entry], Opcode::Nop, 0, 0};
+    Value link{phi.operands[1 - entry]};
+    for (; link != v; ++iv.links) {
+      const Inst &step{fn[link]};
+      if ((step.op != Opcode::Add && step.op != Opcode::Sub) ||
+          step.type != phi.type || fn[step.operands[1]].op != Opcode::Const ||
+          (iv.links > 0 && (step.op != iv.op ||
+                            fn[step.operands[1]].imm != iv.step))) {
+        break;
+      }
+      iv.op = step.op;
+      iv.step = fn[step.operands[1]].imm;
+      link = step.operands[0];
+    }
+    if (link == v) {
+      found.push_back(iv);
+    }
+  }
+  return found;
+}
+} // namespace
+
+void ir::logLoops(std::ostream *out) {
+  decisions = out;
+  said.clear();
+}
+
+std::vector<Loop> ir::findLoops(const Function &fn) {
+  std::vector<BlockId> idom{dominators(fn)};
+  std::vector<Loop> loops;
+  std::vector<std::size_t> loopAt(fn.blocks.size(), loops.max_size());
+  for (BlockId b{0}; b < fn.blocks.size(); ++b) {
+    if (idom[b] == NONE) {
+      continue;
+    }
+    for (const BlockId h : fn.blocks[b].succs) {
+      if (!dominates(idom, h, b)) {
+        continue;
+      }
+      if (loopAt[h] == loops.max_size()) {
+        loopAt[h] = loops.size();
+        loops.push_back(Loop{h, {}, {}, std::nullopt});
+      }
+      std::vector<BlockId> &latches{loops[loopAt[h]].latches};
+      if (latches.empty() || latches.back() != b) {
+        latches.push_back(b);
+      }
+    }
+  }
+
+  for (Loop &loop : loops) {
+    // Everything that gets to a latch without going through the header.
+    std::vector<bool> in(fn.blocks.size());
+    in[loop.header] = true;
+    std::vector<BlockId> work{loop.latches};
+    while (!work.empty()) {
+      BlockId b{work.back()};
+      work.pop_back();
+      if (in[b]) {
+        continue;
+      }
+      in[b] = true;
+      for (const BlockId p : fn.blocks[b].preds) {
+        if (!in[p] && idom[p] != NONE) {
+          work.push_back(p);
+        }
+      }
+    }
+    for (BlockId b{0}; b < fn.blocks.size(); ++b) {
+      if (in[b]) {
+        loop.blocks.push_back(b);
+      }
+    }
+    std::vector<BlockId> entries;
+    for (const BlockId p : fn.blocks[loop.header].preds) {
+      if (!in[p]) {
+        entries.push_back(p);
+      }
+    }
+    if (entries.size() == 1 && fn.blocks[entries[0]].succs.size() == 1) {
+      loop.preheader = entries[0];
+    }
+  }
+  // A loop inside another has fewer blocks than it.
+  std::stable_sort(loops.begin(), loops.end(),
+                   [](const Loop &a, const Loop &b) {
+                     return a.blocks.size() < b.blocks.size();
+                   });
+  return loops;
+}
+
+bool ir::hoistInvariants(Function &fn) {
+  bool changed{false};
+  for (const Loop &loop : findLoops(fn)) {
+    if (!loop.preheader) {
+      note(fn, loop, "nothing hoisted, it has no preheader");
+      continue;
+    }
+    std::vector<bool> in{membership(fn, loop)};
+    std::size_t hoisted{0};
+    // Hoisting one instruction can make those using it invariant too.
+    for (bool again{true}; again;) {
+      again = false;
+      for (const BlockId b : loop.blocks) {
+        std::vector<Value> &list{fn.blocks[b].insts};
+        for (std::size_t i{0}; i < list.size();) {
+          Value v{list[i]};
+          if (!invariant(fn, fn[v], in)) {
+            ++i;
+            continue;
+          }
+          list.erase(list.begin() + static_cast<std::ptrdiff_t>(i));
+          placeBeforeEnd(fn, *loop.preheader, v);
+          ++hoisted;
+          again = true;
+        }
+      }
+    }
+    if (hoisted != 0) {
+      note(fn, loop, "hoisted " + std::to_string(hoisted) + " instructions");
+      changed = true;
+    }
+  }
+  return changed;
+}
+
+bool ir::reduceStrength(Function &fn) {
+  bool changed{false};
+  for (const Loop &loop : findLoops(fn)) {
+    std::vector<Induction> ivs{inductions(fn, loop)};
+    if (ivs.empty()) {
+      continue;
+    }
+    std::vector<bool> in{membership(fn, loop)};
+    BlockId pre{*loop.preheader};
+    BlockId latch{loop.latches[0]};
+    for (const BlockId b : loop.blocks) {
+      for (std::size_t i{0}; i < fn.blocks[b].insts.size(); ++i) {
+        Value v{fn.blocks[b].insts[i]};
+        if (fn[v].op != Opcode::Mul) {
+          continue;
+        }
+        bc::IntKind type{fn[v].type};
+        auto iv{std::find_if(ivs.begin(), ivs.end(), [&](const Induction &iv) {
+          return fn[iv.phi].type == type &&
+                 (fn[v].operands[0] == iv.phi || fn[v].operands[1] == iv.phi);
+        })};
+        if (iv == ivs.end()) {
+          continue;
+        }
+        Value k{fn[v].operands[fn[v].operands[0] == iv->phi ? 1 : 0]};
+        if (in[fn[k].block]) {
+          continue;
+        }
+
+        // j = init * k before the loop, then j += step * k with i.
+        Value start{insertBeforeEnd(fn, pre, Opcode::Mul, type, {iv->init, k})};
+        Value stride{
+            fn[k].op == Opcode::Const
+                ? insertBeforeEnd(fn, pre, Opcode::Const, type, {},
+                                  *fold(Opcode::Mul, type, iv->step,
+                                        fn[k].imm))
+                : insertBeforeEnd(
+                      fn, pre, Opcode::Mul, type,
+                      {insertBeforeEnd(fn, pre, Opcode::Const, type, {},
+                                       iv->step),
+                       k})};
+        Value j{fn.addPhi(loop.header, type)};
+        Value next{insertBeforeEnd(fn, latch, iv->op, type, {j, stride})};
+        for (const BlockId p : fn.blocks[loop.header].preds) {
+          fn[j].operands.push_back(p == pre ? start : next);
+        }
+        fn[v].op = Opcode::Copy;
+        fn[v].operands = {j};
+        note(fn, loop,
+             "v" + std::to_string(v) + " = v" + std::to_string(iv->phi) +
+                 " * v" + std::to_string(k) +
+                 " became an induction variable of its own");
+        changed = true;
+      }
+    }
+  }
+  return changed;
+}
+
+namespace {
+/**
+ * How many times the loop at `loop`, whose header branches on comparing an
+ * induction variable with a constant, goes round; nothing if it can't be
+ * told or is more than MAX_TRIPS.
+ */
+std::optional<int64_t> tripCount(const Function &fn, const Loop &loop,
+                                 const std::vector<Induction> &ivs,
+                                 BlockId body, uint32_t &links) {
+  const Block &header{fn.blocks[loop.header]};
+  const Inst &branch{fn[header.insts.back()]};
+  const Inst &cond{fn[branch.operands[0]]};
+  if (cond.op < Opcode::LT || cond.op > Opcode::Neq) {
+    return std::nullopt;
+  }
+  bool counterFirst{true};
+  auto iv{ivs.end()};
+  for (int side{0}; side < 2 && iv == ivs.end(); ++side) {
+    Value counter{cond.operands[side]};
+    Value bound{cond.operands[1 - side]};
+    if (fn[bound].op == Opcode::Const) {
+      iv = std::find_if(ivs.begin(), ivs.end(), [&](const Induction &iv) {
+        return iv.phi == counter && fn[iv.init].op == Opcode::Const;
+      });
+      counterFirst = side == 0;
+    }
+  }
+  if (iv == ivs.end()) {
+    return std::nullopt;
+  }
+  int64_t bound{fn[cond.operands[counterFirst ? 1 : 0]].imm};
+  bool stayWhen{header.succs[0] == body};
+  bc::IntKind type{fn[iv->phi].type};
+  int64_t x{fn[iv->init].imm};
+  for (int64_t trips{0}; trips <= MAX_TRIPS; trips += iv->links) {
+    int64_t stays{counterFirst ? *fold(cond.op, cond.type, x, bound)
+                               : *fold(cond.op, cond.type, bound, x)};
+    if ((stays != 0) != stayWhen) {
+      links = iv->links;
+      return trips;
+    }
+    for (uint32_t i{0}; i < iv->links; ++i) {
+      x = *fold(iv->op, type, x, iv->step);
+    }
+  }
+  return std::nullopt;
+}
+
+/**
+ * Copies the non-phi instructions of `from`, but for its terminator, to
+ * the end of `into`, with operands mapped through `map` and the copies
+ * recorded in it.
+ */
+void cloneInto(Function &fn, const std::vector<Value> &from, BlockId into,
+               std::vector<Value> &map) {
+  for (const Value v : from) {
+    if (fn[v].op == Opcode::Phi || isTerminator(fn[v].op)) {
+      continue;
+    }
+    Inst copy{fn[v]};
+    for (Value &o : copy.operands) {
+      o = map[o];
+    }
+    copy.block = into;
+    auto c{static_cast<Value>(fn.insts.size())};
+    fn.insts.push_back(std::move(copy));
+    placeBeforeEnd(fn, into, c);
+    map.push_back(c);
+    map[v] = c;
+  }
+}
+
+std::vector<Value> identity(const Function &fn) {
+  std::vector<Value> map(fn.insts.size());
+  for (Value v{0}; v < map.size(); ++v) {
+    map[v] = v;
+  }
+  return map;
+}
+
+void removeBlock(Function &fn, BlockId b) {
+  for (const Value v : fn.blocks[b].insts) {
+    fn[v].op = Opcode::Nop;
+    fn[v].operands.clear();
+  }
+  fn.blocks[b].insts.clear();
+  fn.blocks[b].preds.clear();
+  fn.blocks[b].succs.clear();
+  fn.blocks[b].removed = true;
+}
+
+/**
+ * Runs all `trips` iterations of the loop in its preheader instead, and
+ * the header's test once more at the end for anything after the loop that
+ * uses its values.
+ */
+void unrollCompletely(Function &fn, const Loop &loop, BlockId body,
+                      BlockId exit, int64_t trips) {
+  BlockId pre{*loop.preheader};
+  BlockId h{loop.header};
+  std::size_t entry{fn.blocks[h].preds[0] == pre ? 0u : 1u};
+  std::vector<Value> headerInsts{fn.blocks[h].insts};
+  std::vector<Value> bodyInsts{fn.blocks[body].insts};
+  std::vector<Value> phis;
+  for (const Value v : headerInsts) {
+    if (fn[v].op == Opcode::Phi) {
+      phis.push_back(v);
+    }
+  }
+  std::vector<Value> map{identity(fn)};
+  for (const Value phi : phis) {
+    map[phi] = fn[phi].operands[entry];
+  }
+  std::vector<Value> next(phis.size());
+  for (int64_t t{0}; t < trips; ++t) {
+    cloneInto(fn, headerInsts, pre, map);
+    cloneInto(fn, bodyInsts, pre, map);
+    for (std::size_t i{0}; i < phis.size(); ++i) {
+      next[i] = map[fn[phis[i]].operands[1 - entry]];
+    }
+    for (std::size_t i{0}; i < phis.size(); ++i) {
+      map[phis[i]] = next[i];
+    }
+  }
+  cloneInto(fn, headerInsts, pre, map);
+
+  fn.blocks[pre].succs[0] = exit;
+  std::vector<BlockId> &exitPreds{fn.blocks[exit].preds};
+  *std::find(exitPreds.begin(), exitPreds.end(), h) = pre;
+  removeBlock(fn, h);
+  removeBlock(fn, body);
+  std::vector<Value> forward{identity(fn)};
+  for (const Value v : headerInsts) {
+    forward[v] = map[v];
+  }
+  fn.replaceUses(forward);
+}
+
+/**
+ * Repeats the body `factor` times per trip round the loop, with the
+ * header's instructions before every copy but the first. `factor` divides
+ * the trip count, so the exit test in between can only pass and is left
+ * to constant folding and dead code elimination.
+ */
+void unrollBy(Function &fn, const Loop &loop, BlockId body,
+              uint32_t factor) {
+  BlockId h{loop.header};
+  std::size_t back{fn.blocks[h].preds[0] == body ? 0u : 1u};
+  std::vector<Value> headerInsts{fn.blocks[h].insts};
+  std::vector<Value> bodyInsts{fn.blocks[body].insts};
+  std::vector<Value> map{identity(fn)};
+  std::vector<std::pair<Value, Value>> phis;
+  for (const Value v : headerInsts) {
+    if (fn[v].op == Opcode::Phi) {
+      phis.emplace_back(v, fn[v].operands[back]);
+    }
+  }
+  for (uint32_t copy{1}; copy < factor; ++copy) {
+    for (const auto &[phi, incoming] : phis) {
+      map[phi] = incoming;
+    }
+    cloneInto(fn, headerInsts, body, map);
+    cloneInto(fn, bodyInsts, body, map);
+    for (auto &[phi, incoming] : phis) {
+      incoming = map[fn[phi].operands[back]];
+    }
+  }
+  for (const auto &[phi, incoming] : phis) {
+    fn[phi].operands[back] = incoming;
+  }
+}
+} // namespace
+
+bool ir::unrollLoops(Function &fn) {
+  bool changed{false};
+  // Unrolling changes the blocks, so start over after each loop.
+  for (bool again{true}; again;) {
+    again = false;
+    for (const Loop &loop : findLoops(fn)) {
+      const Block &header{fn.blocks[loop.header]};
+      BlockId body{loop.latches.empty() ? NONE : loop.latches[0]};
+      if (loop.blocks.size() != 2 || !loop.preheader ||
+          loop.latches.size() != 1 || body == loop.header ||
+          header.succs.size() != 2 || fn.blocks[body].succs.size() != 1) {
+        note(fn, loop, "not unrolled, it isn't a loop of one block");
+        continue;
+      }
+      BlockId exit{header.succs[0] == body ? header.succs[1]
+                                           : header.succs[0]};
+      if (fn[fn.blocks[body].insts[0]].op == Opcode::Phi) {
+        continue;
+      }
+      uint32_t links{1};
+      auto trips{tripCount(fn, loop, inductions(fn, loop), body, links)};
+      if (!trips) {
+        note(fn, loop, "not unrolled, the trip count isn't known");
+        continue;
+      }
+      std::string count{std::to_string(*trips) + " iterations"};
+      std::size_t size{fn.blocks[body].insts.size() - 1};
+      for (const Value v : header.insts) {
+        size += fn[v].op != Opcode::Phi && !isTerminator(fn[v].op);
+      }
+      if (links > 1) {
+        note(fn, loop, count + ", unrolled " + std::to_string(links) +
+                           " times");
+        continue;
+      } else if (*trips == 0) {
+        note(fn, loop, "not unrolled, it never iterates");
+        continue;
+      } else if (static_cast<std::size_t>(*trips) * size <= UNROLL_BUDGET) {
+        unrollCompletely(fn, loop, body, exit, *trips);
+        note(fn, loop, count + ", unrolled completely");
+        again = changed = true;
+        break;
+      }
+      uint32_t factor{8};
+      while (factor > 1 &&
+             (*trips % factor != 0 || factor * size > UNROLL_BUDGET)) {
+        factor /= 2;
+      }
+      if (factor == 1) {
+        note(fn, loop, count + ", not unrolled, the body is too big or " +
+                           "the count is odd");
+        continue;
+      }
+      unrollBy(fn, loop, body, factor);
+      note(fn, loop, count + ", unrolled " + std::to_string(factor) +
+                         " times");
+      again = changed = true;
+      break;
+    }
+  }
+  return changed;
+}
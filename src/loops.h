@@ -0,0 +1,72 @@
+/**
+ * Copyright (C) 2024 Charles Ancheta
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ * \file loops.h
+ */
+#ifndef DEW_LOOPS_H_
+#define DEW_LOOPS_H_
+
+#include "ir.h"
+#include <optional>
+#include <ostream>
+#include <vector>
+
+namespace dew {
+namespace ir {
+/** A natural loop: a header and the blocks that get back to it. */
+struct Loop {
+  BlockId header;
+  /** The blocks of the loop, header included, in layout order. */
+  std::vector<BlockId> blocks;
+  /** The blocks that jump back to the header. */
+  std::vector<BlockId> latches;
+  /**
+   * The one block outside the loop that enters it, if it goes nowhere
+   * else; code that runs once before the loop goes at its end.
+   */
+  std::optional<BlockId> preheader;
+};
+
+/** The loops of `fn`, inner loops before the ones around them. */
+std::vector<Loop> findLoops(const Function &fn);
+
+/**
+ * Moves instructions whose operands don't change inside a loop out in
+ * front of it, innermost loops first so that values can leave several.
+ */
+bool hoistInvariants(Function &fn);
+/**
+ * Replaces `i * k`, for an induction variable `i` stepping by a constant
+ * and `k` fixed in the loop, with a variable of its own stepping by
+ * `step * k`.
+ */
+bool reduceStrength(Function &fn);
+/**
+ * Unrolls loops of one block whose trip count is known at compile time:
+ * entirely when the copies stay small, otherwise by a factor of the trip
+ * count, so the exit is only tested once every few iterations.
+ */
+bool unrollLoops(Function &fn);
+
+/**
+ * Makes the loop passes say what they did or didn't do to each loop on
+ * `out`, or stop if it's null.
+ */
+void logLoops(std::ostream *out);
+} // namespace ir
+} // namespace dew
+#endif // !DEW_LOOPS_H_
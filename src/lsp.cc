@@ -0,0 +1,282 @@
+/**
+ * Copyright (C) 2024 Charles Ancheta
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ * \file lsp.cc
+ */
+#include "lsp.h"
+#include <algorithm>
+#include <charconv>
+#include <cstdint>
+#include <iostream>
+#include <sstream>
+
+using namespace dew;
+
+namespace {
+// JSON-RPC error codes.
+constexpr int PARSE_ERROR{-32700};
+constexpr int METHOD_NOT_FOUND{-32601};
+constexpr int INVALID_PARAMS{-32602};
+
+/** Larger messages than this aren't edits to source a person is typing. */
+constexpr std::size_t MAX_MESSAGE{64 << 20};
+
+/** How many bytes the UTF-8 character starting with `lead` takes. */
+uint32_t utf8Length(unsigned char lead) {
+  return lead < 0xC0 ? 1 : lead < 0xE0 ? 2 : lead < 0xF0 ? 3 : 4;
+}
+
+/** A line or character number, clamped; NaN and negatives are 0. */
+uint32_t toIndex(const json::Value &v) {
+  double n{v.asNumber()};
+  if (!(n > 0)) {
+    return 0;
+  }
+  return n < UINT32_MAX ? static_cast<uint32_t>(n) : UINT32_MAX;
+}
+
+/** Echoes the id of a request, which is a number or a string. */
+void writeId(std::ostream &body, const json::Value &id) {
+  if (id.type() == json::Value::Kind::String) {
+    json::quote(body, id.asString());
+  } else if (id.isNull()) {
+    body << "null";
+  } else {
+    json::number(body, id.asNumber());
+  }
+}
+} // namespace
+
+LanguageServer::Document::Document(std::string text)
+    : session{std::move(text)} {
+  index();
+}
+
+void LanguageServer::Document::index() {
+  std::string_view text{session.source()};
+  lines.assign(1, 0);
+  for (std::size_t at{text.find('\n')}; at != std::string_view::npos;
+       at = text.find('\n', at + 1)) {
+    lines.push_back(static_cast<uint32_t>(at + 1));
+  }
+}
+
+LanguageServer::LanguageServer(std::ostream &out)
+    : out{out}, shutdown{false} {}
+
+int LanguageServer::serve(std::istream &in) {
+  std::string line;
+  std::string content;
+  for (;;) {
+    // Headers, then an empty line, then Content-Length bytes of JSON.
+    std::size_t length{0};
+    bool sized{false};
+    while (std::getline(in, line) && line != "\r" && !line.empty()) {
+      constexpr std::string_view HEADER{"Content-Length:"};
+      if (line.compare(0, HEADER.size(), HEADER) != 0) {
+        continue;
+      }
+      std::string_view value{line};
+      value.remove_prefix(HEADER.size());
+      while (!value.empty() && value.front() == ' ') {
+        value.remove_prefix(1);
+      }
+      if (!value.empty() && value.back() == '\r') {
+        value.remove_suffix(1);
+      }
+      const char *end{value.data() + value.size()};
+      auto [last, ec]{std::from_chars(value.data(), end, length)};
+      sized = ec == std::errc{} && last == end && length <= MAX_MESSAGE;
+    }
+    if (!in || !sized) {
+      // Without a length there's no telling where the next message starts.
+      if (in) {
+        std::cerr << "lsp: bad or oversized Content-Length\n";
+      }
+      return shutdown ? 0 : 1;
+    }
+    content.resize(length);
+    if (!in.read(content.data(), static_cast<std::streamsize>(length))) {
+      return shutdown ? 0 : 1;
+    }
+    if (!handle(content)) {
+      return shutdown ? 0 : 1;
+    }
+  }
+}
+
+bool LanguageServer::handle(std::string_view message) {
+  auto request{json::parse(message)};
+  if (!request) {
+    fail(json::Value{}, PARSE_ERROR, "the message isn't JSON");
+    return true;
+  }
+  const std::string &method{(*request)["method"].asString()};
+  const json::Value &id{(*request)["id"]};
+  const json::Value &params{(*request)["params"]};
+  const std::string &uri{params["textDocument"]["uri"].asString()};
+  auto found{documents.find(uri)};
+  Document *doc{found == documents.end() ? nullptr : found->second.get()};
+
+  if (method == "initialize") {
+    // Changes come as edits to ranges, not as the whole text again.
+    reply(id, "{\"capabilities\":{\"textDocumentSync\":"
+              "{\"openClose\":true,\"change\":2},"
+              "\"definitionProvider\":true},"
+              "\"serverInfo\":{\"name\":\"dewc\"}}");
+  } else if (method == "shutdown") {
+    shutdown = true;
+    reply(id, "null");
+  } else if (method == "exit") {
+    return false;
+  } else if (method == "textDocument/didOpen") {
+    auto &opened{documents[uri]};
+    opened =
+        std::make_unique<Document>(params["textDocument"]["text"].asString());
+    publish(uri, opened.get());
+  } else if (method == "textDocument/didChange" && doc) {
+    for (const json::Value &change : params["contentChanges"].items()) {
+      const json::Value &range{change["range"]};
+      const std::string &text{change["text"].asString()};
+      if (range.isNull()) {
+        auto size{static_cast<uint32_t>(doc->session.source().size())};
+        doc->session.edit(0, size, text);
+      } else {
+        uint32_t start{offset(*doc, range["start"])};
+        uint32_t end{std::max(start, offset(*doc, range["end"]))};
+        doc->session.edit(start, end, text);
+      }
+      doc->index();
+    }
+    publish(uri, doc);
+  } else if (method == "textDocument/didClose" && doc) {
+    documents.erase(found);
+    publish(uri, nullptr);
+  } else if (method == "textDocument/definition") {
+    if (!doc) {
+      fail(id, INVALID_PARAMS, "the document isn't open");
+      return true;
+    }
+    auto to{doc->session.definition(offset(*doc, params["position"]))};
+    if (!to) {
+      reply(id, "null");
+      return true;
+    }
+    std::ostringstream result;
+    result << "{\"uri\":";
+    json::quote(result, uri);
+    result << ",\"range\":";
+    writeRange(result, *doc, to->start, to->end);
+    result << "}";
+    reply(id, result.str());
+  } else if (!id.isNull()) {
+    fail(id, METHOD_NOT_FOUND, "unsupported method " + method);
+  }
+  return true;
+}
+
+uint32_t LanguageServer::offset(const Document &doc,
+                                const json::Value &position) const {
+  std::string_view text{doc.session.source()};
+  uint32_t line{toIndex(position["line"])};
+  if (line >= doc.lines.size()) {
+    return static_cast<uint32_t>(text.size());
+  }
+  uint32_t at{doc.lines[line]};
+  auto end{static_cast<uint32_t>(text.size())};
+  if (line + 1 < doc.lines.size()) {
+    end = doc.lines[line + 1] - 1;
+  }
+  // Characters outside the Basic Multilingual Plane are two UTF-16 units.
+  uint32_t units{toIndex(position["character"])};
+  while (units > 0 && at < end) {
+    uint32_t length{utf8Length(static_cast<unsigned char>(text[at]))};
+    units -= std::min(units, length == 4 ? 2u : 1u);
+    at += length;
+  }
+  return std::min(at, end);
+}
+
+void LanguageServer::writeRange(std::ostream &body, const Document &doc,
+                                uint32_t start, uint32_t end) const {
+  std::string_view text{doc.session.source()};
+  auto position{[&](uint32_t offset) {
+    auto next{std::upper_bound(doc.lines.begin(), doc.lines.end(), offset)};
+    auto line{static_cast<uint32_t>(next - doc.lines.begin() - 1)};
+    uint32_t units{0};
+    for (uint32_t at{doc.lines[line]}; at < offset;) {
+      uint32_t length{utf8Length(static_cast<unsigned char>(text[at]))};
+      units += length == 4 ? 2 : 1;
+      at += length;
+    }
+    body << "{\"line\":" << line << ",\"character\":" << units << "}";
+  }};
+  body << "{\"start\":";
+  position(start);
+  body << ",\"end\":";
+  position(end);
+  body << "}";
+}
+
+void LanguageServer::publish(const std::string &uri, Document *doc) {
+  std::vector<DewSession::Problem> problems;
+  if (doc) {
+    doc->session.update();
+    problems = doc->session.problems();
+  }
+  std::ostringstream body;
+  body << "{\"jsonrpc\":\"2.0\","
+          "\"method\":\"textDocument/publishDiagnostics\","
+          "\"params\":{\"uri\":";
+  json::quote(body, uri);
+  body << ",\"diagnostics\":[";
+  const char *sep{""};
+  for (const DewSession::Problem &p : problems) {
+    body << sep << "{\"range\":";
+    writeRange(body, *doc, p.range.start, p.range.end);
+    body << ",\"severity\":1,\"source\":\"dewc\",\"message\":";
+    json::quote(body, p.message);
+    body << "}";
+    sep = ",";
+  }
+  body << "]}}";
+  send(body.str());
+}
+
+void LanguageServer::reply(const json::Value &id, std::string_view result) {
+  std::ostringstream body;
+  body << "{\"jsonrpc\":\"2.0\",\"id\":";
+  writeId(body, id);
+  body << ",\"result\":" << result << "}";
+  send(body.str());
+}
+
+void LanguageServer::fail(const json::Value &id, int code,
+                          std::string_view message) {
+  std::ostringstream body;
+  body << "{\"jsonrpc\":\"2.0\",\"id\":";
+  writeId(body, id);
+  body << ",\"error\":{\"code\":" << code << ",\"message\":";
+  json::quote(body, message);
+  body << "}}";
+  send(body.str());
+}
+
+void LanguageServer::send(std::string_view body) {
+  out << "Content-Length: " << body.size() << "\r\n\r\n" << body;
+  out.flush();
+}
@@ -0,0 +1,81 @@
+/**
+ * Copyright (C) 2024 Charles Ancheta
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ * \file lsp.h
+ */
+#ifndef DEW_LSP_H_
+#define DEW_LSP_H_
+
+#include "DewSession.h"
+#include "json.h"
+#include <istream>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace dew {
+/**
+ * `dewc lsp`: the Language Server Protocol over a pair of streams. Every
+ * open document is a DewSession, edited incrementally as changes come in,
+ * so that only the functions an edit touched are parsed and compiled
+ * again. Diagnostics are published after every change, and definitions
+ * are looked up in the session's AST.
+ */
+class LanguageServer {
+public:
+  /** Replies and notifications go to `out`. */
+  LanguageServer(std::ostream &out);
+  /**
+   * Serves the messages read from `in` until `exit` or the end of input,
+   * returning the status to exit with.
+   */
+  int serve(std::istream &in);
+  /**
+   * Handles the content of one message. Returns false once it's `exit`.
+   */
+  bool handle(std::string_view message);
+
+private:
+  struct Document {
+    Document(std::string text);
+    /** Finds where the lines start again, after an edit. */
+    void index();
+
+    DewSession session;
+    /** The byte offset of every line. */
+    std::vector<uint32_t> lines;
+  };
+
+  /** The byte offset of an LSP position, whose columns are UTF-16. */
+  uint32_t offset(const Document &doc, const json::Value &position) const;
+  void writeRange(std::ostream &body, const Document &doc, uint32_t start,
+                  uint32_t end) const;
+  /** Publishes the problems with `doc`, or none once it's closed. */
+  void publish(const std::string &uri, Document *doc);
+  void reply(const json::Value &id, std::string_view result);
+  void fail(const json::Value &id, int code, std::string_view message);
+  void send(std::string_view body);
+
+  std::ostream &out;
+  std::unordered_map<std::string, std::unique_ptr<Document>> documents;
+  bool shutdown;
+};
+} // namespace dew
+#endif // !DEW_LSP_H_
@@ -17,11 +17,35 @@
 /**
  * \file main.cc
  */
+#include "DewCompiler.h"
 #include "DewParser.h"
+#include "DewSession.h"
+#include "DewVM.h"
+#include "IRBuilder.h"
+#include "ThreadPool.h"
+#include "cache.h"
+#include "image.h"
+#include "irlower.h"
+#include "loops.h"
+#include "lsp.h"
+#include "passes.h"
+#include "profiler.h"
+#include "report.h"
+#include "source.h"
+#include "x86.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
 #include <fstream>
 #include <iostream>
 #include <sstream>
+#include <string>
+#include <string_view>
+#include <thread>
 #include <tree_sitter/api.h>
+#include <utility>
+#include <vector>
 
 using namespace dew;
 
@@ -37,14 +61,574 @@ std::string fileToString(const char *path) {
   return ss.str();
 }
 
-int main(int argc, const char *argv[]) {
-  if (argc < 2) {
-    std::cerr << "USAGE: " << argv[0] << " FILE\n";
+int usage(const char *argv0) {
+  std::cerr << "USAGE: " << argv0
+            << " [-O] [--jit] [--stream] [--time-passes] [--dump-loops]"
+               " [--time-report] [--mem-report] [--trace OUT] [--cache DIR]"
+               " [--profile OUT] [--profile-rate HZ] [-j N]"
+               " [run|disasm|asm|ir|watch] FILE\n"
+            << "       " << argv0
+            << " [-O] [--cache DIR] [-j N] build FILE|@MANIFEST...\n"
+            << "       " << argv0
+            << " [-O] [--stream] [--cache DIR] [-j N] -o OUT compile FILE\n"
+            << "       " << argv0 << " lsp\n";
+  return 1;
+}
+
+struct Options {
+  std::string_view command;
+  const char *path;
+  /** The files and manifests given to `build`. */
+  std::vector<const char *> paths;
+  /** Where compiled programs are kept between runs, if anywhere. */
+  const char *cacheDir;
+  /** Where `compile` writes the `.dewb` file. */
+  const char *outPath;
+  bool optimize;
+  /** Compile hot functions to machine code while running. */
+  bool jit;
+  /** Compile each function as soon as it's parsed; see compileStreaming. */
+  bool stream;
+  bool timePasses;
+  /** Say what the loop passes did to each loop. */
+  bool dumpLoops;
+  /** Print where the time (and memory) went, phase by phase. */
+  bool timeReport;
+  bool memReport;
+  /** Where to write the phases as Chrome trace events, if anywhere. */
+  const char *tracePath;
+  /** Where to write the folded stacks sampled while running, if anywhere. */
+  const char *profilePath;
+  /** Samples per second of CPU time. */
+  uint32_t profileRate;
+  /** Threads to parse and compile function bodies on. */
+  unsigned jobs;
+};
+
+void runPasses(ir::Module &module, const Options &opts) {
+  auto passes{ir::PassManager::standard()};
+  if (opts.dumpLoops) {
+    ir::logLoops(&std::cerr);
+  }
+  {
+    Report::Phase phase{"passes"};
+    passes.run(module);
+  }
+  ir::logLoops(nullptr);
+  if (opts.timePasses) {
+    passes.report(std::cerr);
+  }
+}
+
+/** Builds the IR, running the passes over it with `-O`. */
+std::optional<ir::Module> buildIR(DewParser &p, const Options &opts) {
+  std::optional<ir::Module> module;
+  {
+    Report::Phase phase{"ir"};
+    module = IRBuilder{p.astTree()}.build(p.getFunctions());
+  }
+  if (module && opts.optimize) {
+    runPasses(*module, opts);
+  }
+  return module;
+}
+
+std::optional<bc::Program> compile(DewParser &p, const Options &opts,
+                                   ThreadPool &pool) {
+  p.parseSource(pool);
+  if (!opts.optimize) {
+    Report::Phase phase{"bytecode"};
+    return DewCompiler{p.astTree()}.compile(p.getFunctions(), pool);
+  }
+  auto module{buildIR(p, opts)};
+  if (!module) {
+    return std::nullopt;
+  }
+  Report::Phase phase{"lower"};
+  return ir::lower(*module);
+}
+
+/**
+ * Compiles `source` a function at a time, each as soon as it's parsed, so
+ * that only one function's tree and AST are ever held: bytecode straight
+ * away, or IR that's optimized and lowered once it's all there with `-O`.
+ */
+std::optional<bc::Program> compileStreaming(Source source, const Options &opts,
+                                            TSParser *parser) {
+  DewParser p{std::move(source), parser, DewParser::Streaming{}};
+  const std::vector<ast::Function> &functions{p.getFunctions()};
+  bool ok{true};
+  if (!opts.optimize) {
+    bc::Program program;
+    DewCompiler compiler{p.astTree()};
+    p.stream([&](uint32_t i) {
+      program.functions.emplace_back();
+      ok = compiler.recompile(functions, i, program.functions.back()) && ok;
+    });
+    return ok ? std::optional{std::move(program)} : std::nullopt;
+  }
+  ir::Module module;
+  IRBuilder builder{p.astTree()};
+  p.stream([&](uint32_t i) {
+    module.functions.emplace_back();
+    ok = builder.build(functions, i, module.functions.back()) && ok;
+  });
+  if (!ok) {
+    return std::nullopt;
+  }
+  runPasses(module, opts);
+  Report::Phase phase{"lower"};
+  return ir::lower(module);
+}
+
+/**
+ * Compiles `source` with `parser`, if given, unless `cache` already has the
+ * program from an earlier compile with the same flags.
+ */
+std::optional<bc::Program> compile(Source source, const Options &opts,
+                                   ThreadPool &pool, CompileCache *cache,
+                                   TSParser *parser = nullptr) {
+  std::string key;
+  if (cache) {
+    key = cache->key(source.text(), opts.optimize ? "-O" : "");
+    if (auto program{cache->load(key)}) {
+      return program;
+    }
+  }
+  std::optional<bc::Program> program;
+  if (opts.stream) {
+    program = compileStreaming(std::move(source), opts, parser);
+  } else {
+    DewParser p{std::move(source), parser};
+    program = compile(p, opts, pool);
+  }
+  if (program && cache) {
+    cache->store(key, *program);
+  }
+  return program;
+}
+
+/** How many of the costliest functions the reports list. */
+constexpr std::size_t REPORT_FUNCTIONS{10};
+
+int run(const bc::Program &program, bool jit, Profiler *profiler = nullptr) {
+  auto entry{program.find("main")};
+  if (!entry) {
+    std::cerr << "no `main` function\n";
+    return 1;
+  }
+  const bc::Function &fn{program.functions[*entry]};
+  if (fn.numParams != 0) {
+    std::cerr << "`main` can't take parameters\n";
+    return 1;
+  }
+  std::vector<int64_t> results(fn.numResults);
+  DewVM vm{program};
+  if (jit) {
+    vm.enableJit();
+  }
+  Report::Phase phase{"run"};
+  if (profiler) {
+    vm.profileWith(profiler);
+    if (!profiler->start()) {
+      return 1;
+    }
+  }
+  bool ok{vm.call(*entry, nullptr, results.data())};
+  if (profiler) {
+    profiler->stop();
+  }
+  if (!ok) {
+    std::cerr << "runtime error: " << vm.error() << "\n";
     return 1;
   }
+  return results.empty() ? 0 : static_cast<int>(results[0]);
+}
 
-  DewParser p{fileToString(argv[1])};
+/**
+ * The line each of `program`'s functions is declared on in `text`. The
+ * program may have come from the cache, so the text is parsed again.
+ */
+std::vector<uint32_t> declarationLines(std::string text,
+                                       const bc::Program &program) {
+  DewParser p{std::move(text)};
   p.parseSource();
+  std::vector<uint32_t> lines(program.functions.size());
+  const std::vector<ast::Function> &functions{p.getFunctions()};
+  for (uint32_t i{0}; i < functions.size(); ++i) {
+    std::string_view name{functions[i].decl->name};
+    if (auto function{program.find(name)}) {
+      std::string_view before{
+          p.getSource().substr(0, p.offsetOf(i, name))};
+      lines[*function] = static_cast<uint32_t>(
+          std::count(before.begin(), before.end(), '\n') + 1);
+    }
+  }
+  return lines;
+}
+
+/**
+ * Runs the program under the profiler, printing where the time went and
+ * writing the stacks sampled to `--profile`'s file for flame graphs. With
+ * no `text` to find them in, functions go without their lines.
+ */
+int profile(const bc::Program &program, const Options &opts,
+            std::string text) {
+  std::ofstream out{opts.profilePath};
+  if (!out.is_open()) {
+    std::cerr << "file `" << opts.profilePath << "` could not be written\n";
+    return 1;
+  }
+  Profiler profiler{program,
+                    text.empty() ? std::vector<uint32_t>{}
+                                 : declarationLines(std::move(text), program),
+                    opts.profileRate};
+  int status{run(program, opts.jit, &profiler)};
+  profiler.table(std::cerr, REPORT_FUNCTIONS);
+  profiler.folded(out);
+  return status;
+}
 
-  return 0;
+/**
+ * Runs the program every time the file changes, recompiling only the
+ * functions that changed.
+ */
+int watch(const char *path, bool jit) {
+  namespace fs = std::filesystem;
+  std::string current{fileToString(path)};
+  DewSession session{current};
+  std::error_code ec;
+  fs::file_time_type stamp{fs::last_write_time(path, ec)};
+  for (;;) {
+    auto start{std::chrono::steady_clock::now()};
+    const bc::Program *program{session.update()};
+    std::chrono::duration<double, std::milli> took{
+        std::chrono::steady_clock::now() - start};
+    std::cerr << "compiled " << session.compiledCount() << " function(s) in "
+              << took.count() << " ms\n";
+    for (const DewSession::Problem &problem : session.problems()) {
+      std::string_view before{session.source().substr(0, problem.range.start)};
+      std::cerr << path << ":"
+                << std::count(before.begin(), before.end(), '\n') + 1 << ": "
+                << problem.message << "\n";
+    }
+    if (program) {
+      run(*program, jit);
+    }
+
+    fs::file_time_type now{stamp};
+    while (now == stamp) {
+      std::this_thread::sleep_for(std::chrono::milliseconds{100});
+      now = fs::last_write_time(path, ec);
+      if (ec) {
+        // Editors can replace the file, leaving it missing for a moment.
+        now = stamp;
+      }
+    }
+    stamp = now;
+    // Everything between the common prefix and suffix counts as one edit.
+    std::string next{fileToString(path)};
+    std::size_t prefix{0};
+    std::size_t limit{std::min(current.size(), next.size())};
+    while (prefix < limit && current[prefix] == next[prefix]) {
+      ++prefix;
+    }
+    std::size_t suffix{0};
+    while (suffix < limit - prefix &&
+           current[current.size() - 1 - suffix] ==
+               next[next.size() - 1 - suffix]) {
+      ++suffix;
+    }
+    session.edit(static_cast<uint32_t>(prefix),
+                 static_cast<uint32_t>(current.size() - suffix),
+                 std::string_view{next}.substr(
+                     prefix, next.size() - suffix - prefix));
+    current = std::move(next);
+  }
+}
+
+/**
+ * Compiles many files at once, one file per thread, each thread keeping
+ * its TSParser from file to file. Arguments starting with `@` name
+ * manifests that list more files, one per line.
+ */
+int build(const Options &opts) {
+  std::vector<std::string> files;
+  for (const char *path : opts.paths) {
+    if (path[0] != '@') {
+      files.emplace_back(path);
+      continue;
+    }
+    std::ifstream manifest{path + 1};
+    if (!manifest.is_open()) {
+      std::cerr << "file `" << path + 1 << "` could not be read\n";
+      return 1;
+    }
+    for (std::string line; std::getline(manifest, line);) {
+      if (!line.empty()) {
+        files.push_back(std::move(line));
+      }
+    }
+  }
+
+  struct Result {
+    std::size_t bytes;
+    std::size_t functions;
+    std::chrono::steady_clock::duration time;
+    bool ok;
+  };
+  std::vector<Result> results(files.size());
+  std::optional<CompileCache> cache;
+  if (opts.cacheDir) {
+    cache.emplace(opts.cacheDir);
+  }
+  ThreadPool pool{opts.jobs};
+  std::vector<TSParser *> parsers(pool.size(), nullptr);
+  auto start{std::chrono::steady_clock::now()};
+  pool.run(files.size(), [&](unsigned worker, std::size_t i) {
+    auto fileStart{std::chrono::steady_clock::now()};
+    Result &result{results[i]};
+    auto source{Source::load(files[i].c_str())};
+    if (source) {
+      if (!parsers[worker]) {
+        parsers[worker] = newTSParser();
+      }
+      result.bytes = source->size();
+      // The threads are already busy with other files.
+      ThreadPool serial{1};
+      auto program{compile(std::move(*source), opts, serial,
+                           cache ? &*cache : nullptr, parsers[worker])};
+      result.ok = program.has_value();
+      result.functions = program ? program->functions.size() : 0;
+    }
+    result.time = std::chrono::steady_clock::now() - fileStart;
+  });
+  std::chrono::duration<double> took{std::chrono::steady_clock::now() -
+                                     start};
+  for (TSParser *parser : parsers) {
+    if (parser) {
+      ts_parser_delete(parser);
+    }
+  }
+
+  std::size_t bytes{0};
+  std::size_t failed{0};
+  for (std::size_t i{0}; i < files.size(); ++i) {
+    const Result &result{results[i]};
+    std::chrono::duration<double, std::milli> ms{result.time};
+    std::cerr << files[i] << ": " << result.functions << " function(s), "
+              << result.bytes << " bytes in " << ms.count() << " ms"
+              << (result.ok ? "" : ", failed") << "\n";
+    bytes += result.bytes;
+    failed += !result.ok;
+  }
+  double megabytes{static_cast<double>(bytes) / (1 << 20)};
+  std::cerr << files.size() << " file(s), " << megabytes << " MB in "
+            << took.count() * 1000 << " ms on " << pool.size()
+            << " thread(s): " << files.size() / took.count() << " files/s, "
+            << megabytes / took.count() << " MB/s";
+  if (failed) {
+    std::cerr << ", " << failed << " failed";
+  }
+  std::cerr << "\n";
+  if (cache) {
+    cache->report(std::cerr);
+  }
+  return failed ? 1 : 0;
+}
+
+/**
+ * Disassembles or runs `program`, compiled from `text`, or from a `.dewb`
+ * file if that's empty.
+ */
+int use(const bc::Program &program, const Options &opts, std::string text) {
+  if (opts.command == "disasm") {
+    for (const auto &fn : program.functions) {
+      bc::dump(std::cout, fn);
+    }
+    return 0;
+  }
+  if (opts.command == "asm") {
+    Report::Phase phase{"x86"};
+    x86::AsmWriter out{std::cout, program};
+    if (!x86::generate(program, out)) {
+      return 1;
+    }
+    out.finish();
+    return 0;
+  }
+  if (opts.profilePath) {
+    return profile(program, opts, std::move(text));
+  }
+  return run(program, opts.jit);
+}
+
+/** Everything but `build` and `watch`, once the arguments are read. */
+int execute(const Options &opts) {
+  std::string_view command{opts.command};
+  std::optional<Source> source;
+  {
+    Report::Phase phase{"read"};
+    source = Source::load(opts.path);
+  }
+  if (!source) {
+    return 1;
+  }
+  // A `.dewb` file runs as it is, its bodies loaded as they're called.
+  if (ProgramImage::recognizes(source->text())) {
+    if (command != "run" && command != "disasm" && command != "asm") {
+      std::cerr << "file `" << opts.path << "` is compiled already\n";
+      return 1;
+    }
+    std::unique_ptr<ProgramImage> image;
+    {
+      Report::Phase phase{"index"};
+      image = ProgramImage::open(std::move(*source), opts.path);
+    }
+    if (!image) {
+      return 1;
+    }
+    if (command != "run" && !image->materializeAll()) {
+      std::cerr << "file `" << opts.path << "` has corrupt code\n";
+      return 1;
+    }
+    return use(image->program(), opts, "");
+  }
+
+  if (command == "ir") {
+    DewParser p{std::move(*source)};
+    p.parseSource();
+    auto module{buildIR(p, opts)};
+    if (!module) {
+      return 1;
+    }
+    for (const auto &fn : module->functions) {
+      ir::dump(std::cout, fn);
+    }
+    return 0;
+  }
+  if (command.empty()) {
+    DewParser p{std::move(*source)};
+    p.parseSource();
+    for (const auto &f : p.getFunctions()) {
+      std::cout << f.decl->name << "\n";
+    }
+    return 0;
+  }
+
+  // Kept to find where functions are declared, once the source is gone.
+  std::string text{opts.profilePath ? source->text() : ""};
+  std::optional<CompileCache> cache;
+  if (opts.cacheDir) {
+    cache.emplace(opts.cacheDir);
+  }
+  ThreadPool pool{opts.jobs};
+  auto program{
+      compile(std::move(*source), opts, pool, cache ? &*cache : nullptr)};
+  if (!program) {
+    return 1;
+  }
+  if (command == "compile") {
+    std::ofstream out{opts.outPath, std::ios::binary};
+    if (!out.is_open() || !ProgramImage::write(out, *program) ||
+        !out.flush()) {
+      std::cerr << "file `" << opts.outPath << "` could not be written\n";
+      return 1;
+    }
+    return 0;
+  }
+  return use(*program, opts, std::move(text));
+}
+
+int main(int argc, const char *argv[]) {
+  Options opts{};
+  opts.jobs = 1;
+  opts.profileRate = Profiler::DEFAULT_RATE;
+  for (int i{1}; i < argc; ++i) {
+    std::string_view arg{argv[i]};
+    if (arg == "-O") {
+      opts.optimize = true;
+    } else if (arg == "--jit") {
+      opts.jit = true;
+    } else if (arg == "--stream") {
+      opts.stream = true;
+    } else if (arg == "--time-passes") {
+      opts.timePasses = true;
+    } else if (arg == "--dump-loops") {
+      opts.dumpLoops = true;
+    } else if (arg == "--time-report") {
+      opts.timeReport = true;
+    } else if (arg == "--mem-report") {
+      opts.memReport = true;
+    } else if (arg == "--trace" && i + 2 < argc) {
+      opts.tracePath = argv[++i];
+    } else if (arg == "--profile" && i + 2 < argc) {
+      opts.profilePath = argv[++i];
+    } else if (arg == "--profile-rate" && i + 2 < argc) {
+      int rate{std::atoi(argv[++i])};
+      if (rate < 1) {
+        return usage(argv[0]);
+      }
+      opts.profileRate = static_cast<uint32_t>(rate);
+    } else if (arg == "-o" && i + 2 < argc) {
+      opts.outPath = argv[++i];
+    } else if (arg == "--cache" && i + 2 < argc) {
+      opts.cacheDir = argv[++i];
+    } else if (arg == "-j" && i + 2 < argc) {
+      int jobs{std::atoi(argv[++i])};
+      if (jobs < 1) {
+        return usage(argv[0]);
+      }
+      opts.jobs = static_cast<unsigned>(jobs);
+    } else if (opts.command == "build") {
+      opts.paths.push_back(argv[i]);
+    } else if (arg == "lsp" && opts.command.empty() && i + 1 == argc) {
+      opts.command = arg;
+    } else if (i + 1 < argc && opts.command.empty() &&
+               (arg == "run" || arg == "disasm" || arg == "asm" ||
+                arg == "ir" || arg == "watch" || arg == "build" ||
+                arg == "compile")) {
+      opts.command = arg;
+    } else if (i + 1 == argc) {
+      opts.path = argv[i];
+    } else {
+      return usage(argv[0]);
+    }
+  }
+  std::string_view command{opts.command};
+  if (command == "build") {
+    return opts.paths.empty() ? usage(argv[0]) : build(opts);
+  }
+  if (command == "lsp") {
+    return LanguageServer{std::cout}.serve(std::cin);
+  }
+  if (!opts.path || (command == "compile") != (opts.outPath != nullptr)) {
+    return usage(argv[0]);
+  }
+  if (command == "watch") {
+    return watch(opts.path, opts.jit);
+  }
+  if (!opts.timeReport && !opts.memReport && !opts.tracePath) {
+    return execute(opts);
+  }
+
+  Report report;
+  Report::activate(&report);
+  if (opts.memReport) {
+    Report::countAllocations();
+  }
+  int status{execute(opts)};
+  Report::activate(nullptr);
+  if (opts.timeReport || opts.memReport) {
+    report.table(std::cerr, opts.memReport, REPORT_FUNCTIONS);
+  }
+  if (opts.tracePath) {
+    std::ofstream trace{opts.tracePath};
+    if (!trace.is_open()) {
+      std::cerr << "file `" << opts.tracePath << "` could not be written\n";
+      return 1;
+    }
+    report.trace(trace);
+  }
+  return status;
 }
@@ -0,0 +1,483 @@
+/**
+ * Copyright (C) 2024 Charles Ancheta
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ * \file passes.cc
+ */
+#include "passes.h"
+#include "evaluate.h"
+#include "loops.h"
+#include "report.h"
+#include <algorithm>
+#include <iomanip>
+
+using namespace dew;
+using namespace dew::ir;
+
+namespace {
+bool isConst(const Function &fn, Value v) {
+  return fn[v].op == Opcode::Const;
+}
+
+void makeConst(Inst &inst, int64_t value) {
+  inst.op = Opcode::Const;
+  inst.imm = bc::wrap(inst.type, value);
+  inst.operands.clear();
+}
+
+void makeCopy(Inst &inst, Value of) {
+  inst.op = Opcode::Copy;
+  inst.operands = {of};
+}
+
+bool isBinary(Opcode op) {
+  return (op >= Opcode::Add && op <= Opcode::BitXor) ||
+         (op >= Opcode::LT && op <= Opcode::Neq);
+}
+
+/** Simplifies `x op c` for a constant c that makes it trivial. */
+bool simplifyIdentity(Function &fn, Inst &inst) {
+  Value x{inst.operands[0]};
+  Value y{inst.operands[1]};
+  bool commutative{inst.op == Opcode::Add || inst.op == Opcode::Mul ||
+                   inst.op == Opcode::BitAnd || inst.op == Opcode::BitOr ||
+                   inst.op == Opcode::BitXor};
+  if (commutative && isConst(fn, x)) {
+    std::swap(x, y);
+  }
+  if (!isConst(fn, y) || fn[x].type != inst.type) {
+    return false;
+  }
+  int64_t c{fn[y].imm};
+  switch (inst.op) {
+  case Opcode::Add:
+  case Opcode::Sub:
+  case Opcode::BitOr:
+  case Opcode::BitXor:
+  case Opcode::ShiftLeft:
+  case Opcode::ShiftRight:
+    if (c == 0) {
+      makeCopy(inst, x);
+      return true;
+    }
+    return false;
+  case Opcode::Mul:
+    if (c == 1) {
+      makeCopy(inst, x);
+      return true;
+    } else if (c == 0) {
+      makeConst(inst, 0);
+      return true;
+    }
+    return false;
+  case Opcode::Div:
+    if (c == 1) {
+      makeCopy(inst, x);
+      return true;
+    }
+    return false;
+  case Opcode::BitAnd:
+    if (c == 0) {
+      makeConst(inst, 0);
+      return true;
+    }
+    return false;
+  default:
+    return false;
+  }
+}
+} // namespace
+
+bool ir::foldConstants(Function &fn) {
+  bool changed{false};
+  for (BlockId b{0}; b < fn.blocks.size(); ++b) {
+    if (fn.blocks[b].removed) {
+      continue;
+    }
+    // A phi folded to a constant moves behind the phis still left, where
+    // removeEdge and everything else expects to find them all.
+    bool foldedPhi{false};
+    auto keepPhisFirst{[&] {
+      if (foldedPhi) {
+        std::vector<Value> &insts{fn.blocks[b].insts};
+        std::stable_partition(insts.begin(), insts.end(), [&](Value v) {
+          return fn[v].op == Opcode::Phi;
+        });
+        foldedPhi = false;
+      }
+    }};
+    for (const Value v : fn.blocks[b].insts) {
+      Inst &inst{fn[v]};
+      if (isBinary(inst.op)) {
+        if (isConst(fn, inst.operands[0]) && isConst(fn, inst.operands[1])) {
+          auto value{fold(inst.op, inst.type, fn[inst.operands[0]].imm,
+                          fn[inst.operands[1]].imm)};
+          if (value) {
+            makeConst(inst, *value);
+            changed = true;
+          }
+        } else {
+          changed = simplifyIdentity(fn, inst) || changed;
+        }
+        continue;
+      }
+      switch (inst.op) {
+      case Opcode::Neg:
+      case Opcode::BitNot:
+      case Opcode::Not:
+      case Opcode::Cast: {
+        Value x{inst.operands[0]};
+        if (isConst(fn, x)) {
+          makeConst(inst, *fold(inst.op, inst.type, fn[x].imm));
+          changed = true;
+        } else if (inst.op == Opcode::Cast && fn[x].type == inst.type) {
+          makeCopy(inst, x);
+          changed = true;
+        }
+        break;
+      }
+      case Opcode::Phi: {
+        // Phis of one constant are that constant.
+        auto same{[&](Value o) {
+          return isConst(fn, o) && fn[o].imm == fn[inst.operands[0]].imm;
+        }};
+        if (!inst.operands.empty() &&
+            std::all_of(inst.operands.begin(), inst.operands.end(), same)) {
+          makeConst(inst, fn[inst.operands[0]].imm);
+          foldedPhi = true;
+          changed = true;
+        }
+        break;
+      }
+      case Opcode::Branch: {
+        Value cond{inst.operands[0]};
+        if (!isConst(fn, cond)) {
+          break;
+        }
+        std::vector<BlockId> &succs{fn.blocks[b].succs};
+        BlockId dead{fn[cond].imm != 0 ? succs[1] : succs[0]};
+        inst.op = Opcode::Jump;
+        inst.operands.clear();
+        // The branch is last, so reordering the rest is safe here; this
+        // block may be its own successor.
+        keepPhisFirst();
+        fn.removeEdge(b, dead);
+        changed = true;
+        break;
+      }
+      default:
+        break;
+      }
+    }
+    keepPhisFirst();
+  }
+  return changed;
+}
+
+bool ir::propagateCopies(Function &fn) {
+  std::vector<Value> forward(fn.insts.size());
+  for (Value v{0}; v < forward.size(); ++v) {
+    forward[v] = v;
+  }
+  auto resolve{[&](Value v) {
+    while (forward[v] != v) {
+      v = forward[v];
+    }
+    return v;
+  }};
+
+  // Removing one trivial phi can make another trivial, so go until stable.
+  std::vector<Value> removed;
+  for (bool changed{true}; changed;) {
+    changed = false;
+    for (const Block &block : fn.blocks) {
+      for (const Value v : block.insts) {
+        const Inst &inst{fn[v]};
+        if (forward[v] != v) {
+          continue;
+        }
+        if (inst.op == Opcode::Copy) {
+          forward[v] = resolve(inst.operands[0]);
+        } else if (inst.op == Opcode::Phi) {
+          // A phi whose operands are all one value, or itself, is that
+          // value.
+          std::optional<Value> only;
+          bool trivial{true};
+          for (const Value operand : inst.operands) {
+            Value o{resolve(operand)};
+            if (o == v || o == only) {
+              continue;
+            } else if (only) {
+              trivial = false;
+              break;
+            }
+            only = o;
+          }
+          if (!trivial || !only) {
+            continue;
+          }
+          forward[v] = *only;
+        } else {
+          continue;
+        }
+        removed.push_back(v);
+        changed = true;
+      }
+    }
+  }
+  if (removed.empty()) {
+    return false;
+  }
+  fn.replaceUses(forward);
+  for (const Value v : removed) {
+    fn.erase(v);
+  }
+  return true;
+}
+
+bool ir::eliminateDeadCode(Function &fn) {
+  bool changed{fn.removeUnreachable()};
+  std::vector<bool> live(fn.insts.size());
+  std::vector<Value> work;
+  for (const Block &block : fn.blocks) {
+    for (const Value v : block.insts) {
+      if (hasSideEffects(fn, fn[v])) {
+        live[v] = true;
+        work.push_back(v);
+      }
+    }
+  }
+  while (!work.empty()) {
+    Value v{work.back()};
+    work.pop_back();
+    for (const Value operand : fn[v].operands) {
+      if (!live[operand]) {
+        live[operand] = true;
+        work.push_back(operand);
+      }
+    }
+  }
+
+  for (Block &block : fn.blocks) {
+    for (const Value v : block.insts) {
+      if (!live[v]) {
+        fn[v].op = Opcode::Nop;
+        fn[v].operands.clear();
+        changed = true;
+      }
+    }
+    block.insts.erase(std::remove_if(block.insts.begin(), block.insts.end(),
+                                     [&](Value v) { return !live[v]; }),
+                      block.insts.end());
+  }
+  return changed;
+}
+
+namespace {
+/** Folds `s` into `b`, its only predecessor, when `b` only goes to `s`. */
+bool mergeInto(Function &fn, BlockId b) {
+  Block &block{fn.blocks[b]};
+  if (block.succs.size() != 1) {
+    return false;
+  }
+  BlockId s{block.succs[0]};
+  if (s == b || s == 0 || fn.blocks[s].preds.size() != 1) {
+    return false;
+  }
+  fn.erase(*fn.terminator(b));
+  Block &succ{fn.blocks[s]};
+  for (const Value v : succ.insts) {
+    Inst &inst{fn[v]};
+    if (inst.op == Opcode::Phi) {
+      makeCopy(inst, inst.operands[0]);
+    }
+    inst.block = b;
+    fn.blocks[b].insts.push_back(v);
+  }
+  fn.blocks[b].succs = succ.succs;
+  for (const BlockId t : succ.succs) {
+    std::vector<BlockId> &preds{fn.blocks[t].preds};
+    *std::find(preds.begin(), preds.end(), s) = b;
+  }
+  succ.insts.clear();
+  succ.preds.clear();
+  succ.succs.clear();
+  succ.removed = true;
+  return true;
+}
+
+/** Sends the predecessors of `e`, which only jumps, straight on. */
+bool threadThrough(Function &fn, BlockId e) {
+  Block &empty{fn.blocks[e]};
+  if (e == 0 || empty.insts.size() != 1 || empty.succs.size() != 1 ||
+      empty.succs[0] == e || empty.preds.empty()) {
+    return false;
+  }
+  BlockId t{empty.succs[0]};
+  std::vector<BlockId> &targetPreds{fn.blocks[t].preds};
+  auto index{std::find(targetPreds.begin(), targetPreds.end(), e) -
+             targetPreds.begin()};
+  std::vector<Value> phis;
+  for (const Value v : fn.blocks[t].insts) {
+    if (fn[v].op == Opcode::Phi) {
+      phis.push_back(v);
+    }
+  }
+  // With phis, an edge that already exists would need a second operand
+  // from the same block; leave those for critical edge splitting.
+  for (const BlockId p : empty.preds) {
+    if (!phis.empty() &&
+        std::find(targetPreds.begin(), targetPreds.end(), p) !=
+            targetPreds.end()) {
+      return false;
+    }
+  }
+
+  std::vector<Value> incoming;
+  for (const Value phi : phis) {
+    incoming.push_back(fn[phi].operands[index]);
+  }
+  for (const BlockId p : std::vector<BlockId>{empty.preds}) {
+    std::vector<BlockId> &succs{fn.blocks[p].succs};
+    *std::find(succs.begin(), succs.end(), e) = t;
+    fn.blocks[t].preds.push_back(p);
+    for (std::size_t i{0}; i < phis.size(); ++i) {
+      fn[phis[i]].operands.push_back(incoming[i]);
+    }
+  }
+  fn.removeEdge(e, t);
+  fn.erase(fn.blocks[e].insts[0]);
+  fn.blocks[e].preds.clear();
+  fn.blocks[e].removed = true;
+  return true;
+}
+} // namespace
+
+bool ir::simplifyCFG(Function &fn) {
+  bool changed{fn.removeUnreachable()};
+  for (bool again{true}; again;) {
+    again = false;
+    for (BlockId b{0}; b < fn.blocks.size(); ++b) {
+      if (fn.blocks[b].removed) {
+        continue;
+      }
+      std::vector<BlockId> &succs{fn.blocks[b].succs};
+      if (succs.size() == 2 && succs[0] == succs[1]) {
+        // Both ways lead to the same place, which is only a jump if the
+        // phis there agree on both edges.
+        BlockId s{succs[0]};
+        const std::vector<BlockId> &preds{fn.blocks[s].preds};
+        auto first{std::find(preds.begin(), preds.end(), b) - preds.begin()};
+        auto second{std::find(preds.begin() + first + 1, preds.end(), b) -
+                    preds.begin()};
+        bool agree{true};
+        for (const Value v : fn.blocks[s].insts) {
+          const Inst &inst{fn[v]};
+          agree = agree && (inst.op != Opcode::Phi ||
+                            inst.operands[first] == inst.operands[second]);
+        }
+        if (agree) {
+          Inst &branch{fn[*fn.terminator(b)]};
+          branch.op = Opcode::Jump;
+          branch.operands.clear();
+          fn.removeEdge(b, s);
+          again = true;
+        }
+      }
+      if (mergeInto(fn, b) || threadThrough(fn, b)) {
+        again = true;
+      }
+    }
+    changed = changed || again;
+  }
+  return changed;
+}
+
+PassManager PassManager::standard() {
+  PassManager pm;
+  pm.add("fold-constants", foldConstants);
+  pm.add("propagate-copies", propagateCopies);
+  pm.add("simplify-cfg", simplifyCFG);
+  pm.add("eliminate-dead-code", eliminateDeadCode);
+  pm.add("hoist-invariants", hoistInvariants);
+  pm.add("reduce-strength", reduceStrength);
+  pm.add("unroll-loops", unrollLoops);
+  pm.add("evaluate-calls", evaluateCalls);
+  return pm;
+}
+
+void PassManager::add(std::string_view name, Pass pass) {
+  passes.push_back(Entry{name, pass, nullptr, {}, 0, 0});
+}
+
+void PassManager::add(std::string_view name, ModulePass pass) {
+  passes.push_back(Entry{name, nullptr, pass, {}, 0, 0});
+}
+
+void PassManager::run(Module &module, unsigned maxRounds) {
+  auto timed{[](Entry &entry, auto &&pass) {
+    auto start{std::chrono::steady_clock::now()};
+    bool changed{pass()};
+    entry.time += std::chrono::steady_clock::now() - start;
+    ++entry.runs;
+    entry.changes += changed;
+    return changed;
+  }};
+  bool moduleChanged{true};
+  for (unsigned pass{0}; moduleChanged && pass < maxRounds; ++pass) {
+    for (Function &fn : module.functions) {
+      Report::Function timer{fn.name};
+      bool changed{true};
+      for (unsigned round{0}; changed && round < maxRounds; ++round) {
+        changed = false;
+        for (Entry &entry : passes) {
+          if (entry.pass) {
+            changed = timed(entry, [&] { return entry.pass(fn); }) || changed;
+          }
+        }
+      }
+    }
+    moduleChanged = false;
+    for (Entry &entry : passes) {
+      if (entry.modulePass) {
+        moduleChanged =
+            timed(entry, [&] { return entry.modulePass(module); }) ||
+            moduleChanged;
+      }
+    }
+  }
+}
+
+void PassManager::report(std::ostream &out) const {
+  std::chrono::steady_clock::duration total{};
+  for (const Entry &entry : passes) {
+    total += entry.time;
+  }
+  out << std::left << std::setw(24) << "pass" << std::right << std::setw(8)
+      << "runs" << std::setw(10) << "changed" << std::setw(12) << "ms"
+      << "\n";
+  auto ms{[](std::chrono::steady_clock::duration d) {
+    return std::chrono::duration<double, std::milli>(d).count();
+  }};
+  for (const Entry &entry : passes) {
+    out << std::left << std::setw(24) << entry.name << std::right
+        << std::setw(8) << entry.runs << std::setw(10) << entry.changes
+        << std::setw(12) << std::fixed << std::setprecision(3)
+        << ms(entry.time) << "\n";
+  }
+  out << std::left << std::setw(42) << "total" << std::right << std::setw(12)
+      << ms(total) << "\n";
+}
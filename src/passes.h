@@ -0,0 +1,86 @@
+/**
+ * Copyright (C) 2024 Charles Ancheta
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ * \file passes.h
+ */
+#ifndef DEW_PASSES_H_
+#define DEW_PASSES_H_
+
+#include "ir.h"
+#include <chrono>
+#include <ostream>
+#include <string_view>
+#include <vector>
+
+namespace dew {
+namespace ir {
+/** Rewrites a function in place, returning whether anything changed. */
+using Pass = bool (*)(Function &fn);
+/** The same for passes that look across functions. */
+using ModulePass = bool (*)(Module &module);
+
+/** Evaluates instructions on constants and branches on known conditions. */
+bool foldConstants(Function &fn);
+/** Removes instructions whose values are never used, and dead blocks. */
+bool eliminateDeadCode(Function &fn);
+/** Replaces copies and trivial phis with the values they stand for. */
+bool propagateCopies(Function &fn);
+/**
+ * Removes unreachable blocks, merges straight-line chains of blocks and
+ * threads jumps through empty ones.
+ */
+bool simplifyCFG(Function &fn);
+
+/**
+ * Runs a sequence of passes over every function of a module, then the
+ * passes over the whole module, keeping track of how long each one takes.
+ */
+class PassManager {
+public:
+  /**
+   * Constant folding, copy propagation, CFG simplification, DCE and the
+   * loop passes, then evaluating calls on constants.
+   */
+  static PassManager standard();
+
+  void add(std::string_view name, Pass pass);
+  void add(std::string_view name, ModulePass pass);
+  /**
+   * Runs the sequence on each function, again while it keeps changing
+   * something, up to `maxRounds` times. Then the module passes, and all of
+   * it again while those change something, as many times at most.
+   */
+  void run(Module &module, unsigned maxRounds = 4);
+  /** Prints how often each pass ran and the time it took. */
+  void report(std::ostream &out) const;
+
+private:
+  struct Entry {
+    std::string_view name;
+    /** One of these is null. */
+    Pass pass;
+    ModulePass modulePass;
+    std::chrono::steady_clock::duration time;
+    uint32_t runs;
+    uint32_t changes;
+  };
+
+  std::vector<Entry> passes;
+};
+} // namespace ir
+} // namespace dew
+#endif // !DEW_PASSES_H_
@@ -0,0 +1,229 @@
+/**
+ * Copyright (C) 2024 Charles Ancheta
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ * \file profiler.cc
+ */
+#include "profiler.h"
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <sys/time.h>
+
+using namespace dew;
+
+namespace {
+std::atomic<Profiler *> active{nullptr};
+struct sigaction previous;
+
+/** Room for samples, in words: minutes of them unless stacks run deep. */
+constexpr std::size_t SAMPLE_WORDS{1 << 22};
+} // namespace
+
+Profiler::Profiler(const bc::Program &program, std::vector<uint32_t> lines,
+                   uint32_t rate)
+    : program{program}, lines{std::move(lines)},
+      rate{std::clamp<uint32_t>(rate, 1, 1000000)}, depth{0},
+      samples{new uint32_t[SAMPLE_WORDS]}, capacity{SAMPLE_WORDS}, used{0},
+      taken{0}, dropped{0}, started{0}, cpu{0} {}
+
+Profiler::~Profiler() {
+  if (active == this) {
+    stop();
+  }
+}
+
+bool Profiler::start() {
+  Profiler *none{nullptr};
+  if (!active.compare_exchange_strong(none, this)) {
+    std::cerr << "another profiler is already running\n";
+    return false;
+  }
+  struct sigaction action {};
+  action.sa_handler = onSignal;
+  action.sa_flags = SA_RESTART;
+  sigemptyset(&action.sa_mask);
+  long interval{1000000 / static_cast<long>(rate)};
+  itimerval timer{{interval / 1000000, interval % 1000000},
+                  {interval / 1000000, interval % 1000000}};
+  if (sigaction(SIGPROF, &action, &previous) != 0 ||
+      setitimer(ITIMER_PROF, &timer, nullptr) != 0) {
+    std::cerr << "the profiler couldn't start: " << std::strerror(errno)
+              << "\n";
+    active = nullptr;
+    return false;
+  }
+  started = std::clock();
+  return true;
+}
+
+void Profiler::stop() {
+  if (active != this) {
+    return;
+  }
+  itimerval off{};
+  setitimer(ITIMER_PROF, &off, nullptr);
+  sigaction(SIGPROF, &previous, nullptr);
+  active = nullptr;
+  cpu += std::clock() - started;
+}
+
+void Profiler::onSignal(int) {
+  int saved{errno};
+  if (Profiler *profiler{active.load(std::memory_order_relaxed)}) {
+    profiler->record();
+  }
+  errno = saved;
+}
+
+void Profiler::record() {
+  uint32_t d{depth.load(std::memory_order_acquire)};
+  uint32_t n{std::min(d, MAX_FRAMES)};
+  std::size_t at{used.load(std::memory_order_relaxed)};
+  if (at + 1 + n > capacity) {
+    dropped.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  samples[at] = d;
+  for (uint32_t i{0}; i < n; ++i) {
+    samples[at + 1 + i] = stack[(d - n + i) % RING];
+  }
+  used.store(at + 1 + n, std::memory_order_relaxed);
+  taken.fetch_add(1, std::memory_order_relaxed);
+}
+
+std::string Profiler::label(uint32_t function) const {
+  std::string name{program.functions[function].name};
+  if (function < lines.size() && lines[function] != 0) {
+    name += ":" + std::to_string(lines[function]);
+  }
+  return name;
+}
+
+void Profiler::table(std::ostream &out, std::size_t top) const {
+  std::size_t functions{program.functions.size()};
+  std::vector<uint64_t> self(functions);
+  std::vector<uint64_t> total(functions);
+  // Recursive functions appear in a sample more than once but only take
+  // its time once.
+  std::vector<std::size_t> seen(functions, SIZE_MAX);
+  uint64_t count{0};
+  uint64_t outside{0};
+  std::size_t end{used.load(std::memory_order_relaxed)};
+  for (std::size_t at{0}; at < end; ++count) {
+    uint32_t d{samples[at]};
+    uint32_t n{std::min(d, MAX_FRAMES)};
+    const uint32_t *frames{samples.get() + at + 1};
+    if (n == 0) {
+      ++outside;
+    } else {
+      ++self[frames[n - 1]];
+    }
+    for (uint32_t i{0}; i < n; ++i) {
+      if (seen[frames[i]] != at) {
+        seen[frames[i]] = at;
+        ++total[frames[i]];
+      }
+    }
+    at += 1 + n;
+  }
+
+  // The timer only fires on the kernel's clock ticks, which can be further
+  // apart than asked for, so samples share the CPU time actually used.
+  double cpuMs{1000.0 * static_cast<double>(cpu) / CLOCKS_PER_SEC};
+  double ms{count ? cpuMs / count : 0};
+  char line[160];
+  std::snprintf(line, sizeof(line), "%llu samples over %.1f ms of CPU time",
+                static_cast<unsigned long long>(count), cpuMs);
+  out << line;
+  if (count) {
+    std::snprintf(line, sizeof(line), ", one every %.3f ms", ms);
+    out << line;
+  }
+  if (outside) {
+    out << ", " << outside << " outside Dew code";
+  }
+  if (auto lost{dropped.load(std::memory_order_relaxed)}) {
+    out << ", " << lost << " dropped once the buffer filled";
+  }
+  out << "\n";
+
+  std::vector<uint32_t> order;
+  for (uint32_t f{0}; f < functions; ++f) {
+    if (total[f]) {
+      order.push_back(f);
+    }
+  }
+  std::size_t shown{std::min(top, order.size())};
+  std::partial_sort(order.begin(), order.begin() + shown, order.end(),
+                    [&](uint32_t a, uint32_t b) {
+                      return self[a] != self[b] ? self[a] > self[b]
+                                                : total[a] > total[b];
+                    });
+  std::snprintf(line, sizeof(line), "%-28s %10s %7s %10s %7s %12s\n",
+                "function", "self ms", "self %", "total ms", "total %",
+                "samples");
+  out << line;
+  auto percent{[&](uint64_t n) {
+    return count ? 100.0 * static_cast<double>(n) / count : 0.0;
+  }};
+  for (std::size_t i{0}; i < shown; ++i) {
+    uint32_t f{order[i]};
+    std::string name{label(f)};
+    std::snprintf(line, sizeof(line),
+                  "%-28.*s %10.1f %6.1f%% %10.1f %6.1f%% %12llu\n",
+                  static_cast<int>(std::min<std::size_t>(name.size(), 28)),
+                  name.c_str(), self[f] * ms, percent(self[f]),
+                  total[f] * ms, percent(total[f]),
+                  static_cast<unsigned long long>(total[f]));
+    out << line;
+  }
+}
+
+void Profiler::folded(std::ostream &out) const {
+  std::vector<std::string> labels;
+  for (uint32_t f{0}; f < program.functions.size(); ++f) {
+    labels.push_back(label(f));
+  }
+  std::map<std::string, uint64_t> stacks;
+  std::size_t end{used.load(std::memory_order_relaxed)};
+  std::string key;
+  for (std::size_t at{0}; at < end;) {
+    uint32_t d{samples[at]};
+    uint32_t n{std::min(d, MAX_FRAMES)};
+    const uint32_t *frames{samples.get() + at + 1};
+    at += 1 + n;
+    if (n == 0) {
+      continue;
+    }
+    key.clear();
+    if (n < d) {
+      key = "[truncated];";
+    }
+    for (uint32_t i{0}; i < n; ++i) {
+      key += labels[frames[i]];
+      key += i + 1 < n ? ";" : "";
+    }
+    ++stacks[key];
+  }
+  for (const auto &[key, count] : stacks) {
+    out << key << " " << count << "\n";
+  }
+}
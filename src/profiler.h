@@ -0,0 +1,126 @@
+/**
+ * Copyright (C) 2024 Charles Ancheta
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ * \file profiler.h
+ */
+#ifndef DEW_PROFILER_H_
+#define DEW_PROFILER_H_
+
+#include "bytecode.h"
+#include <atomic>
+#include <cstdint>
+#include <ctime>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace dew {
+/**
+ * Samples the Dew call stack on a CPU time timer, for `--profile`. The VM
+ * tells it about every call and return while it's attached; the timer's
+ * signal copies the calls running into a buffer set aside up front, so the
+ * handler never allocates. Calls aren't counted: that would cost every call
+ * more than the sampling does. Only one profiler runs at a time.
+ *
+ * Machine code calling machine code doesn't go through the VM, so with the
+ * JIT on, those calls are counted as time in the function that entered
+ * machine code.
+ */
+class Profiler {
+public:
+  /** Samples per second of CPU time, by default. */
+  static constexpr uint32_t DEFAULT_RATE{1000};
+  /** The innermost calls kept in each sample; deeper ones are cut off. */
+  static constexpr uint32_t MAX_FRAMES{128};
+  /** Calls kept track of, innermost first, in a ring; a power of two. */
+  static constexpr uint32_t RING{256};
+  static_assert(RING >= MAX_FRAMES && (RING & (RING - 1)) == 0);
+
+  /**
+   * Profiles `program`, whose functions are declared on `lines`, or on no
+   * line known if that's empty.
+   */
+  Profiler(const bc::Program &program, std::vector<uint32_t> lines,
+           uint32_t rate = DEFAULT_RATE);
+  ~Profiler();
+  Profiler(const Profiler &) = delete;
+  Profiler &operator=(const Profiler &) = delete;
+
+  /** Starts the timer. Returns false, saying why on std::cerr, if it can't. */
+  bool start();
+  void stop();
+
+  /** A call to `function` starts. */
+  void enter(uint32_t function) {
+    uint32_t d{depth.load(std::memory_order_relaxed)};
+    stack[d % RING] = function;
+    depth.store(d + 1, std::memory_order_release);
+  }
+  /** The innermost call tail calls `function`. */
+  void replace(uint32_t function) {
+    stack[(depth.load(std::memory_order_relaxed) - 1) % RING] = function;
+    std::atomic_signal_fence(std::memory_order_release);
+  }
+  /** The innermost call returns. */
+  void leave() {
+    depth.store(depth.load(std::memory_order_relaxed) - 1,
+                std::memory_order_release);
+  }
+  /** How many calls are running, to unwind to after a trap. */
+  uint32_t calling() const { return depth.load(std::memory_order_relaxed); }
+  void unwind(uint32_t to) { depth.store(to, std::memory_order_release); }
+
+  /** Samples taken and kept so far. */
+  std::size_t sampled() const { return taken.load(std::memory_order_relaxed); }
+
+  /**
+   * Prints the `top` functions with the most samples of their own: their
+   * self and total time and how many samples they were running in.
+   */
+  void table(std::ostream &out, std::size_t top) const;
+  /** Writes a line per distinct stack, `main;f;g COUNT`, for flame graphs. */
+  void folded(std::ostream &out) const;
+
+private:
+  /** Takes a sample; runs in the signal handler. */
+  void record();
+  static void onSignal(int);
+  /** What a function is called in the output: its name and line. */
+  std::string label(uint32_t function) const;
+
+  const bc::Program &program;
+  std::vector<uint32_t> lines;
+  uint32_t rate;
+  /** The function of each call running, at its depth modulo RING. */
+  uint32_t stack[RING];
+  std::atomic<uint32_t> depth;
+  /**
+   * Samples one after the other: each is the depth of the stack, then the
+   * function of each of its innermost calls, up to MAX_FRAMES of them.
+   */
+  std::unique_ptr<uint32_t[]> samples;
+  std::size_t capacity;
+  std::atomic<std::size_t> used;
+  std::atomic<std::size_t> taken;
+  std::atomic<uint64_t> dropped;
+  /** CPU time used while sampling, which samples are a share of. */
+  std::clock_t started;
+  std::clock_t cpu;
+};
+} // namespace dew
+#endif // !DEW_PROFILER_H_
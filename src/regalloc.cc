@@ -0,0 +1,268 @@
+/**
+ * Copyright (C) 2024 Charles Ancheta
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ * \file regalloc.cc
+ */
+#include "regalloc.h"
+#include <algorithm>
+#include <limits>
+
+using namespace dew;
+using namespace dew::regalloc;
+
+using bc::Instr;
+using bc::Op;
+
+namespace {
+struct Block {
+  uint32_t begin;
+  uint32_t end;
+  std::vector<uint32_t> successors;
+};
+
+struct Interval {
+  uint16_t reg;
+  uint32_t start;
+  uint32_t end;
+  bool touchesCall;
+};
+
+using Bits = std::vector<uint64_t>;
+
+bool test(const Bits &bits, uint32_t i) { return bits[i / 64] >> (i % 64) & 1; }
+void set(Bits &bits, uint32_t i) { bits[i / 64] |= uint64_t{1} << (i % 64); }
+
+uint32_t width(Op op) { return bc::isFusedBranch(op) ? 2 : 1; }
+
+std::vector<Block> buildBlocks(const std::vector<Instr> &code) {
+  std::vector<bool> leader(code.size() + 1);
+  leader[0] = true;
+  for (uint32_t pc{0}; pc < code.size(); pc += width(code[pc].op)) {
+    auto target{bc::branchTarget(code, pc)};
+    if (target) {
+      leader[*target] = true;
+    }
+    if (target || !bc::fallsThrough(code[pc].op)) {
+      leader[pc + width(code[pc].op)] = true;
+    }
+  }
+
+  std::vector<Block> blocks;
+  std::vector<uint32_t> blockOf(code.size() + 1);
+  for (uint32_t pc{0}; pc < code.size(); ++pc) {
+    if (leader[pc]) {
+      blocks.push_back(Block{pc, pc, {}});
+    }
+    blockOf[pc] = static_cast<uint32_t>(blocks.size() - 1);
+    blocks.back().end = pc + 1;
+  }
+  for (Block &b : blocks) {
+    uint32_t last{b.begin};
+    for (uint32_t pc{b.begin}; pc < b.end; pc += width(code[pc].op)) {
+      last = pc;
+    }
+    auto target{bc::branchTarget(code, last)};
+    if (target && *target < code.size()) {
+      b.successors.push_back(blockOf[*target]);
+    }
+    if (bc::fallsThrough(code[last].op) && b.end < code.size()) {
+      b.successors.push_back(blockOf[b.end]);
+    }
+  }
+  return blocks;
+}
+} // namespace
+
+Allocation regalloc::linearScan(const bc::Program &program,
+                                const bc::Function &fn, const Target &target) {
+  const std::vector<Instr> &code{fn.code};
+  std::vector<Block> blocks{buildBlocks(code)};
+  std::size_t words{(fn.numRegs + 63u) / 64u};
+
+  // Block-level liveness, iterated backwards to a fixed point.
+  std::vector<Bits> uses(blocks.size(), Bits(words));
+  std::vector<Bits> defs(blocks.size(), Bits(words));
+  for (std::size_t i{0}; i < blocks.size(); ++i) {
+    for (uint32_t pc{blocks[i].begin}; pc < blocks[i].end; ++pc) {
+      bc::visitOperands(
+          program, code[pc],
+          [&](uint32_t r) {
+            if (!test(defs[i], r)) {
+              set(uses[i], r);
+            }
+          },
+          [&](uint32_t r) { set(defs[i], r); });
+    }
+  }
+  std::vector<Bits> liveIn(blocks.size(), Bits(words));
+  std::vector<Bits> liveOut(blocks.size(), Bits(words));
+  for (bool changed{true}; changed;) {
+    changed = false;
+    for (std::size_t i{blocks.size()}; i-- > 0;) {
+      for (std::size_t w{0}; w < words; ++w) {
+        uint64_t out{0};
+        for (const uint32_t s : blocks[i].successors) {
+          out |= liveIn[s][w];
+        }
+        uint64_t in{uses[i][w] | (out & ~defs[i][w])};
+        changed = changed || in != liveIn[i][w] || out != liveOut[i][w];
+        liveIn[i][w] = in;
+        liveOut[i][w] = out;
+      }
+    }
+  }
+
+  // Each instruction gets two positions: reads happen at 2 * pc and writes
+  // at 2 * pc + 1, so a register read and rewritten by one instruction can
+  // share it.
+  constexpr uint32_t NONE{std::numeric_limits<uint32_t>::max()};
+  std::vector<Interval> intervals(fn.numRegs);
+  for (uint16_t r{0}; r < fn.numRegs; ++r) {
+    intervals[r] = Interval{r, NONE, 0, false};
+  }
+  auto extend{[&](uint32_t r, uint32_t pos) {
+    intervals[r].start = std::min(intervals[r].start, pos);
+    intervals[r].end = std::max(intervals[r].end, pos);
+  }};
+  std::vector<uint32_t> calls;
+  for (std::size_t i{0}; i < blocks.size(); ++i) {
+    const Block &b{blocks[i]};
+    for (uint32_t r{0}; r < fn.numRegs; ++r) {
+      if (test(liveIn[i], r)) {
+        extend(r, 2 * b.begin);
+      }
+      if (test(liveOut[i], r)) {
+        extend(r, 2 * (b.end - 1) + 1);
+      }
+    }
+    for (uint32_t pc{b.begin}; pc < b.end; ++pc) {
+      bc::visitOperands(
+          program, code[pc], [&](uint32_t r) { extend(r, 2 * pc); },
+          [&](uint32_t r) { extend(r, 2 * pc + 1); });
+      if (code[pc].op == Op::Call || code[pc].op == Op::Print) {
+        calls.push_back(pc);
+      }
+    }
+  }
+  for (uint16_t r{0}; r < fn.numParams; ++r) {
+    if (intervals[r].start != NONE) {
+      intervals[r].start = 0;
+    }
+  }
+
+  std::vector<Interval *> order;
+  for (Interval &in : intervals) {
+    if (in.start == NONE) {
+      continue;
+    }
+    // Arguments read by the call and results written by it don't have to
+    // survive it; only values live on both sides do.
+    auto call{std::lower_bound(calls.begin(), calls.end(),
+                                 (in.start + 1) / 2)};
+    in.touchesCall = call != calls.end() && 2 * *call < in.end;
+    order.push_back(&in);
+  }
+  std::sort(order.begin(), order.end(), [](Interval *a, Interval *b) {
+    return a->start < b->start || (a->start == b->start && a->reg < b->reg);
+  });
+
+  Allocation result{std::vector<Location>(fn.numRegs,
+                                          Location{Location::Kind::Unused, 0}),
+                    0,
+                    {},
+                    {}};
+  std::vector<bool> calleeSavedUsed(target.calleeSaved.size());
+  std::vector<bool> isCalleeSaved(256);
+  for (const uint8_t r : target.calleeSaved) {
+    isCalleeSaved[r] = true;
+  }
+  std::vector<uint8_t> freeRegs;
+  // Prefer registers nobody has to save, then the callee-saved ones.
+  for (auto it{target.calleeSaved.rbegin()}; it != target.calleeSaved.rend();
+       ++it) {
+    freeRegs.push_back(*it);
+  }
+  for (auto it{target.callerSaved.rbegin()}; it != target.callerSaved.rend();
+       ++it) {
+    freeRegs.push_back(*it);
+  }
+  std::vector<Interval *> active;
+  auto spill{[&](Interval *in) {
+    result.locations[in->reg] =
+        Location{Location::Kind::Stack, result.stackSlots++};
+  }};
+  auto assign{[&](Interval *in, uint8_t reg) {
+    result.locations[in->reg] = Location{Location::Kind::Register, reg};
+    auto saved{std::find(target.calleeSaved.begin(), target.calleeSaved.end(),
+                         reg)};
+    if (saved != target.calleeSaved.end()) {
+      calleeSavedUsed[saved - target.calleeSaved.begin()] = true;
+    }
+    active.push_back(in);
+  }};
+
+  for (Interval *in : order) {
+    // Expire everything that ended before this interval starts.
+    for (auto it{active.begin()}; it != active.end();) {
+      if ((*it)->end < in->start) {
+        freeRegs.push_back(
+            static_cast<uint8_t>(result.locations[(*it)->reg].index));
+        it = active.erase(it);
+      } else {
+        ++it;
+      }
+    }
+
+    auto usable{[&](uint8_t reg) {
+      return !in->touchesCall || isCalleeSaved[reg];
+    }};
+    auto free{std::find_if(freeRegs.rbegin(), freeRegs.rend(), usable)};
+    if (free != freeRegs.rend()) {
+      uint8_t reg{*free};
+      freeRegs.erase(std::next(free).base());
+      assign(in, reg);
+      continue;
+    }
+
+    // Out of registers: spill whichever interval ends last.
+    Interval *victim{nullptr};
+    for (Interval *a : active) {
+      uint8_t reg{static_cast<uint8_t>(result.locations[a->reg].index)};
+      if (usable(reg) && (!victim || a->end > victim->end)) {
+        victim = a;
+      }
+    }
+    if (victim && victim->end > in->end) {
+      auto reg{static_cast<uint8_t>(result.locations[victim->reg].index)};
+      spill(victim);
+      active.erase(std::find(active.begin(), active.end(), victim));
+      assign(in, reg);
+    } else {
+      spill(in);
+    }
+  }
+
+  for (std::size_t i{0}; i < target.calleeSaved.size(); ++i) {
+    if (calleeSavedUsed[i]) {
+      result.calleeSavedUsed.push_back(target.calleeSaved[i]);
+    }
+  }
+  for (const Interval &in : intervals) {
+    result.intervals.emplace_back(in.start, in.end);
+  }
+  return result;
+}
@@ -0,0 +1,69 @@
+/**
+ * Copyright (C) 2024 Charles Ancheta
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ * \file regalloc.h
+ */
+#ifndef DEW_REGALLOC_H_
+#define DEW_REGALLOC_H_
+
+#include "bytecode.h"
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+namespace dew {
+namespace regalloc {
+/** Machine registers available to the allocator, by target numbering. */
+struct Target {
+  /** Preserved across calls. */
+  std::vector<uint8_t> calleeSaved;
+  /** Clobbered by calls, so only for values that never see one. */
+  std::vector<uint8_t> callerSaved;
+};
+
+struct Location {
+  enum class Kind : uint8_t { Unused, Register, Stack };
+  Kind kind;
+  /** Machine register for Register, slot number for Stack. */
+  uint32_t index;
+};
+
+struct Allocation {
+  /** One per bytecode register. */
+  std::vector<Location> locations;
+  uint32_t stackSlots;
+  /** Callee-saved registers that were handed out, in Target order. */
+  std::vector<uint8_t> calleeSavedUsed;
+  /**
+   * The first and last position each register is live at, where
+   * instruction pc reads at 2 * pc and writes at 2 * pc + 1. No other
+   * register shares its location in between. Unused ones start after they
+   * end.
+   */
+  std::vector<std::pair<uint32_t, uint32_t>> intervals;
+};
+
+/**
+ * Linear scan (Poletto & Sarkar) over the live intervals of `fn`'s
+ * bytecode registers. Intervals are computed from block-level liveness, so
+ * a value used across a loop back-edge stays allocated for the whole loop.
+ */
+Allocation linearScan(const bc::Program &program, const bc::Function &fn,
+                      const Target &target);
+} // namespace regalloc
+} // namespace dew
+#endif // !DEW_REGALLOC_H_
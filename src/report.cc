@@ -0,0 +1,276 @@
+/**
+ * Copyright (C) 2024 Charles Ancheta
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ * \file report.cc
+ */
+#include "report.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <malloc.h>
+#include <tree_sitter/api.h>
+#include <unordered_map>
+
+using namespace dew;
+
+namespace {
+Report *active{nullptr};
+
+// Heap use, in usable bytes of the blocks malloc handed out. Only counted
+// once countAllocations() is called, so the hooks stay a branch away from
+// malloc otherwise.
+std::atomic<bool> counting{false};
+std::atomic<uint64_t> heapAllocations{0};
+std::atomic<uint64_t> heapBytes{0};
+std::atomic<int64_t> heapLive{0};
+std::atomic<int64_t> heapPeak{0};
+thread_local uint64_t threadAllocations{0};
+thread_local uint64_t threadBytes{0};
+
+void raisePeak(int64_t to) {
+  int64_t high{heapPeak.load(std::memory_order_relaxed)};
+  while (to > high && !heapPeak.compare_exchange_weak(
+                          high, to, std::memory_order_relaxed)) {
+  }
+}
+
+void *countedMalloc(std::size_t size) {
+  return Report::allocated(std::malloc(size));
+}
+
+void *countedCalloc(std::size_t count, std::size_t size) {
+  return Report::allocated(std::calloc(count, size));
+}
+
+void *countedRealloc(void *p, std::size_t size) {
+  Report::freeing(p);
+  return Report::allocated(std::realloc(p, size));
+}
+
+void countedFree(void *p) {
+  Report::freeing(p);
+  std::free(p);
+}
+
+/** Nanoseconds as milliseconds. */
+double ms(Report::Clock::duration d) {
+  return std::chrono::duration<double, std::milli>{d}.count();
+}
+
+double mb(int64_t bytes) { return static_cast<double>(bytes) / (1 << 20); }
+
+void quoted(std::ostream &out, std::string_view text) {
+  out << '"';
+  for (const char c : text) {
+    if (c == '"' || c == '\\') {
+      out << '\\';
+    }
+    out << c;
+  }
+  out << '"';
+}
+} // namespace
+
+Report::Phase::Phase(const char *name) : name{name} {
+  if (!active) {
+    return;
+  }
+  start = Clock::now();
+  allocations = heapAllocations.load(std::memory_order_relaxed);
+  bytes = heapBytes.load(std::memory_order_relaxed);
+  live = heapLive.load(std::memory_order_relaxed);
+  outerPeak = heapPeak.exchange(live, std::memory_order_relaxed);
+  outerName = active->current;
+  active->current = name;
+  ++active->depth;
+}
+
+Report::Phase::~Phase() {
+  if (!active) {
+    return;
+  }
+  int64_t high{heapPeak.load(std::memory_order_relaxed)};
+  raisePeak(outerPeak);
+  active->current = outerName;
+  --active->depth;
+  active->record(
+      Event{name, nullptr, 0, active->depth, start, Clock::now() - start,
+            heapAllocations.load(std::memory_order_relaxed) - allocations,
+            heapBytes.load(std::memory_order_relaxed) - bytes, high - live},
+      std::this_thread::get_id());
+}
+
+Report::Function::Function(std::string_view name) : name{name} {
+  if (!active) {
+    return;
+  }
+  start = Clock::now();
+  allocations = threadAllocations;
+  bytes = threadBytes;
+}
+
+Report::Function::~Function() {
+  if (!active) {
+    return;
+  }
+  active->record(Event{std::string{name}, active->current, 0, 0, start,
+                       Clock::now() - start, threadAllocations - allocations,
+                       threadBytes - bytes, 0},
+                 std::this_thread::get_id());
+}
+
+Report::Report() : origin{Clock::now()}, current{nullptr}, depth{0} {}
+
+void Report::activate(Report *report) { active = report; }
+
+void *Report::allocated(void *p) {
+  if (p != nullptr && counting.load(std::memory_order_relaxed)) {
+    auto size{static_cast<int64_t>(malloc_usable_size(p))};
+    heapAllocations.fetch_add(1, std::memory_order_relaxed);
+    heapBytes.fetch_add(size, std::memory_order_relaxed);
+    ++threadAllocations;
+    threadBytes += size;
+    raisePeak(heapLive.fetch_add(size, std::memory_order_relaxed) + size);
+  }
+  return p;
+}
+
+void Report::freeing(void *p) {
+  if (p != nullptr && counting.load(std::memory_order_relaxed)) {
+    heapLive.fetch_sub(static_cast<int64_t>(malloc_usable_size(p)),
+                       std::memory_order_relaxed);
+  }
+}
+
+void Report::countAllocations() {
+  ts_set_allocator(countedMalloc, countedCalloc, countedRealloc, countedFree);
+  counting = true;
+}
+
+void Report::record(Event event, std::thread::id thread) {
+  std::lock_guard<std::mutex> guard{lock};
+  auto known{std::find(threads.begin(), threads.end(), thread)};
+  event.thread = static_cast<uint32_t>(known - threads.begin());
+  if (known == threads.end()) {
+    threads.push_back(thread);
+  }
+  (event.phase ? functions : phases).push_back(std::move(event));
+}
+
+void Report::table(std::ostream &out, bool memory, std::size_t top) const {
+  char line[128];
+  auto row{[&](std::string_view name, const Event &e, bool peak) {
+    std::snprintf(line, sizeof(line), "%-28.*s %10.3f",
+                  static_cast<int>(name.size()), name.data(), ms(e.time));
+    out << line;
+    if (memory) {
+      std::snprintf(line, sizeof(line), " %10llu %10.2f",
+                    static_cast<unsigned long long>(e.allocations),
+                    mb(static_cast<int64_t>(e.bytes)));
+      out << line;
+      if (peak) {
+        std::snprintf(line, sizeof(line), " %10.2f", mb(e.peak));
+        out << line;
+      }
+    }
+    out << "\n";
+  }};
+  auto header{[&](const char *title, bool peak) {
+    std::snprintf(line, sizeof(line), "%-28s %10s", title, "ms");
+    out << line;
+    if (memory) {
+      std::snprintf(line, sizeof(line), " %10s %10s%s", "allocs", "alloc MB",
+                    peak ? "    peak MB" : "");
+      out << line;
+    }
+    out << "\n";
+  }};
+
+  // Phases are recorded as they end, so inner ones come before the phase
+  // they're part of; list them by when they started instead.
+  std::vector<const Event *> order;
+  for (const Event &e : phases) {
+    order.push_back(&e);
+  }
+  std::stable_sort(order.begin(), order.end(),
+                   [](const Event *a, const Event *b) {
+                     return a->start < b->start;
+                   });
+  header("phase", true);
+  for (const Event *e : order) {
+    row(std::string(2 * e->depth, ' ') + e->name, *e, true);
+  }
+
+  // A function is worked on in several phases; add those up.
+  std::vector<Event> totals;
+  std::unordered_map<std::string_view, std::size_t> index;
+  for (const Event &e : functions) {
+    auto [it, added]{index.emplace(e.name, totals.size())};
+    if (added) {
+      totals.push_back(Event{e.name, e.phase, 0, 0, {}, {}, 0, 0, 0});
+    }
+    Event &total{totals[it->second]};
+    total.time += e.time;
+    total.allocations += e.allocations;
+    total.bytes += e.bytes;
+  }
+  if (totals.empty() || top == 0) {
+    return;
+  }
+  std::size_t shown{std::min(top, totals.size())};
+  std::partial_sort(totals.begin(), totals.begin() + shown, totals.end(),
+                    [](const Event &a, const Event &b) {
+                      return a.time > b.time;
+                    });
+  out << "\n";
+  header("function", false);
+  for (std::size_t i{0}; i < shown; ++i) {
+    row(totals[i].name, totals[i], false);
+  }
+}
+
+void Report::trace(std::ostream &out) const {
+  out << "{\"traceEvents\":[\n";
+  bool first{true};
+  auto event{[&](const Event &e) {
+    out << (first ? "" : ",\n") << "{\"name\":";
+    first = false;
+    quoted(out, e.name);
+    out << ",\"cat\":\"" << (e.phase ? "function" : "phase")
+        << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << e.thread
+        << ",\"ts\":" << ms(e.start - origin) * 1000
+        << ",\"dur\":" << ms(e.time) * 1000 << ",\"args\":{";
+    if (e.phase) {
+      out << "\"phase\":";
+      quoted(out, e.phase);
+      out << ",";
+    }
+    out << "\"allocations\":" << e.allocations << ",\"bytes\":" << e.bytes;
+    if (!e.phase) {
+      out << ",\"peak\":" << e.peak;
+    }
+    out << "}}";
+  }};
+  for (const Event &e : phases) {
+    event(e);
+  }
+  for (const Event &e : functions) {
+    event(e);
+  }
+  out << "\n],\"displayTimeUnit\":\"ms\"}\n";
+}
@@ -0,0 +1,129 @@
+/**
+ * Copyright (C) 2024 Charles Ancheta
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ * \file report.h
+ */
+#ifndef DEW_REPORT_H_
+#define DEW_REPORT_H_
+
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+namespace dew {
+/**
+ * Where a compile spends its time and memory, phase by phase and function
+ * by function, for `--time-report`, `--mem-report` and `--trace`. Phases
+ * and functions are recorded into the active report; with none active,
+ * marking them costs a branch.
+ */
+class Report {
+public:
+  using Clock = std::chrono::steady_clock;
+
+  /** Records a phase of the compile for as long as it's in scope. */
+  class Phase {
+  public:
+    Phase(const char *name);
+    ~Phase();
+    Phase(const Phase &) = delete;
+    Phase &operator=(const Phase &) = delete;
+
+  private:
+    const char *name;
+    Clock::time_point start;
+    uint64_t allocations;
+    uint64_t bytes;
+    int64_t live;
+    /** The enclosing phase's high-water mark, restored at the end. */
+    int64_t outerPeak;
+    const char *outerName;
+  };
+
+  /** Records the work on one function for as long as it's in scope. */
+  class Function {
+  public:
+    Function(std::string_view name);
+    ~Function();
+    Function(const Function &) = delete;
+    Function &operator=(const Function &) = delete;
+
+  private:
+    std::string_view name;
+    Clock::time_point start;
+    uint64_t allocations;
+    uint64_t bytes;
+  };
+
+  Report();
+  /** Makes `report` the one phases are recorded into, or none. */
+  static void activate(Report *report);
+  /**
+   * Counts heap allocations from here on, tree-sitter's included. Call it
+   * before any other threads start.
+   */
+  static void countAllocations();
+  /**
+   * Counts `p`, just returned by malloc, and hands it back. With freeing,
+   * this is what the operator new and delete in heap.cc go through; only
+   * dewc links those, so hosts of libdew.a keep their own.
+   */
+  static void *allocated(void *p);
+  /** Uncounts `p`, about to be freed. */
+  static void freeing(void *p);
+
+  /**
+   * Prints the phases and the `top` functions that took longest, with
+   * allocation counts and peak heap growth if `memory`.
+   */
+  void table(std::ostream &out, bool memory, std::size_t top) const;
+  /** Writes everything as Chrome trace events, for a trace viewer. */
+  void trace(std::ostream &out) const;
+
+private:
+  struct Event {
+    std::string name;
+    /** The phase a function was worked on in; null for phases. */
+    const char *phase;
+    uint32_t thread;
+    uint32_t depth;
+    Clock::time_point start;
+    Clock::duration time;
+    uint64_t allocations;
+    uint64_t bytes;
+    /** How far the heap grew past where it was at the start. */
+    int64_t peak;
+  };
+
+  void record(Event event, std::thread::id thread);
+
+  Clock::time_point origin;
+  std::mutex lock;
+  std::vector<Event> phases;
+  std::vector<Event> functions;
+  std::vector<std::thread::id> threads;
+  /** The innermost phase on the thread that runs them, and its depth. */
+  const char *current;
+  uint32_t depth;
+};
+} // namespace dew
+#endif // !DEW_REPORT_H_
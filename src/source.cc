@@ -0,0 +1,124 @@
+/**
+ * Copyright (C) 2024 Charles Ancheta
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ * \file source.cc
+ */
+#include "source.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utility>
+
+using namespace dew;
+
+Source::Source() : map{nullptr}, mapSize{0}, usesOwned{true} {}
+
+Source::Source(std::string text)
+    : map{nullptr}, mapSize{0}, owned{std::move(text)}, usesOwned{true} {}
+
+Source::Source(Source &&other) noexcept
+    : map{std::exchange(other.map, nullptr)},
+      mapSize{std::exchange(other.mapSize, 0)},
+      owned{std::move(other.owned)}, usesOwned{other.usesOwned} {}
+
+Source &Source::operator=(Source &&other) noexcept {
+  std::swap(map, other.map);
+  std::swap(mapSize, other.mapSize);
+  std::swap(owned, other.owned);
+  std::swap(usesOwned, other.usesOwned);
+  return *this;
+}
+
+Source::~Source() {
+  if (map) {
+    munmap(const_cast<char *>(map), mapSize);
+  }
+}
+
+/** Reads all of `fd`, for files that can't be mapped. */
+static bool readAll(int fd, std::string &out) {
+  char buffer[1 << 16];
+  for (;;) {
+    ssize_t n{read(fd, buffer, sizeof(buffer))};
+    if (n == 0) {
+      return true;
+    } else if (n > 0) {
+      out.append(buffer, static_cast<std::size_t>(n));
+    } else if (errno != EINTR) {
+      return false;
+    }
+  }
+}
+
+std::optional<Source> Source::load(const char *path) {
+  bool stdinPath{std::strcmp(path, "-") == 0};
+  int fd{stdinPath ? STDIN_FILENO : open(path, O_RDONLY)};
+  if (fd < 0) {
+    std::cerr << "file `" << path << "` could not be read\n";
+    return std::nullopt;
+  }
+  Source source;
+  struct stat info;
+  // Empty files can't be mapped, and don't need to be.
+  if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0) {
+    auto size{static_cast<std::size_t>(info.st_size)};
+    void *p{mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0)};
+    if (p != MAP_FAILED) {
+      source.map = static_cast<const char *>(p);
+      source.mapSize = size;
+      source.usesOwned = false;
+    }
+  }
+  bool ok{!source.usesOwned || readAll(fd, source.owned)};
+  if (!stdinPath) {
+    close(fd);
+  }
+  if (!ok) {
+    std::cerr << "file `" << path << "` could not be read\n";
+    return std::nullopt;
+  }
+  return source;
+}
+
+std::string_view Source::text() const {
+  return usesOwned ? std::string_view{owned} : std::string_view{map, mapSize};
+}
+
+void Source::replace(std::size_t start, std::size_t end,
+                     std::string_view with) {
+  if (!usesOwned) {
+    owned.assign(map, mapSize);
+    usesOwned = true;
+  }
+  owned.replace(start, end - start, with);
+}
+
+void Source::release(std::size_t end) {
+  if (!mapped()) {
+    return;
+  }
+  auto page{static_cast<std::size_t>(sysconf(_SC_PAGESIZE))};
+  std::size_t length{std::min(end, mapSize) / page * page};
+  if (length > 0) {
+    madvise(const_cast<char *>(map), length, MADV_DONTNEED);
+  }
+}
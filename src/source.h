@@ -0,0 +1,74 @@
+/**
+ * Copyright (C) 2024 Charles Ancheta
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ * \file source.h
+ */
+#ifndef DEW_SOURCE_H_
+#define DEW_SOURCE_H_
+
+#include <cstddef>
+#include <optional>
+#include <string>
+#include <string_view>
+
+namespace dew {
+/**
+ * The text of a source file. Files are mapped read-only rather than read,
+ * so that parsing starts without copying them, and views into the text stay
+ * valid for as long as the Source does.
+ */
+class Source {
+public:
+  Source(std::string text);
+  Source(Source &&other) noexcept;
+  Source &operator=(Source &&other) noexcept;
+  Source(const Source &) = delete;
+  Source &operator=(const Source &) = delete;
+  ~Source();
+
+  /**
+   * Maps the file at `path`, or reads it if it can't be mapped, like a pipe.
+   * `-` reads standard input. Errors are reported on std::cerr.
+   */
+  static std::optional<Source> load(const char *path);
+
+  std::string_view text() const;
+  std::size_t size() const { return text().size(); }
+  /** Whether the text is a mapped file, which is never written to. */
+  bool mapped() const { return !usesOwned; }
+  /**
+   * Replaces the bytes in [start, end) with `with`. The first edit copies a
+   * mapped file, but keeps the mapping, so earlier views stay valid.
+   */
+  void replace(std::size_t start, std::size_t end, std::string_view with);
+  /**
+   * Lets the pages of a mapped file before `end` go from memory, for
+   * callers done with them. Views into them stay valid: the pages are read
+   * back from the file if they're touched again.
+   */
+  void release(std::size_t end);
+
+private:
+  Source();
+
+  const char *map;
+  std::size_t mapSize;
+  std::string owned;
+  bool usesOwned;
+};
+} // namespace dew
+#endif // !DEW_SOURCE_H_
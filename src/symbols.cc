@@ -0,0 +1,83 @@
+/**
+ * Copyright (C) 2024 Charles Ancheta
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ * \file symbols.cc
+ */
+#include "symbols.h"
+
+using namespace dew;
+
+/** FNV-1a. */
+static uint32_t hashName(std::string_view name) {
+  uint32_t hash{2166136261u};
+  for (const char c : name) {
+    hash = (hash ^ static_cast<unsigned char>(c)) * 16777619u;
+  }
+  return hash;
+}
+
+Interner::Interner() : table(64, 0) {}
+
+Symbol Interner::intern(std::string_view name) {
+  uint32_t hash{hashName(name)};
+  std::size_t at{slot(name, hash)};
+  if (table[at] != 0) {
+    return table[at] - 1;
+  }
+  auto symbol{static_cast<Symbol>(names.size())};
+  Span<char> copy{arena.copy(name.data(), name.size())};
+  names.emplace_back(copy.begin(), copy.size());
+  hashes.push_back(hash);
+  table[at] = symbol + 1;
+  // Kept at most half full so that probes stay short.
+  if (names.size() * 2 > table.size()) {
+    grow();
+  }
+  return symbol;
+}
+
+std::optional<Symbol> Interner::find(std::string_view name) const {
+  std::size_t at{slot(name, hashName(name))};
+  if (table[at] == 0) {
+    return std::nullopt;
+  }
+  return table[at] - 1;
+}
+
+std::size_t Interner::slot(std::string_view name, uint32_t hash) const {
+  std::size_t mask{table.size() - 1};
+  for (std::size_t at{hash & mask};; at = (at + 1) & mask) {
+    uint32_t entry{table[at]};
+    if (entry == 0 ||
+        (hashes[entry - 1] == hash && names[entry - 1] == name)) {
+      return at;
+    }
+  }
+}
+
+void Interner::grow() {
+  std::vector<uint32_t> bigger(table.size() * 2, 0);
+  std::size_t mask{bigger.size() - 1};
+  for (uint32_t i{0}; i < names.size(); ++i) {
+    std::size_t at{hashes[i] & mask};
+    while (bigger[at] != 0) {
+      at = (at + 1) & mask;
+    }
+    bigger[at] = i + 1;
+  }
+  table = std::move(bigger);
+}
@@ -0,0 +1,113 @@
+/**
+ * Copyright (C) 2024 Charles Ancheta
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ * \file symbols.h
+ */
+#ifndef DEW_SYMBOLS_H_
+#define DEW_SYMBOLS_H_
+
+#include "arena.h"
+#include <cstdint>
+#include <optional>
+#include <string_view>
+#include <vector>
+
+namespace dew {
+/** Dense ID of an interned name, counting up from 0. */
+using Symbol = uint32_t;
+
+/**
+ * Hands out one Symbol per distinct name, so that names can be compared and
+ * looked up as integers. The names are copied, and stay valid for as long
+ * as the interner does.
+ */
+class Interner {
+public:
+  Interner();
+  Interner(const Interner &) = delete;
+  Interner &operator=(const Interner &) = delete;
+
+  Symbol intern(std::string_view name);
+  /** The symbol of `name` if it was interned before, without adding it. */
+  std::optional<Symbol> find(std::string_view name) const;
+  std::string_view name(Symbol symbol) const { return names[symbol]; }
+  std::size_t size() const { return names.size(); }
+
+private:
+  /** The slot `name` is in, or the empty one it would go in. */
+  std::size_t slot(std::string_view name, uint32_t hash) const;
+  void grow();
+
+  Arena arena;
+  std::vector<std::string_view> names;
+  std::vector<uint32_t> hashes;
+  /** Open addressing with linear probing; holds symbol + 1, 0 if empty. */
+  std::vector<uint32_t> table;
+};
+
+/**
+ * Nested scopes of bindings from symbols to values. Every symbol has one
+ * slot for its innermost binding, and leaving a scope pops the bindings
+ * made since it was entered, putting back whatever each had shadowed. That
+ * makes resolving a name one array access, however deep the nesting.
+ */
+template <typename T> class ScopeTable {
+public:
+  struct Binding {
+    Symbol symbol;
+    /** Index + 1 of the binding this one shadows, 0 if none. */
+    uint32_t shadowed;
+    T value;
+  };
+
+  /** Where the current scope starts, to be passed to leave. */
+  std::size_t mark() const { return bindings.size(); }
+
+  void define(Symbol symbol, T value) {
+    if (symbol >= slots.size()) {
+      slots.resize(symbol + 1, 0);
+    }
+    bindings.push_back(Binding{symbol, slots[symbol], std::move(value)});
+    slots[symbol] = static_cast<uint32_t>(bindings.size());
+  }
+
+  const T *resolve(Symbol symbol) const {
+    if (symbol >= slots.size() || slots[symbol] == 0) {
+      return nullptr;
+    }
+    return &bindings[slots[symbol] - 1].value;
+  }
+
+  /** Undoes every binding made since `mark`. */
+  void leave(std::size_t mark) {
+    while (bindings.size() > mark) {
+      slots[bindings.back().symbol] = bindings.back().shadowed;
+      bindings.pop_back();
+    }
+  }
+
+  void clear() { leave(0); }
+
+  /** Every binding in order, shadowed ones included. */
+  const std::vector<Binding> &all() const { return bindings; }
+
+private:
+  std::vector<uint32_t> slots;
+  std::vector<Binding> bindings;
+};
+} // namespace dew
+#endif // !DEW_SYMBOLS_H_
@@ -20,17 +20,49 @@
 #ifndef DEW_TYPE_H_
 #define DEW_TYPE_H_
 
+#include <cstdint>
+#include <iterator>
 #include <string_view>
 
 namespace dew {
-using DataType = std::string_view;
-
-constexpr DataType INT8 = "i8";
-constexpr DataType INT16 = "i16";
-constexpr DataType INT32 = "i32";
-constexpr DataType UINT8 = "u8";
-constexpr DataType UINT16 = "u16";
-constexpr DataType UINT32 = "u32";
+/**
+ * A type, as an index into TYPES. Only the builtin integer types exist so
+ * far, so every name interns to one of a fixed set of ids; Untyped is what
+ * expressions get when their type comes from where they're used, like
+ * integer literals and comparisons.
+ */
+enum class TypeId : uint8_t { Untyped, Invalid, I8, I16, I32, U8, U16, U32 };
+
+struct TypeInfo {
+  std::string_view name;
+  /** Zero for anything but an integer. */
+  uint8_t bits;
+  bool isSigned;
+};
+
+/** Indexed by TypeId. */
+inline constexpr TypeInfo TYPES[]{
+    {"untyped", 0, false}, {"invalid", 0, false}, {"i8", 8, true},
+    {"i16", 16, true},     {"i32", 32, true},     {"u8", 8, false},
+    {"u16", 16, false},    {"u32", 32, false},
+};
+
+constexpr const TypeInfo &typeInfo(TypeId type) {
+  return TYPES[static_cast<uint8_t>(type)];
+}
+
+constexpr bool isInteger(TypeId type) { return typeInfo(type).bits != 0; }
+
+/** The builtin type called `name`, or Invalid if there's none. */
+constexpr TypeId typeNamed(std::string_view name) {
+  for (uint8_t i{static_cast<uint8_t>(TypeId::I8)}; i < std::size(TYPES);
+       ++i) {
+    if (TYPES[i].name == name) {
+      return static_cast<TypeId>(i);
+    }
+  }
+  return TypeId::Invalid;
+}
 } // namespace dew
 
 #endif // !DEW_TYPE_H_
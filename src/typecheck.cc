@@ -0,0 +1,248 @@
+/**
+ * Copyright (C) 2024 Charles Ancheta
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ * \file typecheck.cc
+ */
+#include "typecheck.h"
+
+using namespace dew;
+
+/** What the compilers give variables of type `type`. */
+static TypeId variableType(TypeId type) {
+  return isInteger(type) ? type : TypeId::I32;
+}
+
+dew::TypeChecker::TypeChecker(ast::Tree &tree,
+                              const std::vector<ast::Function> &functions)
+    : tree{tree}, calls{nullptr} {
+  for (const ast::Function &fn : functions) {
+    if (!this->functions.resolve(fn.decl->symbol)) {
+      this->functions.define(fn.decl->symbol, fn.decl);
+    }
+  }
+}
+
+void dew::TypeChecker::check(const ast::Function &fn,
+                             std::vector<Symbol> *calls) {
+  this->calls = calls;
+  locals.clear();
+  for (const ast::Parameter &param : fn.decl->params) {
+    locals.define(param.symbol, variableType(param.type));
+  }
+  stmt(fn.block);
+}
+
+void dew::TypeChecker::stmt(ast::Stmt root) {
+  // Blocks nest as deep as the source likes, so the statements in them are
+  // checked off a stack of our own rather than by recursing.
+  std::size_t bottom{stmtWork.size()};
+  stmtWork.push_back(StmtWork{root, 0, 0});
+  while (stmtWork.size() > bottom) {
+    StmtWork &w{stmtWork.back()};
+    ast::Stmt s{w.stmt};
+    if (!s) {
+      stmtWork.pop_back();
+      continue;
+    }
+    switch (s.kind()) {
+    case ast::StmtKind::Block: {
+      Span<const ast::Stmt> statements{tree.list(tree.block(s).statements)};
+      if (w.stage == 0) {
+        w.scope = locals.mark();
+      }
+      if (w.stage < statements.size()) {
+        stmtWork.push_back(StmtWork{statements[w.stage++], 0, 0});
+        continue;
+      }
+      locals.leave(w.scope);
+      break;
+    }
+    case ast::StmtKind::For: {
+      const ast::ForStatement &loop{tree.forStmt(s)};
+      switch (w.stage++) {
+      case 0:
+        w.scope = locals.mark();
+        stmtWork.push_back(StmtWork{loop.initial, 0, 0});
+        continue;
+      case 1:
+        expr(loop.condition);
+        stmtWork.push_back(StmtWork{loop.body, 0, 0});
+        continue;
+      case 2:
+        stmtWork.push_back(StmtWork{loop.update, 0, 0});
+        continue;
+      default:
+        locals.leave(w.scope);
+        break;
+      }
+      break;
+    }
+    case ast::StmtKind::If: {
+      const ast::IfStatement &node{tree.ifStmt(s)};
+      switch (w.stage++) {
+      case 0:
+        expr(node.condition);
+        stmtWork.push_back(StmtWork{node.consequence, 0, 0});
+        continue;
+      case 1:
+        stmtWork.push_back(StmtWork{node.alternative, 0, 0});
+        continue;
+      default:
+        break;
+      }
+      break;
+    }
+    default:
+      simpleStmt(s);
+      break;
+    }
+    stmtWork.pop_back();
+  }
+}
+
+void dew::TypeChecker::simpleStmt(ast::Stmt s) {
+  switch (s.kind()) {
+  case ast::StmtKind::Var: {
+    const ast::VarDeclaration &var{tree.var(s)};
+    // The values can't see the names they initialize.
+    exprs(var.values);
+    TypeId type{variableType(var.type)};
+    for (const ast::Expr name : tree.list(var.names)) {
+      tree.setType(name, type);
+      locals.define(tree.identifier(name).symbol, type);
+    }
+    break;
+  }
+  case ast::StmtKind::Expression:
+    expr(tree.expression(s).expr);
+    break;
+  case ast::StmtKind::Increment:
+    expr(tree.increment(s).expr);
+    break;
+  case ast::StmtKind::Decrement:
+    expr(tree.decrement(s).expr);
+    break;
+  case ast::StmtKind::Assignment:
+    exprs(tree.assignment(s).left);
+    exprs(tree.assignment(s).right);
+    break;
+  case ast::StmtKind::Return:
+    exprs(tree.returnStmt(s).values);
+    break;
+  default:
+    break;
+  }
+}
+
+TypeId dew::TypeChecker::expr(ast::Expr root) {
+  // Operands are typed before the expression they're in, and read back
+  // from the tree once they are. Chains of operators nest as deep as
+  // they're long, so this doesn't recurse either.
+  auto typeOf{[&](ast::Expr e) { return e ? tree.type(e) : TypeId::Untyped; }};
+  std::size_t bottom{exprWork.size()};
+  exprWork.push_back(ExprWork{root, false});
+  while (exprWork.size() > bottom) {
+    ExprWork &w{exprWork.back()};
+    ast::Expr e{w.expr};
+    if (!e) {
+      exprWork.pop_back();
+      continue;
+    }
+    if (!w.operandsTyped) {
+      w.operandsTyped = true;
+      switch (e.kind()) {
+      case ast::ExprKind::Binary:
+        exprWork.push_back(ExprWork{tree.binary(e).right, false});
+        exprWork.push_back(ExprWork{tree.binary(e).left, false});
+        break;
+      case ast::ExprKind::Unary:
+        exprWork.push_back(ExprWork{tree.unary(e).operand, false});
+        break;
+      case ast::ExprKind::Call: {
+        const ast::CallExpression &call{tree.call(e)};
+        for (const ast::Expr argument : tree.list(call.arguments)) {
+          exprWork.push_back(ExprWork{argument, false});
+        }
+        exprWork.push_back(ExprWork{call.function, false});
+        break;
+      }
+      default:
+        break;
+      }
+      continue;
+    }
+    exprWork.pop_back();
+
+    TypeId type{TypeId::Untyped};
+    switch (e.kind()) {
+    case ast::ExprKind::Binary: {
+      const ast::BinaryExpression &bin{tree.binary(e)};
+      TypeId left{typeOf(bin.left)};
+      TypeId right{typeOf(bin.right)};
+      switch (bin.op) {
+      case ast::BinaryOp::GT:
+      case ast::BinaryOp::LT:
+      case ast::BinaryOp::GTEq:
+      case ast::BinaryOp::LTEq:
+      case ast::BinaryOp::Eq:
+      case ast::BinaryOp::Neq:
+      case ast::BinaryOp::And:
+      case ast::BinaryOp::Or:
+        break;
+      default:
+        type = left != TypeId::Untyped ? left : right;
+      }
+      break;
+    }
+    case ast::ExprKind::Unary:
+      type = typeOf(tree.unary(e).operand);
+      break;
+    case ast::ExprKind::Identifier: {
+      const TypeId *local{locals.resolve(tree.identifier(e).symbol)};
+      type = local ? *local : TypeId::Untyped;
+      break;
+    }
+    case ast::ExprKind::Integer:
+      break;
+    case ast::ExprKind::Call: {
+      const ast::CallExpression &call{tree.call(e)};
+      if (!call.function ||
+          call.function.kind() != ast::ExprKind::Identifier) {
+        break;
+      }
+      Symbol name{tree.identifier(call.function).symbol};
+      if (calls) {
+        calls->push_back(name);
+      }
+      auto callee{functions.resolve(name)};
+      if (callee && !(*callee)->returnValues.empty() &&
+          isInteger((*callee)->returnValues[0])) {
+        type = (*callee)->returnValues[0];
+      }
+      break;
+    }
+    }
+    tree.setType(e, type);
+  }
+  return typeOf(root);
+}
+
+void dew::TypeChecker::exprs(ast::List<ast::Expr> list) {
+  for (const ast::Expr e : tree.list(list)) {
+    expr(e);
+  }
+}
@@ -0,0 +1,71 @@
+/**
+ * Copyright (C) 2024 Charles Ancheta
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ * \file typecheck.h
+ */
+#ifndef DEW_TYPECHECK_H_
+#define DEW_TYPECHECK_H_
+
+#include "ast.h"
+#include "symbols.h"
+#include "type.h"
+#include <vector>
+
+namespace dew {
+/**
+ * Annotates every expression with the type it has of its own: that of the
+ * variable an identifier names, of the first result of a called function,
+ * or of the left operand of arithmetic, else the right one. Literals,
+ * comparisons and logic are left Untyped and take the type of wherever
+ * they're used, which is also where the compilers report what doesn't fit.
+ *
+ * Copies can check different functions of the same tree at once.
+ */
+class TypeChecker {
+public:
+  /** Calls resolve to the first of `functions` with the callee's name. */
+  TypeChecker(ast::Tree &tree, const std::vector<ast::Function> &functions);
+  /** Adds the name of each function `fn` calls to `calls`, if given. */
+  void check(const ast::Function &fn, std::vector<Symbol> *calls = nullptr);
+
+private:
+  void stmt(ast::Stmt s);
+  /** A statement with no statements in it. */
+  void simpleStmt(ast::Stmt s);
+  TypeId expr(ast::Expr e);
+  void exprs(ast::List<ast::Expr> list);
+
+  /** A statement partway through, and the scope it opened. */
+  struct StmtWork {
+    ast::Stmt stmt;
+    uint32_t stage;
+    std::size_t scope;
+  };
+  struct ExprWork {
+    ast::Expr expr;
+    bool operandsTyped;
+  };
+
+  ast::Tree &tree;
+  ScopeTable<const FunctionDeclaration *> functions;
+  ScopeTable<TypeId> locals;
+  std::vector<StmtWork> stmtWork;
+  std::vector<ExprWork> exprWork;
+  std::vector<Symbol> *calls;
+};
+} // namespace dew
+#endif // !DEW_TYPECHECK_H_
@@ -17,44 +17,55 @@
 /**
  * \file util.cc
  */
+#include <array>
 #include <cstdint>
-#include <cstdlib>
-#include <iostream>
-#include <sstream>
-#include <unordered_map>
+#include <optional>
 
 #include "ast.h"
 #include "util.h"
 
 using namespace dew;
 
-ast::BinaryOp dew::getBinaryOp(const std::string_view &str) {
-  static const std::unordered_map<std::string_view, ast::BinaryOp> enumMap{
-      {"*", ast::BinaryOp::Mul},         {"/", ast::BinaryOp::Div},
-      {"%", ast::BinaryOp::Mod},         {"<<", ast::BinaryOp::ShiftLeft},
-      {">>", ast::BinaryOp::ShiftRight}, {"&", ast::BinaryOp::BitAnd},
-      {"+", ast::BinaryOp::Add},         {"-", ast::BinaryOp::Sub},
-      {"|", ast::BinaryOp::BitOr},       {"^", ast::BinaryOp::BitXor},
-      {">", ast::BinaryOp::GT},          {"<", ast::BinaryOp::LT},
-      {">=", ast::BinaryOp::GTEq},       {"<=", ast::BinaryOp::LTEq},
-      {"==", ast::BinaryOp::Eq},         {"!=", ast::BinaryOp::Neq},
-      {"&&", ast::BinaryOp::And},        {"||", ast::BinaryOp::Or},
-  };
-  auto it{enumMap.find(str)};
-  if (it != enumMap.end()) {
-    return it->second;
-  } else {
-    // shouldn't really get here
-    std::cerr << "Invalid operand: " << str << "\n";
-    std::exit(1);
+static constexpr uint8_t SEPARATOR{254};
+
+/** The value of every digit character, SEPARATOR for `_`, 255 otherwise. */
+static constexpr auto DIGITS{[] {
+  std::array<uint8_t, 256> digits{};
+  for (uint8_t &d : digits) {
+    d = 255;
+  }
+  for (int c{'0'}; c <= '9'; ++c) {
+    digits[c] = static_cast<uint8_t>(c - '0');
+  }
+  for (int c{'a'}; c <= 'f'; ++c) {
+    digits[c] = static_cast<uint8_t>(c - 'a' + 10);
+    digits[c - 'a' + 'A'] = static_cast<uint8_t>(c - 'a' + 10);
+  }
+  digits['_'] = SEPARATOR;
+  return digits;
+}()};
+
+std::optional<uint64_t> dew::parseInt(std::string_view literal) {
+  // Most literals are short and decimal, and 19 digits can't overflow.
+  if (!literal.empty() && literal.size() <= 19) {
+    uint64_t value{0};
+    std::size_t i{0};
+    for (; i < literal.size(); ++i) {
+      auto digit{static_cast<unsigned>(literal[i] - '0')};
+      if (digit > 9) {
+        break;
+      }
+      value = value * 10 + digit;
+    }
+    if (i == literal.size()) {
+      return value;
+    }
   }
-}
 
-uint64_t dew::parseInt(const std::string_view &literal) {
-  int base{10};
-  std::stringstream ss;
-  for (const char c : literal) {
-    switch (c) {
+  unsigned base{10};
+  std::size_t i{0};
+  if (literal.size() > 2 && literal[0] == '0') {
+    switch (literal[1]) {
     case 'x':
     case 'X':
       base = 16;
@@ -67,13 +78,29 @@ uint64_t dew::parseInt(const std::string_view &literal) {
     case 'B':
       base = 2;
       break;
-    case '_':
-      break;
-    default:
-      ss << c;
     }
+    i = base == 10 ? 0 : 2;
+  }
+  // Anything above these would overflow.
+  uint64_t limit{UINT64_MAX / base};
+  uint64_t lastDigit{UINT64_MAX % base};
+  uint64_t value{0};
+  bool digits{false};
+  for (; i < literal.size(); ++i) {
+    uint8_t digit{DIGITS[static_cast<unsigned char>(literal[i])]};
+    if (digit == SEPARATOR) {
+      continue;
+    } else if (digit >= base || value > limit ||
+               (value == limit && digit > lastDigit)) {
+      return std::nullopt;
+    }
+    value = value * base + digit;
+    digits = true;
+  }
+  if (!digits) {
+    return std::nullopt;
   }
-  return std::stoll(ss.str(), 0, base);
+  return value;
 }
 
 Cursor *dew::newCursor(TSNode node) {
@@ -22,6 +22,7 @@
 
 #include "ast.h"
 #include <cstdint>
+#include <optional>
 #include <string_view>
 #include <tree_sitter/api.h>
 
@@ -43,14 +44,12 @@ private:
 inline void freeChar(char *b) { free(b); }
 using SExpression = DewTSObject<char, ts_node_string, freeChar>;
 
-uint64_t parseInt(const std::string_view &literal);
-
-ast::BinaryOp getBinaryOp(const std::string_view &str);
-
-template <std::size_t N>
-constexpr TSNode getField(TSNode &node, const char (&str)[N]) {
-  return ts_node_child_by_field_name(node, str, N - 1);
-}
+/**
+ * Value of an integer literal: decimal, or `0x`, `0o` or `0b` followed by
+ * digits in that base, with `_` allowed between them. Nothing if it's
+ * malformed or more than 64 bits.
+ */
+std::optional<uint64_t> parseInt(std::string_view literal);
 
 class Cursor {
 public:
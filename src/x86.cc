@@ -0,0 +1,959 @@
+/**
+ * Copyright (C) 2024 Charles Ancheta
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ * \file x86.cc
+ */
+#include "x86.h"
+#include "regalloc.h"
+#include <algorithm>
+#include <iostream>
+#include <iterator>
+#include <optional>
+#include <utility>
+
+using namespace dew;
+using namespace dew::x86;
+
+using bc::Instr;
+using bc::IntKind;
+using bc::Op;
+
+namespace {
+const char *const names64[]{"rax", "rcx", "rdx", "rbx", "rsp", "rbp",
+                            "rsi", "rdi", "r8",  "r9",  "r10", "r11",
+                            "r12", "r13", "r14", "r15"};
+const char *const names32[]{"eax",  "ecx",  "edx",  "ebx",  "esp",  "ebp",
+                            "esi",  "edi",  "r8d",  "r9d",  "r10d", "r11d",
+                            "r12d", "r13d", "r14d", "r15d"};
+const char *const names16[]{"ax",   "cx",   "dx",   "bx",   "sp",   "bp",
+                            "si",   "di",   "r8w",  "r9w",  "r10w", "r11w",
+                            "r12w", "r13w", "r14w", "r15w"};
+const char *const names8[]{"al",   "cl",   "dl",   "bl",   "spl",  "bpl",
+                           "sil",  "dil",  "r8b",  "r9b",  "r10b", "r11b",
+                           "r12b", "r13b", "r14b", "r15b"};
+const char *const condNames[]{"o", "no", "b",  "ae", "e", "ne", "be", "a",
+                              "s", "ns", "p", "np", "l", "ge", "le", "g"};
+
+const char *name(const char *const (&names)[16], Reg reg) {
+  return names[static_cast<uint8_t>(reg)];
+}
+} // namespace
+
+AsmWriter::AsmWriter(std::ostream &out, const bc::Program &program)
+    : out{out}, program{program}, labels{0} {
+  out << "\t.intel_syntax noprefix\n\t.text\n";
+}
+
+void AsmWriter::finish() {
+  out << "\t.section .rodata\n"
+         ".Ldew_format:\n"
+         "\t.string \"%ld\\n\"\n"
+         "\t.text\n"
+         "dew_print:\n"
+         "\tpush rbp\n"
+         "\tmov rsi, rdi\n"
+         "\tlea rdi, [rip + .Ldew_format]\n"
+         "\txor eax, eax\n"
+         "\tcall printf@PLT\n"
+         "\tpop rbp\n"
+         "\tret\n";
+  auto entry{program.find("main")};
+  if (entry) {
+    out << "\t.globl main\n"
+           "main:\n"
+           "\tpush rbp\n"
+           "\tcall "
+        << symbol(*entry) << "\n";
+    if (program.functions[*entry].numResults == 0) {
+      out << "\txor eax, eax\n";
+    }
+    out << "\tpop rbp\n"
+           "\tret\n";
+  }
+  out << "\t.section .note.GNU-stack,\"\",@progbits\n";
+}
+
+std::string AsmWriter::operand(Operand op) const {
+  switch (op.kind) {
+  case Operand::Kind::Reg:
+    return name(names64, op.reg);
+  case Operand::Kind::Imm:
+    return std::to_string(op.value);
+  case Operand::Kind::Mem:
+    return "QWORD PTR [" + std::string{name(names64, op.reg)} +
+           (op.value < 0 ? std::to_string(op.value)
+                         : "+" + std::to_string(op.value)) +
+           "]";
+  }
+  return "";
+}
+
+std::string AsmWriter::symbol(uint32_t function) const {
+  return "dew_" + program.functions[function].name;
+}
+
+void AsmWriter::beginFunction(uint32_t index, const bc::Function &) {
+  out << "\t.p2align 4\n" << symbol(index) << ":\n";
+}
+
+void AsmWriter::endFunction() { out << "\n"; }
+
+Label AsmWriter::newLabel() { return labels++; }
+
+void AsmWriter::bind(Label label) { out << ".Ldew" << label << ":\n"; }
+
+void AsmWriter::mov(Operand dst, Operand src) {
+  out << "\tmov " << operand(dst) << ", " << operand(src) << "\n";
+}
+
+void AsmWriter::movImm64(Reg dst, int64_t value) {
+  out << "\tmovabs " << name(names64, dst) << ", " << value << "\n";
+}
+
+void AsmWriter::alu(Alu op, Operand dst, Operand src) {
+  static const char *const mnemonics[]{"add", "or",  "adc", "sbb",
+                                       "and", "sub", "xor", "cmp"};
+  out << "\t" << mnemonics[static_cast<uint8_t>(op)] << " " << operand(dst)
+      << ", " << operand(src) << "\n";
+}
+
+void AsmWriter::imul(Reg dst, Operand src) {
+  out << "\timul " << name(names64, dst) << ", " << operand(src) << "\n";
+}
+
+void AsmWriter::shl(Reg dst) {
+  out << "\tshl " << name(names64, dst) << ", cl\n";
+}
+
+void AsmWriter::sar(Reg dst) {
+  out << "\tsar " << name(names64, dst) << ", cl\n";
+}
+
+void AsmWriter::neg(Reg dst) { out << "\tneg " << name(names64, dst) << "\n"; }
+
+void AsmWriter::bitNot(Reg dst) {
+  out << "\tnot " << name(names64, dst) << "\n";
+}
+
+void AsmWriter::cqoIdiv(Operand src) {
+  out << "\tcqo\n\tidiv " << operand(src) << "\n";
+}
+
+void AsmWriter::extend(Reg reg, IntKind kind) {
+  switch (kind) {
+  case IntKind::I8:
+    out << "\tmovsx " << name(names64, reg) << ", " << name(names8, reg);
+    break;
+  case IntKind::I16:
+    out << "\tmovsx " << name(names64, reg) << ", " << name(names16, reg);
+    break;
+  case IntKind::I32:
+    out << "\tmovsxd " << name(names64, reg) << ", " << name(names32, reg);
+    break;
+  case IntKind::U8:
+    out << "\tmovzx " << name(names32, reg) << ", " << name(names8, reg);
+    break;
+  case IntKind::U16:
+    out << "\tmovzx " << name(names32, reg) << ", " << name(names16, reg);
+    break;
+  case IntKind::U32:
+    out << "\tmov " << name(names32, reg) << ", " << name(names32, reg);
+    break;
+  }
+  out << "\n";
+}
+
+void AsmWriter::set(Cond cond, Reg dst) {
+  out << "\tset" << condNames[static_cast<uint8_t>(cond)] << " "
+      << name(names8, dst) << "\n\tmovzx " << name(names32, dst) << ", "
+      << name(names8, dst) << "\n";
+}
+
+void AsmWriter::test(Reg a, Reg b) {
+  out << "\ttest " << name(names64, a) << ", " << name(names64, b) << "\n";
+}
+
+void AsmWriter::jmp(Label label) { out << "\tjmp .Ldew" << label << "\n"; }
+
+void AsmWriter::jcc(Cond cond, Label label) {
+  out << "\tj" << condNames[static_cast<uint8_t>(cond)] << " .Ldew" << label
+      << "\n";
+}
+
+void AsmWriter::call(uint32_t function) {
+  out << "\tcall " << symbol(function) << "\n";
+}
+
+void AsmWriter::tailCall(uint32_t function) {
+  out << "\tjmp " << symbol(function) << "\n";
+}
+
+void AsmWriter::callPrint() { out << "\tcall dew_print\n"; }
+
+void AsmWriter::push(Reg reg) {
+  out << "\tpush " << name(names64, reg) << "\n";
+}
+
+void AsmWriter::pop(Reg reg) { out << "\tpop " << name(names64, reg) << "\n"; }
+
+void AsmWriter::ret() { out << "\tret\n"; }
+
+namespace {
+uint8_t number(Reg reg) { return static_cast<uint8_t>(reg); }
+
+bool fitsInt8(int32_t value) { return value >= -128 && value <= 127; }
+} // namespace
+
+CodeWriter::CodeWriter(const Runtime &runtime) : runtime{runtime}, index{0} {
+  reset();
+}
+
+void CodeWriter::reset() {
+  bytes.clear();
+  labels.clear();
+  fixups.clear();
+  traps[0] = traps[1] = UINT32_MAX;
+}
+
+void CodeWriter::imm32(int32_t value) {
+  auto v{static_cast<uint32_t>(value)};
+  for (int i{0}; i < 4; ++i) {
+    byte(static_cast<uint8_t>(v >> 8 * i));
+  }
+}
+
+void CodeWriter::rex(bool wide, uint8_t reg, Operand rm, bool byteRm) {
+  uint8_t base{number(rm.reg)};
+  auto prefix{static_cast<uint8_t>(0x40 | wide << 3 | (reg >> 3) << 2 |
+                                   base >> 3)};
+  // Without a prefix, the low bytes of rsp, rbp, rsi and rdi would be ah,
+  // ch, dh and bh.
+  if (prefix != 0x40 || (byteRm && rm.isReg() && base >= 4)) {
+    byte(prefix);
+  }
+}
+
+void CodeWriter::modrm(uint8_t reg, Operand rm) {
+  auto field{static_cast<uint8_t>((reg & 7) << 3)};
+  auto base{static_cast<uint8_t>(number(rm.reg) & 7)};
+  if (rm.isReg()) {
+    byte(0xC0 | field | base);
+    return;
+  }
+  // Memory operands always carry a displacement, which leaves rsp and r12
+  // as the only bases that need a SIB byte.
+  bool near{fitsInt8(rm.value)};
+  byte((near ? 0x40 : 0x80) | field | base);
+  if (base == number(Reg::RSP)) {
+    byte(0x24);
+  }
+  if (near) {
+    byte(static_cast<uint8_t>(rm.value));
+  } else {
+    imm32(rm.value);
+  }
+}
+
+void CodeWriter::encode(bool wide, std::initializer_list<uint8_t> opcode,
+                        uint8_t reg, Operand rm, bool byteRm) {
+  rex(wide, reg, rm, byteRm);
+  for (const uint8_t b : opcode) {
+    byte(b);
+  }
+  modrm(reg, rm);
+}
+
+Label CodeWriter::trapLabel(Trap trap) {
+  Label &label{traps[static_cast<uint8_t>(trap)]};
+  if (label == UINT32_MAX) {
+    label = newLabel();
+  }
+  return label;
+}
+
+void CodeWriter::beginStub() { reset(); }
+
+void CodeWriter::callAddress(Reg target) {
+  encode(false, {0xFF}, 2, Operand::r(target));
+}
+
+void CodeWriter::beginFunction(uint32_t index, const bc::Function &) {
+  reset();
+  this->index = index;
+  // cmp rsp, [rax]
+  movImm64(Reg::RAX, reinterpret_cast<int64_t>(runtime.stackLimit));
+  byte(0x48);
+  byte(0x3B);
+  byte(0x20);
+  jcc(Cond::B, trapLabel(Trap::StackOverflow));
+}
+
+void CodeWriter::endFunction() {
+  for (uint8_t trap{0}; trap < std::size(traps); ++trap) {
+    if (traps[trap] == UINT32_MAX) {
+      continue;
+    }
+    bind(traps[trap]);
+    movImm64(Reg::RDI, reinterpret_cast<int64_t>(runtime.context));
+    mov(Operand::r(Reg::RSI), Operand::imm(static_cast<int32_t>(index)));
+    mov(Operand::r(Reg::RDX), Operand::imm(trap));
+    alu(Alu::And, Operand::r(Reg::RSP), Operand::imm(-16));
+    movImm64(Reg::RAX, reinterpret_cast<int64_t>(runtime.trap));
+    callAddress(Reg::RAX);
+  }
+  for (const auto &[at, label] : fixups) {
+    auto rel{static_cast<int32_t>(labels[label] -
+                                  static_cast<int64_t>(at + 4))};
+    for (int i{0}; i < 4; ++i) {
+      bytes[at + i] = static_cast<uint8_t>(static_cast<uint32_t>(rel) >> 8 * i);
+    }
+  }
+}
+
+Label CodeWriter::newLabel() {
+  labels.push_back(-1);
+  return static_cast<Label>(labels.size() - 1);
+}
+
+void CodeWriter::bind(Label label) {
+  labels[label] = static_cast<int64_t>(bytes.size());
+}
+
+void CodeWriter::mov(Operand dst, Operand src) {
+  if (src.kind == Operand::Kind::Imm) {
+    encode(true, {0xC7}, 0, dst);
+    imm32(src.value);
+  } else if (src.isReg()) {
+    encode(true, {0x89}, number(src.reg), dst);
+  } else {
+    encode(true, {0x8B}, number(dst.reg), src);
+  }
+}
+
+void CodeWriter::movImm64(Reg dst, int64_t value) {
+  byte(0x48 | number(dst) >> 3);
+  byte(0xB8 | (number(dst) & 7));
+  auto v{static_cast<uint64_t>(value)};
+  for (int i{0}; i < 8; ++i) {
+    byte(static_cast<uint8_t>(v >> 8 * i));
+  }
+}
+
+void CodeWriter::alu(Alu op, Operand dst, Operand src) {
+  auto n{static_cast<uint8_t>(op)};
+  if (src.kind == Operand::Kind::Imm) {
+    bool small{fitsInt8(src.value)};
+    encode(true, {static_cast<uint8_t>(small ? 0x83 : 0x81)}, n, dst);
+    if (small) {
+      byte(static_cast<uint8_t>(src.value));
+    } else {
+      imm32(src.value);
+    }
+  } else if (src.isReg()) {
+    encode(true, {static_cast<uint8_t>(8 * n + 1)}, number(src.reg), dst);
+  } else {
+    encode(true, {static_cast<uint8_t>(8 * n + 3)}, number(dst.reg), src);
+  }
+}
+
+void CodeWriter::imul(Reg dst, Operand src) {
+  if (src.kind == Operand::Kind::Imm) {
+    encode(true, {0x69}, number(dst), Operand::r(dst));
+    imm32(src.value);
+  } else {
+    encode(true, {0x0F, 0xAF}, number(dst), src);
+  }
+}
+
+void CodeWriter::shl(Reg dst) { encode(true, {0xD3}, 4, Operand::r(dst)); }
+
+void CodeWriter::sar(Reg dst) { encode(true, {0xD3}, 7, Operand::r(dst)); }
+
+void CodeWriter::neg(Reg dst) { encode(true, {0xF7}, 3, Operand::r(dst)); }
+
+void CodeWriter::bitNot(Reg dst) { encode(true, {0xF7}, 2, Operand::r(dst)); }
+
+void CodeWriter::cqoIdiv(Operand src) {
+  alu(Alu::Cmp, src, Operand::imm(0));
+  jcc(Cond::E, trapLabel(Trap::DivisionByZero));
+  byte(0x48);
+  byte(0x99);
+  encode(true, {0xF7}, 7, src);
+}
+
+void CodeWriter::extend(Reg reg, IntKind kind) {
+  Operand r{Operand::r(reg)};
+  switch (kind) {
+  case IntKind::I8:
+    encode(true, {0x0F, 0xBE}, number(reg), r, true);
+    break;
+  case IntKind::I16:
+    encode(true, {0x0F, 0xBF}, number(reg), r);
+    break;
+  case IntKind::I32:
+    encode(true, {0x63}, number(reg), r);
+    break;
+  case IntKind::U8:
+    encode(false, {0x0F, 0xB6}, number(reg), r, true);
+    break;
+  case IntKind::U16:
+    encode(false, {0x0F, 0xB7}, number(reg), r);
+    break;
+  case IntKind::U32:
+    encode(false, {0x89}, number(reg), r);
+    break;
+  }
+}
+
+void CodeWriter::set(Cond cond, Reg dst) {
+  Operand r{Operand::r(dst)};
+  encode(false, {0x0F, static_cast<uint8_t>(0x90 | static_cast<uint8_t>(cond))},
+         0, r, true);
+  encode(false, {0x0F, 0xB6}, number(dst), r, true);
+}
+
+void CodeWriter::test(Reg a, Reg b) {
+  encode(true, {0x85}, number(b), Operand::r(a));
+}
+
+void CodeWriter::jmp(Label label) {
+  byte(0xE9);
+  fixups.emplace_back(bytes.size(), label);
+  imm32(0);
+}
+
+void CodeWriter::jcc(Cond cond, Label label) {
+  byte(0x0F);
+  byte(0x80 | static_cast<uint8_t>(cond));
+  fixups.emplace_back(bytes.size(), label);
+  imm32(0);
+}
+
+void CodeWriter::call(uint32_t function) {
+  // call [rax]
+  movImm64(Reg::RAX, reinterpret_cast<int64_t>(runtime.entries + function));
+  byte(0xFF);
+  byte(0x10);
+}
+
+void CodeWriter::tailCall(uint32_t function) {
+  // jmp [rax]
+  movImm64(Reg::RAX, reinterpret_cast<int64_t>(runtime.entries + function));
+  byte(0xFF);
+  byte(0x20);
+}
+
+void CodeWriter::callPrint() {
+  movImm64(Reg::RAX, reinterpret_cast<int64_t>(runtime.print));
+  callAddress(Reg::RAX);
+}
+
+void CodeWriter::push(Reg reg) {
+  if (number(reg) >= 8) {
+    byte(0x41);
+  }
+  byte(0x50 | (number(reg) & 7));
+}
+
+void CodeWriter::pop(Reg reg) {
+  if (number(reg) >= 8) {
+    byte(0x41);
+  }
+  byte(0x58 | (number(reg) & 7));
+}
+
+void CodeWriter::ret() { byte(0xC3); }
+
+namespace {
+// rax, rcx and rdx are kept out of the allocator: division, shifts and
+// return values need them, and they double as scratch.
+
+regalloc::Target machine() {
+  auto n{[](Reg r) { return static_cast<uint8_t>(r); }};
+  return regalloc::Target{
+      {n(Reg::RBX), n(Reg::R12), n(Reg::R13), n(Reg::R14), n(Reg::R15)},
+      {n(Reg::RSI), n(Reg::RDI), n(Reg::R8), n(Reg::R9), n(Reg::R10),
+       n(Reg::R11)}};
+}
+
+bool fits(const bc::Function &fn) {
+  return fn.numParams <= maxParams && fn.numResults <= 1;
+}
+
+/** `fn` if it can't be compiled natively, or a callee that can't, if any. */
+const bc::Function *unsupportedIn(const bc::Program &program,
+                                  const bc::Function &fn) {
+  if (!fits(fn)) {
+    return &fn;
+  }
+  for (const Instr &in : fn.code) {
+    if ((in.op == Op::Call || in.op == Op::TailCall) &&
+        !fits(program.functions[in.b])) {
+      return &program.functions[in.b];
+    }
+  }
+  return nullptr;
+}
+
+Cond condition(Op op) {
+  switch (op) {
+  case Op::LT:
+  case Op::JumpIfLT:
+    return Cond::L;
+  case Op::LTEq:
+  case Op::JumpIfLTEq:
+    return Cond::LE;
+  case Op::GT:
+  case Op::JumpIfGT:
+    return Cond::G;
+  case Op::GTEq:
+  case Op::JumpIfGTEq:
+    return Cond::GE;
+  case Op::Eq:
+  case Op::JumpIfEq:
+    return Cond::E;
+  default:
+    return Cond::NE;
+  }
+}
+
+class Generator {
+public:
+  Generator(const bc::Program &program, uint32_t index, Emitter &out,
+            std::optional<uint32_t> entry = std::nullopt)
+      : program{program}, index{index}, fn{program.functions[index]},
+        out{out}, entry{entry} {}
+
+  bool generate() {
+    const bc::Function *unsupported{unsupportedIn(program, fn)};
+    if (unsupported == &fn) {
+      std::cerr << "`" << fn.name
+                << "` can't be compiled natively: only up to " << maxParams
+                << " parameters and one result are supported\n";
+      return false;
+    } else if (unsupported) {
+      std::cerr << "`" << fn.name << "` calls `" << unsupported->name
+                << "`, which can't be compiled natively\n";
+      return false;
+    }
+
+    std::vector<bool> isTarget(fn.code.size() + 1);
+    for (std::size_t pc{0}; pc < fn.code.size(); ++pc) {
+      if (auto t{bc::branchTarget(fn.code, pc)}) {
+        isTarget[*t] = true;
+      }
+      if (bc::isFusedBranch(fn.code[pc].op)) {
+        ++pc;
+      }
+    }
+    if (entry && !isTarget[*entry]) {
+      std::cerr << "`" << fn.name << "` can't be entered at " << *entry
+                << ", which no branch targets\n";
+      return false;
+    }
+
+    alloc = regalloc::linearScan(program, fn, machine());
+    std::size_t saved{alloc.calleeSavedUsed.size()};
+    // rsp is 16-byte aligned after `push rbp`, so keep the pushes and the
+    // spill area an even number of slots.
+    frameSize = static_cast<int32_t>(
+        8 * (alloc.stackSlots + (saved + alloc.stackSlots) % 2));
+
+    out.beginFunction(index, fn);
+    labels.assign(fn.code.size() + 1, UINT32_MAX);
+    for (std::size_t pc{0}; pc < fn.code.size(); ++pc) {
+      auto t{bc::branchTarget(fn.code, pc)};
+      if (t && labels[*t] == UINT32_MAX) {
+        labels[*t] = out.newLabel();
+      }
+      if (bc::isFusedBranch(fn.code[pc].op)) {
+        ++pc;
+      }
+    }
+    exit = out.newLabel();
+    out.push(Reg::RBP);
+    out.mov(Operand::r(Reg::RBP), Operand::r(Reg::RSP));
+    for (const uint8_t r : alloc.calleeSavedUsed) {
+      out.push(static_cast<Reg>(r));
+    }
+    if (frameSize != 0) {
+      out.alu(Alu::Sub, Operand::r(Reg::RSP), Operand::imm(frameSize));
+    }
+
+    if (entry) {
+      enterAt(*entry);
+    } else {
+      std::vector<std::pair<Operand, Operand>> params;
+      for (uint16_t i{0}; i < fn.numParams; ++i) {
+        if (alloc.locations[i].kind != regalloc::Location::Kind::Unused) {
+          params.emplace_back(location(i), Operand::r(argRegs[i]));
+        }
+      }
+      parallelMove(params);
+    }
+
+    for (std::size_t pc{0}; pc < fn.code.size(); ++pc) {
+      if (isTarget[pc]) {
+        out.bind(labels[pc]);
+      }
+      lower(pc);
+      if (bc::isFusedBranch(fn.code[pc].op)) {
+        ++pc;
+      }
+    }
+    if (isTarget[fn.code.size()]) {
+      out.bind(labels[fn.code.size()]);
+    }
+
+    out.bind(exit);
+    leave();
+    out.ret();
+    out.endFunction();
+    return true;
+  }
+
+private:
+  /**
+   * Loads every register that holds a value at `pc` from the interpreter's
+   * registers, which rdi points to, and jumps there. Registers only share
+   * a location outside their intervals, so loading ones that are dead
+   * there doesn't clobber anything.
+   */
+  void enterAt(uint32_t pc) {
+    out.mov(Operand::r(Reg::RCX), Operand::r(Reg::RDI));
+    for (uint32_t r{0}; r < fn.numRegs; ++r) {
+      auto [start, end]{alloc.intervals[r]};
+      if (start <= 2 * pc && 2 * pc <= end) {
+        move(location(r), Operand::mem(8 * static_cast<int32_t>(r), Reg::RCX));
+      }
+    }
+    out.jmp(labels[pc]);
+  }
+
+  /** Tears down the frame the prologue built. */
+  void leave() {
+    if (frameSize != 0) {
+      out.alu(Alu::Add, Operand::r(Reg::RSP), Operand::imm(frameSize));
+    }
+    for (auto it{alloc.calleeSavedUsed.rbegin()};
+         it != alloc.calleeSavedUsed.rend(); ++it) {
+      out.pop(static_cast<Reg>(*it));
+    }
+    out.pop(Reg::RBP);
+  }
+
+  /** Where bytecode register `r` lives; dead values go to rax. */
+  Operand location(uint32_t r) const {
+    const regalloc::Location &loc{alloc.locations[r]};
+    switch (loc.kind) {
+    case regalloc::Location::Kind::Register:
+      return Operand::r(static_cast<Reg>(loc.index));
+    case regalloc::Location::Kind::Stack:
+      return Operand::mem(-8 * static_cast<int32_t>(
+                                   alloc.calleeSavedUsed.size() + 1 +
+                                   loc.index));
+    case regalloc::Location::Kind::Unused:
+      break;
+    }
+    return Operand::r(Reg::RAX);
+  }
+
+  /** Register to compute `dst` in without disturbing `keep`. */
+  static Reg workFor(Operand dst, Operand keep) {
+    return dst.isReg() && dst != keep ? dst.reg : Reg::RAX;
+  }
+
+  void move(Operand dst, Operand src) {
+    if (dst == src) {
+      return;
+    }
+    if (dst.isMem() && src.isMem()) {
+      out.mov(Operand::r(Reg::RAX), src);
+      src = Operand::r(Reg::RAX);
+    }
+    out.mov(dst, src);
+  }
+
+  /**
+   * Performs every move as if simultaneously. Destinations are registers or
+   * stack slots nobody reads from here, so only register cycles need rax.
+   */
+  void parallelMove(std::vector<std::pair<Operand, Operand>> moves) {
+    moves.erase(std::remove_if(moves.begin(), moves.end(),
+                               [](const auto &m) {
+                                 return m.first == m.second;
+                               }),
+                moves.end());
+    while (!moves.empty()) {
+      auto ready{std::find_if(moves.begin(), moves.end(), [&](const auto &m) {
+        return std::none_of(moves.begin(), moves.end(), [&](const auto &o) {
+          return o.second == m.first;
+        });
+      })};
+      if (ready == moves.end()) {
+        // Everything left is a cycle; park one destination's value in rax.
+        Operand parked{moves.front().first};
+        out.mov(Operand::r(Reg::RAX), parked);
+        for (auto &m : moves) {
+          if (m.second == parked) {
+            m.second = Operand::r(Reg::RAX);
+          }
+        }
+        continue;
+      }
+      move(ready->first, ready->second);
+      moves.erase(ready);
+    }
+  }
+
+  Label target(std::size_t pc) const {
+    return labels[*bc::branchTarget(fn.code, pc)];
+  }
+
+  void compare(Operand a, Operand b) {
+    if (a.isMem() && b.isMem()) {
+      out.mov(Operand::r(Reg::RAX), a);
+      a = Operand::r(Reg::RAX);
+    }
+    out.alu(Alu::Cmp, a, b);
+  }
+
+  /**
+   * a = b op c, computed in a's register unless that would clobber c first.
+   * `commutative` lets b and c trade places instead.
+   */
+  template <typename Emit>
+  void binary(const Instr &in, bool commutative, Emit emit) {
+    Operand dst{location(in.a)};
+    Operand b{location(in.b)};
+    Operand c{location(in.c)};
+    if (commutative && dst == c) {
+      std::swap(b, c);
+    }
+    Reg work{workFor(dst, c)};
+    move(Operand::r(work), b);
+    emit(work, c);
+    out.extend(work, in.kind);
+    move(dst, Operand::r(work));
+  }
+
+  void binary(const Instr &in, Alu op) {
+    binary(in, op != Alu::Sub,
+           [&](Reg work, Operand c) { out.alu(op, Operand::r(work), c); });
+  }
+
+  void lower(std::size_t pc) {
+    const Instr &in{fn.code[pc]};
+    switch (in.op) {
+    case Op::Nop:
+      break;
+    case Op::Move:
+      move(location(in.a), location(in.b));
+      break;
+    case Op::LoadInt:
+      out.mov(location(in.a),
+              Operand::imm(static_cast<int32_t>(in.imm())));
+      break;
+    case Op::LoadConst: {
+      Operand dst{location(in.a)};
+      Reg work{dst.isReg() ? dst.reg : Reg::RAX};
+      out.movImm64(work, fn.constants[in.imm()]);
+      move(dst, Operand::r(work));
+      break;
+    }
+    case Op::Add:
+      binary(in, Alu::Add);
+      break;
+    case Op::Sub:
+      binary(in, Alu::Sub);
+      break;
+    case Op::BitAnd:
+      binary(in, Alu::And);
+      break;
+    case Op::BitOr:
+      binary(in, Alu::Or);
+      break;
+    case Op::BitXor:
+      binary(in, Alu::Xor);
+      break;
+    case Op::AddInt: {
+      Operand dst{location(in.a)};
+      Reg work{dst.isReg() ? dst.reg : Reg::RAX};
+      move(Operand::r(work), location(in.b));
+      out.alu(Alu::Add, Operand::r(work),
+              Operand::imm(static_cast<int16_t>(in.c)));
+      out.extend(work, in.kind);
+      move(dst, Operand::r(work));
+      break;
+    }
+    case Op::Mul:
+      binary(in, true, [&](Reg work, Operand c) { out.imul(work, c); });
+      break;
+    case Op::Div:
+    case Op::Mod: {
+      // The emitter decides what a zero divisor does: AsmWriter lets idiv
+      // raise SIGFPE, CodeWriter checks it and traps like the VM.
+      move(Operand::r(Reg::RAX), location(in.b));
+      out.cqoIdiv(location(in.c));
+      Reg result{in.op == Op::Div ? Reg::RAX : Reg::RDX};
+      out.extend(result, in.kind);
+      move(location(in.a), Operand::r(result));
+      break;
+    }
+    case Op::ShiftLeft:
+    case Op::ShiftRight: {
+      Operand dst{location(in.a)};
+      move(Operand::r(Reg::RCX), location(in.c));
+      Reg work{dst.isReg() ? dst.reg : Reg::RAX};
+      move(Operand::r(work), location(in.b));
+      if (in.op == Op::ShiftLeft) {
+        out.shl(work);
+      } else {
+        out.sar(work);
+      }
+      out.extend(work, in.kind);
+      move(dst, Operand::r(work));
+      break;
+    }
+    case Op::Neg:
+    case Op::BitNot:
+    case Op::Cast: {
+      Operand dst{location(in.a)};
+      Reg work{dst.isReg() ? dst.reg : Reg::RAX};
+      move(Operand::r(work), location(in.b));
+      if (in.op == Op::Neg) {
+        out.neg(work);
+      } else if (in.op == Op::BitNot) {
+        out.bitNot(work);
+      }
+      out.extend(work, in.kind);
+      move(dst, Operand::r(work));
+      break;
+    }
+    case Op::Not: {
+      Operand dst{location(in.a)};
+      Reg work{dst.isReg() ? dst.reg : Reg::RAX};
+      out.alu(Alu::Cmp, location(in.b), Operand::imm(0));
+      out.set(Cond::E, work);
+      move(dst, Operand::r(work));
+      break;
+    }
+    case Op::LT:
+    case Op::LTEq:
+    case Op::GT:
+    case Op::GTEq:
+    case Op::Eq:
+    case Op::Neq: {
+      Operand dst{location(in.a)};
+      Reg work{dst.isReg() ? dst.reg : Reg::RAX};
+      compare(location(in.b), location(in.c));
+      out.set(condition(in.op), work);
+      move(dst, Operand::r(work));
+      break;
+    }
+    case Op::Jump:
+      if (in.imm() != pc + 1) {
+        out.jmp(target(pc));
+      }
+      break;
+    case Op::JumpIfZero:
+    case Op::JumpIfNotZero:
+      out.alu(Alu::Cmp, location(in.a), Operand::imm(0));
+      out.jcc(in.op == Op::JumpIfZero ? Cond::E : Cond::NE, target(pc));
+      break;
+    case Op::JumpIfLT:
+    case Op::JumpIfLTEq:
+    case Op::JumpIfGT:
+    case Op::JumpIfGTEq:
+    case Op::JumpIfEq:
+    case Op::JumpIfNeq:
+      compare(location(in.a), location(in.b));
+      out.jcc(condition(in.op), target(pc));
+      break;
+    case Op::Call: {
+      const bc::Function &callee{program.functions[in.b]};
+      std::vector<std::pair<Operand, Operand>> args;
+      for (uint16_t i{0}; i < callee.numParams; ++i) {
+        args.emplace_back(Operand::r(argRegs[i]), location(in.c + i));
+      }
+      parallelMove(args);
+      out.call(in.b);
+      if (callee.numResults == 1) {
+        move(location(in.a), Operand::r(Reg::RAX));
+      }
+      break;
+    }
+    case Op::TailCall: {
+      // Argument registers aren't callee-saved, so they survive leave().
+      const bc::Function &callee{program.functions[in.b]};
+      std::vector<std::pair<Operand, Operand>> args;
+      for (uint16_t i{0}; i < callee.numParams; ++i) {
+        args.emplace_back(Operand::r(argRegs[i]), location(in.c + i));
+      }
+      parallelMove(args);
+      leave();
+      out.tailCall(in.b);
+      break;
+    }
+    case Op::Return:
+      if (in.b == 1) {
+        move(Operand::r(Reg::RAX), location(in.a));
+      }
+      if (pc + 1 != fn.code.size()) {
+        out.jmp(exit);
+      }
+      break;
+    case Op::Print:
+      move(Operand::r(Reg::RDI), location(in.a));
+      out.callPrint();
+      break;
+    }
+  }
+
+  const bc::Program &program;
+  uint32_t index;
+  const bc::Function &fn;
+  Emitter &out;
+  /** Where to start instead of the top, for entering a running call. */
+  std::optional<uint32_t> entry;
+  regalloc::Allocation alloc;
+  int32_t frameSize;
+  std::vector<Label> labels;
+  Label exit;
+};
+} // namespace
+
+bool x86::supported(const bc::Program &program, uint32_t index) {
+  return !unsupportedIn(program, program.functions[index]);
+}
+
+bool x86::generate(const bc::Program &program, uint32_t index, Emitter &out) {
+  return Generator{program, index, out}.generate();
+}
+
+bool x86::generateEntry(const bc::Program &program, uint32_t index,
+                        uint32_t pc, Emitter &out) {
+  return Generator{program, index, out, pc}.generate();
+}
+
+bool x86::generate(const bc::Program &program, Emitter &out) {
+  bool ok{true};
+  for (uint32_t i{0}; i < program.functions.size(); ++i) {
+    ok = generate(program, i, out) && ok;
+  }
+  return ok;
+}
@@ -0,0 +1,313 @@
+/**
+ * Copyright (C) 2024 Charles Ancheta
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ * \file x86.h
+ */
+#ifndef DEW_X86_H_
+#define DEW_X86_H_
+
+#include "bytecode.h"
+#include <cstdint>
+#include <initializer_list>
+#include <iterator>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace dew {
+namespace x86 {
+/** In hardware encoding order. */
+enum class Reg : uint8_t {
+  RAX,
+  RCX,
+  RDX,
+  RBX,
+  RSP,
+  RBP,
+  RSI,
+  RDI,
+  R8,
+  R9,
+  R10,
+  R11,
+  R12,
+  R13,
+  R14,
+  R15,
+};
+
+/** Condition codes, in hardware encoding order. */
+enum class Cond : uint8_t {
+  O,
+  NO,
+  B,
+  AE,
+  E,
+  NE,
+  BE,
+  A,
+  S,
+  NS,
+  P,
+  NP,
+  L,
+  GE,
+  LE,
+  G,
+};
+
+/** The group-1 ALU operations, numbered by their ModRM reg field. */
+enum class Alu : uint8_t {
+  Add = 0,
+  Or = 1,
+  And = 4,
+  Sub = 5,
+  Xor = 6,
+  Cmp = 7,
+};
+
+/**
+ * Dew functions call each other with their own convention, passing
+ * arguments in these caller-saved registers and returning in rax.
+ */
+constexpr Reg argRegs[]{Reg::RDI, Reg::RSI, Reg::R8,
+                        Reg::R9,  Reg::R10, Reg::R11};
+constexpr std::size_t maxParams{std::size(argRegs)};
+
+/** A register, an immediate, or a 64-bit slot at [base + disp]. */
+struct Operand {
+  enum class Kind : uint8_t { Reg, Imm, Mem };
+  Kind kind;
+  Reg reg;
+  int32_t value;
+
+  static Operand r(Reg reg) { return Operand{Kind::Reg, reg, 0}; }
+  static Operand imm(int32_t value) {
+    return Operand{Kind::Imm, Reg::RAX, value};
+  }
+  static Operand mem(int32_t disp, Reg base = Reg::RBP) {
+    return Operand{Kind::Mem, base, disp};
+  }
+  bool isReg() const { return kind == Kind::Reg; }
+  bool isMem() const { return kind == Kind::Mem; }
+  bool operator==(const Operand &o) const {
+    return kind == o.kind && reg == o.reg && value == o.value;
+  }
+  bool operator!=(const Operand &o) const { return !(*this == o); }
+};
+
+using Label = uint32_t;
+
+/**
+ * The slice of x86-64 the code generator needs. All operations are 64 bits
+ * wide unless the name says otherwise; at most one operand may be Mem.
+ */
+class Emitter {
+public:
+  virtual ~Emitter() = default;
+  virtual void beginFunction(uint32_t index, const bc::Function &fn) = 0;
+  virtual void endFunction() = 0;
+  virtual Label newLabel() = 0;
+  virtual void bind(Label label) = 0;
+
+  virtual void mov(Operand dst, Operand src) = 0;
+  virtual void movImm64(Reg dst, int64_t value) = 0;
+  virtual void alu(Alu op, Operand dst, Operand src) = 0;
+  virtual void imul(Reg dst, Operand src) = 0;
+  /** Shifts `dst` by cl; arithmetic for right shifts. */
+  virtual void shl(Reg dst) = 0;
+  virtual void sar(Reg dst) = 0;
+  virtual void neg(Reg dst) = 0;
+  virtual void bitNot(Reg dst) = 0;
+  /** rdx:rax / src, quotient in rax and remainder in rdx. */
+  virtual void cqoIdiv(Operand src) = 0;
+  /** Sign or zero extends the low bits of `reg` as `kind` prescribes. */
+  virtual void extend(Reg reg, bc::IntKind kind) = 0;
+  /** dst = cond ? 1 : 0. */
+  virtual void set(Cond cond, Reg dst) = 0;
+  virtual void test(Reg a, Reg b) = 0;
+
+  virtual void jmp(Label label) = 0;
+  virtual void jcc(Cond cond, Label label) = 0;
+  virtual void call(uint32_t function) = 0;
+  /** Jumps to `function`, which then returns to our caller. */
+  virtual void tailCall(uint32_t function) = 0;
+  /** Prints rdi. */
+  virtual void callPrint() = 0;
+  virtual void push(Reg reg) = 0;
+  virtual void pop(Reg reg) = 0;
+  virtual void ret() = 0;
+};
+
+/**
+ * Writes GNU assembler source in Intel syntax, with a `main` that calls the
+ * Dew `main` and a printf-based print routine, so that `cc out.s` links it
+ * into an executable.
+ */
+class AsmWriter : public Emitter {
+public:
+  AsmWriter(std::ostream &out, const bc::Program &program);
+  /** Emits the entry point and runtime support. */
+  void finish();
+
+  void beginFunction(uint32_t index, const bc::Function &fn) override;
+  void endFunction() override;
+  Label newLabel() override;
+  void bind(Label label) override;
+  void mov(Operand dst, Operand src) override;
+  void movImm64(Reg dst, int64_t value) override;
+  void alu(Alu op, Operand dst, Operand src) override;
+  void imul(Reg dst, Operand src) override;
+  void shl(Reg dst) override;
+  void sar(Reg dst) override;
+  void neg(Reg dst) override;
+  void bitNot(Reg dst) override;
+  void cqoIdiv(Operand src) override;
+  void extend(Reg reg, bc::IntKind kind) override;
+  void set(Cond cond, Reg dst) override;
+  void test(Reg a, Reg b) override;
+  void jmp(Label label) override;
+  void jcc(Cond cond, Label label) override;
+  void call(uint32_t function) override;
+  void tailCall(uint32_t function) override;
+  void callPrint() override;
+  void push(Reg reg) override;
+  void pop(Reg reg) override;
+  void ret() override;
+
+private:
+  std::string operand(Operand op) const;
+  std::string symbol(uint32_t function) const;
+
+  std::ostream &out;
+  const bc::Program &program;
+  Label labels;
+};
+
+/** Why machine code gave up on a function, the way the VM would. */
+enum class Trap : uint8_t { DivisionByZero, StackOverflow };
+
+/** What machine code generated into memory calls out to. */
+struct Runtime {
+  /** Where each function's code starts; calls go through this table. */
+  void *const *entries;
+  /** rsp going below this traps with StackOverflow on function entry. */
+  const uintptr_t *stackLimit;
+  /** Prints `value` like the VM's Print. */
+  void (*print)(int64_t value);
+  /** Called with `context` when a function traps; it must not return. */
+  void (*trap)(void *context, uint32_t function, Trap trap);
+  void *context;
+};
+
+/**
+ * Encodes machine code for calling in-process, one function at a time,
+ * into code() for the caller to copy into executable memory. The code has
+ * no relocations: everything outside the function is reached through the
+ * absolute addresses in `runtime`. Division checks its divisor and every
+ * function checks the stack on entry, trapping like the VM instead of
+ * raising signals.
+ */
+class CodeWriter : public Emitter {
+public:
+  CodeWriter(const Runtime &runtime);
+  /** The bytes of the last function, complete once it has ended. */
+  const std::vector<uint8_t> &code() const { return bytes; }
+  /** Starts a stub; unlike a function, it gets no stack check. */
+  void beginStub();
+  /** Calls the code at the address in `target`. */
+  void callAddress(Reg target);
+
+  void beginFunction(uint32_t index, const bc::Function &fn) override;
+  void endFunction() override;
+  Label newLabel() override;
+  void bind(Label label) override;
+  void mov(Operand dst, Operand src) override;
+  void movImm64(Reg dst, int64_t value) override;
+  void alu(Alu op, Operand dst, Operand src) override;
+  void imul(Reg dst, Operand src) override;
+  void shl(Reg dst) override;
+  void sar(Reg dst) override;
+  void neg(Reg dst) override;
+  void bitNot(Reg dst) override;
+  void cqoIdiv(Operand src) override;
+  void extend(Reg reg, bc::IntKind kind) override;
+  void set(Cond cond, Reg dst) override;
+  void test(Reg a, Reg b) override;
+  void jmp(Label label) override;
+  void jcc(Cond cond, Label label) override;
+  void call(uint32_t function) override;
+  void tailCall(uint32_t function) override;
+  void callPrint() override;
+  void push(Reg reg) override;
+  void pop(Reg reg) override;
+  void ret() override;
+
+private:
+  void byte(uint8_t b) { bytes.push_back(b); }
+  void imm32(int32_t value);
+  /**
+   * The REX prefix for `reg` and a register or memory `rm`, if needed;
+   * `byteRm` is for reading the low byte of `rm`.
+   */
+  void rex(bool wide, uint8_t reg, Operand rm, bool byteRm);
+  void modrm(uint8_t reg, Operand rm);
+  /** An instruction of `opcode` bytes with a ModRM byte. */
+  void encode(bool wide, std::initializer_list<uint8_t> opcode, uint8_t reg,
+              Operand rm, bool byteRm = false);
+  /** Forgets the last function. */
+  void reset();
+  /** The code that reports `trap` from this function. */
+  Label trapLabel(Trap trap);
+
+  Runtime runtime;
+  std::vector<uint8_t> bytes;
+  /** Where each label was bound, or -1. */
+  std::vector<int64_t> labels;
+  /** rel32 fields to fill in, and the labels they jump to. */
+  std::vector<std::pair<std::size_t, Label>> fixups;
+  /** The trap labels used so far, or UINT32_MAX. */
+  Label traps[2];
+  uint32_t index;
+};
+
+/**
+ * Whether generate can compile the `index`th function of `program`: it
+ * takes at most six parameters, returns at most one result, and calls only
+ * functions like that.
+ */
+bool supported(const bc::Program &program, uint32_t index);
+
+/**
+ * Generates machine code for every function of `program`. Functions that
+ * return more than one value or take more than six parameters aren't
+ * supported; those are reported on std::cerr and make this return false.
+ */
+bool generate(const bc::Program &program, Emitter &out);
+/** Generates just `fn`, the `index`th function of `program`. */
+bool generate(const bc::Program &program, uint32_t index, Emitter &out);
+/**
+ * Generates the `index`th function to pick up a call the interpreter is
+ * running, at the branch target `pc`. It takes a pointer to the call's
+ * registers as its first argument and returns like the function does.
+ */
+bool generateEntry(const bc::Program &program, uint32_t index, uint32_t pc,
+                   Emitter &out);
+} // namespace x86
+} // namespace dew
+#endif // !DEW_X86_H_
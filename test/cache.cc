@@ -0,0 +1,109 @@
+/**
+ * Copyright (C) 2024 Charles Ancheta
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ * \file cache.cc
+ *
+ * Entries come back out of the cache as they went in, and one whose code
+ * would make the VM write past its registers is refused, since the cache
+ * directory is just files anyone could have changed.
+ */
+#include "DewCompiler.h"
+#include "DewParser.h"
+#include "cache.h"
+#include <cstdio>
+#include <filesystem>
+#include <unistd.h>
+
+using namespace dew;
+namespace fs = std::filesystem;
+
+namespace {
+int failures{0};
+
+void expect(bool ok, const char *what) {
+  if (!ok) {
+    std::fprintf(stderr, "FAIL %s\n", what);
+    ++failures;
+  }
+}
+} // namespace
+
+int main() {
+  DewParser parser{std::string{"fun two() i32, i32 {\n"
+                               "  return 1, 2\n"
+                               "}\n"
+                               "fun main() {\n"
+                               "  i32 a, b\n"
+                               "  a, b = two()\n"
+                               "  print(a + b)\n"
+                               "}\n"}};
+  parser.parseSource();
+  auto program{DewCompiler{parser.astTree()}.compile(parser.getFunctions())};
+  if (!program) {
+    return 1;
+  }
+
+  fs::path dir{fs::temp_directory_path() /
+               ("dew-cache-test-" + std::to_string(getpid()))};
+  {
+    CompileCache cache{dir};
+    std::string key{cache.key("fun main() {}\n", "")};
+    expect(key.size() == 64 && key != cache.key("fun main() {}\n", "-O") &&
+               key != cache.key("fun main() {} \n", ""),
+           "inputs that differ get their own keys");
+    cache.store("good", *program);
+    auto loaded{cache.load("good")};
+    expect(loaded && loaded->functions.size() == program->functions.size(),
+           "an intact entry loads");
+
+    // main returning as many values as it has registers, all in range,
+    // into a caller that expects none.
+    bc::Program bad{*program};
+    bc::Function &entry{bad.functions.back()};
+    entry.numRegs = 16384;
+    for (bc::Instr &in : entry.code) {
+      if (in.op == bc::Op::Return) {
+        in.a = 0;
+        in.b = entry.numRegs;
+      }
+    }
+    cache.store("bad-return", bad);
+    expect(!cache.load("bad-return"), "a bad return count is refused");
+
+    // A compare-and-branch whose fall-through is past the end, with a
+    // Return in its second slot to look like the function ends.
+    bc::Program falling{*program};
+    falling.functions.back().code = {
+        {bc::Op::LoadInt, bc::IntKind::I32, 0, 1, 0},
+        {bc::Op::LoadInt, bc::IntKind::I32, 1, 2, 0},
+        {bc::Op::JumpIfLT, bc::IntKind::I32, 0, 1, 0},
+        {bc::Op::Return, bc::IntKind::I32, 0, 0, 0}};
+    cache.store("falls-off", falling);
+    expect(!cache.load("falls-off"), "falling off the end is refused");
+
+    bc::Program kinds{*program};
+    kinds.functions[0].numParams = 1;
+    kinds.functions[0].paramKinds = {static_cast<bc::IntKind>(200)};
+    cache.store("bad-kind", kinds);
+    expect(!cache.load("bad-kind"), "a bad parameter kind is refused");
+  }
+  fs::remove_all(dir);
+  if (failures == 0) {
+    std::printf("ok\n");
+  }
+  return failures == 0 ? 0 : 1;
+}
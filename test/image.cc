@@ -0,0 +1,103 @@
+/**
+ * Copyright (C) 2024 Charles Ancheta
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ * \file image.cc
+ *
+ * A `.dewb` loads its bodies as they're first called, and bc::verify is all
+ * that stands between those and the VM, so a body that would run past its
+ * code or a parameter of no kind has to be refused when it loads.
+ */
+#include "DewCompiler.h"
+#include "DewParser.h"
+#include "image.h"
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <unistd.h>
+
+using namespace dew;
+namespace fs = std::filesystem;
+
+namespace {
+int failures{0};
+
+void expect(bool ok, const char *what) {
+  if (!ok) {
+    std::fprintf(stderr, "FAIL %s\n", what);
+    ++failures;
+  }
+}
+
+/** Writes `program` out as a `.dewb` and opens it again. */
+std::unique_ptr<ProgramImage> reopen(const bc::Program &program,
+                                     const fs::path &path) {
+  {
+    std::ofstream out{path, std::ios::binary};
+    if (!ProgramImage::write(out, program) || !out.flush()) {
+      return nullptr;
+    }
+  }
+  auto file{Source::load(path.c_str())};
+  return file ? ProgramImage::open(std::move(*file), path.c_str()) : nullptr;
+}
+} // namespace
+
+int main() {
+  DewParser parser{std::string{"fun add(i32 a, i32 b) i32 {\n"
+                               "  return a + b\n"
+                               "}\n"
+                               "fun main() {\n"
+                               "  print(add(1, 2))\n"
+                               "}\n"}};
+  parser.parseSource();
+  auto program{DewCompiler{parser.astTree()}.compile(parser.getFunctions())};
+  if (!program) {
+    return 1;
+  }
+
+  fs::path path{fs::temp_directory_path() /
+                ("dew-image-test-" + std::to_string(getpid()) + ".dewb")};
+  auto good{reopen(*program, path)};
+  expect(good && good->materializeAll() &&
+             good->materializedCount() == program->functions.size(),
+         "an intact image loads");
+
+  // A compare-and-branch whose fall-through is past the end, with a Return
+  // in its second slot to look like the function ends.
+  bc::Program falling{*program};
+  falling.functions.back().code = {
+      {bc::Op::LoadInt, bc::IntKind::I32, 0, 1, 0},
+      {bc::Op::LoadInt, bc::IntKind::I32, 1, 2, 0},
+      {bc::Op::JumpIfLT, bc::IntKind::I32, 0, 1, 0},
+      {bc::Op::Return, bc::IntKind::I32, 0, 0, 0}};
+  auto image{reopen(falling, path)};
+  expect(image && !image->program().materialize(
+                      static_cast<uint32_t>(falling.functions.size() - 1)),
+         "a body falling off the end is refused");
+
+  bc::Program kinds{*program};
+  kinds.functions[0].paramKinds[1] = static_cast<bc::IntKind>(200);
+  image = reopen(kinds, path);
+  expect(!image || !image->program().materialize(0),
+         "a bad parameter kind is refused");
+
+  fs::remove(path);
+  if (failures == 0) {
+    std::printf("ok\n");
+  }
+  return failures == 0 ? 0 : 1;
+}